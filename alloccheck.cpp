@@ -0,0 +1,529 @@
+#include "audiocodec.h"
+#include "benchutil.h"
+#include "jitterbuffer.h"
+#include "mediacrypto.h"
+#include "nack.h"
+#include "networkengine.h"
+#include "protocol.h"
+#include "videofragments.h"
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QUuid>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Выделения памяти на пути пакета в установившемся режиме: аудио и видео
+// идут непрерывным потоком между двумя NetworkEngine через петлю, как между
+// двумя CallSession. Каждый участок сверяется с нулём:
+//
+//   отправитель: кодирование -> пакет в буфере пула и шифрование ->
+//   фрагмент кадра (копия в буфер повторов) -> send() и пробуждение
+//   сетевого потока;
+//   сеть: планировщик, sendmmsg, recvmmsg, очереди к потребителю -
+//   оба сетевых потока целиком;
+//   получатель: packetsReady и разбор очередей -> расшифровка и окно
+//   повторов -> декодирование -> джиттер-буфер -> сборка кадра.
+//
+// Считаются все выделения (malloc, calloc, realloc и operator new поверх
+// них) в своём потоке. За пределами проверки - то, что окружает путь
+// пакета в CallSession: JPEG (кодер камеры и декодер кадров создают
+// QImage на кадр), вывод звука (маскировка и растяжение речи выделяют
+// новые буферы), FEC и повторы по NACK, которые на петле без потерь не
+// работают. Код возврата 1, если хоть один участок выделяет память.
+//
+//   AuthoLASTVLADIOAllocCheck --packets 20000
+
+namespace {
+
+std::atomic<qint64> allocations{0};
+thread_local qint64 threadAllocations = 0;
+
+void countAllocation()
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    ++threadAllocations;
+}
+
+}
+
+#ifdef __GLIBC__
+// Qt выделяет память под QByteArray и QList через malloc, а не operator
+// new, поэтому подменяется сам malloc; operator new из libstdc++ приходит
+// сюда же
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void __libc_free(void *p);
+
+void *malloc(size_t size)
+{
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+    countAllocation();
+    return __libc_realloc(p, size);
+}
+
+void free(void *p)
+{
+    __libc_free(p);
+}
+
+}
+#else
+// Без glibc видны только выделения через operator new
+void *operator new(size_t size)
+{
+    countAllocation();
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    std::free(p);
+}
+#endif
+
+namespace {
+
+constexpr int SampleRate = 48000;
+constexpr int PacketMs = 20;
+constexpr int PacketSamples = SampleRate * PacketMs / 1000;
+// Кадр видео на каждый второй аудиопакет, 4-8 КБ - 4-7 фрагментов.
+// Прогрев длиннее кольца повторов: его ячейки получают свои буферы
+constexpr int VideoEvery = 2;
+constexpr int VideoPayload = 1200;
+constexpr int WarmupPackets = 1000;
+// Пакет на петле не дошёл за это время - потерян, проверка не пройдена
+constexpr int DeliveryTimeoutMs = 2000;
+
+using Bench::out;
+
+// Участок пути: выделений на аудиопакет (видео - на его долю кадров)
+struct Stage
+{
+    const char *name;
+    qint64 counted = 0;
+};
+
+enum StageIndex {
+    Encode,
+    Packet,
+    Fragment,
+    Send,
+    Network,
+    Delivery,
+    Open,
+    Decode,
+    Jitter,
+    Reassembly,
+    EventLoop,
+    StageCount
+};
+
+// Оба конца звонка в одном потоке: отправитель и получатель со своими
+// сетевыми потоками
+class Call
+{
+public:
+    Call(AudioCodecId codec, quint16 port)
+        : m_sender(port)
+        , m_receiver(quint16(port + 1))
+        , m_encoder(AudioCodecs::createEncoder(codec, SampleRate, 1))
+        , m_decoder(AudioCodecs::createDecoder(codec, SampleRate, 1))
+        , m_key(MediaCrypto::senderKey(QByteArray(MediaCrypto::KeySize, 'k'), QUuid::createUuid()))
+        , m_address(QHostAddress::LocalHost)
+        , m_port(quint16(port + 1))
+    {
+        m_jitterBuffer.setFormat(SampleRate, 2, true);
+        m_capture.resize(PacketSamples * 2);
+        // Кадр до 8 КБ, содержимое для проверки не важно
+        m_image.resize(8192);
+        for (qsizetype i = 0; i < m_image.size(); ++i) {
+            m_image[i] = char(i * 7);
+        }
+        QObject::connect(&m_receiver, &NetworkEngine::packetsReady, [this]() { receive(); });
+    }
+
+    bool isValid() const { return m_encoder && m_decoder; }
+    bool start(QString *error);
+    bool run(int packets);
+    void stop();
+
+    const Stage *stages() const { return m_stages; }
+
+private:
+    // Счётчик участка в этом потоке, только после прогрева
+    template <typename Body>
+    void measure(int index, Body &&body)
+    {
+        const qint64 before = threadAllocations;
+        body();
+        const qint64 spent = threadAllocations - before;
+        m_handled += spent;
+        if (m_counted) m_stages[index].counted += spent;
+    }
+
+    bool sendAudio(int index);
+    void sendVideo(int index, quint32 timestamp);
+    void receive();
+    void receiveAudio(ReceivedPacket &packet);
+    void receiveVideo(ReceivedPacket &packet);
+    void seal(const Protocol::PacketHeader &header, QByteArrayView payload, QByteArray *packet);
+
+    NetworkEngine m_sender;
+    NetworkEngine m_receiver;
+    std::unique_ptr<AudioEncoder> m_encoder;
+    std::unique_ptr<AudioDecoder> m_decoder;
+    MediaCrypto::Key m_key;
+    QHostAddress m_address;
+    quint16 m_port;
+
+    // Отправитель
+    QByteArray m_capture;
+    QByteArray m_payload;
+    QByteArray m_image;
+    QByteArray m_fragment;
+    RetransmissionBuffer m_retransmissions;
+    quint32 m_audioSequence = 0;
+    quint32 m_videoSequence = 0;
+    quint32 m_frameId = 0;
+    qint64 m_sent = 0;
+
+    // Получатель
+    ReplayWindow m_audioReplay;
+    ReplayWindow m_videoReplay;
+    QByteArray m_pcm;
+    AudioJitterBuffer m_jitterBuffer;
+    VideoReassembler m_reassembler;
+    QByteArray m_frame;
+    qint64 m_received = 0;
+    qint64 m_frames = 0;
+    qint64 m_nowMs = 0;
+    bool m_failed = false;
+
+    Stage m_stages[StageCount] = {
+        { "кодирование" },
+        { "аудиопакет в буфере пула, шифрование" },
+        { "фрагмент кадра, буфер повторов, шифрование" },
+        { "send() и пробуждение сетевого потока" },
+        { "сетевые потоки обоих концов" },
+        { "packetsReady и разбор очередей" },
+        { "расшифровка и окно повторов" },
+        { "декодирование" },
+        { "джиттер-буфер" },
+        { "сборка кадра" },
+        { "цикл событий получателя" },
+    };
+    bool m_counted = false;
+    qint64 m_handled = 0;   // выделения в обработчиках за вызов processEvents()
+};
+
+bool Call::start(QString *error)
+{
+    if (!m_sender.start()) {
+        *error = m_sender.errorString();
+        return false;
+    }
+    if (!m_receiver.start()) {
+        *error = m_receiver.errorString();
+        return false;
+    }
+    return true;
+}
+
+void Call::stop()
+{
+    m_sender.stop();
+    m_receiver.stop();
+}
+
+// Как CallSession::makeMediaPacket: шифрование в буфере из пула отправки
+void Call::seal(const Protocol::PacketHeader &header, QByteArrayView payload, QByteArray *packet)
+{
+    Protocol::PacketHeader sealed = header;
+    sealed.encrypted = true;
+    *packet = m_sender.packetBuffer(Protocol::HeaderSize + payload.size() + MediaCrypto::TagSize);
+    Protocol::writePacket(packet->data(), sealed, payload);
+    MediaCrypto::seal(m_key, packet->data(), packet->size());
+}
+
+bool Call::sendAudio(int index)
+{
+    auto *samples = reinterpret_cast<qint16 *>(m_capture.data());
+    for (int k = 0; k < PacketSamples; ++k) {
+        samples[k] = qint16(((k + index * PacketSamples) * 37) % 8000 - 4000);
+    }
+
+    bool encoded = false;
+    measure(Encode, [&]() {
+        m_payload.resize(1);
+        m_payload[0] = char(m_encoder->id());
+        encoded = m_encoder->encode(m_capture, &m_payload);
+    });
+    if (!encoded) return false;
+
+    Protocol::PacketHeader header;
+    header.type = Protocol::PacketType::Audio;
+    header.peerId = 1;
+    header.sequence = ++m_audioSequence;
+    header.timestamp = quint32(index * PacketSamples);
+    QByteArray packet;
+    measure(Packet, [&]() { seal(header, m_payload, &packet); });
+    measure(Send, [&]() { m_sender.send(std::move(packet), m_address, m_port); });
+    ++m_sent;
+    return true;
+}
+
+void Call::sendVideo(int index, quint32 timestamp)
+{
+    const QByteArrayView image = QByteArrayView(m_image).first(4096 + (index * 37) % 4096);
+    const int count = VideoFragments::fragmentCount(image.size(), VideoPayload);
+    ++m_frameId;
+
+    for (int i = 0; i < count; ++i) {
+        Protocol::PacketHeader header;
+        header.type = Protocol::PacketType::Video;
+        header.peerId = 1;
+        header.sequence = ++m_videoSequence;
+        header.timestamp = timestamp;
+        QByteArray packet;
+        measure(Fragment, [&]() {
+            VideoFragments::writeFragment(image, m_frameId, i, count, VideoPayload, &m_fragment);
+            m_retransmissions.store(header.sequence, timestamp, m_fragment, m_nowMs * 1000);
+            seal(header, m_fragment, &packet);
+        });
+        measure(Send, [&]() { m_sender.send(std::move(packet), m_address, m_port); });
+        ++m_sent;
+    }
+}
+
+void Call::receive()
+{
+    ReceivedPacket packet;
+    bool audio = false;
+    bool video = false;
+    measure(Delivery, [&]() {
+        m_receiver.acknowledgePackets();
+        audio = m_receiver.takePacket(NetworkEngine::Stream::Audio, &packet);
+    });
+    while (audio) {
+        receiveAudio(packet);
+        measure(Delivery, [&]() {
+            m_receiver.recycle(std::move(packet));
+            audio = m_receiver.takePacket(NetworkEngine::Stream::Audio, &packet);
+        });
+    }
+    measure(Delivery, [&]() { video = m_receiver.takePacket(NetworkEngine::Stream::Video, &packet); });
+    while (video) {
+        receiveVideo(packet);
+        measure(Delivery, [&]() {
+            m_receiver.recycle(std::move(packet));
+            video = m_receiver.takePacket(NetworkEngine::Stream::Video, &packet);
+        });
+    }
+}
+
+void Call::receiveAudio(ReceivedPacket &packet)
+{
+    ++m_received;
+    bool opened = false;
+    measure(Open, [&]() {
+        const quint32 sequence = packet.header.sequence;
+        opened = m_audioReplay.check(sequence)
+                 && MediaCrypto::open(m_key, packet.datagram.data(), packet.datagram.size());
+        if (opened) {
+            m_audioReplay.update(sequence);
+            packet.datagram.chop(MediaCrypto::TagSize);
+        }
+    });
+    if (!opened) {
+        m_failed = true;
+        return;
+    }
+
+    bool decoded = false;
+    measure(Decode, [&]() {
+        m_pcm.resize(0);
+        decoded = m_decoder->decode(packet.payload().sliced(1), &m_pcm) && !m_pcm.isEmpty();
+    });
+    if (!decoded) {
+        m_failed = true;
+        return;
+    }
+    // Время прихода с небольшим разбросом, чтобы цель буфера пересчитывалась
+    measure(Jitter, [&]() {
+        m_jitterBuffer.insert(packet.header.sequence, packet.header.timestamp, m_pcm,
+                              m_nowMs + (packet.header.sequence * 7) % 13);
+    });
+}
+
+void Call::receiveVideo(ReceivedPacket &packet)
+{
+    ++m_received;
+    bool opened = false;
+    measure(Open, [&]() {
+        const quint32 sequence = packet.header.sequence;
+        opened = m_videoReplay.check(sequence)
+                 && MediaCrypto::open(m_key, packet.datagram.data(), packet.datagram.size());
+        if (opened) {
+            m_videoReplay.update(sequence);
+            packet.datagram.chop(MediaCrypto::TagSize);
+        }
+    });
+    if (!opened) {
+        m_failed = true;
+        return;
+    }
+
+    bool complete = false;
+    measure(Reassembly, [&]() { complete = m_reassembler.addFragment(packet.payload(), m_nowMs, &m_frame); });
+    if (complete) ++m_frames;
+}
+
+bool Call::run(int packets)
+{
+    // Будит ожидание, если пакет потерялся; таймер заведён заранее
+    QTimer watchdog;
+    watchdog.start(50);
+    QElapsedTimer timer;
+    const qint64 globalStart = allocations.load(std::memory_order_relaxed);
+    qint64 threadStart = threadAllocations;
+    qint64 globalCounted = globalStart;
+    qint64 threadCounted = threadStart;
+
+    for (int i = 0; i < WarmupPackets + packets; ++i) {
+        if (i == WarmupPackets) {
+            m_counted = true;
+            globalCounted = allocations.load(std::memory_order_relaxed);
+            threadCounted = threadAllocations;
+        }
+        m_nowMs = qint64(i) * PacketMs;
+
+        if (!sendAudio(i)) return false;
+        if (i % VideoEvery == 0) sendVideo(i, quint32(i * PacketSamples));
+
+        // Пакеты доходят до получателя в этом же потоке через packetsReady
+        timer.start();
+        while (m_received < m_sent && !m_failed) {
+            m_handled = 0;
+            const qint64 before = threadAllocations;
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+            if (m_counted) m_stages[EventLoop].counted += threadAllocations - before - m_handled;
+            if (timer.elapsed() > DeliveryTimeoutMs) {
+                out() << QString("Ошибка: пакет %1 не дошёл за %2 мс").arg(m_received + 1).arg(DeliveryTimeoutMs)
+                      << Qt::endl;
+                return false;
+            }
+        }
+        if (m_failed) {
+            out() << "Ошибка: пакет не расшифрован или не декодирован" << Qt::endl;
+            return false;
+        }
+
+        // Вывод звука - не путь пакета: его выделения не считаются
+        const qint64 before = threadAllocations;
+        m_jitterBuffer.pop();
+        threadCounted += threadAllocations - before;
+        globalCounted += threadAllocations - before;
+    }
+
+    // Всё, что выделено не в этом потоке, - сетевые потоки
+    const qint64 global = allocations.load(std::memory_order_relaxed) - globalCounted;
+    const qint64 own = threadAllocations - threadCounted;
+    m_stages[Network].counted = global - own;
+    if (m_frames == 0) {
+        out() << "Ошибка: ни один кадр не собран" << Qt::endl;
+        return false;
+    }
+    return true;
+}
+
+bool check(AudioCodecId codec, int packets, quint16 port)
+{
+    Call call(codec, port);
+    if (!call.isValid()) return true;
+
+    QString error;
+    if (!call.start(&error)) {
+        out() << "Ошибка: " << error << Qt::endl;
+        return false;
+    }
+    const bool completed = call.run(packets);
+    call.stop();
+    if (!completed) return false;
+
+    bool ok = true;
+    out() << AudioCodecs::name(codec) << " + видео:" << Qt::endl;
+    for (int i = 0; i < StageCount; ++i) {
+        const Stage &stage = call.stages()[i];
+        const double perPacket = double(stage.counted) / packets;
+        ok = ok && stage.counted == 0;
+        out() << QString("  %1: %2 выдел./пакет%3")
+                     .arg(stage.name)
+                     .arg(perPacket, 0, 'f', 3)
+                     .arg(stage.counted == 0 ? "" : " - ПРЕВЫШЕНО")
+              << Qt::endl;
+    }
+    return ok;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    Bench::prepare(parser, "AuthoLASTVLADIOAllocCheck",
+                   "Выделения памяти на пути аудио- и видеопакетов между двумя NetworkEngine");
+    const QCommandLineOption packetsOption("packets", "Аудиопакетов на кодек после прогрева.", "count", "20000");
+    const QCommandLineOption portOption("port", "Порт отправителя на петле, получатель - следующий.", "port",
+                                        "45700");
+    parser.addOptions({ packetsOption, portOption });
+    parser.process(app);
+
+    const int packets = qMax(1, parser.value(packetsOption).toInt());
+    const quint16 port = quint16(parser.value(portOption).toUInt());
+    const quint8 codecs = AudioCodecs::supportedMask(SampleRate, 1, true);
+    bool ok = true;
+    for (int i = 0; i < int(AudioCodecId::Count); ++i) {
+        if (!(codecs & AudioCodecs::maskOf(AudioCodecId(i)))) continue;
+        ok = check(AudioCodecId(i), packets, port) && ok;
+    }
+    out() << (ok ? "Итог: путь пакетов без выделений" : "Итог: есть выделения") << Qt::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,501 @@
+#include "audiocodec.h"
+#include <QtEndian>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#ifdef HAVE_OPUS
+#include <opus.h>
+#endif
+
+namespace {
+
+// ---------------------------------------------------------------------------
+// PCM без сжатия
+
+class PcmEncoder : public AudioEncoder
+{
+public:
+    AudioCodecId id() const override { return AudioCodecId::Pcm; }
+    bool encode(QByteArrayView pcm, QByteArray *out) override
+    {
+        out->append(pcm);
+        return true;
+    }
+};
+
+class PcmDecoder : public AudioDecoder
+{
+public:
+    AudioCodecId id() const override { return AudioCodecId::Pcm; }
+    bool decode(QByteArrayView data, QByteArray *out) override
+    {
+        out->append(data);
+        return true;
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Передискретизация в 16 кГц и обратно (FIR с окном Хэмминга)
+
+constexpr int NarrowRate = 16000;
+constexpr double Pi = 3.14159265358979323846;
+
+class FirResampler
+{
+public:
+    explicit FirResampler(int factor)
+        : m_factor(factor)
+    {
+        if (m_factor <= 1) return;
+
+        // Срез чуть ниже новой частоты Найквиста
+        const int taps = 16 * m_factor + 1;
+        const double cutoff = 0.45 / m_factor;
+        const int middle = taps / 2;
+        double sum = 0.0;
+        m_taps.resize(taps);
+        for (int k = 0; k < taps; ++k) {
+            const double t = k - middle;
+            const double sinc = t == 0 ? 2.0 * cutoff : std::sin(2.0 * Pi * cutoff * t) / (Pi * t);
+            const double window = 0.54 - 0.46 * std::cos(2.0 * Pi * k / (taps - 1));
+            m_taps[k] = float(sinc * window);
+            sum += m_taps[k];
+        }
+        for (float &tap : m_taps) {
+            tap = float(tap / sum);
+        }
+    }
+
+    // Результат пишется в out; векторы сохраняют ёмкость между пакетами,
+    // так что при постоянном размере пакета память не выделяется
+    void decimate(const qint16 *in, int count, std::vector<qint16> *out)
+    {
+        out->clear();
+        if (m_factor <= 1) {
+            out->assign(in, in + count);
+            return;
+        }
+
+        const int taps = int(m_taps.size());
+        m_history.resize(taps - 1, 0.0f);
+        m_buffer.assign(m_history.begin(), m_history.end());
+        m_buffer.insert(m_buffer.end(), in, in + count);
+
+        for (int i = 0; i < count; ++i) {
+            if (m_phase == 0) {
+                const float *x = m_buffer.data() + i + taps - 1;
+                float acc = 0.0f;
+                for (int k = 0; k < taps; ++k) {
+                    acc += m_taps[k] * x[-k];
+                }
+                out->push_back(clampSample(acc));
+            }
+            m_phase = (m_phase + 1) % m_factor;
+        }
+
+        m_history.assign(m_buffer.end() - (taps - 1), m_buffer.end());
+    }
+
+    void interpolate(const qint16 *in, int count, std::vector<qint16> *out)
+    {
+        out->clear();
+        if (m_factor <= 1) {
+            out->assign(in, in + count);
+            return;
+        }
+
+        const int taps = int(m_taps.size());
+        const int span = (taps + m_factor - 1) / m_factor;
+        m_history.resize(span - 1, 0.0f);
+        m_buffer.assign(m_history.begin(), m_history.end());
+        m_buffer.insert(m_buffer.end(), in, in + count);
+
+        for (int i = 0; i < count; ++i) {
+            const float *x = m_buffer.data() + i + span - 1;
+            for (int p = 0; p < m_factor; ++p) {
+                float acc = 0.0f;
+                for (int m = 0; p + m * m_factor < taps; ++m) {
+                    acc += m_taps[p + m * m_factor] * x[-m];
+                }
+                out->push_back(clampSample(acc * m_factor));
+            }
+        }
+
+        m_history.assign(m_buffer.end() - (span - 1), m_buffer.end());
+    }
+
+private:
+    static qint16 clampSample(float v)
+    {
+        return qint16(qBound(-32768, int(std::lround(v)), 32767));
+    }
+
+    int m_factor;
+    int m_phase = 0;
+    std::vector<float> m_taps;
+    std::vector<float> m_history;
+    std::vector<float> m_buffer;   // история и новый вход подряд
+};
+
+// ---------------------------------------------------------------------------
+// IMA-ADPCM, 4 бита на отсчёт после понижения частоты до 16 кГц.
+// Пакет: предсказатель (int16), индекс шага, флаги, затем полубайты
+// (младший первым). Каждый пакет декодируется независимо от предыдущих.
+
+const int ImaStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+const int ImaIndexTable[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+constexpr int AdpcmHeaderSize = 4;
+constexpr quint8 AdpcmOddFlag = 0x01;
+
+struct ImaState
+{
+    int predictor = 0;
+    int index = 0;
+
+    void advance(quint8 code, int delta)
+    {
+        predictor += (code & 8) ? -delta : delta;
+        predictor = qBound(-32768, predictor, 32767);
+        index = qBound(0, index + ImaIndexTable[code], 88);
+    }
+};
+
+quint8 imaEncodeSample(ImaState &state, int sample)
+{
+    int step = ImaStepTable[state.index];
+    int diff = sample - state.predictor;
+    quint8 code = 0;
+    if (diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+
+    int delta = step >> 3;
+    if (diff >= step) { code |= 4; diff -= step; delta += step; }
+    step >>= 1;
+    if (diff >= step) { code |= 2; diff -= step; delta += step; }
+    step >>= 1;
+    if (diff >= step) { code |= 1; delta += step; }
+
+    state.advance(code, delta);
+    return code;
+}
+
+int imaDecodeSample(ImaState &state, quint8 code)
+{
+    const int step = ImaStepTable[state.index];
+    int delta = step >> 3;
+    if (code & 4) delta += step;
+    if (code & 2) delta += step >> 1;
+    if (code & 1) delta += step >> 2;
+
+    state.advance(code, delta);
+    return state.predictor;
+}
+
+class ImaAdpcmEncoder : public AudioEncoder
+{
+public:
+    explicit ImaAdpcmEncoder(int sampleRate)
+        : m_resampler(sampleRate / NarrowRate)
+    {
+    }
+
+    AudioCodecId id() const override { return AudioCodecId::ImaAdpcm; }
+
+    bool encode(QByteArrayView pcm, QByteArray *out) override
+    {
+        m_resampler.decimate(reinterpret_cast<const qint16 *>(pcm.data()), int(pcm.size() / 2), &m_narrow);
+        const int count = int(m_narrow.size());
+
+        const qsizetype start = out->size();
+        const qsizetype length = AdpcmHeaderSize + (count + 1) / 2;
+        out->resize(start + length);
+        uchar *p = reinterpret_cast<uchar *>(out->data()) + start;
+        memset(p, 0, size_t(length));
+        qToBigEndian<qint16>(qint16(m_state.predictor), p);
+        p[2] = quint8(m_state.index);
+        p[3] = (count & 1) ? AdpcmOddFlag : 0;
+
+        uchar *nibbles = p + AdpcmHeaderSize;
+        for (int i = 0; i < count; ++i) {
+            const quint8 code = imaEncodeSample(m_state, m_narrow[i]);
+            nibbles[i / 2] |= (i & 1) ? quint8(code << 4) : code;
+        }
+        return true;
+    }
+
+private:
+    FirResampler m_resampler;
+    ImaState m_state;
+    std::vector<qint16> m_narrow;
+};
+
+class ImaAdpcmDecoder : public AudioDecoder
+{
+public:
+    explicit ImaAdpcmDecoder(int sampleRate)
+        : m_resampler(sampleRate / NarrowRate)
+    {
+    }
+
+    AudioCodecId id() const override { return AudioCodecId::ImaAdpcm; }
+
+    bool decode(QByteArrayView data, QByteArray *out) override
+    {
+        if (data.size() < AdpcmHeaderSize) return false;
+
+        const uchar *p = reinterpret_cast<const uchar *>(data.data());
+        ImaState state;
+        state.predictor = qFromBigEndian<qint16>(p);
+        state.index = qBound(0, int(p[2]), 88);
+
+        int count = int(data.size() - AdpcmHeaderSize) * 2;
+        if (p[3] & AdpcmOddFlag) count--;
+
+        m_narrow.resize(size_t(count));
+        const uchar *nibbles = p + AdpcmHeaderSize;
+        for (int i = 0; i < count; ++i) {
+            const quint8 code = (i & 1) ? quint8(nibbles[i / 2] >> 4) : quint8(nibbles[i / 2] & 0x0f);
+            m_narrow[i] = qint16(imaDecodeSample(state, code));
+        }
+
+        m_resampler.interpolate(m_narrow.data(), count, &m_wide);
+        out->append(reinterpret_cast<const char *>(m_wide.data()), qsizetype(m_wide.size()) * 2);
+        return true;
+    }
+
+private:
+    FirResampler m_resampler;
+    std::vector<qint16> m_narrow;
+    std::vector<qint16> m_wide;
+};
+
+#ifdef HAVE_OPUS
+// ---------------------------------------------------------------------------
+// Opus. Длительность пакета (currentPacketMs) не обязана совпадать с
+// допустимыми кадрами Opus, поэтому пакет делится на подкадры
+// 60/40/20/10/5/2.5 мс, каждый с двухбайтовой длиной.
+
+constexpr int OpusBitrate = 24000;
+constexpr int OpusMaxFrameBytes = 4000;
+
+class OpusAudioEncoder : public AudioEncoder
+{
+public:
+    OpusAudioEncoder(int sampleRate, int channels)
+        : m_sampleRate(sampleRate)
+        , m_channels(channels)
+    {
+        int error = OPUS_OK;
+        m_encoder = opus_encoder_create(sampleRate, channels, OPUS_APPLICATION_VOIP, &error);
+        if (error != OPUS_OK) {
+            m_encoder = nullptr;
+            return;
+        }
+        opus_encoder_ctl(m_encoder, OPUS_SET_BITRATE(OpusBitrate));
+        opus_encoder_ctl(m_encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+        opus_encoder_ctl(m_encoder, OPUS_SET_COMPLEXITY(5));
+    }
+
+    ~OpusAudioEncoder() override
+    {
+        if (m_encoder) opus_encoder_destroy(m_encoder);
+    }
+
+    bool isValid() const { return m_encoder != nullptr; }
+
+    AudioCodecId id() const override { return AudioCodecId::Opus; }
+
+    bool encode(QByteArrayView pcm, QByteArray *out) override
+    {
+        const opus_int16 *samples = reinterpret_cast<const opus_int16 *>(pcm.data());
+        int remaining = int(pcm.size() / 2 / m_channels);
+
+        // Подкадры в десятых долях миллисекунды: 60, 40, 20, 10, 5, 2.5 мс
+        static const int frameTenthsMs[] = { 600, 400, 200, 100, 50, 25 };
+
+        unsigned char frame[OpusMaxFrameBytes];
+        while (remaining > 0) {
+            int frameSize = 0;
+            for (int tenths : frameTenthsMs) {
+                const int size = m_sampleRate * tenths / 10000;
+                if (size <= remaining) {
+                    frameSize = size;
+                    break;
+                }
+            }
+            if (frameSize == 0) break; // хвост короче 2.5 мс отбрасывается
+
+            const opus_int32 bytes = opus_encode(m_encoder, samples, frameSize, frame, OpusMaxFrameBytes);
+            if (bytes < 0) return false;
+
+            char length[2];
+            qToBigEndian<quint16>(quint16(bytes), length);
+            out->append(length, 2);
+            out->append(reinterpret_cast<const char *>(frame), bytes);
+
+            samples += frameSize * m_channels;
+            remaining -= frameSize;
+        }
+        return true;
+    }
+
+private:
+    OpusEncoder *m_encoder = nullptr;
+    int m_sampleRate;
+    int m_channels;
+};
+
+class OpusAudioDecoder : public AudioDecoder
+{
+public:
+    OpusAudioDecoder(int sampleRate, int channels)
+        : m_channels(channels)
+        , m_maxFrameSize(sampleRate * 60 / 1000)
+        , m_frame(size_t(m_maxFrameSize) * channels)
+    {
+        int error = OPUS_OK;
+        m_decoder = opus_decoder_create(sampleRate, channels, &error);
+        if (error != OPUS_OK) m_decoder = nullptr;
+    }
+
+    ~OpusAudioDecoder() override
+    {
+        if (m_decoder) opus_decoder_destroy(m_decoder);
+    }
+
+    bool isValid() const { return m_decoder != nullptr; }
+
+    AudioCodecId id() const override { return AudioCodecId::Opus; }
+
+    bool decode(QByteArrayView data, QByteArray *out) override
+    {
+        const uchar *p = reinterpret_cast<const uchar *>(data.data());
+        qsizetype offset = 0;
+        while (offset + 2 <= data.size()) {
+            const int length = qFromBigEndian<quint16>(p + offset);
+            offset += 2;
+            if (offset + length > data.size()) return false;
+
+            const int samples = opus_decode(m_decoder, p + offset, length, m_frame.data(), m_maxFrameSize, 0);
+            if (samples < 0) return false;
+
+            out->append(reinterpret_cast<const char *>(m_frame.data()), qsizetype(samples) * m_channels * 2);
+            offset += length;
+        }
+        return true;
+    }
+
+private:
+    OpusDecoder *m_decoder = nullptr;
+    int m_channels;
+    int m_maxFrameSize;
+    std::vector<opus_int16> m_frame;
+};
+
+bool isOpusRate(int sampleRate)
+{
+    return sampleRate == 8000 || sampleRate == 12000 || sampleRate == 16000
+           || sampleRate == 24000 || sampleRate == 48000;
+}
+#endif
+
+} // namespace
+
+namespace AudioCodecs {
+
+quint8 supportedMask(int sampleRate, int channels, bool int16)
+{
+    quint8 mask = maskOf(AudioCodecId::Pcm);
+    if (!int16) return mask;
+
+    if (channels == 1 && sampleRate >= NarrowRate && sampleRate % NarrowRate == 0) {
+        mask |= maskOf(AudioCodecId::ImaAdpcm);
+    }
+#ifdef HAVE_OPUS
+    if (channels <= 2 && isOpusRate(sampleRate)) {
+        mask |= maskOf(AudioCodecId::Opus);
+    }
+#endif
+    return mask;
+}
+
+AudioCodecId choose(quint8 localMask, quint8 remoteMask)
+{
+    const quint8 common = localMask & remoteMask;
+    for (AudioCodecId id : { AudioCodecId::Opus, AudioCodecId::ImaAdpcm }) {
+        if (common & maskOf(id)) return id;
+    }
+    return AudioCodecId::Pcm;
+}
+
+std::unique_ptr<AudioEncoder> createEncoder(AudioCodecId id, int sampleRate, int channels)
+{
+    switch (id) {
+    case AudioCodecId::ImaAdpcm:
+        return std::make_unique<ImaAdpcmEncoder>(sampleRate);
+#ifdef HAVE_OPUS
+    case AudioCodecId::Opus: {
+        auto encoder = std::make_unique<OpusAudioEncoder>(sampleRate, channels);
+        if (encoder->isValid()) return encoder;
+        break;
+    }
+#endif
+    default:
+        break;
+    }
+    Q_UNUSED(channels);
+    return std::make_unique<PcmEncoder>();
+}
+
+std::unique_ptr<AudioDecoder> createDecoder(AudioCodecId id, int sampleRate, int channels)
+{
+    switch (id) {
+    case AudioCodecId::Pcm:
+        return std::make_unique<PcmDecoder>();
+    case AudioCodecId::ImaAdpcm:
+        return std::make_unique<ImaAdpcmDecoder>(sampleRate);
+#ifdef HAVE_OPUS
+    case AudioCodecId::Opus: {
+        auto decoder = std::make_unique<OpusAudioDecoder>(sampleRate, channels);
+        if (decoder->isValid()) return decoder;
+        break;
+    }
+#endif
+    default:
+        break;
+    }
+    Q_UNUSED(channels);
+    return nullptr;
+}
+
+QString name(AudioCodecId id)
+{
+    switch (id) {
+    case AudioCodecId::Pcm:
+        return "PCM";
+    case AudioCodecId::ImaAdpcm:
+        return "IMA-ADPCM 16 кГц";
+    case AudioCodecId::Opus:
+        return "Opus";
+    default:
+        return "?";
+    }
+}
+
+} // namespace AudioCodecs
@@ -0,0 +1,61 @@
+#ifndef AUDIOCODEC_H
+#define AUDIOCODEC_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QString>
+#include <QtGlobal>
+#include <memory>
+
+// Кодеки аудио между захватом и сетью.
+//
+// Полезная нагрузка AUDIO-пакета: один байт AudioCodecId и закодированные
+// данные, поэтому приёмник всегда знает, чем декодировать пакет. Набор
+// поддерживаемых кодеков (битовая маска) передаётся в DISCOVER, отправитель
+// выбирает лучший из общих: Opus > IMA-ADPCM > PCM.
+enum class AudioCodecId : quint8 {
+    Pcm = 0,
+    ImaAdpcm = 1,
+    Opus = 2,
+    Count
+};
+
+class AudioEncoder
+{
+public:
+    virtual ~AudioEncoder() = default;
+    virtual AudioCodecId id() const = 0;
+    // pcm - Int16 с частотой и числом каналов, заданными при создании.
+    // Закодированные данные дописываются в конец out, чтобы вызывающий мог
+    // переиспользовать буфер; false - ошибка кодера
+    virtual bool encode(QByteArrayView pcm, QByteArray *out) = 0;
+};
+
+class AudioDecoder
+{
+public:
+    virtual ~AudioDecoder() = default;
+    virtual AudioCodecId id() const = 0;
+    // PCM дописывается в конец out, как у encode(): вызывающий держит
+    // один буфер на поток пакетов. false - повреждённый пакет, out тогда
+    // может быть дописан частично
+    virtual bool decode(QByteArrayView data, QByteArray *out) = 0;
+};
+
+namespace AudioCodecs {
+
+constexpr quint8 maskOf(AudioCodecId id) { return quint8(1u << quint8(id)); }
+
+// Кодеки, доступные для формата; PCM доступен всегда
+quint8 supportedMask(int sampleRate, int channels, bool int16);
+
+AudioCodecId choose(quint8 localMask, quint8 remoteMask);
+
+std::unique_ptr<AudioEncoder> createEncoder(AudioCodecId id, int sampleRate, int channels);
+std::unique_ptr<AudioDecoder> createDecoder(AudioCodecId id, int sampleRate, int channels);
+
+QString name(AudioCodecId id);
+
+} // namespace AudioCodecs
+
+#endif // AUDIOCODEC_H
@@ -0,0 +1,87 @@
+#include "audiomixer.h"
+#include <cstring>
+
+void AudioMixer::setFormat(QAudioFormat::SampleFormat format, int bytesPerFrame)
+{
+    m_format = format;
+    m_bytesPerFrame = qMax(1, bytesPerFrame);
+    m_pending.clear();
+}
+
+void AudioMixer::push(quint16 source, const QByteArray &pcm)
+{
+    m_pending[source].append(pcm);
+}
+
+bool AudioMixer::isEmpty() const
+{
+    for (const QByteArray &pending : m_pending) {
+        if (!pending.isEmpty()) return false;
+    }
+    return true;
+}
+
+QByteArray AudioMixer::mix(qsizetype frameBytes)
+{
+    frameBytes -= frameBytes % m_bytesPerFrame;
+
+    QByteArray mix;
+    for (QByteArray &pending : m_pending) {
+        const qsizetype bytes = qMin(frameBytes, pending.size() - pending.size() % m_bytesPerFrame);
+        if (bytes <= 0) continue;
+
+        if (mix.isEmpty()) {
+            mix = pending.left(bytes);
+        } else {
+            // Более короткий вклад выравнивается по началу порции
+            if (mix.size() < bytes) {
+                const qsizetype offset = mix.size();
+                mix.resize(bytes);
+                memset(mix.data() + offset, m_format == QAudioFormat::UInt8 ? 0x80 : 0, size_t(bytes - offset));
+            }
+            add(mix.data(), pending.constData(), bytes);
+        }
+        pending.remove(0, bytes);
+    }
+    return mix;
+}
+
+void AudioMixer::add(char *mix, const char *pcm, qsizetype bytes) const
+{
+    switch (m_format) {
+    case QAudioFormat::UInt8: {
+        quint8 *out = reinterpret_cast<quint8 *>(mix);
+        const quint8 *in = reinterpret_cast<const quint8 *>(pcm);
+        for (qsizetype i = 0; i < bytes; ++i) {
+            out[i] = quint8(qBound(0, int(out[i]) + int(in[i]) - 0x80, 0xFF));
+        }
+        break;
+    }
+    case QAudioFormat::Int16: {
+        qint16 *out = reinterpret_cast<qint16 *>(mix);
+        const qint16 *in = reinterpret_cast<const qint16 *>(pcm);
+        for (qsizetype i = 0; i < bytes / qsizetype(sizeof(qint16)); ++i) {
+            out[i] = qint16(qBound(-32768, int(out[i]) + int(in[i]), 32767));
+        }
+        break;
+    }
+    case QAudioFormat::Int32: {
+        qint32 *out = reinterpret_cast<qint32 *>(mix);
+        const qint32 *in = reinterpret_cast<const qint32 *>(pcm);
+        for (qsizetype i = 0; i < bytes / qsizetype(sizeof(qint32)); ++i) {
+            out[i] = qint32(qBound<qint64>(-2147483648LL, qint64(out[i]) + qint64(in[i]), 2147483647LL));
+        }
+        break;
+    }
+    case QAudioFormat::Float: {
+        float *out = reinterpret_cast<float *>(mix);
+        const float *in = reinterpret_cast<const float *>(pcm);
+        for (qsizetype i = 0; i < bytes / qsizetype(sizeof(float)); ++i) {
+            out[i] = qBound(-1.0f, out[i] + in[i], 1.0f);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef AUDIOMIXER_H
+#define AUDIOMIXER_H
+
+#include <QAudioFormat>
+#include <QByteArray>
+#include <QHash>
+
+// Сведение PCM нескольких участников в один поток воспроизведения.
+//
+// Джиттер-буферы отдают порции разной длины (растяжение и сжатие речи),
+// поэтому у каждого источника своя очередь, а сводится всегда ровно
+// frameBytes: каждый источник отдаёт столько, сколько у него есть, но не
+// больше. Отсчёты складываются с насыщением; источник, у которого буфер
+// ещё набирается, просто не участвует и не задерживает остальных.
+class AudioMixer
+{
+public:
+    void setFormat(QAudioFormat::SampleFormat format, int bytesPerFrame);
+
+    void push(quint16 source, const QByteArray &pcm);
+    qsizetype pending(quint16 source) const { return m_pending.value(source).size(); }
+    bool isEmpty() const;
+
+    // Сведённая порция не длиннее frameBytes; пустая, если данных нет ни у кого
+    QByteArray mix(qsizetype frameBytes);
+
+    void removeSource(quint16 source) { m_pending.remove(source); }
+    void clear() { m_pending.clear(); }
+
+private:
+    void add(char *mix, const char *pcm, qsizetype bytes) const;
+
+    QAudioFormat::SampleFormat m_format = QAudioFormat::Int16;
+    int m_bytesPerFrame = 2;
+    QHash<quint16, QByteArray> m_pending;
+};
+
+#endif // AUDIOMIXER_H
@@ -0,0 +1,91 @@
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QList>
+#include <QTextStream>
+#include <algorithm>
+#include <ctime>
+
+// Общее для замеров и проверок (AuthoLASTVLADIO*Bench, *Check): вывод,
+// начало разбора командной строки и циклы замера времени. Результат
+// печатается в stdout строками QString::arg, код возврата 1 - ошибка или
+// непройденная проверка.
+namespace Bench {
+
+inline QTextStream &out()
+{
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+// Имя приложения, описание и --help; свои опции утилита добавляет сама
+inline void prepare(QCommandLineParser &parser, const QString &name, const QString &description)
+{
+    QCoreApplication::setApplicationName(name);
+    parser.setApplicationDescription(description);
+    parser.addHelpOption();
+}
+
+// Процессорное время процесса (все потоки, пользователь и ядро), с
+inline double cpuSeconds()
+{
+    return double(std::clock()) / CLOCKS_PER_SEC;
+}
+
+// body(i) по 256 вызовов, пока не истечёт seconds; наносекунд на вызов.
+// i - сквозной номер вызова
+template <typename Body>
+double nsPerCall(double seconds, Body &&body)
+{
+    QElapsedTimer timer;
+    qint64 count = 0;
+    timer.start();
+    do {
+        for (int i = 0; i < 256; ++i) {
+            body(count++);
+        }
+    } while (timer.nsecsElapsed() < qint64(seconds * 1e9));
+    return double(timer.nsecsElapsed()) / double(count);
+}
+
+struct Latency
+{
+    double meanNs = 0.0;
+    double p95Ns = 0.0;
+    double cpuNs = 0.0;   // процессор на вызов
+};
+
+// count вызовов body(i), каждый по отдельности: средняя задержка и 95-й
+// перцентиль, когда важен разброс, а не только пропускная способность
+template <typename Body>
+Latency latency(qsizetype count, Body &&body)
+{
+    QList<double> samples;
+    samples.reserve(count);
+    QElapsedTimer timer;
+    const double cpuStart = cpuSeconds();
+    for (qsizetype i = 0; i < count; ++i) {
+        timer.start();
+        body(i);
+        samples.append(double(timer.nsecsElapsed()));
+    }
+
+    Latency result;
+    if (samples.isEmpty()) return result;
+    result.cpuNs = (cpuSeconds() - cpuStart) * 1e9 / double(count);
+    double total = 0.0;
+    for (const double sample : samples) {
+        total += sample;
+    }
+    result.meanNs = total / double(count);
+    std::sort(samples.begin(), samples.end());
+    result.p95Ns = samples.at(qMin(count - 1, qsizetype(double(count) * 0.95)));
+    return result;
+}
+
+}
+
+#endif // BENCHUTIL_H
@@ -0,0 +1,81 @@
+#include "bundler.h"
+#include "packetpool.h"
+#include "protocol.h"
+#include <QtEndian>
+#include <cstring>
+
+QByteArray PacketBundler::attach(quint16 key, QByteArray carrier, int limit, PacketPool &pool)
+{
+    auto it = m_pending.find(key);
+    if (it == m_pending.end()) return carrier;
+
+    QByteArray bundle = build(carrier, it.value(), limit, pool);
+    if (it.value().isEmpty()) m_pending.erase(it);
+    if (bundle.isEmpty()) return carrier;
+    // Аудиопакет уже переписан в датаграмму BUNDLE
+    pool.release(std::move(carrier));
+    return bundle;
+}
+
+QByteArray PacketBundler::take(quint16 key, int limit, PacketPool &pool)
+{
+    auto it = m_pending.find(key);
+    if (it == m_pending.end()) return QByteArray();
+
+    QList<QByteArray> &pending = it.value();
+    QByteArray datagram;
+    if (pending.size() > 1) {
+        datagram = build(QByteArrayView(), pending, limit, pool);
+    }
+    // Один пакет или первый не помещается вместе со следующим
+    if (datagram.isEmpty()) {
+        datagram = pending.takeFirst();
+    }
+    if (pending.isEmpty()) m_pending.erase(it);
+    return datagram;
+}
+
+QByteArray PacketBundler::build(QByteArrayView carrier, QList<QByteArray> &pending, int limit,
+                                PacketPool &pool)
+{
+    // Сколько отложенных пакетов помещается по порядку
+    qsizetype size = Protocol::HeaderSize;
+    if (!carrier.isEmpty()) size += Protocol::BundleEntryHeaderSize + carrier.size();
+    int count = 0;
+    while (count < pending.size()
+           && size + Protocol::BundleEntryHeaderSize + pending.at(count).size() <= limit) {
+        size += Protocol::BundleEntryHeaderSize + pending.at(count).size();
+        ++count;
+    }
+    const int entries = count + (carrier.isEmpty() ? 0 : 1);
+    if (count == 0 || entries < 2) return QByteArray();
+
+    // Отправитель у вложенных пакетов один, peerId - из первого
+    Protocol::PacketHeader first;
+    Protocol::readHeader(carrier.isEmpty() ? QByteArrayView(pending.first()) : carrier, &first);
+
+    Protocol::PacketHeader header;
+    header.type = Protocol::PacketType::Bundle;
+    header.peerId = first.peerId;
+    header.timestamp = quint32(entries);
+
+    QByteArray bundle = pool.acquire(size);
+    Protocol::writeHeader(bundle.data(), header);
+    char *p = bundle.data() + Protocol::HeaderSize;
+    auto append = [&p](QByteArrayView packet) {
+        qToBigEndian<quint16>(quint16(packet.size()), p);
+        memcpy(p + Protocol::BundleEntryHeaderSize, packet.data(), size_t(packet.size()));
+        p += Protocol::BundleEntryHeaderSize + packet.size();
+    };
+    // Первым - аудио: по нему планировщик выбирает очередь
+    if (!carrier.isEmpty()) append(carrier);
+    for (int i = 0; i < count; ++i) {
+        append(pending.at(i));
+    }
+    pending.remove(0, count);
+
+    ++m_stats.bundles;
+    m_stats.bundledPackets += entries;
+    m_stats.framingBytes += Protocol::HeaderSize + qint64(entries) * Protocol::BundleEntryHeaderSize;
+    return bundle;
+}
@@ -0,0 +1,60 @@
+#ifndef BUNDLER_H
+#define BUNDLER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+
+class PacketPool;
+
+// Объединение мелких пакетов одному адресату в датаграмму BUNDLE.
+//
+// Управляющие пакеты (KEEPALIVE, MSG, отчёты) откладываются по ключу
+// адресата и уезжают со следующим аудиопакетом туда же: attach()
+// дописывает их к аудиопакету, который уходит сразу, поэтому аудио
+// ничего не ждёт. Если аудио нет (микрофон выключен или не подключён),
+// владелец по истечении короткого срока забирает накопленное через
+// take(), и совпавшие по времени пакеты всё равно уходят одной
+// датаграммой. Датаграмма не больше заданного предела, не уместившееся
+// остаётся ждать.
+//
+// Датаграмма BUNDLE собирается в буфере из пула отправки (тот же пул, что
+// у NetworkEngine::packetBuffer()), а carrier, переписанный в неё,
+// возвращается туда же: прицепленный к аудио управляющий пакет не
+// добавляет выделений памяти на пути отправки.
+class PacketBundler
+{
+public:
+    // IPv4 + UDP: во столько обходится каждая отдельная датаграмма
+    static constexpr int DatagramOverhead = 28;
+
+    struct Stats
+    {
+        qint64 bundles = 0;          // отправлено датаграмм BUNDLE
+        qint64 bundledPackets = 0;   // пакетов в них
+        qint64 framingBytes = 0;     // заголовки BUNDLE и длины вложенных пакетов
+    };
+
+    void hold(quint16 key, const QByteArray &packet) { m_pending[key].append(packet); }
+    bool hasPending(quint16 key) const { return m_pending.contains(key); }
+    bool isEmpty() const { return m_pending.isEmpty(); }
+    QList<quint16> keys() const { return m_pending.keys(); }
+
+    // carrier и отложенные для key, сколько их уместится в limit; без
+    // отложенных - сам carrier
+    QByteArray attach(quint16 key, QByteArray carrier, int limit, PacketPool &pool);
+    // Отложенные для key одной датаграммой, одиночный пакет - как есть
+    QByteArray take(quint16 key, int limit, PacketPool &pool);
+    void remove(quint16 key) { m_pending.remove(key); }
+    void clear() { m_pending.clear(); }
+
+    const Stats &stats() const { return m_stats; }
+
+private:
+    QByteArray build(QByteArrayView carrier, QList<QByteArray> &pending, int limit, PacketPool &pool);
+
+    QHash<quint16, QList<QByteArray>> m_pending;
+    Stats m_stats;
+};
+
+#endif // BUNDLER_H
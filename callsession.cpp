@@ -0,0 +1,1593 @@
+#include "callsession.h"
+#include <QRandomGenerator>
+#include <QNetworkInterface>
+#include <QDateTime>
+
+// Темп отправки с запасом над оценкой канала: кадр уходит быстрее, чем за
+// период кадра, но без всплеска на всю пропускную способность интерфейса
+const double PACING_FACTOR = 1.5;
+
+CallSession::CallSession(const Settings &settings, QObject *parent)
+    : QObject(parent)
+    , settings(settings)
+    , localPort(settings.localPort)
+    , remotePort(settings.remotePort)
+    , encryptMedia(!settings.callKey.isEmpty())
+{
+    instanceId = QUuid::createUuid();
+    if (encryptMedia) {
+        sendKey = MediaCrypto::senderKey(settings.callKey, instanceId);
+    }
+    nickname = settings.nickname.isEmpty()
+                   ? "User_" + QString::number(QRandomGenerator::global()->bounded(1000))
+                   : settings.nickname;
+    localPeerId = quint16(QRandomGenerator::global()->bounded(1, 0x10000));
+    mediaClock.start();
+
+    network = new NetworkEngine(localPort, this);
+    localAddresses = new LocalAddresses(this);
+    connect(network, &NetworkEngine::errorOccurred, this, &CallSession::logMessage);
+    if (isMulticast()) {
+        NetworkEngine::Multicast multicast;
+        multicast.group = settings.multicastGroup;
+        multicast.ttl = settings.multicastTtl;
+        multicast.loopback = settings.multicastLoopback;
+        network->setMulticast(multicast);
+    }
+
+    // Кодирование и декодирование видео в отдельных потоках
+    videoEncoder = new VideoEncoder(this);
+    connect(videoEncoder, &VideoEncoder::previewReady, this, &CallSession::localPreviewReady);
+    connect(videoEncoder, &VideoEncoder::frameEncoded, this, &CallSession::videoFrameEncoded);
+
+    setupTimers();
+
+    // Универсальный формат, владелец может заменить его форматом устройств
+    QAudioFormat format;
+    format.setSampleRate(48000);
+    format.setChannelCount(1);
+    format.setSampleFormat(QAudioFormat::Int16);
+    setAudioFormat(format);
+}
+
+CallSession::~CallSession()
+{
+    stop();
+    qDeleteAll(peers);
+}
+
+bool CallSession::start()
+{
+    if (isMulticast() && (settings.multicastGroup.protocol() != QAbstractSocket::IPv4Protocol
+                          || !settings.multicastGroup.isMulticast())) {
+        logMessage("Не адрес группы IPv4: " + settings.multicastGroup.toString());
+        return false;
+    }
+    if (!network->start()) {
+        logMessage("Ошибка привязки сокета: " + network->errorString());
+        return false;
+    }
+    logMessage("Сетевой поток: " + network->backendName());
+    logMessage(encryptMedia ? "Медиа шифруется (ChaCha20-Poly1305)" : "Медиа не шифруется");
+    updateVideoBitrate();
+
+    videoEncoder->start();
+    for (Peer *peer : std::as_const(peers)) {
+        peer->videoDecoder->start();
+    }
+
+    connectionTimer->start(250);
+    keepAliveTimer->start(KEEPALIVE_MS);
+    feedbackTimer->start(100);
+    reportTimer->start(1000);
+    nackTimer->start(10);
+    pathMtuTimer->start(50);
+    bundleWindowStats = bundler.stats();
+    bundleWindowStartUs = NetworkEngine::monotonicUs();
+    bundleRates = BundleRates();
+
+    logMessage("Система готова. Ваш ник: " + nickname);
+    logConnectionQuality();
+
+    if (usesPeerCache() && !settings.peerCachePath.isEmpty() && peerCache.load(settings.peerCachePath)) {
+        logMessage(QString("Недавних участников: %1").arg(peerCache.entries().size()));
+    }
+    startDiscovery();
+    return true;
+}
+
+void CallSession::stop()
+{
+    for (QTimer *timer : { connectionTimer, keepAliveTimer, discoveryTimer, feedbackTimer, reportTimer, nackTimer,
+                            pathMtuTimer, bundleTimer }) {
+        timer->stop();
+    }
+    if (usesPeerCache() && !settings.peerCachePath.isEmpty() && !peerCache.isEmpty()) {
+        peerCache.save(settings.peerCachePath);
+    }
+    videoEncoder->stop();
+    for (Peer *peer : std::as_const(peers)) {
+        peer->videoDecoder->stop();
+    }
+    network->stop();
+}
+
+void CallSession::setupTimers()
+{
+    connectionTimer = new QTimer(this);
+    connect(connectionTimer, &QTimer::timeout, this, [this](){
+        // Отказ у каждого участника свой, остальные звонок продолжают.
+        // Потерянного ищем по его адресу, пока он не вернётся
+        const qint64 now = NetworkEngine::monotonicUs();
+        const QList<quint16> ids = peers.keys();
+        for (quint16 id : ids) {
+            const Peer *peer = peers[id];
+            if (peer->liveness.isAvailable(now)) continue;
+
+            lostPeers.insert(peer->address, now);
+            removePeer(id, QString("Участник не отвечает (phi %1)").arg(peer->liveness.phi(now), 0, 'f', 1));
+            startDiscovery();
+        }
+    });
+
+    keepAliveTimer = new QTimer(this);
+    connect(keepAliveTimer, &QTimer::timeout, this, &CallSession::sendKeepAlive);
+
+    discoveryTimer = new QTimer(this);
+    discoveryTimer->setSingleShot(true);
+    connect(discoveryTimer, &QTimer::timeout, this, &CallSession::probePeers);
+
+    // Отчёты о приходе видеопакетов для оценки канала у отправителя
+    feedbackTimer = new QTimer(this);
+    connect(feedbackTimer, &QTimer::timeout, this, &CallSession::sendTransportFeedback);
+
+    // SR/RR по аудио и видео: собираются с ближайшим аудиопакетом или
+    // по истечении срока объединения, время в них - время отправки
+    reportTimer = new QTimer(this);
+    connect(reportTimer, &QTimer::timeout, this, [this]() {
+        reportsDue = true;
+        if (!bundleTimer->isActive()) bundleTimer->start(BUNDLE_DELAY_MS);
+        updateBundleRates(NetworkEngine::monotonicUs());
+    });
+
+    // Запросы повторной отправки: не чаще одного NACK за период таймера
+    nackTimer = new QTimer(this);
+    nackTimer->setTimerType(Qt::PreciseTimer);
+    connect(nackTimer, &QTimer::timeout, this, &CallSession::sendNacks);
+
+    // Пробы пути: по одной в пути на участника, поиск сходится за секунду
+    pathMtuTimer = new QTimer(this);
+    connect(pathMtuTimer, &QTimer::timeout, this, &CallSession::probePathMtu);
+
+    // Отложенные управляющие пакеты, которые не дождались аудио
+    bundleTimer = new QTimer(this);
+    bundleTimer->setSingleShot(true);
+    bundleTimer->setTimerType(Qt::PreciseTimer);
+    connect(bundleTimer, &QTimer::timeout, this, &CallSession::flushBundles);
+
+    connect(network, &NetworkEngine::packetsReady, this, &CallSession::readPendingDatagrams);
+}
+
+void CallSession::setAudioFormat(const QAudioFormat &format)
+{
+    audioFormat = format;
+
+    localAudioCodecs = AudioCodecs::supportedMask(audioFormat.sampleRate(), audioFormat.channelCount(),
+                                                  audioFormat.sampleFormat() == QAudioFormat::Int16);
+    if (!peers.isEmpty()) {
+        audioEncoder.reset();
+        selectAudioCodec();
+    }
+    for (Peer *peer : std::as_const(peers)) {
+        for (auto &decoder : peer->audioDecoders) {
+            decoder.reset();
+        }
+        peer->audioJitterBuffer.setFormat(audioFormat.sampleRate(), audioFormat.bytesPerFrame(),
+                                          audioFormat.sampleFormat() == QAudioFormat::Int16
+                                              && audioFormat.channelCount() == 1);
+        peer->streamReception[int(Protocol::MediaStream::Audio)].setClockRate(audioFormat.sampleRate());
+    }
+    audioMixer.setFormat(audioFormat.sampleFormat(), audioFormat.bytesPerFrame());
+}
+
+void CallSession::setAudioInput(QIODevice *device)
+{
+    if (audioInputDevice) {
+        disconnect(audioInputDevice, nullptr, this, nullptr);
+    }
+    audioInputDevice = device;
+    if (audioInputDevice) {
+        connect(audioInputDevice, &QIODevice::readyRead, this, &CallSession::sendAudioData);
+    }
+}
+
+int CallSession::audioPacketBytes() const
+{
+    return (audioFormat.sampleRate() * audioFormat.bytesPerFrame() * currentPacketMs) / 1000;
+}
+
+QByteArray CallSession::takePlayoutAudio()
+{
+    // Один участник - порции джиттер-буфера как есть, без сведения
+    if (peers.size() == 1 && audioMixer.isEmpty()) {
+        return peers.first()->audioJitterBuffer.pop();
+    }
+
+    // Сводится по 10 мс: мельче - лишние вызовы, крупнее - лишняя задержка
+    const qsizetype frameBytes = qsizetype(audioFormat.sampleRate() / 100) * audioFormat.bytesPerFrame();
+    for (Peer *peer : std::as_const(peers)) {
+        while (audioMixer.pending(peer->id) < frameBytes) {
+            const QByteArray chunk = peer->audioJitterBuffer.pop();
+            if (chunk.isEmpty()) break;
+            audioMixer.push(peer->id, chunk);
+        }
+    }
+    return audioMixer.mix(frameBytes);
+}
+
+void CallSession::setRemoteVideoSize(const QSize &size)
+{
+    remoteVideoSize = size;
+    for (Peer *peer : std::as_const(peers)) {
+        peer->videoDecoder->setTargetSize(size);
+    }
+}
+
+QList<CallSession::PeerInfo> CallSession::peerList() const
+{
+    QList<PeerInfo> list;
+    for (const Peer *peer : peers) {
+        PeerInfo info;
+        info.id = peer->id;
+        info.nickname = peer->nickname;
+        info.address = peer->address;
+        info.audioLossPercent = peer->audioLossRate;
+        info.videoLossPercent = peer->videoLossRate;
+        const SenderStatistics &video = peer->streamSending[int(Protocol::MediaStream::Video)];
+        const SenderStatistics &audio = peer->streamSending[int(Protocol::MediaStream::Audio)];
+        info.rttMs = video.hasRtt() ? video.rttMs() : audio.hasRtt() ? audio.rttMs() : 0.0;
+        list.append(info);
+    }
+    return list;
+}
+
+double CallSession::audioLossPercent() const
+{
+    double loss = 0.0;
+    for (const Peer *peer : peers) {
+        loss = qMax(loss, peer->audioLossRate);
+    }
+    return loss;
+}
+
+double CallSession::videoLossPercent() const
+{
+    double loss = 0.0;
+    for (const Peer *peer : peers) {
+        loss = qMax(loss, peer->videoLossRate);
+    }
+    return loss;
+}
+
+qint64 CallSession::videoFramesReceived() const
+{
+    qint64 frames = 0;
+    for (const Peer *peer : peers) {
+        frames += peer->videoDecoder->decodedFrames();
+    }
+    return frames;
+}
+
+void CallSession::logConnectionQuality()
+{
+    logMessage(statisticsReport());
+}
+
+void CallSession::updateBundleRates(qint64 now)
+{
+    const qint64 elapsedUs = now - bundleWindowStartUs;
+    if (elapsedUs < qint64(BUNDLE_RATE_WINDOW_MS) * 1000) return;
+
+    const PacketBundler::Stats stats = bundler.stats();
+    const double seconds = elapsedUs / 1e6;
+    const qint64 bundles = stats.bundles - bundleWindowStats.bundles;
+    const qint64 bundledPackets = stats.bundledPackets - bundleWindowStats.bundledPackets;
+    const qint64 savedDatagrams = bundledPackets - bundles;
+    bundleRates.packets = bundledPackets / seconds;
+    bundleRates.bundles = bundles / seconds;
+    bundleRates.savedDatagrams = savedDatagrams / seconds;
+    bundleRates.savedBytes = (savedDatagrams * PacketBundler::DatagramOverhead
+                              - (stats.framingBytes - bundleWindowStats.framingBytes))
+                             / seconds;
+    bundleWindowStats = stats;
+    bundleWindowStartUs = now;
+}
+
+QString CallSession::statisticsReport() const
+{
+    const double audioLoss = audioLossPercent();
+    const double videoLoss = videoLossPercent();
+
+    QString quality;
+    if (peers.isEmpty()) {
+        quality = "Нет соединения";
+    }
+    else if (audioLoss < 2.0 && videoLoss < 2.0) {
+        quality = "Качество связи: Отличное";
+    }
+    else if (audioLoss < 5.0 && videoLoss < 5.0) {
+        quality = "Качество связи: Хорошее";
+    }
+    else if (audioLoss < 10.0 && videoLoss < 10.0) {
+        quality = "Качество связи: Среднее";
+    }
+    else {
+        quality = "Качество связи: Плохое";
+    }
+
+    // По участнику: приём его потоков и канал до него
+    const qint64 now = NetworkEngine::monotonicUs();
+    QString peerReports;
+    for (const Peer *peer : peers) {
+        const SenderStatistics &audioSent = peer->streamSending[int(Protocol::MediaStream::Audio)];
+        const SenderStatistics &videoSent = peer->streamSending[int(Protocol::MediaStream::Video)];
+        const CongestionController &congestion = peer->congestionController;
+
+        peerReports += QString("\n%1 (%2) - Потери: аудио %3%, видео %4%"
+                               "\n  Джиттер: %5мс, Буфер: %6/%7мс; декодирование видео: %8мс/кадр, пропущено кадров: %9"
+                               "\n  Оценка канала: %10 кбит/с, дошло %11 кбит/с, потери %12%"
+                               "\n  У получателя: аудио потери %13%, джиттер %14мс; видео потери %15%, джиттер %16мс; RTT %17мс"
+                               "\n  FEC: восстановлено аудио %18, видео %19 пакетов"
+                               "\n  NACK: запрошено %20, восстановлено %21, не успели %22; отправлено повторов %23"
+                               "\n  KEEPALIVE: интервал %24±%25мс, phi %26"
+                               "\n  Путь: датаграмма до %27 байт%28, проб %29, без ответа %30")
+                           .arg(peer->nickname)
+                           .arg(peer->address.toString())
+                           .arg(peer->audioLossRate, 0, 'f', 1)
+                           .arg(peer->videoLossRate, 0, 'f', 1)
+                           .arg(peer->audioJitterBuffer.jitterMs(), 0, 'f', 1)
+                           .arg(peer->audioJitterBuffer.depthMs())
+                           .arg(peer->audioJitterBuffer.targetMs())
+                           .arg(peer->videoDecoder->averageDecodeUs() / 1000.0, 0, 'f', 2)
+                           .arg(peer->videoDecoder->droppedFrames())
+                           .arg(congestion.targetBitrate() / 1000)
+                           .arg(congestion.ackedBitrate() / 1000)
+                           .arg(congestion.lossFraction() * 100.0, 0, 'f', 1)
+                           .arg(audioSent.fractionLost() * 100.0, 0, 'f', 1)
+                           .arg(audioSent.remoteJitterMs(), 0, 'f', 1)
+                           .arg(videoSent.fractionLost() * 100.0, 0, 'f', 1)
+                           .arg(videoSent.remoteJitterMs(), 0, 'f', 1)
+                           .arg(audioSent.hasRtt() ? audioSent.rttMs() : videoSent.rttMs(), 0, 'f', 1)
+                           .arg(peer->fecDecoders[int(Protocol::MediaStream::Audio)].stats().recovered)
+                           .arg(peer->fecDecoders[int(Protocol::MediaStream::Video)].stats().recovered)
+                           .arg(peer->videoNacks.stats().requested)
+                           .arg(peer->videoNacks.stats().recovered)
+                           .arg(peer->videoNacks.stats().expired)
+                           .arg(peer->videoRetransmissions.stats().retransmitted)
+                           .arg(peer->liveness.meanIntervalMs(), 0, 'f', 0)
+                           .arg(peer->liveness.stdDevMs(), 0, 'f', 0)
+                           .arg(peer->liveness.phi(now), 0, 'f', 2)
+                           .arg(peer->pathMtu.datagramLimit())
+                           .arg(peer->pathMtu.isSearching() ? " (поиск)" : "")
+                           .arg(peer->pathMtu.stats().probesSent)
+                           .arg(peer->pathMtu.stats().probesLost);
+    }
+
+    QString impairmentInfo = "выключена";
+    if (impairmentEnabled) {
+        const NetworkImpairment::Stats impairment = network->impairmentStats();
+        impairmentInfo = QString("потеряно %1, сброшено очередью %2, переставлено %3, дублировано %4 из %5; в пути %6")
+                             .arg(impairment.lost)
+                             .arg(impairment.queueDropped)
+                             .arg(impairment.reordered)
+                             .arg(impairment.duplicated)
+                             .arg(impairment.submitted)
+                             .arg(impairment.held);
+    }
+
+    const QString cryptoInfo = encryptMedia ? QString("ChaCha20-Poly1305, отброшено: подделка %1, повтор %2")
+                                                  .arg(forgedPackets)
+                                                  .arg(replayedPackets)
+                                            : QString("выключено");
+
+    const PacketPool::Stats receivePool = network->receivePoolStats();
+    const PacketPool::Stats sendPool = network->sendPoolStats();
+
+    // Очереди отправки: глубина, средняя и пиковая задержка с прошлого вывода
+    static const char *const sendClassNames[] = { "аудио", "управление", "повторы", "видео" };
+    QStringList sendQueues;
+    for (int i = 0; i < int(SendScheduler::Class::Count); ++i) {
+        const SendScheduler::ClassStats stats = network->sendStats(SendScheduler::Class(i));
+        sendQueues << QString("%1 %2 пак. %3/%4мс")
+                          .arg(sendClassNames[i])
+                          .arg(stats.queuedPackets)
+                          .arg(stats.averageDelayMs, 0, 'f', 1)
+                          .arg(stats.peakDelayMs, 0, 'f', 1);
+    }
+
+    return quality + QString("\nУчастников: %1, размер аудиопакета: %2мс, датаграмма до %3 байт, FEC: %4")
+                         .arg(peers.size())
+                         .arg(currentPacketMs)
+                         .arg(datagramLimit)
+                         .arg(Gf256::backendName())
+           + peerReports
+           + QString("\nОчереди отправки (ср./макс. задержка): %1"
+                     "\nСистемные вызовы: отправка %2, приём %3"
+                     "\nПулы пакетов (промахи/всего): приём %4/%5, отправка %6/%7"
+                     "\nИмитация сети: %8"
+                     "\nОбъединение (за %9 с): %10 пак/с в %11 датаграммах/с, экономия %12 датаграмм/с и %13 байт/с"
+                     " заголовков"
+                     "\nШифрование: %14")
+                 .arg(sendQueues.join(", "))
+                 .arg(network->sendCalls())
+                 .arg(network->receiveCalls())
+                 .arg(receivePool.misses)
+                 .arg(receivePool.hits + receivePool.misses)
+                 .arg(sendPool.misses)
+                 .arg(sendPool.hits + sendPool.misses)
+                 .arg(impairmentInfo)
+                 .arg(BUNDLE_RATE_WINDOW_MS / 1000)
+                 .arg(bundleRates.packets, 0, 'f', 1)
+                 .arg(bundleRates.bundles, 0, 'f', 1)
+                 .arg(bundleRates.savedDatagrams, 0, 'f', 1)
+                 .arg(bundleRates.savedBytes, 0, 'f', 0)
+                 .arg(cryptoInfo);
+}
+
+void CallSession::sendAudioData()
+{
+    if (peers.isEmpty() || !audioInputDevice || !audioEncoder) return;
+
+    const int packetSize = audioPacketBytes();
+
+    // Буферы захвата и полезной нагрузки живут между вызовами: после первых
+    // пакетов их ёмкости хватает, и кодирование идёт без выделения памяти
+    audioCaptureBuffer.resize(packetSize);
+
+    while (audioInputDevice->bytesAvailable() >= packetSize) {
+        if (audioInputDevice->read(audioCaptureBuffer.data(), packetSize) != packetSize) {
+            continue;
+        }
+
+        audioPayload.resize(1);
+        audioPayload[0] = char(audioEncoder->id());
+        if (!audioEncoder->encode(audioCaptureBuffer, &audioPayload)) {
+            continue;
+        }
+        audioBytesPerMs = double(audioPayload.size() - 1) / currentPacketMs;
+
+        // Отчёты, которые пора отправить, уедут с этим же пакетом
+        if (reportsDue) sendStreamReports();
+
+        QByteArray packet = makeMediaPacket(
+            makeHeader(Protocol::PacketType::Audio, ++audioSendSequence, audioTimestamp), audioPayload);
+
+        for (Peer *peer : std::as_const(peers)) {
+            peer->streamSending[int(Protocol::MediaStream::Audio)].onPacketSent(int(packet.size()));
+        }
+        sendToPeers(std::move(packet), Protocol::MediaStream::Audio);
+        sendFecParity(Protocol::MediaStream::Audio, audioSendSequence, audioTimestamp, audioPayload);
+
+        audioTimestamp += quint32(packetSize / audioFormat.bytesPerFrame());
+    }
+}
+
+void CallSession::readPendingDatagrams()
+{
+    network->acknowledgePackets();
+
+    // Управляющие пакеты первыми: они могут добавить участника
+    // Обработчики видят пакет только через QByteArrayView, поэтому после
+    // разбора буфер возвращается в пул приёма
+    ReceivedPacket packet;
+    while (network->takePacket(NetworkEngine::Stream::Control, &packet)) {
+        if (openPacket(packet)) dispatchPacket(packet);
+        network->recycle(std::move(packet));
+    }
+    while (network->takePacket(NetworkEngine::Stream::Audio, &packet)) {
+        if (openPacket(packet)) dispatchPacket(packet);
+        network->recycle(std::move(packet));
+    }
+    while (network->takePacket(NetworkEngine::Stream::Video, &packet)) {
+        if (openPacket(packet)) dispatchPacket(packet);
+        network->recycle(std::move(packet));
+    }
+}
+
+bool CallSession::openPacket(ReceivedPacket &packet)
+{
+    // Управляющие пакеты всегда открытым текстом, медиа - как договорено
+    const int index = MediaCrypto::encryptedIndex(packet.header.type);
+    if (index < 0) return !packet.header.encrypted;
+    if (packet.header.encrypted != encryptMedia) return false;
+    if (!encryptMedia) return true;
+
+    // Ключ участника известен после DISCOVER, до него медиа не расшифровать
+    Peer *peer = peers.value(packet.header.peerId);
+    if (!peer || !peer->hasCryptoKey) return false;
+
+    // Окно смотрится до проверки тега, а сдвигается только после неё:
+    // подделка с большим sequence не закроет окно для настоящих пакетов.
+    // Неудачная проверка данные не трогает, поэтому можно попробовать и
+    // ключ кандидата
+    const quint32 sequence = packet.header.sequence;
+    ReplayWindow &window = peer->replayWindows[index];
+    const bool fresh = window.check(sequence);
+    if (fresh && MediaCrypto::open(peer->cryptoKey, packet.datagram.data(), packet.datagram.size())) {
+        window.update(sequence);
+    } else if (peer->hasCandidateKey
+               && MediaCrypto::open(peer->candidateKey, packet.datagram.data(), packet.datagram.size())) {
+        // Участник и правда перезапущен: его sequence начались заново
+        peer->cryptoKey = peer->candidateKey;
+        peer->cryptoInstance = peer->candidateInstance;
+        peer->hasCandidateKey = false;
+        peer->forgeryLogged = false;
+        for (ReplayWindow &stale : peer->replayWindows) {
+            stale.clear();
+        }
+        peer->replayWindows[index].update(sequence);
+    } else {
+        if (!fresh) {
+            ++replayedPackets;
+            return false;
+        }
+        ++forgedPackets;
+        if (!peer->forgeryLogged) {
+            peer->forgeryLogged = true;
+            logMessage("Медиа участника не проходит проверку подлинности (другой пароль?): " + peer->nickname);
+        }
+        return false;
+    }
+    packet.datagram.chop(MediaCrypto::TagSize);
+
+    // При шифровании адрес участника меняет только подлинный пакет:
+    // KEEPALIVE и DISCOVER с чужого адреса подделать ничего не стоит
+    if (peer->address != packet.sender) {
+        peer->address = packet.sender;
+        logMessage("Участник сменил адрес: " + peer->nickname + " (" + packet.sender.toString() + ")");
+    }
+    return true;
+}
+
+void CallSession::dispatchPacket(const ReceivedPacket &packet)
+{
+    // Свои пакеты отсекаются и по идентификаторам, адрес - для обычного
+    // случая, когда на машине один участник. Ретранслятор свои не возвращает.
+    // В группе свои пакеты возвращает петля, а участники на одной машине
+    // делят адрес, поэтому фильтр - по peer id; DISCOVER проходит, по нему
+    // разрешается коллизия идентификаторов
+    if (isMulticast()) {
+        if (packet.header.peerId == localPeerId && packet.header.type != Protocol::PacketType::Discover) return;
+        // Адресные пакеты через группу видят все, чужие отбрасываются
+        if (Protocol::isDirected(packet.header.type) && packet.header.timestamp != localPeerId) return;
+    } else if (!peers.contains(packet.header.peerId)) {
+        // Известный участник уже прошёл проверку, адрес смотрится только у
+        // новых id: свои пакеты (широковещательный DISCOVER) и чужие с этой машины
+        if (packet.header.peerId == localPeerId && packet.header.type != Protocol::PacketType::Discover) return;
+        if (!settings.acceptLocalPeers && !settings.useRelay && isLocalAddress(packet.sender)) return;
+    }
+
+    packetArrivalUs = packet.arrivalUs;
+    (this->*packetHandlers[int(packet.header.type)])(packet.header, packet.payload(), packet.sender);
+
+    // Любой пакет участника - признак, что он жив
+    if (Peer *peer = peers.value(packet.header.peerId)) {
+        peer->liveness.activity(packet.arrivalUs);
+    }
+}
+
+Protocol::DiscoverInfo CallSession::localDiscoverInfo() const
+{
+    Protocol::DiscoverInfo info;
+    info.instanceId = instanceId;
+    info.nickname = nickname;
+    info.audioCodecs = localAudioCodecs;
+
+    // Отдельные медиапорты объявляются, только если они действительно открыты
+    const quint16 controlPort = network->port(NetworkEngine::Stream::Control);
+    const quint16 audioPort = network->port(NetworkEngine::Stream::Audio);
+    const quint16 videoPort = network->port(NetworkEngine::Stream::Video);
+    info.audioPort = audioPort != controlPort ? audioPort : 0;
+    info.videoPort = videoPort != controlPort ? videoPort : 0;
+    info.features = Protocol::FeatureBundle | (encryptMedia ? Protocol::FeatureEncryption : 0);
+    return info;
+}
+
+void CallSession::selectAudioCodec()
+{
+    // Кодер один на всех: кодек, который умеют все участники. Участник,
+    // известный только по KEEPALIVE, свои кодеки ещё не сообщил - его
+    // учитываем после DISCOVER, иначе весь звонок на это время уходил бы в PCM
+    quint8 remoteAudioCodecs = 0xFF;
+    for (const Peer *peer : std::as_const(peers)) {
+        if (peer->instanceId.isNull()) continue;
+        remoteAudioCodecs &= peer->audioCodecs;
+    }
+    const AudioCodecId codec = AudioCodecs::choose(localAudioCodecs, remoteAudioCodecs);
+    if (audioEncoder && audioEncoder->id() == codec) return;
+
+    audioEncoder = AudioCodecs::createEncoder(codec, audioFormat.sampleRate(), audioFormat.channelCount());
+    audioBytesPerMs = 0.0;
+    currentPacketMs = qMin(currentPacketMs, maxAudioPacketMs());
+    logMessage("Аудиокодек: " + AudioCodecs::name(audioEncoder->id()));
+}
+
+AudioDecoder *CallSession::audioDecoderFor(Peer &peer, AudioCodecId codec)
+{
+    std::unique_ptr<AudioDecoder> &decoder = peer.audioDecoders[int(codec)];
+    if (!decoder) {
+        decoder = AudioCodecs::createDecoder(codec, audioFormat.sampleRate(), audioFormat.channelCount());
+    }
+    return decoder.get();
+}
+
+Protocol::PacketHeader CallSession::makeHeader(Protocol::PacketType type, quint32 sequence, quint32 timestamp) const
+{
+    Protocol::PacketHeader header;
+    header.type = type;
+    header.peerId = localPeerId;
+    header.sequence = sequence;
+    header.timestamp = timestamp;
+    return header;
+}
+
+QByteArray CallSession::makeMediaPacket(const Protocol::PacketHeader &header, QByteArrayView payload) const
+{
+    if (!encryptMedia) {
+        QByteArray packet = network->packetBuffer(Protocol::HeaderSize + payload.size());
+        Protocol::writePacket(packet.data(), header, payload);
+        return packet;
+    }
+
+    // Шифруется в том же буфере, тег - в конце; копия одна на всех участников
+    Protocol::PacketHeader sealed = header;
+    sealed.encrypted = true;
+    QByteArray packet = network->packetBuffer(Protocol::HeaderSize + payload.size() + MediaCrypto::TagSize);
+    Protocol::writePacket(packet.data(), sealed, payload);
+    MediaCrypto::seal(sendKey, packet.data(), packet.size());
+    return packet;
+}
+
+bool CallSession::acceptPeer(const QUuid &remoteInstance, quint16 peerId)
+{
+    if (remoteInstance == instanceId) return false;
+
+    // Коллизия коротких идентификаторов: новый выбирает участник с большим UUID
+    if (peerId == localPeerId && instanceId > remoteInstance) {
+        do {
+            localPeerId = quint16(QRandomGenerator::global()->bounded(1, 0x10000));
+        } while (localPeerId == peerId || peers.contains(localPeerId));
+        logMessage(QString("Коллизия идентификатора участника, новый id: %1").arg(localPeerId));
+        QTimer::singleShot(0, this, &CallSession::sendDiscover);
+    }
+    return true;
+}
+
+bool CallSession::cryptoCompatible(const Protocol::DiscoverInfo &info, quint16 peerId, const QHostAddress &address)
+{
+    if (bool(info.features & Protocol::FeatureEncryption) == encryptMedia) {
+        cryptoMismatches.remove(peerId);
+        return true;
+    }
+
+    // Запись, заведённая по KEEPALIVE до DISCOVER, убирается
+    if (peers.contains(peerId)) {
+        removePeer(peerId, "Участник шифрует медиа иначе");
+    }
+    if (cryptoMismatches.value(peerId) != info.instanceId) {
+        cryptoMismatches.insert(peerId, info.instanceId);
+        logMessage(QString("Участник %1 (%2) %3, соединение невозможно")
+                       .arg(info.nickname, address.toString(),
+                            encryptMedia ? "не шифрует медиа" : "шифрует медиа, нужен пароль"));
+    }
+    return false;
+}
+
+CallSession::Peer *CallSession::findOrAddPeer(quint16 peerId, const QHostAddress &address)
+{
+    // Через ретранслятор у всех участников один адрес, в группе адрес
+    // могут делить участники одной машины; там старые записи уходят
+    // только по таймауту
+    const QList<quint16> ids = peers.keys();
+    for (quint16 id : ids) {
+        if (!settings.useRelay && !isMulticast() && id != peerId && peers[id]->address == address) {
+            removePeer(id, "Участник сменил идентификатор");
+        }
+    }
+
+    Peer *peer = peers.value(peerId);
+    if (peer) {
+        // С шифрованием - по подлинному медиапакету, в openPacket()
+        if (!encryptMedia) peer->address = address;
+        return peer;
+    }
+
+    peer = new Peer;
+    peer->id = peerId;
+    peer->address = address;
+    // Ник, кодеки и медиапорты неизвестны до DISCOVER
+    peer->nickname = QString("#%1").arg(peerId);
+    peer->audioJitterBuffer.setFormat(audioFormat.sampleRate(), audioFormat.bytesPerFrame(),
+                                      audioFormat.sampleFormat() == QAudioFormat::Int16
+                                          && audioFormat.channelCount() == 1);
+    peer->streamReception[int(Protocol::MediaStream::Audio)].setClockRate(audioFormat.sampleRate());
+
+    // Декодер в своём потоке на каждого участника: кадры разных участников
+    // не ждут друг друга
+    peer->videoDecoder = std::make_unique<VideoDecoder>();
+    if (remoteVideoSize.isValid()) {
+        peer->videoDecoder->setTargetSize(remoteVideoSize);
+    }
+    connect(peer->videoDecoder.get(), &VideoDecoder::frameReady, this, [this, peerId]() {
+        remoteFrameDecoded(peerId);
+    });
+    peer->videoDecoder->start();
+
+    peers.insert(peerId, peer);
+    videoEncoder->setEncodingEnabled(true);
+    updateVideoBitrate();
+    // Путь до нового участника ещё не проверен
+    updateDatagramLimit();
+    return peer;
+}
+
+void CallSession::updatePeer(Peer *peer, const Protocol::DiscoverInfo &info)
+{
+    // Первый ключ берётся сразу: защищать ещё нечего. Ключ другого
+    // экземпляра ждёт подтверждения медиапакетом, иначе подделанные
+    // DISCOVER сбрасывали бы окна повторов
+    if (encryptMedia) {
+        if (!peer->hasCryptoKey) {
+            peer->cryptoKey = MediaCrypto::senderKey(settings.callKey, info.instanceId);
+            peer->cryptoInstance = info.instanceId;
+            peer->hasCryptoKey = true;
+        } else if (info.instanceId != peer->cryptoInstance
+                   && (!peer->hasCandidateKey || info.instanceId != peer->candidateInstance)) {
+            peer->candidateKey = MediaCrypto::senderKey(settings.callKey, info.instanceId);
+            peer->candidateInstance = info.instanceId;
+            peer->hasCandidateKey = true;
+        }
+    }
+    peer->instanceId = info.instanceId;
+    peer->nickname = info.nickname;
+    peer->audioCodecs = info.audioCodecs;
+    peer->mediaPorts[int(Protocol::MediaStream::Audio)] = info.audioPort;
+    peer->mediaPorts[int(Protocol::MediaStream::Video)] = info.videoPort;
+    peer->features = info.features;
+    selectAudioCodec();
+}
+
+void CallSession::removePeer(quint16 peerId, const QString &reason)
+{
+    Peer *peer = peers.take(peerId);
+    if (!peer) return;
+
+    const QString peerNickname = peer->nickname;
+    delete peer;
+    audioMixer.removeSource(peerId);
+    bundler.remove(peerId);
+    logMessage(reason + ": " + peerNickname);
+    updateDatagramLimit();
+
+    if (peers.isEmpty()) {
+        resetSending();
+    } else {
+        // Ушедший мог ограничивать кодек и битрейт остальных
+        selectAudioCodec();
+        updateVideoBitrate();
+    }
+    logConnectionQuality();
+    emit peerLost(peerId, peerNickname);
+}
+
+void CallSession::processAudioPacket(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    Q_UNUSED(senderAddr);
+    Peer *peer = peers.value(header.peerId);
+    if (!peer) return;
+
+    playAudioPayload(*peer, header.sequence, header.timestamp, payload);
+
+    // Потери считаются по sequence с учётом переупорядочивания (RFC 3550).
+    // Восстановленные FEC пакеты сюда не попадают: RR сообщает потери в сети
+    ReceiverStatistics &reception = peer->streamReception[int(Protocol::MediaStream::Audio)];
+    reception.onPacket(header.sequence, header.timestamp, packetArrivalUs);
+    peer->audioLossRate = reception.lossPercent();
+
+    handleRecoveredPackets(*peer, Protocol::MediaStream::Audio,
+                           peer->fecDecoders[int(Protocol::MediaStream::Audio)].addSource(header.sequence, header.timestamp, payload));
+}
+
+void CallSession::playAudioPayload(Peer &peer, quint32 sequence, quint32 timestamp, QByteArrayView payload)
+{
+    // Первый байт - кодек, которым закодирован пакет
+    if (payload.isEmpty() || quint8(payload.at(0)) >= quint8(AudioCodecId::Count)) return;
+    AudioDecoder *decoder = audioDecoderFor(peer, AudioCodecId(quint8(payload.at(0))));
+    if (!decoder) return;
+
+    // resize(0) сохраняет ёмкость: PCM каждого пакета пишется в тот же буфер
+    decodedAudio.resize(0);
+    if (decoder->decode(payload.sliced(1), &decodedAudio) && !decodedAudio.isEmpty()) {
+        peer.audioJitterBuffer.insert(sequence, timestamp, decodedAudio, mediaClock.elapsed());
+    }
+}
+
+void CallSession::processDiscoverPacket(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    Protocol::DiscoverInfo info;
+    if (!Protocol::readDiscoverPayload(payload, &info)) return;
+
+    if (!acceptPeer(info.instanceId, header.peerId)) return;
+
+    // Ответ уходит и при коллизии id: по нему участник узнаёт, что id надо сменить
+    QByteArray reply = Protocol::makePacket(makeHeader(Protocol::PacketType::DiscoverReply, 0, header.peerId),
+                                            Protocol::makeDiscoverPayload(localDiscoverInfo()));
+    sendDirected(reply, senderAddr);
+    if (header.peerId == localPeerId || !cryptoCompatible(info, header.peerId, senderAddr)) return;
+
+    Peer *peer = findOrAddPeer(header.peerId, senderAddr);
+    const bool announced = peer->instanceId == info.instanceId;
+    updatePeer(peer, info);
+    if (announced) return;
+
+    rememberPeer(*peer);
+    logMessage("Обнаружен участник: " + info.nickname + " (" + senderAddr.toString() + ")");
+    logConnectionQuality();
+    emit peerConnected(peer->id, peer->nickname, peer->address);
+}
+
+void CallSession::processDiscoverReply(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    Protocol::DiscoverInfo info;
+    if (!Protocol::readDiscoverPayload(payload, &info)) return;
+
+    if (!acceptPeer(info.instanceId, header.peerId) || header.peerId == localPeerId) return;
+    if (!cryptoCompatible(info, header.peerId, senderAddr)) return;
+
+    Peer *peer = findOrAddPeer(header.peerId, senderAddr);
+    const bool announced = peer->instanceId == info.instanceId;
+    updatePeer(peer, info);
+    if (announced) return;
+
+    rememberPeer(*peer);
+    logMessage("Подключено к участнику: " + info.nickname + " (" + senderAddr.toString() + ")");
+    logConnectionQuality();
+    emit peerConnected(peer->id, peer->nickname, peer->address);
+}
+
+void CallSession::processKeepAlive(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    Q_UNUSED(payload);
+    if (header.peerId == localPeerId) return;
+
+    Peer *peer = peers.value(header.peerId);
+    if (!peer) {
+        // Несовместимого по шифрованию не заводим заново на каждый KEEPALIVE
+        if (cryptoMismatches.contains(header.peerId)) return;
+        peer = findOrAddPeer(header.peerId, senderAddr);
+
+        // Ник и возможности участник сообщит в ответе на DISCOVER
+        QByteArray discover = Protocol::makePacket(makeHeader(Protocol::PacketType::Discover),
+                                                   Protocol::makeDiscoverPayload(localDiscoverInfo()));
+        sendDirected(discover, senderAddr);
+    }
+    if (!encryptMedia) peer->address = senderAddr;
+    peer->liveness.heartbeat(packetArrivalUs);
+}
+
+void CallSession::processVideoPacket(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    Q_UNUSED(senderAddr);
+    Peer *peer = peers.value(header.peerId);
+    if (!peer) return;
+
+    peer->videoFeedback.onPacketReceived(header.sequence, packetArrivalUs);
+    peer->streamReception[int(Protocol::MediaStream::Video)].onPacket(header.sequence, header.timestamp, packetArrivalUs);
+    peer->videoNacks.onPacket(header.sequence, packetArrivalUs);
+
+    handleVideoFragment(*peer, payload);
+
+    handleRecoveredPackets(*peer, Protocol::MediaStream::Video,
+                           peer->fecDecoders[int(Protocol::MediaStream::Video)].addSource(header.sequence, header.timestamp, payload));
+}
+
+void CallSession::processRetransmission(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    Q_UNUSED(senderAddr);
+    Peer *peer = peers.value(header.peerId);
+    if (!peer) return;
+
+    // Повтор не учитывается в отчётах о канале: они описывают потери в сети
+    peer->videoNacks.onRecovered(header.sequence);
+    handleVideoFragment(*peer, payload);
+
+    handleRecoveredPackets(*peer, Protocol::MediaStream::Video,
+                           peer->fecDecoders[int(Protocol::MediaStream::Video)].addSource(header.sequence, header.timestamp, payload));
+}
+
+void CallSession::handleVideoFragment(Peer &peer, QByteArrayView payload)
+{
+    const bool frameComplete = peer.videoReassembler.addFragment(payload, mediaClock.elapsed(), &peer.videoFrame);
+
+    // Статистика потерь по кадрам: недособранный кадр считается потерянным
+    peer.videoLossRate = peer.videoReassembler.frameLossRate();
+
+    if (!frameComplete) return;
+
+    // Декодирование и масштабирование идут в потоке декодера
+    peer.videoDecoder->submit(peer.videoFrame);
+}
+
+void CallSession::remoteFrameDecoded(quint16 peerId)
+{
+    // Участник мог уйти, пока кадр шёл из потока декодера
+    Peer *peer = peers.value(peerId);
+    if (!peer) return;
+
+    QImage image;
+    if (!peer->videoDecoder->takeFrame(&image)) return;
+
+    emit remoteFrameReady(peerId, image);
+}
+
+void CallSession::processTextMessage(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    Q_UNUSED(senderAddr);
+    const Peer *peer = peers.value(header.peerId);
+    if (!peer) return;
+
+    emit messageReceived(peer->nickname, QString::fromUtf8(payload));
+}
+
+void CallSession::processTransportFeedback(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    Q_UNUSED(senderAddr);
+    Peer *peer = peers.value(header.peerId);
+    if (!peer) return;
+
+    Protocol::TransportFeedback feedback;
+    if (!Protocol::readFeedbackPayload(payload, &feedback)) return;
+
+    peer->congestionController.onFeedback(feedback, NetworkEngine::monotonicUs());
+    if (!peer->congestionController.hasFeedback()) return;
+
+    // Повторы идут сверх оценки канала, поэтому их бюджет - доля от неё
+    peer->videoRetransmissions.setRateLimit(peer->congestionController.targetBitrate() / 4);
+    updateVideoBitrate();
+}
+
+void CallSession::updateVideoBitrate()
+{
+    // Кодер один на всех, поэтому битрейт - по самому слабому каналу.
+    // Участник без отчётов о канале пока не ограничивает остальных
+    qint64 bitrate = -1;
+    for (const Peer *peer : std::as_const(peers)) {
+        if (!peer->congestionController.hasFeedback()) continue;
+        const qint64 target = peer->congestionController.targetBitrate();
+        bitrate = bitrate < 0 ? target : qMin(bitrate, target);
+    }
+
+    // Поток уходит каждому участнику, темп отправки - на всех сразу.
+    // Ретранслятору и группе уходит одна копия
+    const qint64 pacingBitrate = bitrate < 0 ? CongestionController::StartBitrate : bitrate;
+    const qsizetype copies = settings.useRelay || isMulticast() ? 1 : qMax<qsizetype>(1, peers.size());
+    network->setPacingRate(qint64(pacingBitrate * copies * PACING_FACTOR));
+    if (bitrate < 0) return;
+
+    // Часть оценки канала уходит на пакеты чётности видео
+    const double fecOverhead = fecEncoders[int(Protocol::MediaStream::Video)].params().overhead();
+    const qint64 mediaBitrate = qint64(bitrate / (1.0 + fecOverhead));
+
+    if (videoQualityLadder.update(mediaBitrate, mediaClock.elapsed())) {
+        videoEncoder->setSettings(videoQualityLadder.settings());
+
+        const VideoQualityLadder::Step &step = videoQualityLadder.currentStep();
+        logMessage(QString("Видео: %1x%2, качество %3, %4 кадр/с (оценка канала %5 кбит/с)")
+                       .arg(step.resolution.width())
+                       .arg(step.resolution.height())
+                       .arg(step.quality)
+                       .arg(step.fps)
+                       .arg(bitrate / 1000));
+    }
+}
+
+void CallSession::sendTransportFeedback()
+{
+    for (Peer *peer : std::as_const(peers)) {
+        Protocol::TransportFeedback feedback;
+        if (!peer->videoFeedback.takeFeedback(&feedback)) continue;
+
+        QByteArray packet = Protocol::makePacket(
+            makeHeader(Protocol::PacketType::TransportFeedback, ++feedbackSendSequence, peer->id),
+            Protocol::makeFeedbackPayload(feedback));
+        sendDirected(packet, *peer);
+    }
+}
+
+void CallSession::processSenderReport(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    Q_UNUSED(senderAddr);
+    Peer *peer = peers.value(header.peerId);
+    if (!peer) return;
+
+    Protocol::SenderReport report;
+    if (!Protocol::readSenderReportPayload(payload, &report)) return;
+
+    peer->streamReception[int(report.stream)].onSenderReport(report, packetArrivalUs);
+}
+
+void CallSession::processReceiverReport(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    Q_UNUSED(senderAddr);
+    Peer *peer = peers.value(header.peerId);
+    if (!peer) return;
+
+    Protocol::ReceiverReport report;
+    if (!Protocol::readReceiverReportPayload(payload, &report)) return;
+
+    SenderStatistics &sending = peer->streamSending[int(report.stream)];
+    sending.onReceiverReport(report, NetworkEngine::monotonicUs());
+
+    // Чётность общая, поэтому защищает по худшему из получателей
+    double fractionLost = 0.0;
+    double worstRttMs = 0.0;
+    for (const Peer *other : std::as_const(peers)) {
+        const SenderStatistics &stats = other->streamSending[int(report.stream)];
+        fractionLost = qMax(fractionLost, stats.fractionLost());
+        if (stats.hasRtt()) {
+            worstRttMs = qMax(worstRttMs, stats.rttMs());
+        }
+    }
+    fecController.onLossReport(report.stream, fractionLost);
+    if (worstRttMs > 0.0) {
+        fecController.setRttMs(worstRttMs);
+    }
+    updateFecParams();
+
+    if (report.stream == Protocol::MediaStream::Audio) {
+        adaptAudioPacketSize();
+    } else if (sending.hasRtt()) {
+        peer->congestionController.setRttMs(sending.rttMs());
+    }
+}
+
+void CallSession::processFecPacket(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    Q_UNUSED(senderAddr);
+    Peer *peer = peers.value(header.peerId);
+    if (!peer) return;
+
+    Fec::Header fec;
+    if (!Fec::readHeader(payload, &fec)) return;
+
+    handleRecoveredPackets(*peer, fec.stream,
+                           peer->fecDecoders[int(fec.stream)].addParity(fec, payload.sliced(Fec::HeaderSize)));
+}
+
+void CallSession::handleRecoveredPackets(Peer &peer, Protocol::MediaStream stream, const QList<Fec::RecoveredPacket> &packets)
+{
+    for (const Fec::RecoveredPacket &packet : packets) {
+        if (stream == Protocol::MediaStream::Audio) {
+            playAudioPayload(peer, packet.sequence, packet.timestamp, packet.payload);
+        } else {
+            peer.videoNacks.onRecovered(packet.sequence);
+            handleVideoFragment(peer, packet.payload);
+        }
+    }
+}
+
+void CallSession::processNack(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    Q_UNUSED(senderAddr);
+    Peer *peer = peers.value(header.peerId);
+    if (!peer) return;
+
+    Protocol::Nack nack;
+    if (!Protocol::readNackPayload(payload, &nack) || nack.stream != Protocol::MediaStream::Video) return;
+
+    // Повтор уходит только тому, кто его запросил
+    const qint64 now = NetworkEngine::monotonicUs();
+    for (quint32 sequence : std::as_const(nack.sequences)) {
+        quint32 timestamp = 0;
+        QByteArray fragment;
+        if (!peer->videoRetransmissions.retransmit(sequence, now, rttMs(*peer), &timestamp, &fragment)) continue;
+
+        QByteArray packet = makeMediaPacket(
+            makeHeader(Protocol::PacketType::Retransmission, sequence, timestamp), fragment);
+        network->send(std::move(packet), peer->address, mediaPort(*peer, Protocol::MediaStream::Video));
+    }
+}
+
+void CallSession::sendNacks()
+{
+    const qint64 now = NetworkEngine::monotonicUs();
+    for (Peer *peer : std::as_const(peers)) {
+        if (!peer->videoNacks.hasMissing()) continue;
+
+        Protocol::Nack nack;
+        nack.stream = Protocol::MediaStream::Video;
+        nack.sequences = peer->videoNacks.takeNacks(now, rttMs(*peer));
+        if (nack.sequences.isEmpty()) continue;
+
+        QByteArray packet = Protocol::makePacket(
+            makeHeader(Protocol::PacketType::Nack, ++nackSendSequence, peer->id), Protocol::makeNackPayload(nack));
+        sendDirected(packet, peer->address);
+    }
+}
+
+double CallSession::rttMs(const Peer &peer)
+{
+    // RTT одинаков для обоих потоков, берём тот, по которому он уже известен
+    const SenderStatistics &video = peer.streamSending[int(Protocol::MediaStream::Video)];
+    const SenderStatistics &audio = peer.streamSending[int(Protocol::MediaStream::Audio)];
+    if (video.hasRtt()) return video.rttMs();
+    if (audio.hasRtt()) return audio.rttMs();
+    return 50.0;
+}
+
+void CallSession::sendFecParity(Protocol::MediaStream stream, quint32 sequence, quint32 timestamp, QByteArrayView payload)
+{
+    const QList<QByteArray> parities = fecEncoders[int(stream)].addSource(stream, sequence, timestamp, payload);
+    for (const QByteArray &parity : parities) {
+        QByteArray packet = makeMediaPacket(
+            makeHeader(Protocol::PacketType::Fec, ++fecSendSequence, timestamp), parity);
+        sendToPeers(std::move(packet), stream);
+    }
+}
+
+void CallSession::sendToPeers(QByteArray packet, Protocol::MediaStream stream)
+{
+    // Аудио везёт отложенные управляющие пакеты тому же адресату
+    const bool carrier = stream == Protocol::MediaStream::Audio && !bundler.isEmpty();
+
+    // Ретранслятор раздаёт сам, группе раздаёт сеть: одна копия
+    if (settings.useRelay) {
+        if (carrier) packet = bundler.attach(0, std::move(packet), datagramLimit, network->sendPool());
+        network->send(std::move(packet), settings.peerAddress, remotePort);
+        return;
+    }
+    if (isMulticast()) {
+        if (!peers.isEmpty()) {
+            if (carrier) packet = bundler.attach(0, std::move(packet), datagramLimit, network->sendPool());
+            network->send(std::move(packet), settings.multicastGroup, remotePort);
+        }
+        return;
+    }
+
+    qsizetype remaining = peers.size();
+    for (const Peer *peer : std::as_const(peers)) {
+        // Последнему уходит сам буфер: после отправки он вернётся в пул
+        QByteArray datagram = --remaining == 0 ? std::move(packet) : packet;
+        if (carrier) {
+            datagram = bundler.attach(peer->id, std::move(datagram), datagramLimit, network->sendPool());
+        }
+        network->send(std::move(datagram), peer->address, mediaPort(*peer, stream));
+    }
+}
+
+void CallSession::updateFecParams()
+{
+    for (int i = 0; i < int(Protocol::MediaStream::Count); ++i) {
+        const Protocol::MediaStream stream = Protocol::MediaStream(i);
+        const Fec::Params params = fecController.params(stream);
+        if (params == fecEncoders[i].params()) continue;
+
+        fecEncoders[i].setParams(params);
+        const QString name = stream == Protocol::MediaStream::Audio ? "аудио" : "видео";
+        if (!params.enabled()) {
+            logMessage("FEC для " + name + " выключена");
+        } else {
+            logMessage(QString("FEC для %1: %2, %3 + %4 пакетов")
+                           .arg(name)
+                           .arg(params.scheme == Fec::Scheme::Xor ? "XOR" : "Рид-Соломон")
+                           .arg(params.sourceCount)
+                           .arg(params.parityCount));
+        }
+    }
+}
+
+void CallSession::setFecMode(FecController::Mode mode)
+{
+    fecController.setMode(mode);
+    updateFecParams();
+}
+
+bool CallSession::setSeparateMediaPorts(bool enabled)
+{
+    // Сокеты открываются при старте сетевого потока - перезапускаем его
+    network->stop();
+    if (enabled) {
+        network->setMediaPorts(quint16(localPort + AudioPortOffset), quint16(localPort + VideoPortOffset));
+    } else {
+        network->setMediaPorts(0, 0);
+    }
+
+    bool applied = true;
+    if (!network->start()) {
+        logMessage("Ошибка привязки сокета: " + network->errorString());
+        if (!enabled) return false;
+
+        // Медиапорты заняты - возвращаемся к общему сокету
+        network->setMediaPorts(0, 0);
+        if (!network->start()) return false;
+        applied = false;
+    }
+    logMessage("Сетевой поток: " + network->backendName());
+
+    // Участник узнаёт о новых портах из DISCOVER
+    sendDiscover();
+    return applied;
+}
+
+void CallSession::setImpairment(const NetworkImpairment::Config &config)
+{
+    impairmentEnabled = config.enabled;
+    network->setImpairment(config);
+}
+
+void CallSession::sendStreamReports()
+{
+    reportsDue = false;
+    const qint64 now = NetworkEngine::monotonicUs();
+    for (Peer *peer : std::as_const(peers)) {
+        for (int i = 0; i < int(Protocol::MediaStream::Count); ++i) {
+            const Protocol::MediaStream stream = Protocol::MediaStream(i);
+
+            if (peer->streamSending[i].hasSent()) {
+                QByteArray packet = Protocol::makePacket(
+                    makeHeader(Protocol::PacketType::SenderReport, ++reportSendSequence, peer->id),
+                    Protocol::makeSenderReportPayload(peer->streamSending[i].makeReport(stream, now)));
+                sendDirected(packet, *peer);
+            }
+
+            if (peer->streamReception[i].hasPackets()) {
+                QByteArray packet = Protocol::makePacket(
+                    makeHeader(Protocol::PacketType::ReceiverReport, ++reportSendSequence, peer->id),
+                    Protocol::makeReceiverReportPayload(peer->streamReception[i].makeReport(stream, now)));
+                sendDirected(packet, *peer);
+            }
+        }
+    }
+}
+
+void CallSession::adaptAudioPacketSize()
+{
+    // Размер аудиопакета по тому, как поток доходит до получателей: при
+    // большом джиттере или RTT пакеты крупнее, в спокойной сети - мельче
+    // ради меньшей задержки. Пакет общий, поэтому смотрим на худшего
+    double jitterMs = 0.0;
+    double rttMs = 0.0;
+    for (const Peer *peer : std::as_const(peers)) {
+        const SenderStatistics &audio = peer->streamSending[int(Protocol::MediaStream::Audio)];
+        jitterMs = qMax(jitterMs, audio.remoteJitterMs());
+        if (audio.hasRtt()) {
+            rttMs = qMax(rttMs, audio.rttMs());
+        }
+    }
+
+    if ((jitterMs > 20.0 || rttMs > 200.0) && currentPacketMs < MAX_PACKET_MS) {
+        currentPacketMs = qMin(MAX_PACKET_MS, currentPacketMs + 5);
+    }
+    else if (jitterMs < 5.0 && rttMs < 100.0 && currentPacketMs > MIN_PACKET_MS) {
+        currentPacketMs = qMax(MIN_PACKET_MS, currentPacketMs - 5);
+    }
+    currentPacketMs = qMin(currentPacketMs, maxAudioPacketMs());
+}
+
+int CallSession::maxAudioPacketMs() const
+{
+    // До первого пакета - как у PCM: ни один кодек не длиннее
+    const double pcmBytesPerMs = audioFormat.sampleRate() * audioFormat.bytesPerFrame() / 1000.0;
+    const double bytesPerMs = audioBytesPerMs > 0.0 ? audioBytesPerMs : pcmBytesPerMs;
+    if (bytesPerMs <= 0.0) return MAX_PACKET_MS;
+
+    // Байт кодека в начале полезной нагрузки; длительность кратна 5 мс
+    const int fitMs = int((mediaPayloadLimit() - 1) / bytesPerMs) / 5 * 5;
+    return qBound(5, fitMs, MAX_PACKET_MS);
+}
+
+void CallSession::probePathMtu()
+{
+    const qint64 now = NetworkEngine::monotonicUs();
+    for (Peer *peer : std::as_const(peers)) {
+        quint32 probeId = 0;
+        const int size = peer->pathMtu.nextProbe(now, rttMs(*peer), &probeId);
+        if (size == 0) continue;
+
+        // Заполнитель - нули, участнику важна только длина
+        QByteArray probe(size, '\0');
+        Protocol::writeHeader(probe.data(), makeHeader(Protocol::PacketType::MtuProbe, probeId, peer->id));
+        if (!network->sendProbe(probe, peer->address, remotePort)) {
+            logMessage(QString("Пробы пути недоступны, размер датаграммы: %1 байт").arg(datagramLimit));
+            pathMtuTimer->stop();
+            return;
+        }
+    }
+}
+
+void CallSession::updateDatagramLimit()
+{
+    int limit = peers.isEmpty() ? PathMtuProber::MinDatagram : PathMtuProber::MaxDatagram;
+    for (const Peer *peer : std::as_const(peers)) {
+        limit = qMin(limit, peer->pathMtu.datagramLimit());
+    }
+    if (limit == datagramLimit) return;
+
+    datagramLimit = limit;
+    currentPacketMs = qMin(currentPacketMs, maxAudioPacketMs());
+    logMessage(QString("Размер датаграммы: %1 байт").arg(datagramLimit));
+}
+
+void CallSession::processMtuProbe(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    // Дошедшая проба подтверждается сразу, участник ещё может быть не в таблице
+    QByteArray reply = Protocol::makePacket(
+        makeHeader(Protocol::PacketType::MtuProbeReply, header.sequence, header.peerId),
+        Protocol::makeMtuProbeReplyPayload(quint16(Protocol::HeaderSize + payload.size())));
+    sendDirected(reply, senderAddr);
+}
+
+void CallSession::processMtuProbeReply(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    Q_UNUSED(senderAddr);
+    Peer *peer = peers.value(header.peerId);
+    if (!peer) return;
+
+    quint16 size = 0;
+    if (!Protocol::readMtuProbeReplyPayload(payload, &size)) return;
+
+    peer->pathMtu.onReply(header.sequence, size, NetworkEngine::monotonicUs());
+    updateDatagramLimit();
+}
+
+void CallSession::processBundle(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr)
+{
+    // BUNDLE разбирает сетевой движок, сюда приходят только вложенные пакеты
+    Q_UNUSED(header);
+    Q_UNUSED(payload);
+    Q_UNUSED(senderAddr);
+}
+
+void CallSession::sendDiscover()
+{
+    QByteArray data = Protocol::makePacket(makeHeader(Protocol::PacketType::Discover),
+                                           Protocol::makeDiscoverPayload(localDiscoverInfo()));
+
+    // Группа - это и есть звонок: DISCOVER только в неё
+    if (isMulticast()) {
+        network->send(data, settings.multicastGroup, remotePort);
+        return;
+    }
+
+    // Известный адрес участника - без широковещания
+    if (!settings.peerAddress.isNull()) {
+        network->send(data, settings.peerAddress, remotePort);
+        return;
+    }
+
+    network->send(data, QHostAddress::Broadcast, remotePort);
+
+    foreach (const QNetworkInterface &interface, QNetworkInterface::allInterfaces()) {
+        if (interface.flags() & QNetworkInterface::CanBroadcast) {
+            foreach (const QNetworkAddressEntry &entry, interface.addressEntries()) {
+                if (!entry.broadcast().isNull()) {
+                    network->send(data, entry.broadcast(), remotePort);
+                }
+            }
+        }
+    }
+}
+
+void CallSession::startDiscovery()
+{
+    discoveryIntervalMs = DISCOVERY_MIN_MS;
+    discoveryTimer->start(0);
+}
+
+void CallSession::probePeers()
+{
+    QByteArray data = Protocol::makePacket(makeHeader(Protocol::PacketType::Discover),
+                                           Protocol::makeDiscoverPayload(localDiscoverInfo()));
+
+    // Пока никого нет - широковещательный поиск и недавние адреса. Ответ на
+    // адресный DISCOVER приходит за RTT, не дожидаясь широковещания
+    if (peers.isEmpty()) {
+        sendDiscover();
+        if (usesPeerCache()) {
+            for (const PeerCache::Entry &entry : peerCache.entries()) {
+                network->send(data, entry.address, entry.port);
+            }
+        }
+    }
+
+    // Потерянные участники - напрямую, пока не вернутся или не выйдет срок
+    const qint64 now = NetworkEngine::monotonicUs();
+    for (auto it = lostPeers.begin(); it != lostPeers.end();) {
+        if (now - it.value() > qint64(LOST_PEER_PROBE_MS) * 1000) {
+            it = lostPeers.erase(it);
+            continue;
+        }
+        sendDirected(data, it.key());
+        ++it;
+    }
+
+    // Интервал удваивается: быстрый старт без шторма DISCOVER в тихой сети
+    if (peers.isEmpty() || !lostPeers.isEmpty()) {
+        discoveryTimer->start(discoveryIntervalMs);
+        discoveryIntervalMs = qMin(DISCOVERY_MAX_MS, discoveryIntervalMs * 2);
+    }
+}
+
+void CallSession::rememberPeer(const Peer &peer)
+{
+    lostPeers.remove(peer.address);
+    if (!usesPeerCache()) return;
+
+    peerCache.touch(peer.address, remotePort, peer.nickname, QDateTime::currentMSecsSinceEpoch());
+    if (!settings.peerCachePath.isEmpty()) {
+        peerCache.save(settings.peerCachePath);
+    }
+}
+
+void CallSession::sendKeepAlive()
+{
+    // Поиском занят discoveryTimer; новые участники находят звонок своим
+    // DISCOVER, поэтому на связи рассылаются только KEEPALIVE. Их интервалы
+    // - статистика для детектора отказа у получателя
+    if (peers.isEmpty()) return;
+
+    QByteArray data = Protocol::makePacket(
+        makeHeader(Protocol::PacketType::KeepAlive, 0, quint32(mediaClock.elapsed())));
+    sendToAll(data);
+}
+
+bool CallSession::sendMessage(const QString &text)
+{
+    if (peers.isEmpty()) {
+        logMessage("Нет подключения к участнику");
+        return false;
+    }
+
+    QByteArray packet = Protocol::makePacket(makeHeader(Protocol::PacketType::Message), text.toUtf8());
+    sendToAll(packet);
+    return true;
+}
+
+void CallSession::sendToAll(const QByteArray &packet)
+{
+    if (settings.useRelay || isMulticast()) {
+        if (canBundle(0)) {
+            holdForBundle(0, packet);
+        } else {
+            network->send(packet, settings.useRelay ? settings.peerAddress : settings.multicastGroup, remotePort);
+        }
+        return;
+    }
+    for (const Peer *peer : std::as_const(peers)) {
+        if (canBundle(peer->id)) {
+            holdForBundle(peer->id, packet);
+        } else {
+            network->send(packet, peer->address, remotePort);
+        }
+    }
+}
+
+void CallSession::sendDirected(const QByteArray &packet, const QHostAddress &address)
+{
+    // Участники одной машины делят порт управления (SO_REUSEPORT), и ядро
+    // отдало бы пакет любому из них. С петлёй он идёт через группу, а
+    // получатели отбирают свои по peerId адресата
+    if (isMulticast() && settings.multicastLoopback) {
+        network->send(packet, settings.multicastGroup, remotePort);
+    } else {
+        network->send(packet, address, remotePort);
+    }
+}
+
+void CallSession::sendDirected(const QByteArray &packet, const Peer &peer)
+{
+    const quint16 key = bundleKey(peer);
+    if (canBundle(key)) {
+        holdForBundle(key, packet);
+    } else {
+        sendDirected(packet, peer.address);
+    }
+}
+
+bool CallSession::canBundle(quint16 key) const
+{
+    if (key != 0) {
+        const Peer *peer = peers.value(key, nullptr);
+        return peer && (peer->features & Protocol::FeatureBundle);
+    }
+    // Общему адресату - только если разобрать BUNDLE могут все
+    if (peers.isEmpty()) return false;
+    for (const Peer *peer : std::as_const(peers)) {
+        if (!(peer->features & Protocol::FeatureBundle)) return false;
+    }
+    return true;
+}
+
+void CallSession::holdForBundle(quint16 key, const QByteArray &packet)
+{
+    bundler.hold(key, packet);
+    if (!bundleTimer->isActive()) bundleTimer->start(BUNDLE_DELAY_MS);
+}
+
+void CallSession::flushBundles()
+{
+    // Аудио за срок не нашлось: отложенное уходит само, но одной
+    // датаграммой на адресата
+    if (reportsDue) sendStreamReports();
+
+    const QList<quint16> keys = bundler.keys();
+    for (quint16 key : keys) {
+        QHostAddress address;
+        if (key == 0) {
+            address = settings.useRelay ? settings.peerAddress : settings.multicastGroup;
+        } else if (const Peer *peer = peers.value(key, nullptr)) {
+            address = peer->address;
+        } else {
+            bundler.remove(key);
+            continue;
+        }
+        while (bundler.hasPending(key)) {
+            network->send(bundler.take(key, datagramLimit, network->sendPool()), address, remotePort);
+        }
+    }
+}
+
+void CallSession::resetSending()
+{
+    audioEncoder.reset();
+    bundler.clear();
+    audioMixer.clear();
+    fecController.clear();
+    updateFecParams();
+    for (FecEncoder &encoder : fecEncoders) {
+        encoder.clear();
+    }
+
+    // Следующий участник - новый канал: оценка начинается заново
+    videoQualityLadder.reset();
+    videoEncoder->setEncodingEnabled(false);
+    videoEncoder->setSettings(VideoEncoder::Settings());
+    updateVideoBitrate();
+
+    logMessage("Соединение сброшено");
+}
+
+void CallSession::videoFrameEncoded(const QByteArray &imageData, quint32 timestamp)
+{
+    if (peers.isEmpty()) return;
+
+    videoQualityLadder.onFrameEncoded(imageData.size());
+
+    // Кадр режется на фрагменты размером не больше MTU, все с общим timestamp
+    const int maxPayload = mediaPayloadLimit();
+    const int count = VideoFragments::fragmentCount(imageData.size(), maxPayload);
+    if (count == 0) {
+        logMessage(QString("Кадр слишком велик: %1 байт").arg(imageData.size()));
+        return;
+    }
+    ++videoFrameId;
+
+    // Кадр закодирован один раз, участникам уходят одни и те же пакеты;
+    // учёт отправки и буфер повторов у каждого свои. Фрагмент пишется в
+    // один и тот же буфер, пакет и буферы повторов получают его копии
+    for (int i = 0; i < count; ++i) {
+        VideoFragments::writeFragment(imageData, videoFrameId, i, count, maxPayload, &videoFragment);
+        const QByteArrayView fragment = videoFragment;
+        QByteArray packet = makeMediaPacket(
+            makeHeader(Protocol::PacketType::Video, ++videoSendSequence, timestamp), fragment);
+
+        const qint64 now = NetworkEngine::monotonicUs();
+        for (Peer *peer : std::as_const(peers)) {
+            peer->congestionController.onPacketSent(videoSendSequence, int(packet.size()), now);
+            peer->streamSending[int(Protocol::MediaStream::Video)].onPacketSent(int(packet.size()));
+            peer->videoRetransmissions.store(videoSendSequence, timestamp, fragment, now);
+        }
+        sendToPeers(std::move(packet), Protocol::MediaStream::Video);
+        sendFecParity(Protocol::MediaStream::Video, videoSendSequence, timestamp, fragment);
+    }
+}
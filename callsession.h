@@ -0,0 +1,438 @@
+#ifndef CALLSESSION_H
+#define CALLSESSION_H
+
+#include <QObject>
+#include <QAudioFormat>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <QImage>
+#include <QIODevice>
+#include <QMap>
+#include <QPointer>
+#include <QSize>
+#include <QTimer>
+#include <QUuid>
+#include <QVideoFrame>
+#include "protocol.h"
+#include "videofragments.h"
+#include "networkengine.h"
+#include "jitterbuffer.h"
+#include "audiomixer.h"
+#include "audiocodec.h"
+#include "videoencoder.h"
+#include "videodecoder.h"
+#include "congestioncontroller.h"
+#include "streamstats.h"
+#include "fec.h"
+#include "nack.h"
+#include "localaddresses.h"
+#include "failuredetector.h"
+#include "peercache.h"
+#include "pathmtu.h"
+#include "bundler.h"
+#include "mediacrypto.h"
+#include <memory>
+
+// Звонок без привязки к GUI и устройствам.
+//
+// Сессия владеет транспортом (NetworkEngine), поиском участников,
+// кодированием и отправкой аудио и видео, приёмом с джиттер-буфером,
+// FEC, NACK и управлением битрейтом. Источники и приёмники медиа задаёт
+// владелец: PCM читается из любого QIODevice (микрофон, файл, генератор),
+// воспроизведение забирает готовые порции через takePlayoutAudio(), кадры
+// камеры или готовые изображения подаются в submitVideoFrame(),
+// принятые кадры приходят сигналом remoteFrameReady. Поэтому одна и та же
+// сессия работает и под окном чата, и в консольной утилите без дисплея.
+//
+// Участников может быть несколько, таблица ведётся по короткому peer id
+// из заголовка. Приём у каждого свой: sequence, потери, джиттер-буфер,
+// декодеры, FEC и NACK; аудио всех участников сводится в один поток.
+// Отправка общая: кадр и аудиопакет кодируются один раз, и один и тот же
+// буфер уходит каждому участнику. Оценка канала и RTT у каждого свои,
+// кодер подстраивается под самого слабого.
+class CallSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Settings
+    {
+        quint16 localPort = 45454;
+        quint16 remotePort = 45454;       // порт управления участника
+        QHostAddress peerAddress;         // пусто - поиск широковещательным DISCOVER
+        QString nickname;                 // пусто - случайный
+        // Принимать участников с адресов этой машины (несколько сессий на
+        // одном хосте); свои пакеты отсекаются по идентификаторам
+        bool acceptLocalPeers = false;
+        // peerAddress:remotePort - ретранслятор (RelayServer): всё уходит
+        // ему одной копией, участников он раздаёт сам
+        bool useRelay = false;
+        // Групповой режим для одной подсети: всё общее уходит одной копией
+        // на группу:remotePort, адресные пакеты - каждому напрямую. Порт
+        // управления у всех участников должен совпадать (localPort == remotePort)
+        QHostAddress multicastGroup;      // пусто - без группы
+        int multicastTtl = 1;
+        bool multicastLoopback = false;   // нужен нескольким участникам на одной машине
+        // Файл недавних участников для прямого поиска; пусто - только в памяти
+        QString peerCachePath;
+        // Общий ключ шифрования медиа, MediaCrypto::deriveCallKey(пароль);
+        // пусто - медиа открытым текстом. У всех участников должен совпадать
+        QByteArray callKey;
+    };
+
+    static constexpr int AudioPortOffset = 1;
+    static constexpr int VideoPortOffset = 2;
+
+    struct PeerInfo
+    {
+        quint16 id = 0;
+        QString nickname;
+        QHostAddress address;
+        double audioLossPercent = 0.0;
+        double videoLossPercent = 0.0;
+        double rttMs = 0.0;               // 0 - ещё не измерен
+    };
+
+    explicit CallSession(const Settings &settings, QObject *parent = nullptr);
+    ~CallSession();
+
+    bool start();
+    void stop();
+
+    // Формат PCM источника и воспроизведения
+    void setAudioFormat(const QAudioFormat &format);
+    // Источник PCM в audioFormat(); читается по readyRead, nullptr - без аудио
+    void setAudioInput(QIODevice *device);
+    // Очередная порция для воспроизведения, сведённая от всех участников;
+    // пустая, пока джиттер-буферы набираются
+    QByteArray takePlayoutAudio();
+    // Размер аудиопакета в байтах PCM при текущей длительности пакета
+    int audioPacketBytes() const;
+
+    // Потокобезопасно, можно подключать напрямую к QVideoSink::videoFrameChanged
+    void submitVideoFrame(const QVideoFrame &frame) { videoEncoder->submit(frame); }
+    void submitVideoFrame(const QImage &image) { videoEncoder->submit(image); }
+    void setPreviewSize(const QSize &size) { videoEncoder->setPreviewSize(size); }
+    // Размер кадра каждого участника, например ячейки сетки
+    void setRemoteVideoSize(const QSize &size);
+
+    bool sendMessage(const QString &text);
+
+    void setFecMode(FecController::Mode mode);
+    // Отдельные сокеты для аудио и видео; false - порты заняты, остался общий
+    bool setSeparateMediaPorts(bool enabled);
+    void setImpairment(const NetworkImpairment::Config &config);
+
+    bool isConnected() const { return !peers.isEmpty(); }
+    int peerCount() const { return int(peers.size()); }
+    QList<PeerInfo> peerList() const;
+    QString localNickname() const { return nickname; }
+    // Худшие потери среди участников
+    double audioLossPercent() const;
+    double videoLossPercent() const;
+    int audioPacketMs() const { return currentPacketMs; }
+    // Счётчики байт, системных вызовов и пулов
+    NetworkEngine *networkEngine() const { return network; }
+    qint64 videoFramesSent() const { return videoEncoder->encodedFrames(); }
+    qint64 videoFramesReceived() const;
+
+    // Качество связи и состояние всех подсистем, многострочный текст
+    QString statisticsReport() const;
+
+public slots:
+    void sendDiscover();
+
+signals:
+    void logMessage(const QString &message);
+    void peerConnected(quint16 peerId, const QString &nickname, const QHostAddress &address);
+    void peerLost(quint16 peerId, const QString &nickname);
+    void messageReceived(const QString &nickname, const QString &text);
+    void localPreviewReady(const QImage &preview);
+    void remoteFrameReady(quint16 peerId, const QImage &frame);
+
+private slots:
+    void readPendingDatagrams();
+    void sendAudioData();
+    void sendKeepAlive();
+    void videoFrameEncoded(const QByteArray &imageData, quint32 timestamp);
+
+private:
+    // Всё, что относится к одному участнику: адрес и возможности из
+    // DISCOVER, состояние приёма его потоков и канал до него
+    struct Peer
+    {
+        quint16 id = 0;
+        QUuid instanceId;
+        QHostAddress address;
+        QString nickname;
+        quint8 audioCodecs = 0;   // AudioCodecs::maskOf; до DISCOVER неизвестны
+        quint16 mediaPorts[int(Protocol::MediaStream::Count)] = {};   // 0 - remotePort
+        quint8 features = 0;      // Protocol::Feature*
+        FailureDetector liveness;
+
+        // Приём
+        std::unique_ptr<AudioDecoder> audioDecoders[int(AudioCodecId::Count)];
+        AudioJitterBuffer audioJitterBuffer;
+        double audioLossRate = 0.0;
+        VideoReassembler videoReassembler;
+        // Последний собранный кадр; декодер отпускает его быстрее, чем
+        // соберётся следующий, и буфер возвращается сборщику
+        QByteArray videoFrame;
+        std::unique_ptr<VideoDecoder> videoDecoder;
+        double videoLossRate = 0.0;
+        FeedbackCollector videoFeedback;
+        ReceiverStatistics streamReception[int(Protocol::MediaStream::Count)];
+        FecDecoder fecDecoders[int(Protocol::MediaStream::Count)];
+        NackGenerator videoNacks;
+
+        // Отправка: поток общий, канал у каждого свой
+        SenderStatistics streamSending[int(Protocol::MediaStream::Count)];
+        CongestionController congestionController;
+        RetransmissionBuffer videoRetransmissions;
+        PathMtuProber pathMtu;
+
+        // Шифрование: ключ экземпляра cryptoInstance и окна повторов по
+        // типам. DISCOVER не подписан, поэтому ключ другого экземпляра из
+        // него (перезапуск участника или подделка) - только кандидат: он
+        // заменяет текущий, когда под ним пройдёт проверку медиапакет
+        MediaCrypto::Key cryptoKey;
+        QUuid cryptoInstance;
+        bool hasCryptoKey = false;
+        MediaCrypto::Key candidateKey;
+        QUuid candidateInstance;
+        bool hasCandidateKey = false;
+        bool forgeryLogged = false;
+        ReplayWindow replayWindows[MediaCrypto::EncryptedTypeCount];
+    };
+
+    const Settings settings;
+    const quint16 localPort;
+    const quint16 remotePort;
+
+    // Network
+    NetworkEngine *network;
+    LocalAddresses *localAddresses = nullptr;
+    QUuid instanceId;
+    QString nickname;
+    quint16 localPeerId = 0;
+    // Поиск: DISCOVER с нарастающим интервалом, пока никого нет или
+    // недавно потерянные не вернулись; по недавним адресам - напрямую
+    int discoveryIntervalMs = 0;
+    PeerCache peerCache;
+    QHash<QHostAddress, qint64> lostPeers;   // адрес -> когда потерян, мкс
+    // Упорядочены по id, поэтому сетка видео и отчёты не прыгают
+    QMap<quint16, Peer *> peers;
+    quint32 audioSendSequence = 0;
+    quint32 videoSendSequence = 0;
+    quint32 audioTimestamp = 0;
+    QElapsedTimer mediaClock;
+    bool impairmentEnabled = false;
+    // Наибольшая датаграмма, которая без фрагментации доходит до всех
+    // участников: медиа общее, поэтому - по самому узкому пути
+    int datagramLimit = PathMtuProber::MinDatagram;
+
+    // Audio
+    QAudioFormat audioFormat;
+    QPointer<QIODevice> audioInputDevice;
+    // Переиспользуются от пакета к пакету, чтобы отправка не выделяла память
+    QByteArray audioCaptureBuffer;
+    QByteArray audioPayload;
+    // PCM принятого пакета перед копированием в джиттер-буфер участника
+    QByteArray decodedAudio;
+    AudioMixer audioMixer;
+    int currentPacketMs = 40;
+    // Байт кодека на мс звука по последнему пакету; 0 - ещё не кодировали
+    double audioBytesPerMs = 0.0;
+
+    // Кодеки: маски поддерживаемых, кодер для отправки (общий для всех участников)
+    quint8 localAudioCodecs = 0;
+    std::unique_ptr<AudioEncoder> audioEncoder;
+
+    // Video
+    VideoEncoder *videoEncoder = nullptr;
+    QSize remoteVideoSize;
+    quint32 videoFrameId = 0;
+    // Полезная нагрузка очередного фрагмента кадра; из неё копируют пакет,
+    // буфер повторов и FEC
+    QByteArray videoFragment;
+
+    // Управление битрейтом видео: отчёты о приходе пакетов от получателей,
+    // оценки каналов (в Peer) и общая лестница качества у отправителя
+    VideoQualityLadder videoQualityLadder;
+    quint32 feedbackSendSequence = 0;
+    qint64 packetArrivalUs = 0;   // время приема пакета, который сейчас обрабатывается
+
+    // Отчёты SR/RR по каждому потоку
+    quint32 reportSendSequence = 0;
+
+    // FEC по каждому потоку: параметры выбираются по худшим потерям из RR,
+    // чётность считается один раз для всех участников
+    FecController fecController;
+    FecEncoder fecEncoders[int(Protocol::MediaStream::Count)];
+    quint32 fecSendSequence = 0;
+
+    // Повторная отправка потерянных видеопакетов по запросу получателя
+    quint32 nackSendSequence = 0;
+
+    // Мелкие управляющие пакеты ждут попутного аудиопакета в общей
+    // датаграмме. Ключ - id участника, 0 - общий адресат (ретранслятор,
+    // группа). SR/RR собираются при отправке, чтобы ожидание не попало в RTT
+    PacketBundler bundler;
+    bool reportsDue = false;
+    // Объединение за последнее полное окно BUNDLE_RATE_WINDOW_MS: окна
+    // отсчитывает таймер отчётов, statisticsReport() их только читает
+    struct BundleRates
+    {
+        double packets = 0.0;          // пакетов/с попутно
+        double bundles = 0.0;          // датаграмм BUNDLE/с
+        double savedDatagrams = 0.0;   // датаграмм/с сбережено
+        double savedBytes = 0.0;       // байт/с заголовков IP/UDP за вычетом своих
+    };
+    BundleRates bundleRates;
+    PacketBundler::Stats bundleWindowStats;
+    qint64 bundleWindowStartUs = 0;
+
+    // Шифрование медиа: свой ключ отправки и отброшенное на приёме.
+    // Участники с другим режимом шифрования не добавляются: id -> экземпляр,
+    // о котором уже сообщено
+    const bool encryptMedia;
+    MediaCrypto::Key sendKey;
+    qint64 forgedPackets = 0;
+    qint64 replayedPackets = 0;
+    QHash<quint16, QUuid> cryptoMismatches;
+
+    // Timers
+    QTimer *connectionTimer;
+    QTimer *keepAliveTimer;
+    QTimer *discoveryTimer;
+    QTimer *feedbackTimer;
+    QTimer *reportTimer;
+    QTimer *nackTimer;
+    QTimer *pathMtuTimer;
+    QTimer *bundleTimer;
+
+    const int KEEPALIVE_MS = 500;
+    const int DISCOVERY_MIN_MS = 50;
+    const int DISCOVERY_MAX_MS = 2000;
+    const int LOST_PEER_PROBE_MS = 30000;
+    const int MIN_PACKET_MS = 20;
+    const int MAX_PACKET_MS = 60;
+    const int BUNDLE_DELAY_MS = 20;
+    const int BUNDLE_RATE_WINDOW_MS = 5000;
+
+    void setupTimers();
+    // Поиск заново с коротким интервалом: старт или потеря участника
+    void startDiscovery();
+    void probePeers();
+    // Кэш недавних участников - только при поиске широковещанием
+    bool usesPeerCache() const { return !settings.useRelay && !isMulticast() && settings.peerAddress.isNull(); }
+    void rememberPeer(const Peer &peer);
+    void logConnectionQuality();
+    void updateBundleRates(qint64 now);
+
+    void processAudioPacket(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+    void processDiscoverPacket(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+    void processDiscoverReply(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+    void processKeepAlive(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+    void processVideoPacket(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+    void processTextMessage(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+    void processTransportFeedback(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+    void processSenderReport(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+    void processReceiverReport(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+    void processFecPacket(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+    void processNack(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+    void processRetransmission(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+    void processMtuProbe(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+    void processMtuProbeReply(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+    void processBundle(const Protocol::PacketHeader &header, QByteArrayView payload, const QHostAddress &senderAddr);
+
+    // Таблица обработчиков, индекс - Protocol::PacketType
+    using PacketHandler = void (CallSession::*)(const Protocol::PacketHeader &, QByteArrayView, const QHostAddress &);
+    static constexpr PacketHandler packetHandlers[Protocol::TypeCount] = {
+        &CallSession::processAudioPacket,
+        &CallSession::processVideoPacket,
+        &CallSession::processDiscoverPacket,
+        &CallSession::processDiscoverReply,
+        &CallSession::processKeepAlive,
+        &CallSession::processTextMessage,
+        &CallSession::processTransportFeedback,
+        &CallSession::processSenderReport,
+        &CallSession::processReceiverReport,
+        &CallSession::processFecPacket,
+        &CallSession::processNack,
+        &CallSession::processRetransmission,
+        &CallSession::processMtuProbe,
+        &CallSession::processMtuProbeReply,
+        &CallSession::processBundle,
+    };
+
+    // Медиапакет расшифровывается на месте; false - пакет отброшен
+    bool openPacket(ReceivedPacket &packet);
+    void dispatchPacket(const ReceivedPacket &packet);
+    Protocol::DiscoverInfo localDiscoverInfo() const;
+    void selectAudioCodec();
+    AudioDecoder *audioDecoderFor(Peer &peer, AudioCodecId codec);
+    Protocol::PacketHeader makeHeader(Protocol::PacketType type, quint32 sequence = 0, quint32 timestamp = 0) const;
+    // Медиапакет в буфере из пула сетевого движка
+    QByteArray makeMediaPacket(const Protocol::PacketHeader &header, QByteArrayView payload) const;
+    bool acceptPeer(const QUuid &remoteInstance, quint16 peerId);
+    // Шифрует ли участник медиа так же, как мы; о несовпадении - одна запись
+    bool cryptoCompatible(const Protocol::DiscoverInfo &info, quint16 peerId, const QHostAddress &address);
+    // Участник с этим id, новый заводится; прежняя запись с того же адреса
+    // под другим id (перезапуск, смена id после коллизии) удаляется
+    Peer *findOrAddPeer(quint16 peerId, const QHostAddress &address);
+    void updatePeer(Peer *peer, const Protocol::DiscoverInfo &info);
+    void removePeer(quint16 peerId, const QString &reason);
+    void remoteFrameDecoded(quint16 peerId);
+
+    void sendTransportFeedback();
+    void sendStreamReports();
+    void sendNacks();
+    static double rttMs(const Peer &peer);
+    void playAudioPayload(Peer &peer, quint32 sequence, quint32 timestamp, QByteArrayView payload);
+    void handleVideoFragment(Peer &peer, QByteArrayView payload);
+    void handleRecoveredPackets(Peer &peer, Protocol::MediaStream stream, const QList<Fec::RecoveredPacket> &packets);
+    void sendFecParity(Protocol::MediaStream stream, quint32 sequence, quint32 timestamp, QByteArrayView payload);
+    // Один буфер всем участникам: копии QByteArray разделяют данные
+    void sendToPeers(QByteArray packet, Protocol::MediaStream stream);
+    // Управляющий пакет всем участникам
+    void sendToAll(const QByteArray &packet);
+    // Управляющий пакет одному участнику
+    void sendDirected(const QByteArray &packet, const QHostAddress &address);
+    // То же с объединением, если участник принимает BUNDLE
+    void sendDirected(const QByteArray &packet, const Peer &peer);
+    quint16 bundleKey(const Peer &peer) const
+    {
+        return settings.useRelay || (isMulticast() && settings.multicastLoopback) ? 0 : peer.id;
+    }
+    bool canBundle(quint16 key) const;
+    // Пакет ждёт попутного аудио, но не дольше BUNDLE_DELAY_MS
+    void holdForBundle(quint16 key, const QByteArray &packet);
+    void flushBundles();
+    void updateFecParams();
+    void updateVideoBitrate();
+    bool isMulticast() const { return !settings.multicastGroup.isNull(); }
+    quint16 mediaPort(const Peer &peer, Protocol::MediaStream stream) const
+    {
+        if (settings.useRelay) return remotePort;
+        return peer.mediaPorts[int(stream)] != 0 ? peer.mediaPorts[int(stream)] : remotePort;
+    }
+    void adaptAudioPacketSize();
+    void probePathMtu();
+    void updateDatagramLimit();
+    // Полезная нагрузка медиапакета: чётность FEC длиннее источника на свои
+    // заголовки, и она тоже должна пройти без фрагментации
+    int mediaPayloadLimit() const
+    {
+        return datagramLimit - Protocol::HeaderSize - Fec::HeaderSize - Fec::BlockHeaderSize
+               - (encryptMedia ? MediaCrypto::TagSize : 0);
+    }
+    // Самый длинный аудиопакет, который умещается в mediaPayloadLimit()
+    int maxAudioPacketMs() const;
+    // Последний участник ушёл: отправка начинается с чистого листа
+    void resetSending();
+    bool isLocalAddress(const QHostAddress &address) const { return localAddresses->contains(address); }
+};
+
+#endif // CALLSESSION_H
@@ -2,56 +2,63 @@
 #include "ui_chatwindow.h"
 #include <QMediaDevices>
 #include <QVideoFrame>
-#include <QUuid>
-#include <QRandomGenerator>
-#include <QNetworkInterface>
 #include <QMessageBox>
 #include <QDateTime>
-#include <QBuffer>
 #include <QElapsedTimer>
-
-// Константы для аудио
-const int MIN_PACKET_MS = 20;
-const int MAX_PACKET_MS = 60;
-const int TARGET_QUEUE_SIZE = 3;
+#include <QPainter>
+#include <QStandardPaths>
+#include <QtMath>
 
 ChatWindow::ChatWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::ChatWindow)
-    , currentPacketMs(40)
-    , packetLossRate(0.0)
-    , totalPackets(0)
-    , lostPackets(0)
-    , lastSequence(-1)
-    , videoTotalPackets(0)
-    , videoLostPackets(0)
-    , videoPacketLossRate(0.0)
-    , lastVideoSequence(-1)
 {
     ui->setupUi(this);
     setWindowTitle("VladioChat");
 
     connect(ui->BufferCheckBox, &QCheckBox::stateChanged, this, &ChatWindow::on_BufferCheckBox_stateChanged);
-
-    // Инициализация
-    instanceId = QUuid::createUuid().toString();
-    localNickname = "User_" + QString::number(QRandomGenerator::global()->bounded(1000));
-
-    // Настройка сети
-    udpSocket = new QUdpSocket(this);
-    if (!udpSocket->bind(localPort, QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint)) {
-        logMessage("Ошибка привязки сокета: " + udpSocket->errorString());
-    }
-
-    // Настройка таймеров
-    setupTimers();
+    connect(ui->fecModeComboBox, &QComboBox::currentIndexChanged, this, &ChatWindow::on_fecModeComboBox_currentIndexChanged);
+    connect(ui->separatePortsCheckBox, &QCheckBox::toggled, this, &ChatWindow::on_separatePortsCheckBox_toggled);
+
+    // Любое изменение настроек имитации сети применяется сразу
+    connect(ui->impairmentGroup, &QGroupBox::toggled, this, &ChatWindow::applyImpairment);
+    for (QDoubleSpinBox *spinBox : { ui->impairmentLossSpinBox, ui->impairmentBurstSpinBox,
+                                     ui->impairmentBurstLengthSpinBox, ui->impairmentReorderSpinBox,
+                                     ui->impairmentDuplicateSpinBox }) {
+        connect(spinBox, &QDoubleSpinBox::valueChanged, this, &ChatWindow::applyImpairment);
+    }
+    for (QSpinBox *spinBox : { ui->impairmentDelaySpinBox, ui->impairmentJitterSpinBox,
+                               ui->impairmentRateSpinBox, ui->impairmentQueueSpinBox,
+                               ui->impairmentSeedSpinBox }) {
+        connect(spinBox, &QSpinBox::valueChanged, this, &ChatWindow::applyImpairment);
+    }
+    connect(ui->impairmentDistributionComboBox, &QComboBox::currentIndexChanged, this, &ChatWindow::applyImpairment);
+
+    // Звонок
+    CallSession::Settings settings;
+    settings.localPort = quint16(localPort);
+    settings.remotePort = quint16(remotePort);
+    settings.peerCachePath = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/peers.json";
+    // Пароль звонка из окружения; без него медиа не шифруется
+    settings.callKey = MediaCrypto::deriveCallKey(qEnvironmentVariable("VLADIO_PASSPHRASE"));
+    session = new CallSession(settings, this);
+    connect(session, &CallSession::logMessage, this, &ChatWindow::logMessage);
+    connect(session, &CallSession::localPreviewReady, this, &ChatWindow::localPreviewReady);
+    connect(session, &CallSession::remoteFrameReady, this, &ChatWindow::remoteFrameReady);
+    connect(session, &CallSession::peerLost, this, &ChatWindow::peerLost);
+    connect(session, &CallSession::messageReceived, this, &ChatWindow::messageReceived);
+    session->setRemoteVideoSize(ui->remoteVideoLabel->size());
+
+    // Воспроизведение из джиттер-буфера
+    QTimer *audioPlayoutTimer = new QTimer(this);
+    audioPlayoutTimer->setTimerType(Qt::PreciseTimer);
+    connect(audioPlayoutTimer, &QTimer::timeout, this, &ChatWindow::playoutAudio);
+    audioPlayoutTimer->start(10);
 
     // Настройка аудио/видео
     setupAudioVideo();
 
-    logMessage("Система готова. Ваш ник: " + localNickname);
-    logConnectionQuality();
-    QTimer::singleShot(1000, this, &ChatWindow::sendDiscover);
+    session->start();
 
     connect(ui->applyBufferButton, &QPushButton::clicked,
             this, &ChatWindow::on_applyBufferButton_clicked);
@@ -71,6 +78,7 @@ ChatWindow::~ChatWindow()
         camera->stop();
         delete camera;
     }
+    session->stop();
     videoTimer.stop();
     delete ui;
 }
@@ -132,8 +140,8 @@ void ChatWindow::updateBitrateChart()
     if (elapsed == 0) return;
 
     // Получаем текущие значения
-    qint64 currentSent = totalBytesSent;
-    qint64 currentReceived = totalBytesReceived;
+    qint64 currentSent = session->networkEngine()->bytesSent();
+    qint64 currentReceived = session->networkEngine()->bytesReceived();
 
     // Рассчитываем битрейт (Мбит/с)
     qreal bitsSent = (currentSent - lastUpdateBytesSent) * 8;  // Байты → биты
@@ -210,51 +218,17 @@ void ChatWindow::on_applyBufferButton_clicked()
     }
 }
 
-void ChatWindow::logConnectionQuality()
-{
-    QString quality;
-    if (!isRemotePeerFound) {
-        quality = "Нет соединения";
-    }
-    else if (packetLossRate < 2.0 && videoPacketLossRate < 2.0) {
-        quality = "Качество связи: Отличное";
-    }
-    else if (packetLossRate < 5.0 && videoPacketLossRate < 5.0) {
-        quality = "Качество связи: Хорошее";
-    }
-    else if (packetLossRate < 10.0 && videoPacketLossRate < 10.0) {
-        quality = "Качество связи: Среднее";
-    }
-    else {
-        quality = "Качество связи: Плохое";
-    }
-
-    logMessage(quality + QString("\nАудио - Потери: %1%, Размер пакета: %2мс\nВидео - Потери: %3%")
-                             .arg(packetLossRate, 0, 'f', 1)
-                             .arg(currentPacketMs)
-                             .arg(videoPacketLossRate, 0, 'f', 1));
-}
-
-void ChatWindow::checkAudioTiming()
+void ChatWindow::playoutAudio()
 {
-    if (!audioTimer.isValid()) {
-        audioTimer.start();
-        return;
-    }
-
-    if (audioTimer.elapsed() > 2000) {
-        QMutexLocker locker(&audioMutex);
-        int currentSize = audioQueue.size();
+    if (!audioOutput || !audioOutputDevice) return;
 
-        if (currentSize < TARGET_QUEUE_SIZE && currentPacketMs > MIN_PACKET_MS) {
-            currentPacketMs = qMax(MIN_PACKET_MS, currentPacketMs - 5);
-        }
-        else if (currentSize > TARGET_QUEUE_SIZE * 1.5 && currentPacketMs < MAX_PACKET_MS) {
-            currentPacketMs = qMin(MAX_PACKET_MS, currentPacketMs + 5);
-        }
-
-        audioTimer.restart();
-        logConnectionQuality();
+    // В устройстве держим около одного пакета, остальная задержка - в джиттер-буфере,
+    // где её можно подстраивать
+    const int sinkTarget = session->audioPacketBytes();
+    while (audioOutput->bufferSize() - audioOutput->bytesFree() < sinkTarget) {
+        const QByteArray chunk = session->takePlayoutAudio();
+        if (chunk.isEmpty()) break;
+        audioOutputDevice->write(chunk);
     }
 }
 
@@ -264,54 +238,15 @@ void ChatWindow::on_BufferCheckBox_stateChanged(int state)
 
 
     if (!BufferingEnabled) {
-        // Очищаем оба буфера при отключении
+        // Очищаем буфер при отключении
         QMutexLocker videoLocker(&videoMutex);
         videoBuffer.clear();
-
-        QMutexLocker audioLocker(&audioMutex);
-        audioQueue.clear();
     }
 
     logMessage(QString("Буферизация %1")
                    .arg(BufferingEnabled ? "включена" : "отключена"));
 }
 
-void ChatWindow::updatePacketLossStats()
-{
-    if (totalPackets > 0) {
-        packetLossRate = (double)lostPackets / (totalPackets + lostPackets) * 100.0;
-        logConnectionQuality();
-    }
-}
-
-int ChatWindow::calculateAudioPacketSize() const
-{
-    return (audioFormat.sampleRate() * audioFormat.bytesPerFrame() * currentPacketMs) / 1000;
-}
-
-void ChatWindow::setupTimers()
-{
-    connectionTimer = new QTimer(this);
-    connect(connectionTimer, &QTimer::timeout, this, [this](){
-        if (isRemotePeerFound && ++missedPings > MAX_MISSED_PINGS) {
-            logMessage("Таймаут соединения с " + remoteNickname);
-            resetConnection();
-        }
-    });
-    connectionTimer->start(5000);
-
-    keepAliveTimer = new QTimer(this);
-    connect(keepAliveTimer, &QTimer::timeout, this, &ChatWindow::sendKeepAlive);
-    keepAliveTimer->start(2000);
-
-    // Таймер для проверки аудио буфера
-    QTimer *audioCheckTimer = new QTimer(this);
-    connect(audioCheckTimer, &QTimer::timeout, this, &ChatWindow::checkAudioTiming);
-    audioCheckTimer->start(500);
-
-    connect(udpSocket, &QUdpSocket::readyRead, this, &ChatWindow::readPendingDatagrams);
-}
-
 void ChatWindow::setupAudioVideo()
 {
     initAudioDevices();
@@ -353,13 +288,13 @@ void ChatWindow::initAudioDevices()
         logMessage("Корректировка выходного формата");
     }
 
-    audioBufferSize = calculateAudioPacketSize();
+    session->setAudioFormat(audioFormat);
+    audioBufferSize = session->audioPacketBytes();
 
-    // Инициализация входа
+    // Инициализация входа: звонок читает захваченный PCM сам
     audioInput = new QAudioSource(inputDevice, audioFormat, this);
     audioInput->setBufferSize(audioBufferSize * 3);
-    audioInputDevice = audioInput->start();
-    connect(audioInputDevice, &QIODevice::readyRead, this, &ChatWindow::sendAudioData);
+    session->setAudioInput(audioInput->start());
 
     // Инициализация выхода
     audioOutput = new QAudioSink(outputDevice, audioFormat, this);
@@ -377,7 +312,10 @@ void ChatWindow::initVideoDevices()
 
         videoSink = new QVideoSink(this);
         captureSession->setVideoOutput(videoSink);
-        connect(videoSink, &QVideoSink::videoFrameChanged, this, &ChatWindow::videoFrameReady);
+        // Кадры уходят в кодер прямо из потока камеры, минуя GUI
+        session->setPreviewSize(ui->localVideoLabel->size());
+        connect(videoSink, &QVideoSink::videoFrameChanged,
+                session, qOverload<const QVideoFrame &>(&CallSession::submitVideoFrame), Qt::DirectConnection);
 
         camera->start();
     } else {
@@ -387,6 +325,7 @@ void ChatWindow::initVideoDevices()
 
 void ChatWindow::cleanupAudio()
 {
+    session->setAudioInput(nullptr);
     if (audioInput) {
         audioInput->stop();
         delete audioInput;
@@ -397,279 +336,121 @@ void ChatWindow::cleanupAudio()
         delete audioOutput;
         audioOutput = nullptr;
     }
-    audioInputDevice = nullptr;
     audioOutputDevice = nullptr;
 }
 
-void ChatWindow::sendAudioData()
+void ChatWindow::processBufferedVideo()
 {
-    if (!isRemotePeerFound || !audioInputDevice) return;
-
-    const int packetSize = calculateAudioPacketSize();
+    if (videoBuffer.isEmpty()) return;
 
-    while (audioInputDevice->bytesAvailable() >= packetSize) {
-        QByteArray audioData = audioInputDevice->read(packetSize);
-        if (audioData.isEmpty() || audioData.size() != packetSize) {
-            continue;
-        }
+    // Берем самый старый кадр из буфера
+    QImage image = videoBuffer.dequeue();
 
-        QByteArray packet;
-        QDataStream stream(&packet, QIODevice::WriteOnly);
-        stream << QString("AUDIO") << instanceId << localNickname << ++lastSequence << audioData;
+    // Отображаем кадр, он уже декодирован под размер окна
+    ui->remoteVideoLabel->setPixmap(QPixmap::fromImage(image));
 
-        qint64 bytesSent = udpSocket->writeDatagram(packet, remoteAddress, remotePort);
-        if (bytesSent != -1) {
-            totalBytesSent += bytesSent;
-        }
+    // Если в буфере остались кадры, планируем следующий
+    if (!videoBuffer.isEmpty()) {
+        QTimer::singleShot(100, this, &ChatWindow::processBufferedVideo); // ~30 FPS
     }
 }
 
-void ChatWindow::readPendingDatagrams()
+QSize ChatWindow::videoGridCell() const
 {
-    while (udpSocket->hasPendingDatagrams()) {
-        QNetworkDatagram datagram = udpSocket->receiveDatagram();
-        totalBytesReceived += datagram.data().size();
-        if (!datagram.isValid() || isLocalAddress(datagram.senderAddress())) {
-            continue;
-        }
-
-        QByteArray data = datagram.data();
-        QDataStream stream(data);
-        QString msgType;
-        stream >> msgType;
-
-        if (msgType == "AUDIO") {
-            processAudioPacket(stream);
-        }
-        else if (msgType == "DISCOVER") {
-            processDiscoverPacket(stream, datagram.senderAddress());
-        }
-        else if (msgType == "DISCOVER_REPLY") {
-            processDiscoverReply(stream, datagram.senderAddress());
-        }
-        else if (msgType == "KEEPALIVE") {
-            processKeepAlive(stream, datagram.senderAddress());
-        }
-        else if (msgType == "VIDEO") {
-            processVideoPacket(stream);
-        }
-        else if (msgType == "MSG") {
-            processTextMessage(stream);
-        }
-    }
+    // Сетка почти квадратная: 2 участника - 2x1, 3-4 - 2x2, 5-6 - 3x2
+    const int count = qMax(1, int(remoteFrames.size()));
+    const int columns = qCeil(qSqrt(count));
+    const int rows = (count + columns - 1) / columns;
+    const QSize area = ui->remoteVideoLabel->size();
+    return QSize(area.width() / columns, area.height() / rows);
 }
 
-void ChatWindow::processAudioPacket(QDataStream &stream)
+QImage ChatWindow::composeVideoGrid() const
 {
-    QString id, name;
-    qint64 sequence;
-    QByteArray audioData;
-    stream >> id >> name >> sequence >> audioData;
-
-    if (id == instanceId) return;
-
-    static int initialPackets = 0;
-    if (initialPackets < 5) {
-        initialPackets++;
-        lastSequence = sequence;
-        return;
-    }
+    // Один участник - кадр как есть, без лишнего копирования
+    if (remoteFrames.size() == 1) return remoteFrames.first();
 
-    totalPackets++;
+    const QSize cell = videoGridCell();
+    const int columns = qMax(1, ui->remoteVideoLabel->width() / qMax(1, cell.width()));
+    QImage grid(ui->remoteVideoLabel->size(), QImage::Format_RGB32);
+    grid.fill(Qt::black);
 
-    if (lastSequence == -1) {
-        lastSequence = sequence;
-        return;
-    }
-
-    // Подсчет потерь только если sequence > lastSequence
-    if (sequence > lastSequence) {
-        lostPackets += qMax(0LL, sequence - lastSequence - 1);
-        lastSequence = sequence;
+    QPainter painter(&grid);
+    int index = 0;
+    for (auto it = remoteFrames.cbegin(); it != remoteFrames.cend(); ++it, ++index) {
+        // Кадры уже декодированы под ячейку; крупнее бывают только сразу после смены сетки
+        QImage frame = it.value();
+        if (frame.width() > cell.width() || frame.height() > cell.height()) {
+            frame = frame.scaled(cell, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        }
+        const QPoint origin((index % columns) * cell.width(), (index / columns) * cell.height());
+        painter.drawImage(origin + QPoint((cell.width() - frame.width()) / 2,
+                                          (cell.height() - frame.height()) / 2),
+                          frame);
     }
+    return grid;
+}
 
-    // Обновляем статистику потерь
-    packetLossRate = (totalPackets > 0) ?
-                         (double)lostPackets / (totalPackets + lostPackets) * 100.0 : 0.0;
+void ChatWindow::remoteFrameReady(quint16 peerId, const QImage &frame)
+{
+    remoteFrames.insert(peerId, frame);
 
-    if (!audioOutputDevice) return;
+    // Следующие кадры декодируются под ячейку сетки при текущем размере окна
+    session->setRemoteVideoSize(videoGridCell());
+    const QImage image = composeVideoGrid();
 
     if (BufferingEnabled) {
-        QMutexLocker locker(&audioMutex);
-        audioQueue.enqueue(audioData);
-        while (audioQueue.size() > TARGET_QUEUE_SIZE * 2) {
-            audioQueue.dequeue();
+        QMutexLocker locker(&videoMutex);
+        videoBuffer.enqueue(image);
+        while (videoBuffer.size() > maxBufferSize) {
+            videoBuffer.dequeue();
         }
-        if (audioQueue.size() >= TARGET_QUEUE_SIZE) {
-            audioOutputDevice->write(audioQueue.dequeue());
+        if (videoBuffer.size() >= maxBufferSize) {
+            processBufferedVideo();
         }
     } else {
-        audioOutputDevice->write(audioData);
+        ui->remoteVideoLabel->setPixmap(QPixmap::fromImage(image));
     }
 }
 
-void ChatWindow::processDiscoverPacket(QDataStream &stream, const QHostAddress &senderAddr)
+void ChatWindow::messageReceived(const QString &nickname, const QString &text)
 {
-    QString id, name;
-    stream >> id >> name;
-
-    if (id == instanceId) return;
-
-    QByteArray reply;
-    QDataStream replyStream(&reply, QIODevice::WriteOnly);
-    replyStream << QString("DISCOVER_REPLY") << instanceId << localNickname;
-    udpSocket->writeDatagram(reply, senderAddr, remotePort);
-
-    remoteAddress = senderAddr;
-    remoteNickname = name;
-    isRemotePeerFound = true;
-    missedPings = 0;
-    logMessage("Обнаружен участник: " + name + " (" + senderAddr.toString() + ")");
-    logConnectionQuality();
+    ui->chatArea->append("<b>" + nickname + ":</b> " + text);
 }
 
-void ChatWindow::processDiscoverReply(QDataStream &stream, const QHostAddress &senderAddr)
+void ChatWindow::on_separatePortsCheckBox_toggled(bool checked)
 {
-    QString id, name;
-    stream >> id >> name;
-
-    if (id == instanceId) return;
-
-    remoteAddress = senderAddr;
-    remoteNickname = name;
-    isRemotePeerFound = true;
-    missedPings = 0;
-    logMessage("Подключено к участнику: " + name + " (" + senderAddr.toString() + ")");
-    logConnectionQuality();
-}
-
-void ChatWindow::processKeepAlive(QDataStream &stream, const QHostAddress &senderAddr)
-{
-    QString id, name;
-    qint64 timestamp;
-    stream >> id >> name >> timestamp;
-
-    // Рассчитываем сетевую задержку
-    qint64 delay = QDateTime::currentMSecsSinceEpoch() - timestamp;
-
-    // Адаптируем размер пакета на основе задержки
-    if (delay > 100 && currentPacketMs < MAX_PACKET_MS) {
-        currentPacketMs = qMin(MAX_PACKET_MS, currentPacketMs + 5);
-    }
-    else if (delay < 50 && currentPacketMs > MIN_PACKET_MS) {
-        currentPacketMs = qMax(MIN_PACKET_MS, currentPacketMs - 5);
-    }
-
-    missedPings = 0;
-    if (!isRemotePeerFound || remoteAddress != senderAddr) {
-        remoteAddress = senderAddr;
-        remoteNickname = name;
-        isRemotePeerFound = true;
-    }
-}
-
-void ChatWindow::processBufferedVideo()
-{
-    if (videoBuffer.isEmpty()) return;
-
-    // Берем самый старый кадр из буфера
-    QImage image = videoBuffer.dequeue();
-
-    // Отображаем кадр
-    QPixmap pixmap = QPixmap::fromImage(image.scaled(ui->remoteVideoLabel->size(),
-                                                     Qt::KeepAspectRatio, Qt::SmoothTransformation));
-    ui->remoteVideoLabel->setPixmap(pixmap);
-
-    // Если в буфере остались кадры, планируем следующий
-    if (!videoBuffer.isEmpty()) {
-        QTimer::singleShot(100, this, &ChatWindow::processBufferedVideo); // ~30 FPS
-    }
-}
-
-void ChatWindow::processVideoPacket(QDataStream &stream)
-{
-    QString id, name;
-    qint64 sequence;
-    QByteArray imageData;
-    stream >> id >> name >> sequence >> imageData;
-
-    if (id == instanceId) return;
-
-    videoTotalPackets++;
-
-    if (lastVideoSequence == -1) {
-        lastVideoSequence = sequence;
-        return;
-    }
-
-    // Подсчет пропущенных пакетов
-    if (sequence > lastVideoSequence + 1) {
-        videoLostPackets += sequence - (lastVideoSequence + 1);
-    }
-    lastVideoSequence = sequence;
-
-    // Обновляем статистику потерь
-    videoPacketLossRate = (videoTotalPackets > 0) ?
-                              (double)videoLostPackets / (videoTotalPackets + videoLostPackets) * 100.0 : 0.0;
-
-    QImage image;
-    if (image.loadFromData(imageData, "JPEG")) {
-        if (BufferingEnabled) {
-            QMutexLocker locker(&videoMutex);
-            videoBuffer.enqueue(image);
-            while (videoBuffer.size() > maxBufferSize) {
-                videoBuffer.dequeue();
-            }
-            if (videoBuffer.size() >= maxBufferSize) {
-                processBufferedVideo();
-            }
-        } else {
-            QPixmap pixmap = QPixmap::fromImage(image.scaled(ui->remoteVideoLabel->size(),
-                                                             Qt::KeepAspectRatio, Qt::SmoothTransformation));
-            ui->remoteVideoLabel->setPixmap(pixmap);
-        }
-    }
-}
-
-void ChatWindow::processTextMessage(QDataStream &stream)
-{
-    QString id, name, text;
-    stream >> id >> name >> text;
-
-    if (id != instanceId) {
-        ui->chatArea->append("<b>" + name + ":</b> " + text);
+    // Медиапорты заняты - остался общий сокет
+    if (!session->setSeparateMediaPorts(checked) && checked) {
+        QSignalBlocker blocker(ui->separatePortsCheckBox);
+        ui->separatePortsCheckBox->setChecked(false);
     }
 }
 
-void ChatWindow::sendDiscover()
+void ChatWindow::applyImpairment()
 {
-    QByteArray data;
-    QDataStream stream(&data, QIODevice::WriteOnly);
-    stream << QString("DISCOVER") << instanceId << localNickname;
-
-    udpSocket->writeDatagram(data, QHostAddress::Broadcast, localPort);
-
-    foreach (const QNetworkInterface &interface, QNetworkInterface::allInterfaces()) {
-        if (interface.flags() & QNetworkInterface::CanBroadcast) {
-            foreach (const QNetworkAddressEntry &entry, interface.addressEntries()) {
-                if (!entry.broadcast().isNull()) {
-                    udpSocket->writeDatagram(data, entry.broadcast(), localPort);
-                }
-            }
-        }
-    }
+    NetworkImpairment::Config config;
+    config.enabled = ui->impairmentGroup->isChecked();
+    config.lossPercent = ui->impairmentLossSpinBox->value();
+    config.burstPercent = ui->impairmentBurstSpinBox->value();
+    config.burstLength = ui->impairmentBurstLengthSpinBox->value();
+    config.delayMs = ui->impairmentDelaySpinBox->value();
+    config.jitterMs = ui->impairmentJitterSpinBox->value();
+    // Порядок пунктов совпадает с NetworkImpairment::Distribution
+    config.distribution = NetworkImpairment::Distribution(
+        qBound(0, ui->impairmentDistributionComboBox->currentIndex(), int(NetworkImpairment::Distribution::Pareto)));
+    config.reorderPercent = ui->impairmentReorderSpinBox->value();
+    config.duplicatePercent = ui->impairmentDuplicateSpinBox->value();
+    config.rateLimit = qint64(ui->impairmentRateSpinBox->value()) * 1000;
+    config.queueLimit = ui->impairmentQueueSpinBox->value();
+    config.seed = quint32(ui->impairmentSeedSpinBox->value());
+    session->setImpairment(config);
 }
 
-void ChatWindow::sendKeepAlive()
+void ChatWindow::on_fecModeComboBox_currentIndexChanged(int index)
 {
-    if (isRemotePeerFound && !remoteAddress.isNull()) {
-        QByteArray data;
-        QDataStream stream(&data, QIODevice::WriteOnly);
-        stream << QString("KEEPALIVE") << instanceId << localNickname << QDateTime::currentMSecsSinceEpoch();
-        udpSocket->writeDatagram(data, remoteAddress, remotePort);
-    } else {
-        sendDiscover();
-    }
+    // Порядок пунктов совпадает с FecController::Mode
+    session->setFecMode(FecController::Mode(qBound(0, index, int(FecController::Mode::ReedSolomon))));
 }
 
 void ChatWindow::on_sendButton_clicked()
@@ -677,78 +458,55 @@ void ChatWindow::on_sendButton_clicked()
     QString text = ui->messageEdit->text().trimmed();
     if (text.isEmpty()) return;
 
-    if (!isRemotePeerFound) {
-        logMessage("Нет подключения к участнику");
-        return;
-    }
-
-    QByteArray packet;
-    QDataStream stream(&packet, QIODevice::WriteOnly);
-    stream << QString("MSG") << instanceId << localNickname << text;
+    if (!session->sendMessage(text)) return;
 
-    qint64 bytesSent = udpSocket->writeDatagram(packet, remoteAddress, remotePort);
-    if (bytesSent == -1) {
-        logMessage("Ошибка отправки сообщения");
-    } else {
-        totalBytesSent += bytesSent;
-        ui->chatArea->append("<b>Я:</b> " + text);
-        ui->messageEdit->clear();
-    }
+    ui->chatArea->append("<b>Я:</b> " + text);
+    ui->messageEdit->clear();
 }
 
 void ChatWindow::showStatus()
 {
+    QStringList peers;
+    for (const CallSession::PeerInfo &peer : session->peerList()) {
+        peers << QString("%1 (%2)").arg(peer.nickname, peer.address.toString());
+    }
+
     QString status = QString("Статус системы:\n"
                              "Соединение: %1\n"
                              "Качество связи: %2\n"
                              "Размер пакета: %3 мс\n"
                              "Потери пакетов: %4%\n"
-                             "Участник: %5\n"
-                             "IP: %6\n"
+                             "Участники: %5\n"
+                             "Всего: %6\n"
                              "Формат аудио: %7 Hz, %8 каналов\n")
-                         .arg(isRemotePeerFound ? "Подключено" : "Не подключено")
-                         .arg(packetLossRate < 2 ? "Отличное" :
-                                  packetLossRate < 5 ? "Хорошее" : "Плохое")
-                         .arg(currentPacketMs)
-                         .arg(packetLossRate, 0, 'f', 1)
-                         .arg(remoteNickname)
-                         .arg(remoteAddress.toString())
+                         .arg(session->isConnected() ? "Подключено" : "Не подключено")
+                         .arg(session->audioLossPercent() < 2 ? "Отличное" :
+                                  session->audioLossPercent() < 5 ? "Хорошее" : "Плохое")
+                         .arg(session->audioPacketMs())
+                         .arg(session->audioLossPercent(), 0, 'f', 1)
+                         .arg(peers.join(", "))
+                         .arg(peers.size())
                          .arg(audioFormat.sampleRate())
                          .arg(audioFormat.channelCount());
 
     QMessageBox::information(this, "Статус системы", status);
 }
 
-void ChatWindow::resetConnection()
+void ChatWindow::peerLost(quint16 peerId, const QString &nickname)
 {
-    isRemotePeerFound = false;
-    remoteAddress = QHostAddress();
-    remoteNickname.clear();
-    missedPings = 0;
-    packetLossRate = 0.0;
-    totalPackets = 0;
-    lostPackets = 0;
-    lastSequence = -1;  // Сбрасываем в начальное состояние
-
-    {
-        QMutexLocker locker(&audioMutex);
-        audioQueue.clear();
-    }
-
-    logMessage("Соединение сброшено");
-    logConnectionQuality();
-    ui->chatArea->append("<i>Соединение потеряно</i>");
-}
+    ui->chatArea->append("<i>Соединение с " + nickname + " потеряно</i>");
 
-bool ChatWindow::isLocalAddress(const QHostAddress &address)
-{
-    if (address.isLoopback()) return true;
-    foreach (const QHostAddress &localAddress, QNetworkInterface::allAddresses()) {
-        if (address == localAddress) {
-            return true;
-        }
+    // Оставшиеся участники занимают освободившееся место в сетке
+    remoteFrames.remove(peerId);
+    session->setRemoteVideoSize(videoGridCell());
+    if (remoteFrames.isEmpty()) {
+        QMutexLocker locker(&videoMutex);
+        videoBuffer.clear();
+        ui->remoteVideoLabel->clear();
+        ui->remoteVideoLabel->setText("Ожидание подключения...");
+    } else {
+        ui->remoteVideoLabel->setPixmap(QPixmap::fromImage(composeVideoGrid()));
     }
-    return false;
 }
 
 void ChatWindow::logMessage(const QString &message)
@@ -758,31 +516,10 @@ void ChatWindow::logMessage(const QString &message)
     ui->debugArea->verticalScrollBar()->setValue(ui->debugArea->verticalScrollBar()->maximum());
 }
 
-void ChatWindow::videoFrameReady(const QVideoFrame &frame)
+void ChatWindow::localPreviewReady(const QImage &preview)
 {
-    // Локальное отображение
-    QImage image = frame.toImage();
-    if (!image.isNull()) {
-        QPixmap pixmap = QPixmap::fromImage(image.scaled(ui->localVideoLabel->size(),
-                                                         Qt::KeepAspectRatio, Qt::SmoothTransformation));
-        ui->localVideoLabel->setPixmap(pixmap);
-    }
-
-    if (!isRemotePeerFound || remoteAddress.isNull()) return;
+    ui->localVideoLabel->setPixmap(QPixmap::fromImage(preview));
 
-    static qint64 videoSequence = 0;
-    image = image.scaled(640, 480, Qt::KeepAspectRatio);
-    QByteArray imageData;
-    QBuffer buffer(&imageData);
-    buffer.open(QIODevice::WriteOnly);
-    image.save(&buffer, "JPEG", 80);
-
-    QByteArray packet;
-    QDataStream stream(&packet, QIODevice::WriteOnly);
-    stream << QString("VIDEO") << instanceId << localNickname << ++videoSequence << imageData;
-
-    qint64 bytesSent = udpSocket->writeDatagram(packet, remoteAddress, remotePort);
-    if (bytesSent != -1) {
-        totalBytesSent += bytesSent;
-    }
+    // Размер превью для следующих кадров
+    session->setPreviewSize(ui->localVideoLabel->size());
 }
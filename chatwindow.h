@@ -21,6 +21,7 @@
     #include <QtCharts/QLineSeries>
     #include <QtCharts/QValueAxis>
     #include <QBasicTimer>
+    #include "callsession.h"
 
     QT_BEGIN_NAMESPACE
     namespace Ui { class ChatWindow; }
@@ -35,11 +36,10 @@
         ~ChatWindow();
 
     private slots:
-        void readPendingDatagrams();
-        void sendAudioData();
-        void sendDiscover();
-        void sendKeepAlive();
-        void videoFrameReady(const QVideoFrame &frame);
+        void localPreviewReady(const QImage &preview);
+        void remoteFrameReady(quint16 peerId, const QImage &image);
+        void peerLost(quint16 peerId, const QString &nickname);
+        void messageReceived(const QString &nickname, const QString &text);
         void on_sendButton_clicked();
         void showStatus();
         void on_applyBufferButton_clicked();
@@ -47,10 +47,13 @@
     private:
         Ui::ChatWindow *ui;
 
-        int videoTotalPackets;
-        int videoLostPackets;
-        double videoPacketLossRate;
-        qint64 lastVideoSequence;
+        // Звонок: сеть, кодеки и обработка медиа
+        CallSession *session;
+
+        // Последний кадр каждого участника, из них собирается сетка
+        QMap<quint16, QImage> remoteFrames;
+        QSize videoGridCell() const;
+        QImage composeVideoGrid() const;
 
         // Video buffering
         QQueue<QImage> videoBuffer;
@@ -71,8 +74,6 @@
         QValueAxis *axisX;
         QValueAxis *axisY;
         QElapsedTimer bitrateTimer;
-        qint64 totalBytesSent = 0;
-        qint64 totalBytesReceived = 0;
         qint64 lastUpdateBytesSent = 0;
         qint64 lastUpdateBytesReceived = 0;
         QBasicTimer videoTimer;
@@ -82,73 +83,33 @@
         void setupBitrateChart();
         void timerEvent(QTimerEvent *event) override;
 
-        // Network
-        QUdpSocket *udpSocket;
-        QHostAddress remoteAddress;
-        QString remoteNickname;
-        QString instanceId;
-        QString localNickname;
-        bool isRemotePeerFound = false;
-        int missedPings = 0;
-
-        void checkAudioTiming();
-        void updatePacketLossStats();
+        void playoutAudio();
 
         // Audio
         QAudioFormat audioFormat;
         QAudioSource *audioInput = nullptr;
         QAudioSink *audioOutput = nullptr;
-        QIODevice *audioInputDevice = nullptr;
         QIODevice *audioOutputDevice = nullptr;
-        QByteArray audioBuffer;
         int audioBufferSize;
-        QMutex audioMutex;
 
         // Video
         QCamera *camera = nullptr;
         QMediaCaptureSession *captureSession = nullptr;
         QVideoSink *videoSink = nullptr;
 
-        // Timers
-        QTimer *connectionTimer;
-        QTimer *keepAliveTimer;
-
         // Constants
         const int localPort = 45454;
         const int remotePort = 45454;
-        const int MAX_MISSED_PINGS = 3;
-        const int AUDIO_PACKET_MS = 40;
-        QQueue<QByteArray> audioQueue;
-        QElapsedTimer audioTimer;
-        int currentPacketMs;
-        const int MIN_PACKET_MS = 20;
-        const int MAX_PACKET_MS = 60;
-        const int TARGET_QUEUE_SIZE = 3;
-
-        double packetLossRate;
-        int totalPackets;
-        int lostPackets;
-        qint64 lastSequence;
-
-        void logConnectionQuality();
-
-        void setupTimers();
+
         void setupAudioVideo();
         void initAudioDevices();
         void initVideoDevices();
         void cleanupAudio();
 
-        void processAudioPacket(QDataStream &stream);
-        void processDiscoverPacket(QDataStream &stream, const QHostAddress &senderAddr);
-        void processDiscoverReply(QDataStream &stream, const QHostAddress &senderAddr);
-        void processKeepAlive(QDataStream &stream, const QHostAddress &senderAddr);
-        void processVideoPacket(QDataStream &stream);
-        void processTextMessage(QDataStream &stream);
-
-        void resetConnection();
-        bool isLocalAddress(const QHostAddress &address);
+        void on_fecModeComboBox_currentIndexChanged(int index);
+        void on_separatePortsCheckBox_toggled(bool checked);
+        void applyImpairment();
         void logMessage(const QString &message);
-        int calculateAudioPacketSize() const;
 
         void on_BufferCheckBox_stateChanged(int state);
     };
@@ -0,0 +1,304 @@
+#include "callsession.h"
+#include "climedia.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QTimer>
+#include <csignal>
+
+// Консольный звонок без GUI и устройств: одна или много сессий с
+// синтетическими или файловыми источниками. Сессия i слушает порт
+// --port + 3*i (управление и два медиапорта) и звонит на --remote-port + 3*i,
+// поэтому два процесса с переставленными портами образуют N пар:
+//
+//   AuthoLASTVLADIOCli --port 50000 --remote-port 60000 --peer 127.0.0.1 --sessions 100
+//   AuthoLASTVLADIOCli --port 60000 --remote-port 50000 --peer 127.0.0.1 --sessions 100
+//
+// С --relay все сессии звонят на один порт ретранслятора и попадают в
+// общий звонок. С --multicast общий звонок - группа: все сессии на одном
+// порту --port, для нескольких на одной машине нужен --multicast-loop.
+//
+// Имитация плохой сети настраивается так же полно, как на вкладке
+// настроек окна; с одним и тем же --impair-seed прогоны повторяются:
+//
+//   AuthoLASTVLADIOCli --peer 127.0.0.1 --burst 2 --burst-length 4 --reorder 1 --impair-seed 7
+
+namespace {
+
+constexpr int PortsPerSession = 3;
+// Формат звонка по умолчанию: 48 кГц, моно, Int16
+constexpr int CallSampleRate = 48000;
+constexpr int CallFormatBytesPerSecond = CallSampleRate * 2;
+
+struct CliSession
+{
+    CallSession *call = nullptr;
+    PcmSource *audio = nullptr;
+    FrameGenerator *video = nullptr;
+    PlayoutSink *sink = nullptr;
+};
+
+QTextStream &out()
+{
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+void printSummary(int index, const CliSession &session, qint64 elapsedMs)
+{
+    const NetworkEngine *network = session.call->networkEngine();
+    const double seconds = qMax<qint64>(1, elapsedMs) / 1000.0;
+    QStringList peers;
+    for (const CallSession::PeerInfo &peer : session.call->peerList()) {
+        peers << peer.nickname;
+    }
+    out() << QString("[%1] %2 %3: аудио потери %4%, принято %5 с; видео потери %6%, кадров %7/%8; TX %9 кбит/с, RX %10 кбит/с")
+                 .arg(index)
+                 .arg(session.call->localNickname())
+                 .arg(peers.isEmpty() ? "без участника" : "на связи с " + peers.join(", "))
+                 .arg(session.call->audioLossPercent(), 0, 'f', 1)
+                 .arg(double(session.sink->audioBytes()) / CallFormatBytesPerSecond, 0, 'f', 1)
+                 .arg(session.call->videoLossPercent(), 0, 'f', 1)
+                 .arg(session.call->videoFramesSent())
+                 .arg(session.sink->videoFrames())
+                 .arg(network->bytesSent() * 8 / seconds / 1000.0, 0, 'f', 0)
+                 .arg(network->bytesReceived() * 8 / seconds / 1000.0, 0, 'f', 0)
+          << Qt::endl;
+}
+
+// Из обработчика сигнала можно только поставить флаг, его проверяет таймер
+volatile std::sig_atomic_t stopRequested = 0;
+
+void requestStop(int)
+{
+    stopRequested = 1;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("AuthoLASTVLADIOCli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Звонок без GUI: синтетические или файловые источники, много сессий в одном процессе");
+    parser.addHelpOption();
+    const QCommandLineOption portOption("port", "Локальный порт первой сессии.", "port", "45454");
+    const QCommandLineOption remotePortOption("remote-port", "Порт участника первой сессии.", "port", "45454");
+    const QCommandLineOption peerOption("peer", "Адрес участника; без него - широковещательный поиск.", "address");
+    const QCommandLineOption relayOption("relay", "--peer - ретранслятор, все сессии на --remote-port.");
+    const QCommandLineOption multicastOption("multicast", "Групповой звонок через группу IPv4.", "group");
+    const QCommandLineOption multicastTtlOption("multicast-ttl", "TTL пакетов группе.", "hops", "1");
+    const QCommandLineOption multicastLoopOption("multicast-loop", "Пакеты группе - и на эту машину.");
+    const QCommandLineOption sessionsOption("sessions", "Число сессий.", "count", "1");
+    const QCommandLineOption durationOption("duration", "Длительность, с; 0 - до Ctrl+C.", "seconds", "0");
+    const QCommandLineOption audioFileOption("audio-file", "Сырой PCM 48 кГц, моно, 16 бит, по кругу.", "path");
+    const QCommandLineOption toneOption("tone", "Частота синуса, если файла нет, Гц.", "hz", "440");
+    const QCommandLineOption fpsOption("fps", "Частота синтетического видео; 0 - без видео.", "fps", "15");
+    const QCommandLineOption videoSizeOption("video-size", "Размер синтетического кадра.", "WxH", "320x240");
+    const QCommandLineOption peerCacheOption("peer-cache", "Каталог для недавних участников (peers<N>.json).", "dir");
+    const QCommandLineOption recordOption("record", "Каталог для принятого PCM (session<N>.pcm).", "dir");
+    const QCommandLineOption fecOption("fec", "FEC: auto, off, xor, rs.", "mode", "auto");
+    const QCommandLineOption separatePortsOption("separate-ports", "Отдельные сокеты для аудио и видео.");
+    const QCommandLineOption lossOption("loss", "Имитация: случайные потери, %.", "percent", "0");
+    const QCommandLineOption delayOption("delay", "Имитация: задержка, мс.", "ms", "0");
+    const QCommandLineOption jitterOption("jitter", "Имитация: джиттер, мс.", "ms", "0");
+    const QCommandLineOption rateOption("rate", "Имитация: ограничение скорости, кбит/с.", "kbps", "0");
+    const QCommandLineOption burstOption("burst", "Имитация: вход в пачку потерь, % на пакет.", "percent", "0");
+    const QCommandLineOption burstLengthOption("burst-length", "Имитация: средняя длина пачки, пакетов.", "packets", "0");
+    const QCommandLineOption burstLossOption("burst-loss", "Имитация: потери внутри пачки, %.", "percent", "100");
+    const QCommandLineOption jitterDistributionOption("jitter-distribution",
+                                                      "Имитация: распределение джиттера: uniform, normal, pareto.",
+                                                      "name", "normal");
+    const QCommandLineOption reorderOption("reorder", "Имитация: переупорядочивание, %.", "percent", "0");
+    const QCommandLineOption duplicateOption("duplicate", "Имитация: дублирование, %.", "percent", "0");
+    const QCommandLineOption queueLimitOption("queue-limit", "Имитация: очередь узкого места, пакетов.", "packets", "1000");
+    const QCommandLineOption impairSeedOption("impair-seed", "Имитация: seed генератора, у сессии i - seed + i.", "seed", "1");
+    const QCommandLineOption passphraseOption("passphrase", "Пароль звонка: медиа шифруется, у всех участников одинаковый.", "text");
+    const QCommandLineOption statsOption("stats", "Период вывода статистики, с; 0 - только в конце.", "seconds", "5");
+    const QCommandLineOption verboseOption("verbose", "Журнал сессий и подробная статистика.");
+    parser.addOptions({ portOption, remotePortOption, peerOption, relayOption, multicastOption,
+                        multicastTtlOption, multicastLoopOption, sessionsOption, durationOption,
+                        audioFileOption, toneOption, fpsOption, videoSizeOption, peerCacheOption,
+                        recordOption, fecOption, separatePortsOption, lossOption, delayOption, jitterOption,
+                        rateOption, burstOption, burstLengthOption, burstLossOption, jitterDistributionOption,
+                        reorderOption, duplicateOption, queueLimitOption, impairSeedOption, passphraseOption,
+                        statsOption, verboseOption });
+    parser.process(app);
+
+    const int sessionCount = qMax(1, parser.value(sessionsOption).toInt());
+    const quint16 basePort = quint16(parser.value(portOption).toUInt());
+    const quint16 baseRemotePort = quint16(parser.value(remotePortOption).toUInt());
+    const bool verbose = parser.isSet(verboseOption);
+    const bool useRelay = parser.isSet(relayOption);
+    if (useRelay && !parser.isSet(peerOption)) {
+        out() << "Для --relay нужен адрес ретранслятора в --peer" << Qt::endl;
+        return 1;
+    }
+    const bool useMulticast = parser.isSet(multicastOption);
+    const int fps = parser.value(fpsOption).toInt();
+    const QStringList size = parser.value(videoSizeOption).split('x');
+    const QSize videoSize = size.size() == 2 ? QSize(size[0].toInt(), size[1].toInt()) : QSize(320, 240);
+
+    static const QStringList fecModes = { "auto", "off", "xor", "rs" };
+    const int fecMode = int(qMax<qsizetype>(0, fecModes.indexOf(parser.value(fecOption))));
+
+    // Порядок совпадает с NetworkImpairment::Distribution
+    static const QStringList distributions = { "uniform", "normal", "pareto" };
+    const qsizetype distribution = distributions.indexOf(parser.value(jitterDistributionOption));
+    if (distribution < 0) {
+        out() << "Неизвестное распределение джиттера: " << parser.value(jitterDistributionOption) << Qt::endl;
+        return 1;
+    }
+
+    NetworkImpairment::Config impairment;
+    impairment.lossPercent = parser.value(lossOption).toDouble();
+    impairment.burstPercent = parser.value(burstOption).toDouble();
+    impairment.burstLength = parser.value(burstLengthOption).toDouble();
+    impairment.burstLossPercent = parser.value(burstLossOption).toDouble();
+    impairment.delayMs = parser.value(delayOption).toInt();
+    impairment.jitterMs = parser.value(jitterOption).toInt();
+    impairment.distribution = NetworkImpairment::Distribution(distribution);
+    impairment.reorderPercent = parser.value(reorderOption).toDouble();
+    impairment.duplicatePercent = parser.value(duplicateOption).toDouble();
+    impairment.rateLimit = parser.value(rateOption).toLongLong() * 1000;
+    impairment.queueLimit = parser.value(queueLimitOption).toInt();
+    impairment.seed = parser.value(impairSeedOption).toUInt();
+    impairment.enabled = impairment.lossPercent > 0.0
+                         || (impairment.burstPercent > 0.0 && impairment.burstLength >= 1.0)
+                         || impairment.delayMs > 0 || impairment.jitterMs > 0 || impairment.reorderPercent > 0.0
+                         || impairment.duplicatePercent > 0.0 || impairment.rateLimit > 0;
+
+    if (parser.isSet(recordOption)) {
+        QDir().mkpath(parser.value(recordOption));
+    }
+
+    // Ключ из пароля считается долго, поэтому один раз на все сессии
+    const QByteArray callKey = MediaCrypto::deriveCallKey(parser.value(passphraseOption));
+
+    QAudioFormat format;
+    format.setSampleRate(CallSampleRate);
+    format.setChannelCount(1);
+    format.setSampleFormat(QAudioFormat::Int16);
+
+    QList<CliSession> sessions;
+    for (int i = 0; i < sessionCount; ++i) {
+        CallSession::Settings settings;
+        settings.localPort = quint16(basePort + PortsPerSession * i);
+        settings.remotePort = useRelay ? baseRemotePort : quint16(baseRemotePort + PortsPerSession * i);
+        settings.useRelay = useRelay;
+        if (useMulticast) {
+            settings.localPort = basePort;
+            settings.remotePort = basePort;
+            settings.multicastGroup = QHostAddress(parser.value(multicastOption));
+            settings.multicastTtl = parser.value(multicastTtlOption).toInt();
+            settings.multicastLoopback = parser.isSet(multicastLoopOption);
+        }
+        if (parser.isSet(peerOption)) {
+            settings.peerAddress = QHostAddress(parser.value(peerOption));
+        }
+        settings.nickname = QString("cli%1_%2").arg(basePort).arg(i);
+        settings.callKey = callKey;
+        if (parser.isSet(peerCacheOption)) {
+            settings.peerCachePath = QDir(parser.value(peerCacheOption)).filePath(QString("peers%1.json").arg(i));
+        }
+        // Пары сессий обычно на одной машине
+        settings.acceptLocalPeers = true;
+
+        CliSession session;
+        session.call = new CallSession(settings, &app);
+        if (verbose) {
+            QObject::connect(session.call, &CallSession::logMessage, [i](const QString &message) {
+                out() << QString("[%1] ").arg(i) << message << Qt::endl;
+            });
+        }
+        session.call->setFecMode(FecController::Mode(fecMode));
+        // Свой поток случайных чисел у каждой сессии, но повторяемый
+        NetworkImpairment::Config sessionImpairment = impairment;
+        sessionImpairment.seed = impairment.seed + quint32(i);
+        session.call->setImpairment(sessionImpairment);
+        session.call->setAudioFormat(format);
+        if (!session.call->start()) {
+            out() << QString("[%1] не удалось открыть порт %2").arg(i).arg(settings.localPort) << Qt::endl;
+            return 1;
+        }
+        if (parser.isSet(separatePortsOption)) {
+            session.call->setSeparateMediaPorts(true);
+        }
+
+        session.audio = new PcmSource(format, &app);
+        if (!session.audio->start(parser.value(audioFileOption), parser.value(toneOption).toInt())) {
+            out() << session.audio->errorString() << Qt::endl;
+            return 1;
+        }
+        session.call->setAudioInput(session.audio);
+
+        if (fps > 0) {
+            session.video = new FrameGenerator(videoSize, fps, &app);
+            QObject::connect(session.video, &FrameGenerator::frameReady, session.call,
+                             qOverload<const QImage &>(&CallSession::submitVideoFrame));
+            session.video->start();
+        }
+
+        session.sink = new PlayoutSink(session.call, format, &app);
+        const QString recordPath = parser.isSet(recordOption)
+                                       ? QDir(parser.value(recordOption)).filePath(QString("session%1.pcm").arg(i))
+                                       : QString();
+        if (!session.sink->start(recordPath)) {
+            out() << "Не удалось создать " << recordPath << Qt::endl;
+            return 1;
+        }
+
+        sessions.append(session);
+    }
+    out() << QString("Запущено сессий: %1").arg(sessionCount) << Qt::endl;
+
+    QElapsedTimer clock;
+    clock.start();
+
+    const int statsSeconds = parser.value(statsOption).toInt();
+    QTimer statsTimer;
+    if (statsSeconds > 0) {
+        QObject::connect(&statsTimer, &QTimer::timeout, [&]() {
+            int connected = 0;
+            for (int i = 0; i < sessions.size(); ++i) {
+                if (sessions[i].call->isConnected()) ++connected;
+                if (verbose || sessions.size() <= 10) {
+                    printSummary(i, sessions[i], clock.elapsed());
+                }
+            }
+            out() << QString("На связи %1 из %2").arg(connected).arg(sessions.size()) << Qt::endl;
+        });
+        statsTimer.start(statsSeconds * 1000);
+    }
+
+    const int durationSeconds = parser.value(durationOption).toInt();
+    if (durationSeconds > 0) {
+        QTimer::singleShot(durationSeconds * 1000, &app, &QCoreApplication::quit);
+    }
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+    QTimer stopTimer;
+    QObject::connect(&stopTimer, &QTimer::timeout, [&app]() {
+        if (stopRequested) app.quit();
+    });
+    stopTimer.start(100);
+
+    const int result = app.exec();
+
+    for (int i = 0; i < sessions.size(); ++i) {
+        const CliSession &session = sessions[i];
+        if (session.video) session.video->stop();
+        session.audio->stop();
+        session.sink->stop();
+        printSummary(i, session, clock.elapsed());
+        if (verbose) {
+            out() << session.call->statisticsReport() << Qt::endl;
+        }
+        session.call->stop();
+    }
+    return result;
+}
@@ -0,0 +1,209 @@
+#include "climedia.h"
+#include <QtMath>
+
+namespace {
+
+// Период выдачи PCM и забора воспроизведения
+constexpr int TickMs = 10;
+
+}
+
+PcmSource::PcmSource(const QAudioFormat &format, QObject *parent)
+    : QIODevice(parent)
+    , m_format(format)
+{
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &PcmSource::produce);
+}
+
+bool PcmSource::start(const QString &filePath, int toneHz)
+{
+    if (!filePath.isEmpty()) {
+        m_file.setFileName(filePath);
+        if (!m_file.open(QIODevice::ReadOnly) || m_file.size() < m_format.bytesPerFrame()) {
+            setErrorString("Не удалось открыть " + filePath);
+            return false;
+        }
+    }
+    m_phaseStep = 2.0 * M_PI * toneHz / m_format.sampleRate();
+
+    open(QIODevice::ReadOnly);
+    m_producedFrames = 0;
+    m_clock.start();
+    m_timer.start(TickMs);
+    return true;
+}
+
+void PcmSource::stop()
+{
+    m_timer.stop();
+    m_file.close();
+    m_buffer.clear();
+    close();
+}
+
+void PcmSource::produce()
+{
+    // Сколько кадров положено к этому моменту - без накопления ошибки таймера
+    const qint64 dueFrames = m_clock.elapsed() * m_format.sampleRate() / 1000;
+    const qint64 frames = dueFrames - m_producedFrames;
+    if (frames <= 0) return;
+    m_producedFrames = dueFrames;
+
+    const qsizetype offset = m_buffer.size();
+    m_buffer.resize(offset + frames * m_format.bytesPerFrame());
+    generate(m_buffer.data() + offset, frames);
+
+    emit readyRead();
+}
+
+void PcmSource::generate(char *data, qint64 frames)
+{
+    qint64 bytes = frames * m_format.bytesPerFrame();
+
+    if (m_file.isOpen()) {
+        while (bytes > 0) {
+            const qint64 read = m_file.read(data, bytes);
+            if (read <= 0) {
+                m_file.seek(0);
+                continue;
+            }
+            data += read;
+            bytes -= read;
+        }
+        return;
+    }
+
+    // Синус на все каналы; генератор понимает только Int16, остальное - тишина
+    if (m_format.sampleFormat() != QAudioFormat::Int16) {
+        memset(data, 0, size_t(bytes));
+        return;
+    }
+    qint16 *samples = reinterpret_cast<qint16 *>(data);
+    const int channels = m_format.channelCount();
+    for (qint64 i = 0; i < frames; ++i) {
+        const qint16 value = qint16(qSin(m_phase) * 8000.0);
+        for (int c = 0; c < channels; ++c) {
+            *samples++ = value;
+        }
+        m_phase += m_phaseStep;
+        if (m_phase > 2.0 * M_PI) m_phase -= 2.0 * M_PI;
+    }
+}
+
+qint64 PcmSource::readData(char *data, qint64 maxSize)
+{
+    const qint64 size = qMin(maxSize, qint64(m_buffer.size()));
+    memcpy(data, m_buffer.constData(), size_t(size));
+    m_buffer.remove(0, size);
+    return size;
+}
+
+qint64 PcmSource::writeData(const char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+FrameGenerator::FrameGenerator(const QSize &size, int fps, QObject *parent)
+    : QObject(parent)
+    , m_background(size, QImage::Format_RGB32)
+    , m_fps(qMax(1, fps))
+{
+    // Градиент рисуется один раз, на кадр - только полоса и номер
+    for (int y = 0; y < m_background.height(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(m_background.scanLine(y));
+        for (int x = 0; x < m_background.width(); ++x) {
+            line[x] = qRgb(x * 255 / m_background.width(), y * 255 / m_background.height(), 128);
+        }
+    }
+
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &FrameGenerator::produce);
+}
+
+void FrameGenerator::start()
+{
+    m_timer.start(1000 / m_fps);
+}
+
+void FrameGenerator::produce()
+{
+    // Только запись пикселей: QPainter с текстом требует QGuiApplication
+    QImage frame = m_background.copy();
+
+    const int barWidth = qMax(1, frame.width() / 10);
+    const int barX = int((m_frameNumber * 4) % (frame.width() + barWidth)) - barWidth;
+    const int left = qMax(0, barX);
+    const int right = qMin(frame.width(), barX + barWidth);
+
+    // Номер кадра - 16 двоичных квадратов в верхней строке
+    const int cell = qMax(1, qMin(frame.width() / 16, frame.height() / 8));
+    for (int y = 0; y < frame.height(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(frame.scanLine(y));
+        for (int x = left; x < right; ++x) {
+            line[x] = qRgb(255, 255, 255);
+        }
+        if (y >= cell) continue;
+        for (int bit = 0; bit < 16 && (bit + 1) * cell <= frame.width(); ++bit) {
+            const QRgb color = (m_frameNumber >> bit) & 1 ? qRgb(255, 255, 255) : qRgb(0, 0, 0);
+            for (int x = bit * cell; x < (bit + 1) * cell; ++x) {
+                line[x] = color;
+            }
+        }
+    }
+
+    ++m_frameNumber;
+    emit frameReady(frame);
+}
+
+PlayoutSink::PlayoutSink(CallSession *session, const QAudioFormat &format, QObject *parent)
+    : QObject(parent)
+    , m_session(session)
+    , m_format(format)
+{
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &PlayoutSink::pull);
+    connect(m_session, &CallSession::remoteFrameReady, this, [this]() { ++m_videoFrames; });
+}
+
+bool PlayoutSink::start(const QString &filePath)
+{
+    if (!filePath.isEmpty()) {
+        m_file.setFileName(filePath);
+        if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+    }
+    m_playedBytes = 0;
+    m_clock.start();
+    m_timer.start(TickMs);
+    return true;
+}
+
+void PlayoutSink::stop()
+{
+    m_timer.stop();
+    m_file.close();
+}
+
+void PlayoutSink::pull()
+{
+    // Позиция воображаемого устройства; пока буфер набирается, оно играет
+    // тишину, и позиция догоняется без всплеска
+    const qint64 deviceBytes = m_clock.elapsed() * m_format.sampleRate() / 1000 * m_format.bytesPerFrame();
+    const qint64 target = deviceBytes + m_session->audioPacketBytes();
+
+    while (m_playedBytes < target) {
+        const QByteArray chunk = m_session->takePlayoutAudio();
+        if (chunk.isEmpty()) {
+            m_playedBytes = qMax(m_playedBytes, deviceBytes);
+            break;
+        }
+
+        m_playedBytes += chunk.size();
+        m_audioBytes += chunk.size();
+        if (m_file.isOpen()) {
+            m_file.write(chunk);
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef CLIMEDIA_H
+#define CLIMEDIA_H
+
+#include <QObject>
+#include <QIODevice>
+#include <QAudioFormat>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImage>
+#include <QTimer>
+#include "callsession.h"
+
+// Источники и приёмники медиа для консольной утилиты: звонок идёт без
+// микрофона, камеры и окна, поэтому сотни сессий можно запустить на
+// одной тестовой машине.
+
+// PCM в реальном темпе: из файла (сырые отсчёты в формате звонка, по кругу)
+// или синус заданной частоты. Данные появляются порциями по таймеру и
+// сигналят readyRead, как устройство захвата.
+class PcmSource : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    PcmSource(const QAudioFormat &format, QObject *parent = nullptr);
+
+    // Пустой путь - синус toneHz
+    bool start(const QString &filePath, int toneHz);
+    void stop();
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override { return m_buffer.size() + QIODevice::bytesAvailable(); }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    void produce();
+    void generate(char *data, qint64 frames);
+
+    QAudioFormat m_format;
+    QTimer m_timer;
+    QElapsedTimer m_clock;
+    qint64 m_producedFrames = 0;
+    QByteArray m_buffer;
+
+    QFile m_file;
+    double m_phase = 0.0;
+    double m_phaseStep = 0.0;
+};
+
+// Синтетическое видео: полоса, бегущая по градиенту, и номер кадра
+// двоичным кодом. Картинка каждый раз новая, поэтому JPEG не вырождается
+// в пару байт.
+class FrameGenerator : public QObject
+{
+    Q_OBJECT
+
+public:
+    FrameGenerator(const QSize &size, int fps, QObject *parent = nullptr);
+
+    void start();
+    void stop() { m_timer.stop(); }
+
+signals:
+    void frameReady(const QImage &frame);
+
+private:
+    void produce();
+
+    QImage m_background;
+    QTimer m_timer;
+    int m_fps;
+    qint64 m_frameNumber = 0;
+};
+
+// Приёмник звонка вместо звуковой карты и окна: забирает воспроизведение
+// в реальном темпе (в «устройстве» не больше одного пакета, как у окна
+// чата), считает принятое и при желании пишет PCM в файл
+class PlayoutSink : public QObject
+{
+    Q_OBJECT
+
+public:
+    PlayoutSink(CallSession *session, const QAudioFormat &format, QObject *parent = nullptr);
+
+    // Пустой путь - только подсчёт
+    bool start(const QString &filePath);
+    void stop();
+
+    qint64 audioBytes() const { return m_audioBytes; }
+    qint64 videoFrames() const { return m_videoFrames; }
+
+private:
+    void pull();
+
+    CallSession *m_session;
+    QAudioFormat m_format;
+    QTimer m_timer;
+    QElapsedTimer m_clock;
+    QFile m_file;
+    qint64 m_playedBytes = 0;    // ушло в «устройство», включая тишину
+    qint64 m_audioBytes = 0;     // принятый звук
+    qint64 m_videoFrames = 0;
+};
+
+#endif // CLIMEDIA_H
@@ -0,0 +1,144 @@
+#include "audiocodec.h"
+#include "benchutil.h"
+#include <QList>
+#include <QtMath>
+
+// Процессор на кадр 20 мс для каждого кодека, собранного в этой сборке:
+// кодирование и декодирование в микросекундах на кадр и в доле ядра в
+// реальном времени, плюс битрейт на выходе против PCM. Сигнал - несколько
+// секунд синтетической "речи": гармоники с плавающим основным тоном,
+// слоговая огибающая и шум, чтобы кодеры не получали тишину.
+//
+//   AuthoLASTVLADIOCodecBench --sample-rate 48000 --channels 1 --duration 2
+
+namespace {
+
+constexpr int FrameMs = 20;
+constexpr int SignalSeconds = 5;
+
+using Bench::out;
+
+QList<QByteArray> makeFrames(int sampleRate, int channels)
+{
+    const int frameSamples = sampleRate * FrameMs / 1000;
+    const int frameCount = SignalSeconds * 1000 / FrameMs;
+    quint32 noise = 1;
+    double phase = 0.0;
+
+    QList<QByteArray> frames;
+    for (int f = 0; f < frameCount; ++f) {
+        QByteArray frame(frameSamples * channels * 2, Qt::Uninitialized);
+        auto *samples = reinterpret_cast<qint16 *>(frame.data());
+        for (int i = 0; i < frameSamples; ++i) {
+            const double t = double(f * frameSamples + i) / sampleRate;
+            const double pitch = 120.0 + 30.0 * qSin(2 * M_PI * 0.7 * t);
+            const double envelope = 0.5 + 0.5 * qSin(2 * M_PI * 4.0 * t);
+            phase += 2 * M_PI * pitch / sampleRate;
+            double value = 0.0;
+            for (int h = 1; h <= 8; ++h) {
+                value += qSin(phase * h) / h;
+            }
+            noise = noise * 1664525u + 1013904223u;
+            value = envelope * value * 6000.0 + (double(noise >> 16) / 65536.0 - 0.5) * 400.0;
+            for (int c = 0; c < channels; ++c) {
+                samples[i * channels + c] = qint16(qBound(-32768.0, value, 32767.0));
+            }
+        }
+        frames.append(frame);
+    }
+    return frames;
+}
+
+struct Result
+{
+    double encodeUs = 0.0;   // на кадр
+    double decodeUs = 0.0;
+    double bytesPerFrame = 0.0;
+};
+
+bool measure(AudioCodecId codec, int sampleRate, int channels, const QList<QByteArray> &frames, double seconds,
+             Result *result)
+{
+    std::unique_ptr<AudioEncoder> encoder = AudioCodecs::createEncoder(codec, sampleRate, channels);
+    std::unique_ptr<AudioDecoder> decoder = AudioCodecs::createDecoder(codec, sampleRate, channels);
+    if (!encoder || !decoder) return false;
+
+    // Кодирование по кругу, пока не истечёт время; последний круг - для декодера
+    QList<QByteArray> encoded(frames.size());
+    QByteArray payload;
+    qint64 count = 0;
+    qint64 bytes = 0;
+    bool ok = true;
+    result->encodeUs = Bench::nsPerCall(seconds, [&](qint64 call) {
+        const qsizetype i = call % frames.size();
+        payload.clear();
+        ok = encoder->encode(frames.at(i), &payload) && ok;
+        encoded[i] = payload;
+        bytes += payload.size();
+        ++count;
+    }) / 1e3;
+    result->bytesPerFrame = double(bytes) / double(count);
+
+    QByteArray decoded;
+    result->decodeUs = Bench::nsPerCall(seconds, [&](qint64 call) {
+        decoded.resize(0);
+        ok = decoder->decode(encoded.at(call % encoded.size()), &decoded) && !decoded.isEmpty() && ok;
+    }) / 1e3;
+    return ok;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    Bench::prepare(parser, "AuthoLASTVLADIOCodecBench",
+                   "Процессор на кадр 20 мс для кодеков аудио");
+    const QCommandLineOption rateOption("sample-rate", "Частота дискретизации, Гц.", "hz", "48000");
+    const QCommandLineOption channelsOption("channels", "Каналов.", "count", "1");
+    const QCommandLineOption durationOption("duration", "Замер на кодек и направление, с.", "seconds", "2");
+    parser.addOptions({ rateOption, channelsOption, durationOption });
+    parser.process(app);
+
+    const int sampleRate = qBound(8000, parser.value(rateOption).toInt(), 96000);
+    const int channels = qBound(1, parser.value(channelsOption).toInt(), 2);
+    const double seconds = qMax(0.1, parser.value(durationOption).toDouble());
+    const QList<QByteArray> frames = makeFrames(sampleRate, channels);
+    const double pcmBytes = frames.first().size();
+    const double frameUs = FrameMs * 1000.0;
+
+    out() << QString("%1 Гц, каналов %2, кадр %3 мс (%4 байт PCM)")
+                 .arg(sampleRate)
+                 .arg(channels)
+                 .arg(FrameMs)
+                 .arg(pcmBytes, 0, 'f', 0)
+          << Qt::endl;
+
+    const quint8 codecs = AudioCodecs::supportedMask(sampleRate, channels, true);
+    for (int i = 0; i < int(AudioCodecId::Count); ++i) {
+        const AudioCodecId codec = AudioCodecId(i);
+        if (!(codecs & AudioCodecs::maskOf(codec))) {
+            out() << AudioCodecs::name(codec) << ": недоступен для этого формата или сборки" << Qt::endl;
+            continue;
+        }
+
+        Result result;
+        if (!measure(codec, sampleRate, channels, frames, seconds, &result)) {
+            out() << AudioCodecs::name(codec) << ": ошибка кодера" << Qt::endl;
+            return 1;
+        }
+        out() << QString("%1: кодирование %2 мкс/кадр (%3% ядра), декодирование %4 мкс/кадр (%5% ядра);"
+                         " %6 байт/кадр, %7 кбит/с, сжатие %8x")
+                     .arg(AudioCodecs::name(codec))
+                     .arg(result.encodeUs, 0, 'f', 1)
+                     .arg(100.0 * result.encodeUs / frameUs, 0, 'f', 2)
+                     .arg(result.decodeUs, 0, 'f', 1)
+                     .arg(100.0 * result.decodeUs / frameUs, 0, 'f', 2)
+                     .arg(result.bytesPerFrame, 0, 'f', 0)
+                     .arg(result.bytesPerFrame * 8 / FrameMs, 0, 'f', 1)
+                     .arg(pcmBytes / qMax(1.0, result.bytesPerFrame), 0, 'f', 1)
+              << Qt::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,462 @@
+#include "congestioncontroller.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+constexpr int SentHistorySize = 4096;
+constexpr qint64 GroupSpanUs = 5000;
+constexpr int TrendlineWindow = 20;
+constexpr double TrendlineSmoothing = 0.9;
+constexpr double TrendlineGain = 4.0;
+constexpr double MinThreshold = 6.0;
+constexpr double MaxThreshold = 600.0;
+constexpr double ThresholdUp = 0.0087;
+constexpr double ThresholdDown = 0.039;
+constexpr double OveruseTimeMs = 10.0;
+constexpr qint64 AckedWindowUs = 500000;
+constexpr double DecreaseFactor = 0.85;
+// Рост скорости: 8% в секунду, до первой перегрузки - 25%
+constexpr double IncreasePerSecond = 1.08;
+constexpr double StartupIncreasePerSecond = 1.25;
+constexpr int MinLossWindowPackets = 20;
+constexpr double HighLoss = 0.10;
+constexpr double LowLoss = 0.02;
+// Запас под аудио и служебный трафик при выборе ступени видео
+constexpr double LadderHeadroom = 0.9;
+// Видео ограничено лестницей и редко занимает весь канал, поэтому оценку
+// разрешаем поднимать до двукратного фактически дошедшего битрейта
+constexpr double AckedBitrateMargin = 2.0;
+constexpr qint64 LadderStepUpIntervalMs = 3000;
+}
+
+void FeedbackCollector::onPacketReceived(quint32 sequence, qint64 arrivalUs)
+{
+    const bool first = !m_hasSequence;
+    const qint64 seq = unwrapSequence(sequence);
+    if (first) {
+        m_nextReported = seq;
+    }
+
+    // Опоздал к уже отправленному отчёту - там он посчитан потерянным
+    if (seq < m_nextReported) return;
+
+    m_arrivals.insert(seq, arrivalUs);
+
+    // Получатель отчётов мог пропасть: не копим бесконечно
+    while (m_arrivals.size() > Protocol::MaxFeedbackPackets * 4) {
+        m_arrivals.erase(m_arrivals.begin());
+        m_nextReported = m_arrivals.firstKey();
+    }
+}
+
+bool FeedbackCollector::takeFeedback(Protocol::TransportFeedback *feedback)
+{
+    if (m_arrivals.isEmpty()) return false;
+
+    // Слишком длинную дыру перед первым полученным пакетом не описываем
+    const qint64 firstReceived = m_arrivals.firstKey();
+    if (firstReceived - m_nextReported >= Protocol::MaxFeedbackPackets) {
+        m_nextReported = firstReceived;
+    }
+
+    const qint64 base = m_nextReported;
+    const qint64 end = qMin(m_arrivals.lastKey() + 1, base + Protocol::MaxFeedbackPackets);
+
+    feedback->baseSequence = quint32(base);
+    feedback->deltas.clear();
+    feedback->deltas.reserve(int(end - base));
+
+    bool hasReference = false;
+    qint64 previousUnits = 0;
+    auto it = m_arrivals.begin();
+    for (qint64 seq = base; seq < end; ++seq) {
+        if (it == m_arrivals.end() || it.key() != seq) {
+            feedback->deltas.append(Protocol::FeedbackNotReceived);
+            continue;
+        }
+
+        const qint64 units = it.value() / Protocol::FeedbackTimeUnitUs;
+        if (!hasReference) {
+            hasReference = true;
+            feedback->referenceTime = quint32(units);
+            previousUnits = units;
+        }
+        // Ограничиваем, не давая совпасть с FeedbackNotReceived; отправитель
+        // восстанавливает время той же суммой, поэтому ошибка не копится
+        const qint64 delta = std::clamp<qint64>(units - previousUnits, -32767, 32767);
+        feedback->deltas.append(qint16(delta));
+        previousUnits += delta;
+        it = m_arrivals.erase(it);
+    }
+
+    m_nextReported = end;
+    return true;
+}
+
+void FeedbackCollector::clear()
+{
+    m_arrivals.clear();
+    m_hasSequence = false;
+    m_highestSequence = 0;
+    m_nextReported = 0;
+}
+
+qint64 FeedbackCollector::unwrapSequence(quint32 sequence)
+{
+    if (!m_hasSequence) {
+        m_hasSequence = true;
+        m_highestSequence = sequence;
+        return sequence;
+    }
+
+    const qint64 seq = m_highestSequence + qint32(sequence - quint32(m_highestSequence));
+    if (seq > m_highestSequence) {
+        m_highestSequence = seq;
+    }
+    return seq;
+}
+
+CongestionController::CongestionController()
+    : m_history(SentHistorySize)
+{
+}
+
+void CongestionController::reset()
+{
+    *this = CongestionController();
+}
+
+void CongestionController::onPacketSent(quint32 sequence, int bytes, qint64 sendUs)
+{
+    SentPacket &slot = m_history[int(sequence % SentHistorySize)];
+    slot.sequence = sequence;
+    slot.bytes = bytes;
+    slot.sendUs = sendUs;
+}
+
+void CongestionController::onFeedback(const Protocol::TransportFeedback &feedback, qint64 nowUs)
+{
+    // referenceTime 32-битный и переполняется примерно раз в 12 суток
+    if (m_hasReference) {
+        m_referenceUnits += qint32(feedback.referenceTime - quint32(m_referenceUnits));
+    } else {
+        m_hasReference = true;
+        m_referenceUnits = feedback.referenceTime;
+    }
+
+    int received = 0;
+    int lost = 0;
+    qint64 arrivalUnits = m_referenceUnits;
+
+    for (int i = 0; i < feedback.deltas.size(); ++i) {
+        const quint32 sequence = feedback.baseSequence + quint32(i);
+        const SentPacket &sent = m_history.at(int(sequence % SentHistorySize));
+        const bool known = sent.sendUs >= 0 && sent.sequence == sequence;
+
+        if (feedback.deltas.at(i) == Protocol::FeedbackNotReceived) {
+            if (known) ++lost;
+            continue;
+        }
+
+        arrivalUnits += feedback.deltas.at(i);
+
+        if (!known) continue;
+        ++received;
+        onPacketAcked(sent, arrivalUnits * Protocol::FeedbackTimeUnitUs, nowUs);
+    }
+
+    if (received == 0 && lost == 0) return;
+
+    m_hasFeedback = true;
+    updateAckedBitrate();
+    updateDelayBasedRate(nowUs);
+    updateLossBasedRate(received, lost, nowUs);
+}
+
+void CongestionController::onPacketAcked(const SentPacket &sent, qint64 arrivalUs, qint64 nowUs)
+{
+    m_acked.append(qMakePair(arrivalUs, sent.bytes));
+    m_ackedBytes += sent.bytes;
+
+    if (m_currentGroup.firstSendUs < 0) {
+        m_currentGroup.firstSendUs = sent.sendUs;
+        m_currentGroup.lastSendUs = sent.sendUs;
+        m_currentGroup.lastArrivalUs = arrivalUs;
+        return;
+    }
+
+    // Переупорядоченный пакет из уже закрытой группы
+    if (sent.sendUs < m_currentGroup.firstSendUs) return;
+
+    if (sent.sendUs - m_currentGroup.firstSendUs <= GroupSpanUs) {
+        m_currentGroup.lastSendUs = qMax(m_currentGroup.lastSendUs, sent.sendUs);
+        m_currentGroup.lastArrivalUs = qMax(m_currentGroup.lastArrivalUs, arrivalUs);
+        return;
+    }
+
+    // Группа закрыта: сравниваем её с предыдущей
+    if (m_previousGroup.firstSendUs >= 0) {
+        const double sendDeltaMs = (m_currentGroup.lastSendUs - m_previousGroup.lastSendUs) / 1000.0;
+        const double arrivalDeltaMs = (m_currentGroup.lastArrivalUs - m_previousGroup.lastArrivalUs) / 1000.0;
+        updateTrendline(arrivalDeltaMs - sendDeltaMs, sendDeltaMs, m_currentGroup.lastArrivalUs, nowUs);
+    }
+
+    m_previousGroup = m_currentGroup;
+    m_currentGroup.firstSendUs = sent.sendUs;
+    m_currentGroup.lastSendUs = sent.sendUs;
+    m_currentGroup.lastArrivalUs = arrivalUs;
+}
+
+void CongestionController::updateTrendline(double delayDeltaMs, double sendDeltaMs, qint64 arrivalUs, qint64 nowUs)
+{
+    if (m_firstArrivalUs < 0) {
+        m_firstArrivalUs = arrivalUs;
+    }
+
+    m_numDeltas = qMin(m_numDeltas + 1, 1000);
+    m_accumulatedDelay += delayDeltaMs;
+    m_smoothedDelay = TrendlineSmoothing * m_smoothedDelay + (1.0 - TrendlineSmoothing) * m_accumulatedDelay;
+
+    m_delayWindow.append(qMakePair((arrivalUs - m_firstArrivalUs) / 1000.0, m_smoothedDelay));
+    if (m_delayWindow.size() > TrendlineWindow) {
+        m_delayWindow.removeFirst();
+    }
+    if (m_delayWindow.size() < TrendlineWindow) return;
+
+    // Наклон линейной регрессии задержки по времени прихода
+    double meanX = 0.0;
+    double meanY = 0.0;
+    for (const auto &point : m_delayWindow) {
+        meanX += point.first;
+        meanY += point.second;
+    }
+    meanX /= m_delayWindow.size();
+    meanY /= m_delayWindow.size();
+
+    double numerator = 0.0;
+    double denominator = 0.0;
+    for (const auto &point : m_delayWindow) {
+        numerator += (point.first - meanX) * (point.second - meanY);
+        denominator += (point.first - meanX) * (point.first - meanX);
+    }
+    const double slope = denominator > 0.0 ? numerator / denominator : 0.0;
+
+    detect(qMin(m_numDeltas, 60) * slope * TrendlineGain, sendDeltaMs, nowUs);
+}
+
+void CongestionController::detect(double trend, double sendDeltaMs, qint64 nowUs)
+{
+    if (trend > m_threshold) {
+        if (m_overuseTimeMs < 0.0) {
+            m_overuseTimeMs = sendDeltaMs / 2.0;
+        } else {
+            m_overuseTimeMs += sendDeltaMs;
+        }
+        ++m_overuseCounter;
+        // Перегрузка - только если тренд держится и не убывает
+        if (m_overuseTimeMs > OveruseTimeMs && m_overuseCounter > 1 && trend >= m_previousTrend) {
+            m_overuseTimeMs = 0.0;
+            m_overuseCounter = 0;
+            m_usage = Usage::Overusing;
+        }
+    } else if (trend < -m_threshold) {
+        m_overuseTimeMs = -1.0;
+        m_overuseCounter = 0;
+        m_usage = Usage::Underusing;
+    } else {
+        m_overuseTimeMs = -1.0;
+        m_overuseCounter = 0;
+        m_usage = Usage::Normal;
+    }
+
+    m_previousTrend = trend;
+    updateThreshold(trend, nowUs);
+}
+
+void CongestionController::updateThreshold(double trend, qint64 nowUs)
+{
+    if (m_lastThresholdUpdateUs < 0) {
+        m_lastThresholdUpdateUs = nowUs;
+    }
+
+    // Резкие выбросы не должны раздувать порог
+    const double absTrend = std::fabs(trend);
+    if (absTrend > m_threshold + 15.0) {
+        m_lastThresholdUpdateUs = nowUs;
+        return;
+    }
+
+    const double k = absTrend < m_threshold ? ThresholdDown : ThresholdUp;
+    const double dtMs = qMin((nowUs - m_lastThresholdUpdateUs) / 1000.0, 100.0);
+    m_threshold = std::clamp(m_threshold + k * (absTrend - m_threshold) * dtMs, MinThreshold, MaxThreshold);
+    m_lastThresholdUpdateUs = nowUs;
+}
+
+void CongestionController::updateAckedBitrate()
+{
+    if (m_acked.isEmpty()) return;
+
+    const qint64 newest = m_acked.last().first;
+    while (!m_acked.isEmpty() && m_acked.first().first < newest - AckedWindowUs) {
+        m_ackedBytes -= m_acked.first().second;
+        m_acked.removeFirst();
+    }
+
+    const qint64 spanUs = newest - m_acked.first().first;
+    if (spanUs < AckedWindowUs / 2) return;
+
+    m_ackedBitrate = m_ackedBytes * 8.0 * 1000000.0 / double(spanUs);
+}
+
+void CongestionController::updateDelayBasedRate(qint64 nowUs)
+{
+    const double dt = m_lastRateUpdateUs < 0 ? 0.0 : qMin((nowUs - m_lastRateUpdateUs) / 1e6, 1.0);
+    m_lastRateUpdateUs = nowUs;
+
+    switch (m_usage) {
+    case Usage::Overusing:
+        // Не чаще раза за RTT, иначе одна перегрузка срежет скорость многократно
+        if (m_lastDecreaseUs < 0 || nowUs - m_lastDecreaseUs >= qint64(m_rttMs * 1000.0)) {
+            const double base = m_ackedBitrate > 0.0 ? m_ackedBitrate : m_delayBasedBitrate;
+            m_delayBasedBitrate = qMin(m_delayBasedBitrate, DecreaseFactor * base);
+            m_lastDecreaseUs = nowUs;
+            m_startup = false;
+        }
+        break;
+    case Usage::Underusing:
+        // Очереди рассасываются: держим скорость
+        break;
+    case Usage::Normal:
+        m_delayBasedBitrate *= std::pow(m_startup ? StartupIncreasePerSecond : IncreasePerSecond, dt);
+        break;
+    }
+
+    // Без подтверждения канал не разгоняем сильно выше фактически дошедшего
+    if (m_ackedBitrate > 0.0) {
+        m_delayBasedBitrate = qMin(m_delayBasedBitrate, AckedBitrateMargin * m_ackedBitrate + 10000.0);
+    }
+    m_delayBasedBitrate = std::clamp(m_delayBasedBitrate, double(MinBitrate), double(MaxBitrate));
+}
+
+void CongestionController::updateLossBasedRate(int received, int lost, qint64 nowUs)
+{
+    m_lossWindowReceived += received;
+    m_lossWindowLost += lost;
+    const int total = m_lossWindowReceived + m_lossWindowLost;
+    if (total < MinLossWindowPackets) return;
+
+    m_lossFraction = double(m_lossWindowLost) / total;
+    m_lossWindowReceived = 0;
+    m_lossWindowLost = 0;
+
+    const double dt = m_lastLossUpdateUs < 0 ? 0.0 : qMin((nowUs - m_lastLossUpdateUs) / 1e6, 1.0);
+    m_lastLossUpdateUs = nowUs;
+
+    if (m_lossFraction > HighLoss) {
+        m_lossBasedBitrate *= 1.0 - 0.5 * m_lossFraction;
+        m_startup = false;
+    } else if (m_lossFraction < LowLoss) {
+        m_lossBasedBitrate *= std::pow(IncreasePerSecond, dt);
+    }
+
+    if (m_ackedBitrate > 0.0) {
+        m_lossBasedBitrate = qMin(m_lossBasedBitrate, AckedBitrateMargin * m_ackedBitrate + 10000.0);
+    }
+    m_lossBasedBitrate = std::clamp(m_lossBasedBitrate, double(MinBitrate), double(MaxBitrate));
+}
+
+VideoQualityLadder::VideoQualityLadder()
+{
+    // Соседние ступени отличаются по битрейту не больше чем в ~1.5 раза,
+    // иначе при ограничении сверху по фактически дошедшему битрейту
+    // подняться на следующую ступень было бы невозможно
+    m_steps = {
+        { QSize(1280, 720), 80, 30 },
+        { QSize(1280, 720), 70, 30 },
+        { QSize(960, 540), 80, 30 },
+        { QSize(960, 540), 70, 30 },
+        { QSize(640, 480), 80, 30 },
+        { QSize(640, 480), 70, 30 },
+        { QSize(640, 480), 70, 20 },
+        { QSize(640, 480), 60, 20 },
+        { QSize(560, 420), 60, 20 },
+        { QSize(480, 360), 60, 20 },
+        { QSize(480, 360), 60, 15 },
+        { QSize(400, 300), 60, 15 },
+        { QSize(320, 240), 60, 20 },
+        { QSize(320, 240), 50, 15 },
+        { QSize(320, 240), 50, 10 },
+        { QSize(320, 240), 40, 10 },
+        { QSize(320, 240), 40, 7 },
+        { QSize(240, 180), 40, 10 },
+        { QSize(160, 120), 40, 10 },
+        { QSize(160, 120), 40, 5 },
+    };    reset();
+}
+
+void VideoQualityLadder::reset()
+{
+    // Начинаем с прежних фиксированных 640x480 и качества 80
+    m_index = 4;
+    m_calibration = 1.0;
+    m_lastChangeMs = -1;
+}
+
+bool VideoQualityLadder::update(qint64 targetBitrate, qint64 nowMs)
+{
+    const double budget = targetBitrate * LadderHeadroom;
+
+    int best = m_steps.size() - 1;
+    for (int i = 0; i < m_steps.size(); ++i) {
+        if (expectedBitrate(i) <= budget) {
+            best = i;
+            break;
+        }
+    }
+
+    int next = m_index;
+    if (best > m_index) {
+        // Вниз - сразу, на нужную ступень
+        next = best;
+    } else if (best < m_index
+               && (m_lastChangeMs < 0 || nowMs - m_lastChangeMs >= LadderStepUpIntervalMs)) {
+        // Вверх - по одной ступени и не чаще раза в несколько секунд
+        next = m_index - 1;
+    }
+
+    if (next == m_index) return false;
+    m_index = next;
+    m_lastChangeMs = nowMs;
+    return true;
+}
+
+void VideoQualityLadder::onFrameEncoded(int bytes)
+{
+    const double predicted = predictedFrameBytes(m_index);
+    if (predicted <= 0.0 || bytes <= 0) return;
+
+    const double ratio = std::clamp(bytes / predicted, 0.1, 10.0);
+    m_calibration = 0.9 * m_calibration + 0.1 * ratio;
+}
+
+VideoEncoder::Settings VideoQualityLadder::settings() const
+{
+    VideoEncoder::Settings settings;
+    settings.resolution = currentStep().resolution;
+    settings.quality = currentStep().quality;
+    settings.maxFps = currentStep().fps;
+    return settings;
+}
+
+qint64 VideoQualityLadder::expectedBitrate(int index) const
+{
+    return qint64(predictedFrameBytes(index) * m_calibration * 8.0 * m_steps.at(index).fps);
+}
+
+double VideoQualityLadder::predictedFrameBytes(int index) const
+{
+    // Грубая модель JPEG: ~0.5 бит/пиксель при качестве 40, ~1 при 80
+    const Step &step = m_steps.at(index);
+    const double bitsPerPixel = 0.25 * std::exp(step.quality / 60.0);
+    return step.resolution.width() * step.resolution.height() * bitsPerPixel / 8.0;
+}
@@ -0,0 +1,166 @@
+#ifndef CONGESTIONCONTROLLER_H
+#define CONGESTIONCONTROLLER_H
+
+#include <QList>
+#include <QMap>
+#include <QPair>
+#include <QVector>
+#include <QtGlobal>
+#include "protocol.h"
+#include "videoencoder.h"
+
+// Оценка пропускной способности канала по задержке и потерям (в духе
+// Google Congestion Control с transport-wide feedback).
+//
+// Получатель (FeedbackCollector) запоминает время прихода каждого
+// видеопакета и периодически отправляет TRANSPORT_FEEDBACK. Отправитель
+// (CongestionController) сопоставляет его со своими временами отправки:
+// рост задержки между группами пакетов (тренд по линейной регрессии)
+// означает заполнение очереди на пути и снижает скорость, потери свыше 10%
+// - тоже. Итоговый битрейт - минимум из оценок по задержке и по потерям.
+
+class FeedbackCollector
+{
+public:
+    void onPacketReceived(quint32 sequence, qint64 arrivalUs);
+
+    // false - с прошлого отчёта ничего не пришло
+    bool takeFeedback(Protocol::TransportFeedback *feedback);
+
+    void clear();
+
+private:
+    qint64 unwrapSequence(quint32 sequence);
+
+    QMap<qint64, qint64> m_arrivals;   // развёрнутый sequence -> время прихода
+    bool m_hasSequence = false;
+    qint64 m_highestSequence = 0;
+    qint64 m_nextReported = 0;         // первый sequence, ещё не попавший в отчёт
+};
+
+class CongestionController
+{
+public:
+    enum class Usage { Normal, Overusing, Underusing };
+
+    static constexpr qint64 MinBitrate = 100000;
+    static constexpr qint64 MaxBitrate = 50000000;
+    static constexpr qint64 StartBitrate = 3000000;
+
+    CongestionController();
+
+    void reset();
+
+    void onPacketSent(quint32 sequence, int bytes, qint64 sendUs);
+    void onFeedback(const Protocol::TransportFeedback &feedback, qint64 nowUs);
+
+    // RTT влияет на скорость аддитивного роста; по умолчанию 100 мс
+    void setRttMs(double rttMs) { m_rttMs = qMax(1.0, rttMs); }
+
+    bool hasFeedback() const { return m_hasFeedback; }
+    qint64 targetBitrate() const { return qint64(qMin(m_delayBasedBitrate, m_lossBasedBitrate)); }
+    qint64 delayBasedBitrate() const { return qint64(m_delayBasedBitrate); }
+    qint64 lossBasedBitrate() const { return qint64(m_lossBasedBitrate); }
+    qint64 ackedBitrate() const { return qint64(m_ackedBitrate); }
+    double lossFraction() const { return m_lossFraction; }
+    Usage usage() const { return m_usage; }
+
+private:
+    struct SentPacket
+    {
+        quint32 sequence = 0;
+        int bytes = 0;
+        qint64 sendUs = -1;
+    };
+
+    // Пакеты, отправленные в пределах GroupSpanUs, считаются одной группой
+    // (фрагменты одного кадра)
+    struct PacketGroup
+    {
+        qint64 firstSendUs = -1;
+        qint64 lastSendUs = 0;
+        qint64 lastArrivalUs = 0;
+    };
+
+    void onPacketAcked(const SentPacket &sent, qint64 arrivalUs, qint64 nowUs);
+    void updateTrendline(double delayDeltaMs, double sendDeltaMs, qint64 arrivalUs, qint64 nowUs);
+    void detect(double trend, double sendDeltaMs, qint64 nowUs);
+    void updateThreshold(double trend, qint64 nowUs);
+    void updateAckedBitrate();
+    void updateDelayBasedRate(qint64 nowUs);
+    void updateLossBasedRate(int received, int lost, qint64 nowUs);
+
+    QVector<SentPacket> m_history;
+    bool m_hasReference = false;
+    qint64 m_referenceUnits = 0;
+
+    PacketGroup m_currentGroup;
+    PacketGroup m_previousGroup;
+
+    // Тренд задержки
+    double m_accumulatedDelay = 0.0;
+    double m_smoothedDelay = 0.0;
+    qint64 m_firstArrivalUs = -1;
+    int m_numDeltas = 0;
+    QList<QPair<double, double>> m_delayWindow;  // (время прихода, мс; сглаженная задержка, мс)
+    double m_previousTrend = 0.0;
+
+    // Детектор перегрузки с адаптивным порогом
+    double m_threshold = 12.5;
+    qint64 m_lastThresholdUpdateUs = -1;
+    double m_overuseTimeMs = -1.0;
+    int m_overuseCounter = 0;
+    Usage m_usage = Usage::Normal;
+
+    // Скорость
+    bool m_hasFeedback = false;
+    bool m_startup = true;
+    double m_rttMs = 100.0;
+    double m_delayBasedBitrate = StartBitrate;
+    double m_lossBasedBitrate = StartBitrate;
+    double m_ackedBitrate = 0.0;
+    qint64 m_lastRateUpdateUs = -1;
+    qint64 m_lastDecreaseUs = -1;
+    qint64 m_lastLossUpdateUs = -1;
+    int m_lossWindowReceived = 0;
+    int m_lossWindowLost = 0;
+    double m_lossFraction = 0.0;
+    QList<QPair<qint64, int>> m_acked;   // (время прихода, байты) за последние AckedWindowUs
+    qint64 m_ackedBytes = 0;
+};
+
+// Лестница качества видео: разрешение, качество JPEG и частота кадров под
+// целевой битрейт. Ожидаемый битрейт ступени рассчитывается по числу бит на
+// пиксель для данного качества и уточняется по реальным размерам кадров.
+class VideoQualityLadder
+{
+public:
+    struct Step
+    {
+        QSize resolution;
+        int quality;
+        int fps;
+    };
+
+    VideoQualityLadder();
+
+    void reset();
+
+    // true - ступень сменилась
+    bool update(qint64 targetBitrate, qint64 nowMs);
+    void onFrameEncoded(int bytes);
+
+    const Step &currentStep() const { return m_steps.at(m_index); }
+    VideoEncoder::Settings settings() const;
+    qint64 expectedBitrate(int index) const;
+
+private:
+    double predictedFrameBytes(int index) const;
+
+    QList<Step> m_steps;
+    int m_index = 0;
+    double m_calibration = 1.0;   // реальный размер кадра / расчётный
+    qint64 m_lastChangeMs = -1;
+};
+
+#endif // CONGESTIONCONTROLLER_H
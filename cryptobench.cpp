@@ -0,0 +1,140 @@
+#include "benchutil.h"
+#include "mediacrypto.h"
+#include <QUuid>
+#include <cstring>
+#include <vector>
+
+// Скорость шифрования медиа на этой машине: сколько стоит пакет на
+// отправке (seal) и на приёме (open) и какую долю ядра это займёт при
+// заданном битрейте. Перед замером - проверка по примеру из RFC 8439,
+// чтобы не мерить скорость неправильной реализации.
+//
+//   AuthoLASTVLADIOCryptoBench --sizes 160,1200 --bitrate 8000
+
+namespace {
+
+using Bench::out;
+
+QByteArray hex(const char *text)
+{
+    return QByteArray::fromHex(QByteArray(text));
+}
+
+// RFC 8439, 2.8.2
+bool knownAnswer()
+{
+    const QByteArray key = hex("808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f");
+    const QByteArray nonce = hex("070000004041424344454647");
+    const QByteArray aad = hex("50515253c0c1c2c3c4c5c6c7");
+    const QByteArray plaintext("Ladies and Gentlemen of the class of '99: If I could offer you only one tip "
+                               "for the future, sunscreen would be it.");
+    const QByteArray expectedTag = hex("1ae10b594f09e26a7e902ecbd0600691");
+
+    const auto *k = reinterpret_cast<const uchar *>(key.constData());
+    const auto *n = reinterpret_cast<const uchar *>(nonce.constData());
+    const auto *a = reinterpret_cast<const uchar *>(aad.constData());
+    QByteArray data = plaintext;
+    uchar tag[ChaCha20Poly1305::TagSize];
+    ChaCha20Poly1305::seal(k, n, a, aad.size(), reinterpret_cast<uchar *>(data.data()), data.size(), tag);
+    if (QByteArray(reinterpret_cast<const char *>(tag), sizeof(tag)) != expectedTag
+        || data.startsWith(plaintext.left(16))) {
+        return false;
+    }
+
+    // Обратно, и испорченный тег не проходит
+    QByteArray opened = data;
+    if (!ChaCha20Poly1305::open(k, n, a, aad.size(), reinterpret_cast<uchar *>(opened.data()), opened.size(), tag)
+        || opened != plaintext) {
+        return false;
+    }
+    tag[0] ^= 1;
+    return !ChaCha20Poly1305::open(k, n, a, aad.size(), reinterpret_cast<uchar *>(data.data()), data.size(), tag);
+}
+
+struct Result
+{
+    double sealNs = 0.0;   // на пакет
+    double openNs = 0.0;
+};
+
+// Пакет аудио или видео с полезной нагрузкой payloadSize байт
+Result measure(const MediaCrypto::Key &key, int payloadSize, double seconds)
+{
+    const qsizetype length = Protocol::HeaderSize + payloadSize + MediaCrypto::TagSize;
+    Protocol::PacketHeader header;
+    header.type = payloadSize > 400 ? Protocol::PacketType::Video : Protocol::PacketType::Audio;
+    header.peerId = 1;
+    header.encrypted = true;
+    std::vector<char> packet(size_t(length), 0x5a);
+    Protocol::writeHeader(packet.data(), header);
+
+    Result result;
+
+    // Отправка: каждый пакет со своим sequence, как в звонке
+    result.sealNs = Bench::nsPerCall(seconds, [&](qint64 i) {
+        header.sequence = quint32(i);
+        Protocol::writeHeader(packet.data(), header);
+        MediaCrypto::seal(key, packet.data(), length);
+    });
+
+    // Приём: open расшифровывает на месте, поэтому каждый раз - с копии
+    const std::vector<char> sealed = packet;
+    bool opened = true;
+    result.openNs = Bench::nsPerCall(seconds, [&](qint64) {
+        memcpy(packet.data(), sealed.data(), size_t(length));
+        opened = MediaCrypto::open(key, packet.data(), length) && opened;
+    });
+    return opened ? result : Result();
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    Bench::prepare(parser, "AuthoLASTVLADIOCryptoBench",
+                   "Скорость шифрования медиа: ChaCha20-Poly1305 на пакет и доля ядра");
+    const QCommandLineOption sizesOption("sizes", "Полезная нагрузка пакетов, байт, через запятую.", "bytes", "160,1200");
+    const QCommandLineOption bitrateOption("bitrate", "Битрейт звонка для оценки нагрузки, кбит/с.", "kbps", "8000");
+    const QCommandLineOption durationOption("duration", "Замер на размер и направление, с.", "seconds", "1");
+    parser.addOptions({ sizesOption, bitrateOption, durationOption });
+    parser.process(app);
+
+    if (!knownAnswer()) {
+        out() << "Ошибка: результат не совпадает с примером RFC 8439" << Qt::endl;
+        return 1;
+    }
+    out() << "Проверка по RFC 8439: пройдена" << Qt::endl;
+
+    const double bitrate = parser.value(bitrateOption).toDouble() * 1000;
+    const double seconds = qMax(0.1, parser.value(durationOption).toDouble());
+    const MediaCrypto::Key key = MediaCrypto::senderKey(MediaCrypto::deriveCallKey("bench"), QUuid::createUuid());
+
+    const QStringList sizes = parser.value(sizesOption).split(',', Qt::SkipEmptyParts);
+    for (const QString &size : sizes) {
+        const int payloadSize = qBound(1, size.toInt(), 2000);
+        const Result result = measure(key, payloadSize, seconds);
+        if (result.sealNs <= 0.0 || result.openNs <= 0.0) {
+            out() << "Ошибка: зашифрованный пакет не прошёл проверку" << Qt::endl;
+            return 1;
+        }
+
+        // Пакетов в секунду при заданном битрейте этими пакетами
+        const double bytes = Protocol::HeaderSize + payloadSize + MediaCrypto::TagSize;
+        const double packetsPerSecond = bitrate / 8 / bytes;
+        out() << QString("%1 байт: шифрование %2 нс/пак (%3 МБ/с), расшифровка %4 нс/пак (%5 МБ/с);"
+                         " при %6 кбит/с (%7 пак/с) - %8% ядра на отправку, %9% на приём от участника")
+                     .arg(payloadSize)
+                     .arg(result.sealNs, 0, 'f', 0)
+                     .arg(payloadSize / result.sealNs * 1e3, 0, 'f', 1)
+                     .arg(result.openNs, 0, 'f', 0)
+                     .arg(payloadSize / result.openNs * 1e3, 0, 'f', 1)
+                     .arg(bitrate / 1000, 0, 'f', 0)
+                     .arg(packetsPerSecond, 0, 'f', 0)
+                     .arg(packetsPerSecond * result.sealNs / 1e7, 0, 'f', 2)
+                     .arg(packetsPerSecond * result.openNs / 1e7, 0, 'f', 2)
+              << Qt::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "failuredetector.h"
+#include <QtMath>
+
+FailureDetector::FailureDetector(const Config &config)
+    : m_config(config)
+{
+    clear();
+}
+
+void FailureDetector::clear()
+{
+    m_intervals.clear();
+    m_intervals.reserve(m_config.windowSize);
+    m_next = 0;
+    m_sum = 0.0;
+    m_sumSquares = 0.0;
+    m_lastHeartbeatUs = 0;
+    m_lastActivityUs = 0;
+
+    // Затравка: ожидаемый интервал с разбросом в четверть, как до первых измерений
+    const double mean = m_config.expectedIntervalMs;
+    const double deviation = mean / 4.0;
+    addInterval(mean - deviation);
+    addInterval(mean + deviation);
+}
+
+void FailureDetector::heartbeat(qint64 nowUs)
+{
+    if (m_lastHeartbeatUs != 0 && nowUs > m_lastHeartbeatUs) {
+        addInterval((nowUs - m_lastHeartbeatUs) / 1000.0);
+    }
+    m_lastHeartbeatUs = nowUs;
+    activity(nowUs);
+}
+
+void FailureDetector::activity(qint64 nowUs)
+{
+    m_lastActivityUs = qMax(m_lastActivityUs, nowUs);
+}
+
+void FailureDetector::addInterval(double intervalMs)
+{
+    if (m_intervals.size() < m_config.windowSize) {
+        m_intervals.append(intervalMs);
+    } else {
+        const double old = m_intervals[m_next];
+        m_sum -= old;
+        m_sumSquares -= old * old;
+        m_intervals[m_next] = intervalMs;
+        m_next = (m_next + 1) % m_config.windowSize;
+    }
+    m_sum += intervalMs;
+    m_sumSquares += intervalMs * intervalMs;
+}
+
+double FailureDetector::meanIntervalMs() const
+{
+    return m_intervals.isEmpty() ? m_config.expectedIntervalMs : m_sum / m_intervals.size();
+}
+
+double FailureDetector::stdDevMs() const
+{
+    if (m_intervals.size() < 2) return m_config.minStdDevMs;
+    const double mean = meanIntervalMs();
+    const double variance = qMax(0.0, m_sumSquares / m_intervals.size() - mean * mean);
+    return qMax(m_config.minStdDevMs, qSqrt(variance));
+}
+
+double FailureDetector::phi(qint64 nowUs) const
+{
+    if (m_lastActivityUs == 0) return 0.0;
+
+    const double elapsedMs = (nowUs - m_lastActivityUs) / 1000.0;
+    const double mean = meanIntervalMs() + m_config.acceptablePauseMs;
+    const double y = (elapsedMs - mean) / stdDevMs();
+
+    // Логистическое приближение хвоста нормального распределения
+    // (как в Akka): точность 1e-4, без erfc и без переполнения
+    const double e = qExp(-y * (1.5976 + 0.070566 * y * y));
+    if (elapsedMs > mean) {
+        return -std::log10(e / (1.0 + e));
+    }
+    return -std::log10(1.0 - 1.0 / (1.0 + e));
+}
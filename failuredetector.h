@@ -0,0 +1,57 @@
+#ifndef FAILUREDETECTOR_H
+#define FAILUREDETECTOR_H
+
+#include <QList>
+#include <QtGlobal>
+
+// Адаптивный детектор отказа участника (phi-accrual).
+//
+// Вместо порога "пропущено N пингов" детектор копит интервалы между
+// KEEPALIVE и по их среднему и разбросу оценивает, насколько невероятна
+// текущая тишина: phi = -log10(P(интервал длиннее прошедшего)). phi 8 -
+// шанс ошибиться порядка 1e-8 для нормального распределения. Стабильная
+// сеть даёт узкое распределение и быстрое решение, джиттер сам
+// раздвигает порог. Любой другой пакет участника тоже доказывает, что он
+// жив, и отодвигает отсчёт, но в статистику интервалов не попадает:
+// медиа идёт с другим темпом и может прерываться.
+class FailureDetector
+{
+public:
+    struct Config
+    {
+        double threshold = 8.0;
+        int windowSize = 100;            // интервалов в статистике
+        double minStdDevMs = 100.0;      // снизу: в идеальной сети не дёргаться от одного опоздания
+        double acceptablePauseMs = 1500.0;   // запас на потерю пары KEEPALIVE подряд
+        double expectedIntervalMs = 500.0;   // начальная оценка, пока интервалов нет
+    };
+
+    FailureDetector() : FailureDetector(Config()) {}
+    explicit FailureDetector(const Config &config);
+
+    // KEEPALIVE: новый интервал в статистику
+    void heartbeat(qint64 nowUs);
+    // Любой другой пакет: участник жив
+    void activity(qint64 nowUs);
+
+    double phi(qint64 nowUs) const;
+    bool isAvailable(qint64 nowUs) const { return phi(nowUs) < m_config.threshold; }
+
+    double meanIntervalMs() const;
+    double stdDevMs() const;
+
+    void clear();
+
+private:
+    void addInterval(double intervalMs);
+
+    Config m_config;
+    QList<double> m_intervals;         // кольцо на windowSize
+    int m_next = 0;
+    double m_sum = 0.0;
+    double m_sumSquares = 0.0;
+    qint64 m_lastHeartbeatUs = 0;
+    qint64 m_lastActivityUs = 0;
+};
+
+#endif // FAILUREDETECTOR_H
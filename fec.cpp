@@ -0,0 +1,640 @@
+#include "fec.h"
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define FEC_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Группы и блоки старше этого окна по sequence забываются
+constexpr qint64 DecoderWindow = 1024;
+
+struct Tables
+{
+    uchar exp[512];
+    uchar log[256];
+    // Произведения на младший и старший полубайт для умножения областей
+    uchar mulLow[256][16];
+    uchar mulHigh[256][16];
+
+    Tables()
+    {
+        int x = 1;
+        for (int i = 0; i < 255; ++i) {
+            exp[i] = uchar(x);
+            log[x] = uchar(i);
+            x <<= 1;
+            if (x & 0x100) x ^= 0x11d;
+        }
+        for (int i = 255; i < 512; ++i) {
+            exp[i] = exp[i - 255];
+        }
+        log[0] = 0;
+
+        for (int c = 0; c < 256; ++c) {
+            for (int n = 0; n < 16; ++n) {
+                mulLow[c][n] = multiply(uchar(c), uchar(n));
+                mulHigh[c][n] = multiply(uchar(c), uchar(n << 4));
+            }
+        }
+    }
+
+    uchar multiply(uchar a, uchar b) const
+    {
+        if (a == 0 || b == 0) return 0;
+        return exp[log[a] + log[b]];
+    }
+};
+
+const Tables &tables()
+{
+    static const Tables instance;
+    return instance;
+}
+
+void xorScalar(uchar *dst, const uchar *src, qsizetype length)
+{
+    for (qsizetype i = 0; i < length; ++i) {
+        dst[i] ^= src[i];
+    }
+}
+
+void mulAddScalar(uchar *dst, const uchar *src, const uchar *low, const uchar *high, qsizetype length)
+{
+    for (qsizetype i = 0; i < length; ++i) {
+        dst[i] ^= low[src[i] & 0x0f] ^ high[src[i] >> 4];
+    }
+}
+
+#ifdef FEC_X86_SIMD
+__attribute__((target("sse2")))
+void xorSse2(uchar *dst, const uchar *src, qsizetype length)
+{
+    qsizetype i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(a, b));
+    }
+    xorScalar(dst + i, src + i, length - i);
+}
+
+__attribute__((target("avx2")))
+void xorAvx2(uchar *dst, const uchar *src, qsizetype length)
+{
+    qsizetype i = 0;
+    for (; i + 32 <= length; i += 32) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_xor_si256(a, b));
+    }
+    xorScalar(dst + i, src + i, length - i);
+}
+
+// Умножение на константу через PSHUFB: два табличных поиска по полубайтам
+__attribute__((target("ssse3")))
+void mulAddSsse3(uchar *dst, const uchar *src, const uchar *low, const uchar *high, qsizetype length)
+{
+    const __m128i tableLow = _mm_loadu_si128(reinterpret_cast<const __m128i *>(low));
+    const __m128i tableHigh = _mm_loadu_si128(reinterpret_cast<const __m128i *>(high));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+
+    qsizetype i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const __m128i lo = _mm_and_si128(s, mask);
+        const __m128i hi = _mm_and_si128(_mm_srli_epi64(s, 4), mask);
+        const __m128i product = _mm_xor_si128(_mm_shuffle_epi8(tableLow, lo), _mm_shuffle_epi8(tableHigh, hi));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(d, product));
+    }
+    mulAddScalar(dst + i, src + i, low, high, length - i);
+}
+
+__attribute__((target("avx2")))
+void mulAddAvx2(uchar *dst, const uchar *src, const uchar *low, const uchar *high, qsizetype length)
+{
+    const __m256i tableLow = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(low)));
+    const __m256i tableHigh = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(high)));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+
+    qsizetype i = 0;
+    for (; i + 32 <= length; i += 32) {
+        const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        const __m256i lo = _mm256_and_si256(s, mask);
+        const __m256i hi = _mm256_and_si256(_mm256_srli_epi64(s, 4), mask);
+        const __m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(tableLow, lo),
+                                                 _mm256_shuffle_epi8(tableHigh, hi));
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_xor_si256(d, product));
+    }
+    mulAddScalar(dst + i, src + i, low, high, length - i);
+}
+#endif
+
+struct Backend
+{
+    void (*xorRegion)(uchar *, const uchar *, qsizetype);
+    void (*mulAddRegion)(uchar *, const uchar *, const uchar *, const uchar *, qsizetype);
+    const char *name;
+};
+
+// Реализации, которые поддерживает процессор, от таблиц к самой быстрой
+QList<Backend> supportedBackends()
+{
+    QList<Backend> backends = { { xorScalar, mulAddScalar, "scalar" } };
+#ifdef FEC_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        backends.append({ xorSse2, mulAddScalar, "SSE2" });
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        backends.append({ xorSse2, mulAddSsse3, "SSSE3" });
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        backends.append({ xorAvx2, mulAddAvx2, "AVX2" });
+    }
+#endif
+    return backends;
+}
+
+struct Backends
+{
+    QList<Backend> supported = supportedBackends();
+    qsizetype current = supported.size() - 1;
+};
+
+Backends &backends()
+{
+    static Backends instance;
+    return instance;
+}
+
+const Backend &backend()
+{
+    const Backends &b = backends();
+    return b.supported.at(b.current);
+}
+
+// Коэффициент матрицы Коши 1 / (x_j + y_i), x_j = k + j, y_i = i: любая
+// квадратная подматрица обратима, поэтому любые k пакетов из k + m
+// восстанавливают группу
+uchar cauchy(int sourceCount, int parityIndex, int sourceIndex)
+{
+    return Gf256::inverse(uchar((sourceCount + parityIndex) ^ sourceIndex));
+}
+
+void writeFecHeader(uchar *p, const Fec::Header &header)
+{
+    p[0] = quint8(header.stream);
+    p[1] = quint8(header.scheme);
+    qToBigEndian<quint32>(header.baseSequence, p + 2);
+    p[6] = header.sourceCount;
+    p[7] = header.parityCount;
+    p[8] = header.parityIndex;
+    qToBigEndian<quint16>(header.length, p + 9);
+}
+
+// Обращение квадратной матрицы над GF(256) методом Гаусса-Жордана
+bool invertMatrix(QList<uchar> &matrix, int n)
+{
+    QList<uchar> inverse(n * n, 0);
+    for (int i = 0; i < n; ++i) {
+        inverse[i * n + i] = 1;
+    }
+
+    for (int col = 0; col < n; ++col) {
+        int pivot = col;
+        while (pivot < n && matrix[pivot * n + col] == 0) ++pivot;
+        if (pivot == n) return false;
+
+        if (pivot != col) {
+            for (int k = 0; k < n; ++k) {
+                std::swap(matrix[pivot * n + k], matrix[col * n + k]);
+                std::swap(inverse[pivot * n + k], inverse[col * n + k]);
+            }
+        }
+
+        const uchar scale = Gf256::inverse(matrix[col * n + col]);
+        for (int k = 0; k < n; ++k) {
+            matrix[col * n + k] = Gf256::mul(matrix[col * n + k], scale);
+            inverse[col * n + k] = Gf256::mul(inverse[col * n + k], scale);
+        }
+
+        for (int row = 0; row < n; ++row) {
+            const uchar factor = matrix[row * n + col];
+            if (row == col || factor == 0) continue;
+            for (int k = 0; k < n; ++k) {
+                matrix[row * n + k] ^= Gf256::mul(factor, matrix[col * n + k]);
+                inverse[row * n + k] ^= Gf256::mul(factor, inverse[col * n + k]);
+            }
+        }
+    }
+
+    matrix = inverse;
+    return true;
+}
+
+} // namespace
+
+namespace Fec {
+
+bool readHeader(QByteArrayView payload, Header *header)
+{
+    if (payload.size() < HeaderSize) return false;
+
+    const uchar *p = reinterpret_cast<const uchar *>(payload.data());
+    if (p[0] >= quint8(Protocol::MediaStream::Count) || p[1] > quint8(Scheme::ReedSolomon)) return false;
+
+    header->stream = Protocol::MediaStream(p[0]);
+    header->scheme = Scheme(p[1]);
+    header->baseSequence = qFromBigEndian<quint32>(p + 2);
+    header->sourceCount = p[6];
+    header->parityCount = p[7];
+    header->parityIndex = p[8];
+    header->length = qFromBigEndian<quint16>(p + 9);
+
+    if (header->sourceCount == 0 || header->sourceCount > MaxSourceCount) return false;
+    if (header->parityCount == 0 || header->parityCount > MaxParityCount) return false;
+    if (header->parityIndex >= header->parityCount) return false;
+    if (header->scheme == Scheme::Xor && header->parityCount != 1) return false;
+    return payload.size() >= HeaderSize + header->length;
+}
+
+} // namespace Fec
+
+namespace Gf256 {
+
+uchar mul(uchar a, uchar b)
+{
+    return tables().multiply(a, b);
+}
+
+uchar inverse(uchar a)
+{
+    const Tables &t = tables();
+    return a == 0 ? 0 : t.exp[255 - t.log[a]];
+}
+
+void xorRegion(uchar *dst, const uchar *src, qsizetype length)
+{
+    backend().xorRegion(dst, src, length);
+}
+
+void mulAddRegion(uchar *dst, const uchar *src, uchar coef, qsizetype length)
+{
+    if (coef == 0) return;
+    if (coef == 1) {
+        backend().xorRegion(dst, src, length);
+        return;
+    }
+    const Tables &t = tables();
+    backend().mulAddRegion(dst, src, t.mulLow[coef], t.mulHigh[coef], length);
+}
+
+const char *backendName()
+{
+    return backend().name;
+}
+
+QList<const char *> backendNames()
+{
+    QList<const char *> names;
+    for (const Backend &b : backends().supported) {
+        names.append(b.name);
+    }
+    return names;
+}
+
+bool setBackend(const char *name)
+{
+    Backends &b = backends();
+    for (qsizetype i = 0; i < b.supported.size(); ++i) {
+        if (qstrcmp(b.supported.at(i).name, name) == 0) {
+            b.current = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace Gf256
+
+void FecEncoder::setParams(const Fec::Params &params)
+{
+    if (params == m_params) return;
+
+    m_params = params;
+    m_params.sourceCount = qBound(0, m_params.sourceCount, Fec::MaxSourceCount);
+    m_params.parityCount = qBound(0, m_params.parityCount, Fec::MaxParityCount);
+    if (m_params.scheme == Fec::Scheme::Xor) {
+        m_params.parityCount = qMin(m_params.parityCount, 1);
+    }
+    clear();
+}
+
+QList<QByteArray> FecEncoder::addSource(Protocol::MediaStream stream, quint32 sequence, quint32 timestamp,
+                                        QByteArrayView payload)
+{
+    if (!m_params.enabled() || payload.size() > 0xffff - Fec::BlockHeaderSize) return {};
+
+    // Группа - строго подряд идущие sequence
+    if (!m_blocks.isEmpty() && sequence != m_baseSequence + quint32(m_blocks.size())) {
+        clear();
+    }
+    if (m_blocks.isEmpty()) {
+        m_baseSequence = sequence;
+    }
+
+    QByteArray block(Fec::BlockHeaderSize + payload.size(), Qt::Uninitialized);
+    uchar *p = reinterpret_cast<uchar *>(block.data());
+    qToBigEndian<quint32>(timestamp, p);
+    qToBigEndian<quint16>(quint16(payload.size()), p + 4);
+    if (!payload.isEmpty()) {
+        memcpy(p + Fec::BlockHeaderSize, payload.data(), payload.size());
+    }
+    m_maxLength = qMax(m_maxLength, int(block.size()));
+    m_blocks.append(block);
+
+    if (m_blocks.size() < m_params.sourceCount) return {};
+
+    Fec::Header header;
+    header.stream = stream;
+    header.scheme = m_params.scheme;
+    header.baseSequence = m_baseSequence;
+    header.sourceCount = quint8(m_params.sourceCount);
+    header.parityCount = quint8(m_params.parityCount);
+    header.length = quint16(m_maxLength);
+
+    QList<QByteArray> parities;
+    for (int j = 0; j < m_params.parityCount; ++j) {
+        header.parityIndex = quint8(j);
+
+        QByteArray out(Fec::HeaderSize + m_maxLength, '\0');
+        uchar *dst = reinterpret_cast<uchar *>(out.data());
+        writeFecHeader(dst, header);
+        uchar *parity = dst + Fec::HeaderSize;
+
+        for (int i = 0; i < m_blocks.size(); ++i) {
+            const QByteArray &source = m_blocks.at(i);
+            const uchar *src = reinterpret_cast<const uchar *>(source.constData());
+            if (m_params.scheme == Fec::Scheme::Xor) {
+                Gf256::xorRegion(parity, src, source.size());
+            } else {
+                Gf256::mulAddRegion(parity, src, cauchy(m_params.sourceCount, j, i), source.size());
+            }
+        }
+        parities.append(out);
+    }
+
+    clear();
+    return parities;
+}
+
+void FecEncoder::clear()
+{
+    m_blocks.clear();
+    m_maxLength = 0;
+}
+
+QList<Fec::RecoveredPacket> FecDecoder::addSource(quint32 sequence, quint32 timestamp, QByteArrayView payload)
+{
+    const qint64 seq = unwrapSequence(sequence);
+    if (m_sources.contains(seq) || payload.size() > 0xffff - Fec::BlockHeaderSize) return {};
+
+    QByteArray block(Fec::BlockHeaderSize + payload.size(), Qt::Uninitialized);
+    uchar *p = reinterpret_cast<uchar *>(block.data());
+    qToBigEndian<quint32>(timestamp, p);
+    qToBigEndian<quint16>(quint16(payload.size()), p + 4);
+    if (!payload.isEmpty()) {
+        memcpy(p + Fec::BlockHeaderSize, payload.data(), payload.size());
+    }
+    m_sources.insert(seq, block);
+    prune();
+
+    // Группы, в которые входит пакет: base в (seq - MaxSourceCount, seq]
+    QList<Fec::RecoveredPacket> recovered;
+    for (auto it = m_groups.lowerBound(seq - Fec::MaxSourceCount + 1);
+         it != m_groups.end() && it.key() <= seq; ++it) {
+        Group &group = it.value();
+        if (!group.done && seq < it.key() + group.sourceCount) {
+            recovered.append(tryRecover(it.key(), group));
+        }
+    }
+    return recovered;
+}
+
+QList<Fec::RecoveredPacket> FecDecoder::addParity(const Fec::Header &header, QByteArrayView parity)
+{
+    m_stats.parityPackets++;
+
+    const qint64 base = unwrapSequence(header.baseSequence);
+    if (base < m_highestSequence - DecoderWindow) return {};
+
+    auto it = m_groups.find(base);
+    if (it == m_groups.end()) {
+        Group group;
+        group.scheme = header.scheme;
+        group.sourceCount = header.sourceCount;
+        group.parityCount = header.parityCount;
+        group.length = header.length;
+        m_groups.insert(base, group);
+        it = m_groups.find(base);
+    }
+
+    Group &group = it.value();
+    if (group.scheme != header.scheme || group.sourceCount != header.sourceCount
+        || group.parityCount != header.parityCount || group.length != header.length) {
+        return {};
+    }
+    if (group.done || group.parities.contains(header.parityIndex)) return {};
+
+    group.parities.insert(header.parityIndex, parity.first(header.length).toByteArray());
+    prune();
+    return tryRecover(base, group);
+}
+
+QList<Fec::RecoveredPacket> FecDecoder::tryRecover(qint64 base, Group &group)
+{
+    QList<int> missing;
+    for (int i = 0; i < group.sourceCount; ++i) {
+        if (!m_sources.contains(base + i)) missing.append(i);
+    }
+    if (missing.isEmpty()) {
+        group.done = true;
+        group.parities.clear();
+        return {};
+    }
+    if (missing.size() > group.parities.size()) return {};
+
+    const int n = int(missing.size());
+    const int length = group.length;
+
+    // Используемые пакеты чётности по возрастанию индекса
+    QList<int> parityIndexes = group.parities.keys();
+    std::sort(parityIndexes.begin(), parityIndexes.end());
+    parityIndexes.resize(n);
+
+    // Синдромы: чётность минус вклад полученных пакетов
+    QList<QByteArray> syndromes;
+    for (int r = 0; r < n; ++r) {
+        const int j = parityIndexes.at(r);
+        QByteArray syndrome = group.parities.value(j);
+        uchar *dst = reinterpret_cast<uchar *>(syndrome.data());
+
+        for (int i = 0; i < group.sourceCount; ++i) {
+            auto source = m_sources.constFind(base + i);
+            if (source == m_sources.constEnd()) continue;
+
+            const QByteArray &block = source.value();
+            const qsizetype size = qMin<qsizetype>(block.size(), length);
+            const uchar *src = reinterpret_cast<const uchar *>(block.constData());
+            if (group.scheme == Fec::Scheme::Xor) {
+                Gf256::xorRegion(dst, src, size);
+            } else {
+                Gf256::mulAddRegion(dst, src, cauchy(group.sourceCount, j, i), size);
+            }
+        }
+        syndromes.append(syndrome);
+    }
+
+    QList<QByteArray> blocks;
+    if (group.scheme == Fec::Scheme::Xor) {
+        blocks = syndromes;
+    } else {
+        QList<uchar> matrix(n * n);
+        for (int r = 0; r < n; ++r) {
+            for (int c = 0; c < n; ++c) {
+                matrix[r * n + c] = cauchy(group.sourceCount, parityIndexes.at(r), missing.at(c));
+            }
+        }
+        if (!invertMatrix(matrix, n)) return {};
+
+        for (int c = 0; c < n; ++c) {
+            QByteArray block(length, '\0');
+            uchar *dst = reinterpret_cast<uchar *>(block.data());
+            for (int r = 0; r < n; ++r) {
+                Gf256::mulAddRegion(dst, reinterpret_cast<const uchar *>(syndromes.at(r).constData()),
+                                    matrix[c * n + r], length);
+            }
+            blocks.append(block);
+        }
+    }
+
+    QList<Fec::RecoveredPacket> recovered;
+    for (int c = 0; c < n; ++c) {
+        const QByteArray &block = blocks.at(c);
+        if (block.size() < Fec::BlockHeaderSize) continue;
+
+        const uchar *p = reinterpret_cast<const uchar *>(block.constData());
+        const int payloadSize = qFromBigEndian<quint16>(p + 4);
+        if (Fec::BlockHeaderSize + payloadSize > block.size()) continue;
+
+        Fec::RecoveredPacket packet;
+        packet.sequence = quint32(base + missing.at(c));
+        packet.timestamp = qFromBigEndian<quint32>(p);
+        packet.payload = block.mid(Fec::BlockHeaderSize, payloadSize);
+        m_sources.insert(base + missing.at(c), block.left(Fec::BlockHeaderSize + payloadSize));
+        recovered.append(packet);
+    }
+
+    m_stats.recovered += recovered.size();
+    group.done = true;
+    group.parities.clear();
+    return recovered;
+}
+
+void FecDecoder::prune()
+{
+    const qint64 cutoff = m_highestSequence - DecoderWindow;
+
+    while (!m_sources.isEmpty() && m_sources.firstKey() < cutoff) {
+        m_sources.erase(m_sources.begin());
+    }
+
+    while (!m_groups.isEmpty() && m_groups.firstKey() < cutoff) {
+        if (!m_groups.first().done) {
+            m_stats.unrecoverable++;
+        }
+        m_groups.erase(m_groups.begin());
+    }
+}
+
+void FecDecoder::clear()
+{
+    m_sources.clear();
+    m_groups.clear();
+    m_hasSequence = false;
+    m_highestSequence = 0;
+}
+
+qint64 FecDecoder::unwrapSequence(quint32 sequence)
+{
+    if (!m_hasSequence) {
+        m_hasSequence = true;
+        m_highestSequence = sequence;
+        return sequence;
+    }
+
+    const qint64 seq = m_highestSequence + qint32(sequence - quint32(m_highestSequence));
+    if (seq > m_highestSequence) {
+        m_highestSequence = seq;
+    }
+    return seq;
+}
+
+void FecController::onLossReport(Protocol::MediaStream stream, double fractionLost)
+{
+    // Рост потерь учитываем быстро, снижение - медленно, чтобы не
+    // переключаться на каждом отчёте
+    double &loss = m_loss[int(stream)];
+    const double alpha = fractionLost > loss ? 0.5 : 0.1;
+    loss += alpha * (fractionLost - loss);
+}
+
+Fec::Params FecController::params(Protocol::MediaStream stream) const
+{
+    const bool video = stream == Protocol::MediaStream::Video;
+
+    switch (m_mode) {
+    case Mode::Off:
+        return {};
+    case Mode::Xor:
+        return video ? Fec::Params{ Fec::Scheme::Xor, 5, 1 } : Fec::Params{ Fec::Scheme::Xor, 3, 1 };
+    case Mode::ReedSolomon:
+        return video ? Fec::Params{ Fec::Scheme::ReedSolomon, 10, 3 } : Fec::Params{ Fec::Scheme::ReedSolomon, 4, 2 };
+    case Mode::Auto:
+        break;
+    }
+
+    const double loss = m_loss[int(stream)];
+    if (loss < 0.01) return {};
+
+    // Аудио - короткие группы: чётность должна успеть до воспроизведения
+    if (!video) {
+        if (loss < 0.05) return { Fec::Scheme::Xor, 4, 1 };
+        if (loss < 0.10) return { Fec::Scheme::Xor, 2, 1 };
+        return { Fec::Scheme::ReedSolomon, 4, 2 };
+    }
+
+    // Повтор успевает задолго до срока показа кадра - чётность не нужна
+    if (m_rttMs >= 0.0 && m_rttMs < 20.0 && loss < 0.10) return {};
+
+    if (loss < 0.03) return { Fec::Scheme::Xor, 10, 1 };
+    if (loss < 0.06) return { Fec::Scheme::Xor, 5, 1 };
+    if (loss < 0.12) return { Fec::Scheme::ReedSolomon, 10, 2 };
+    if (loss < 0.20) return { Fec::Scheme::ReedSolomon, 10, 3 };
+    return { Fec::Scheme::ReedSolomon, 8, 4 };
+}
+
+void FecController::clear()
+{
+    for (double &loss : m_loss) {
+        loss = 0.0;
+    }
+    m_rttMs = -1.0;
+}
@@ -0,0 +1,186 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QtGlobal>
+#include "protocol.h"
+
+// Прямая коррекция ошибок (FEC) для аудио- и видеопакетов.
+//
+// Отправитель накапливает k подряд идущих пакетов потока (по sequence) и
+// отправляет m пакетов чётности. При m = 1 чётность - XOR всех пакетов
+// группы, иначе - систематический код Рида-Соломона над GF(256) с матрицей
+// Коши: любые k пакетов из k + m восстанавливают группу. Получатель
+// восстанавливает потерянные пакеты без запроса отправителю.
+//
+// Защищаемый блок пакета: timestamp (4) | длина полезной нагрузки (2) |
+// полезная нагрузка; блоки группы дополняются нулями до самого длинного.
+//
+// Полезная нагрузка FEC-пакета после Protocol::PacketHeader:
+//
+//   0        1        2                  6     7     8     9        11
+//   +--------+--------+------------------+-----+-----+-----+--------+-----------
+//   | stream | scheme |   baseSequence   |  k  |  m  | idx | length | чётность
+//   +--------+--------+------------------+-----+-----+-----+--------+-----------
+namespace Fec {
+
+enum class Scheme : quint8 {
+    Xor = 0,
+    ReedSolomon = 1
+};
+
+constexpr int HeaderSize = 11;
+constexpr int BlockHeaderSize = 6;
+constexpr int MaxSourceCount = 48;
+constexpr int MaxParityCount = 16;
+
+struct Header
+{
+    Protocol::MediaStream stream = Protocol::MediaStream::Audio;
+    Scheme scheme = Scheme::Xor;
+    quint32 baseSequence = 0;
+    quint8 sourceCount = 0;
+    quint8 parityCount = 0;
+    quint8 parityIndex = 0;
+    quint16 length = 0;
+};
+
+struct Params
+{
+    Scheme scheme = Scheme::Xor;
+    int sourceCount = 0;   // 0 - FEC выключена
+    int parityCount = 0;
+
+    bool enabled() const { return sourceCount > 0 && parityCount > 0; }
+    double overhead() const { return enabled() ? double(parityCount) / sourceCount : 0.0; }
+    bool operator==(const Params &other) const
+    {
+        return scheme == other.scheme && sourceCount == other.sourceCount
+               && parityCount == other.parityCount;
+    }
+};
+
+struct RecoveredPacket
+{
+    quint32 sequence = 0;
+    quint32 timestamp = 0;
+    QByteArray payload;
+};
+
+bool readHeader(QByteArrayView payload, Header *header);
+
+} // namespace Fec
+
+// Арифметика GF(256) (многочлен 0x11d) и операции над областями памяти.
+// Операции над областями используют AVX2/SSSE3/SSE2, если их поддерживает
+// процессор, иначе - таблицы.
+namespace Gf256 {
+
+uchar mul(uchar a, uchar b);
+uchar inverse(uchar a);
+
+// dst ^= src
+void xorRegion(uchar *dst, const uchar *src, qsizetype length);
+// dst ^= coef * src
+void mulAddRegion(uchar *dst, const uchar *src, uchar coef, qsizetype length);
+
+// Имя используемой реализации для журнала
+const char *backendName();
+
+// Реализации, которые поддерживает процессор: первая - таблицы, последняя
+// используется по умолчанию
+QList<const char *> backendNames();
+// Переключение реализации для сверки с таблицами; не потокобезопасно,
+// вызывать до начала звонка. false - процессор её не поддерживает
+bool setBackend(const char *name);
+
+} // namespace Gf256
+
+class FecEncoder
+{
+public:
+    void setParams(const Fec::Params &params);
+    const Fec::Params &params() const { return m_params; }
+
+    // Возвращает полезные нагрузки FEC-пакетов, когда группа заполнена
+    QList<QByteArray> addSource(Protocol::MediaStream stream, quint32 sequence, quint32 timestamp,
+                                QByteArrayView payload);
+
+    void clear();
+
+private:
+    Fec::Params m_params;
+    QList<QByteArray> m_blocks;
+    quint32 m_baseSequence = 0;
+    int m_maxLength = 0;
+};
+
+class FecDecoder
+{
+public:
+    struct Stats
+    {
+        qint64 parityPackets = 0;
+        qint64 recovered = 0;
+        qint64 unrecoverable = 0;   // группы, где потерь больше, чем чётности
+    };
+
+    // Возвращают пакеты, которые удалось восстановить благодаря этому пакету
+    QList<Fec::RecoveredPacket> addSource(quint32 sequence, quint32 timestamp, QByteArrayView payload);
+    QList<Fec::RecoveredPacket> addParity(const Fec::Header &header, QByteArrayView parity);
+
+    void clear();
+
+    const Stats &stats() const { return m_stats; }
+
+private:
+    struct Group
+    {
+        Fec::Scheme scheme = Fec::Scheme::Xor;
+        int sourceCount = 0;
+        int parityCount = 0;
+        int length = 0;
+        QHash<int, QByteArray> parities;   // индекс чётности -> данные
+        bool done = false;
+    };
+
+    qint64 unwrapSequence(quint32 sequence);
+    QList<Fec::RecoveredPacket> tryRecover(qint64 base, Group &group);
+    void prune();
+
+    // Упорядочены по развёрнутому sequence: старые записи срезаются с начала
+    QMap<qint64, QByteArray> m_sources;   // sequence -> защищаемый блок
+    QMap<qint64, Group> m_groups;         // baseSequence -> группа
+    bool m_hasSequence = false;
+    qint64 m_highestSequence = 0;
+    Stats m_stats;
+};
+
+// Выбор параметров FEC по потерям, о которых сообщает получатель
+class FecController
+{
+public:
+    enum class Mode { Auto, Off, Xor, ReedSolomon };
+
+    void setMode(Mode mode) { m_mode = mode; }
+    Mode mode() const { return m_mode; }
+
+    // fractionLost - доля потерь из RECEIVER_REPORT
+    void onLossReport(Protocol::MediaStream stream, double fractionLost);
+    // При малом RTT умеренные потери видео закрываются повторами по NACK
+    void setRttMs(double rttMs) { m_rttMs = rttMs; }
+    Fec::Params params(Protocol::MediaStream stream) const;
+
+    void clear();
+
+private:
+    Mode m_mode = Mode::Auto;
+    double m_loss[int(Protocol::MediaStream::Count)] = {};
+    double m_rttMs = -1.0;   // неизвестен
+};
+
+#endif // FEC_H
@@ -0,0 +1,248 @@
+#include "benchutil.h"
+#include "fec.h"
+#include "impairment.h"
+
+// FEC на этой машине и в плохой сети:
+//
+//   - скорость FecEncoder::addSource (подсчёт чётности) в МБ/с исходных
+//     данных для каждой реализации Gf256 и каждой формы группы k+m;
+//   - FecEncoder -> NetworkImpairment -> FecDecoder при случайных потерях и
+//     пачках Гилберта-Эллиота: какая доля потерянных пакетов восстановлена
+//     чётностью и сколько потерь осталось.
+//
+// Формы групп по умолчанию - те, что выбирает FecController.
+//
+//   AuthoLASTVLADIOFecBench --shapes xor:5+1,rs:10+3 --loss 2,10 --burst 1:3
+//
+// --burst процент:длина - вероятность входа в пачку на пакет и средняя
+// длина пачки в пакетах; в пачке теряется всё.
+
+namespace {
+
+// Темп пакетов в модели сети, как у аудио
+constexpr qint64 PacketIntervalUs = 20000;
+
+using Bench::out;
+
+struct Shape
+{
+    QString name;
+    Fec::Params params;
+};
+
+// "xor:5+1", "rs:10+3"
+bool parseShape(const QString &text, Shape *shape)
+{
+    const QStringList parts = text.split(':');
+    if (parts.size() != 2) return false;
+    const QStringList counts = parts.at(1).split('+');
+    if (counts.size() != 2) return false;
+
+    Fec::Params params;
+    if (parts.at(0) == "xor") {
+        params.scheme = Fec::Scheme::Xor;
+    } else if (parts.at(0) == "rs") {
+        params.scheme = Fec::Scheme::ReedSolomon;
+    } else {
+        return false;
+    }
+    params.sourceCount = counts.at(0).toInt();
+    params.parityCount = counts.at(1).toInt();
+    if (params.sourceCount < 1 || params.sourceCount > Fec::MaxSourceCount || params.parityCount < 1
+        || params.parityCount > Fec::MaxParityCount
+        || (params.scheme == Fec::Scheme::Xor && params.parityCount != 1)) {
+        return false;
+    }
+
+    shape->name = QString("%1 %2+%3").arg(parts.at(0)).arg(params.sourceCount).arg(params.parityCount);
+    shape->params = params;
+    return true;
+}
+
+// Наносекунд на исходный пакет, включая чётность по заполнении группы
+double encodeNs(const Fec::Params &params, const QByteArray &payload, double seconds)
+{
+    FecEncoder encoder;
+    encoder.setParams(params);
+    qint64 parities = 0;
+    const double ns = Bench::nsPerCall(seconds, [&](qint64 i) {
+        parities += encoder.addSource(Protocol::MediaStream::Video, quint32(i), quint32(i * 960), payload).size();
+    });
+    return parities > 0 ? ns : 0.0;
+}
+
+struct LossModel
+{
+    QString name;
+    NetworkImpairment::Config config;
+};
+
+struct Recovery
+{
+    qint64 sent = 0;        // исходных пакетов
+    qint64 lost = 0;        // из них потеряно в сети
+    qint64 recovered = 0;   // восстановлено чётностью
+};
+
+// Поток исходных пакетов с чётностью через имитацию сети в декодер
+Recovery simulate(const Fec::Params &params, const NetworkImpairment::Config &config, int packets,
+                  const QByteArray &payload)
+{
+    NetworkImpairment impairment;
+    impairment.setConfig(config);
+    FecEncoder encoder;
+    encoder.setParams(params);
+    FecDecoder decoder;
+
+    Recovery result;
+    qint64 arrived = 0;
+    qint64 nowUs = 0;
+    Protocol::PacketHeader header;
+    header.peerId = 1;
+
+    auto submit = [&](Protocol::PacketType type, quint32 sequence, quint32 timestamp, QByteArrayView data) {
+        header.type = type;
+        header.sequence = sequence;
+        header.timestamp = timestamp;
+        OutgoingPacket packet;
+        packet.datagram = Protocol::makePacket(header, data);
+        impairment.submit(std::move(packet), nowUs);
+    };
+    auto deliver = [&]() {
+        OutgoingPacket packet;
+        while (impairment.next(nowUs, &packet)) {
+            Protocol::PacketHeader received;
+            if (!Protocol::readHeader(packet.datagram, &received)) continue;
+            const QByteArrayView data = Protocol::payloadOf(packet.datagram);
+            if (received.type == Protocol::PacketType::Fec) {
+                Fec::Header fec;
+                if (Fec::readHeader(data, &fec)) {
+                    result.recovered += decoder.addParity(fec, data.sliced(Fec::HeaderSize)).size();
+                }
+            } else {
+                ++arrived;
+                result.recovered += decoder.addSource(received.sequence, received.timestamp, data).size();
+            }
+        }
+    };
+
+    for (int i = 0; i < packets; ++i) {
+        const quint32 sequence = quint32(i + 1);
+        const quint32 timestamp = sequence * 960;
+        submit(Protocol::PacketType::Video, sequence, timestamp, payload);
+        const QList<QByteArray> parities =
+            encoder.addSource(Protocol::MediaStream::Video, sequence, timestamp, payload);
+        for (const QByteArray &parity : parities) {
+            submit(Protocol::PacketType::Fec, 0, 0, parity);
+        }
+        deliver();
+        nowUs += PacketIntervalUs;
+    }
+    // Задержанные пакеты тоже доходят
+    nowUs += 10 * 1000000;
+    deliver();
+
+    result.sent = packets;
+    result.lost = packets - arrived;
+    return result;
+}
+
+QList<LossModel> lossModels(const QStringList &losses, const QStringList &bursts, quint32 seed)
+{
+    QList<LossModel> models;
+    for (const QString &text : losses) {
+        LossModel model;
+        model.config.enabled = true;
+        model.config.seed = seed;
+        model.config.lossPercent = qBound(0.0, text.toDouble(), 100.0);
+        model.name = QString("случайные %1%").arg(model.config.lossPercent, 0, 'g', 3);
+        models.append(model);
+    }
+    for (const QString &text : bursts) {
+        const QStringList parts = text.split(':');
+        if (parts.size() != 2) continue;
+        LossModel model;
+        model.config.enabled = true;
+        model.config.seed = seed;
+        model.config.burstPercent = qBound(0.0, parts.at(0).toDouble(), 100.0);
+        model.config.burstLength = qMax(1.0, parts.at(1).toDouble());
+        model.name = QString("пачки %1% x %2")
+                         .arg(model.config.burstPercent, 0, 'g', 3)
+                         .arg(model.config.burstLength, 0, 'g', 3);
+        models.append(model);
+    }
+    return models;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    Bench::prepare(parser, "AuthoLASTVLADIOFecBench",
+                   "Скорость подсчёта чётности FEC и восстановление при потерях");
+    const QCommandLineOption shapesOption("shapes", "Формы групп через запятую: xor:k+1, rs:k+m.", "list",
+                                          "xor:2+1,xor:4+1,xor:5+1,xor:10+1,rs:4+2,rs:10+2,rs:10+3,rs:8+4");
+    const QCommandLineOption payloadOption("payload", "Полезная нагрузка пакета, байт.", "bytes", "1200");
+    const QCommandLineOption durationOption("duration", "Замер скорости на реализацию и форму, с.", "seconds", "0.3");
+    const QCommandLineOption packetsOption("packets", "Пакетов на прогон через имитацию сети.", "count", "100000");
+    const QCommandLineOption lossOption("loss", "Случайные потери, %, через запятую.", "list", "1,5,10");
+    const QCommandLineOption burstOption("burst", "Пачки потерь процент:длина через запятую.", "list", "1:3,3:5");
+    const QCommandLineOption seedOption("seed", "Начальное значение генератора потерь.", "seed", "1");
+    parser.addOptions({ shapesOption, payloadOption, durationOption, packetsOption, lossOption, burstOption,
+                        seedOption });
+    parser.process(app);
+
+    QList<Shape> shapes;
+    const QStringList shapeTexts = parser.value(shapesOption).split(',', Qt::SkipEmptyParts);
+    for (const QString &text : shapeTexts) {
+        Shape shape;
+        if (!parseShape(text, &shape)) {
+            out() << "Ошибка: неверная форма группы " << text << Qt::endl;
+            return 1;
+        }
+        shapes.append(shape);
+    }
+    const QByteArray payload(qBound(1, parser.value(payloadOption).toInt(), 1400), 'f');
+    const double seconds = qMax(0.05, parser.value(durationOption).toDouble());
+    const int packets = qMax(100, parser.value(packetsOption).toInt());
+    const QList<LossModel> models = lossModels(parser.value(lossOption).split(',', Qt::SkipEmptyParts),
+                                               parser.value(burstOption).split(',', Qt::SkipEmptyParts),
+                                               parser.value(seedOption).toUInt());
+
+    out() << QString("Пакет %1 байт").arg(payload.size()) << Qt::endl;
+    const QList<const char *> names = Gf256::backendNames();
+    for (const char *name : names) {
+        Gf256::setBackend(name);
+        out() << name << ":" << Qt::endl;
+        for (const Shape &shape : shapes) {
+            const double ns = encodeNs(shape.params, payload, seconds);
+            if (ns <= 0.0) {
+                out() << "Ошибка: кодер не выдал чётность для " << shape.name << Qt::endl;
+                return 1;
+            }
+            out() << QString("  %1: %2 МБ/с исходных данных, %3 нс/пакет")
+                         .arg(shape.name, -8)
+                         .arg(payload.size() / ns * 1e3, 0, 'f', 1)
+                         .arg(ns, 0, 'f', 0)
+                  << Qt::endl;
+        }
+    }
+    Gf256::setBackend(names.last());
+
+    for (const LossModel &model : models) {
+        out() << QString("Потери: %1, %2 пакетов").arg(model.name).arg(packets) << Qt::endl;
+        for (const Shape &shape : shapes) {
+            const Recovery result = simulate(shape.params, model.config, packets, payload);
+            out() << QString("  %1 (+%2%): потеряно %3%, восстановлено %4% потерь, осталось %5%")
+                         .arg(shape.name, -8)
+                         .arg(100.0 * shape.params.overhead(), 0, 'f', 0)
+                         .arg(100.0 * result.lost / result.sent, 0, 'f', 2)
+                         .arg(result.lost > 0 ? 100.0 * result.recovered / result.lost : 100.0, 0, 'f', 1)
+                         .arg(100.0 * (result.lost - result.recovered) / result.sent, 0, 'f', 3)
+                  << Qt::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,231 @@
+#include "benchutil.h"
+#include "fec.h"
+#include <QRandomGenerator>
+#include <vector>
+
+// Сверка векторных реализаций GF(256) с таблицами. Для каждой реализации,
+// которую поддерживает процессор (SSE2, SSSE3, AVX2):
+//
+//   - xorRegion и mulAddRegion на всех коэффициентах, длинах с хвостами и
+//     невыровненных адресах - побайтно против Gf256::mul;
+//   - пакеты чётности Рида-Соломона и XOR - побайтно против таблиц;
+//   - восстановление групп с потерями до m пакетов - против исходных.
+//
+// Код возврата 1 при первом расхождении.
+//
+//   AuthoLASTVLADIOFecCheck --groups 200
+
+namespace {
+
+constexpr int MaxOffset = 3;
+
+using Bench::out;
+
+void fill(QRandomGenerator &random, uchar *data, qsizetype length)
+{
+    for (qsizetype i = 0; i < length; ++i) {
+        data[i] = uchar(random.generate());
+    }
+}
+
+// Длины: все хвосты короче 64 байт и размеры видеофрагментов
+QList<int> regionLengths()
+{
+    QList<int> lengths;
+    for (int length = 0; length <= 80; ++length) {
+        lengths.append(length);
+    }
+    lengths << 127 << 128 << 129 << 1199 << 1200 << 1412 << 1500;
+    return lengths;
+}
+
+bool checkRegions()
+{
+    QRandomGenerator random(1);
+    std::vector<uchar> src(size_t(1500 + MaxOffset));
+    std::vector<uchar> dst(size_t(1500 + MaxOffset));
+    std::vector<uchar> expected(size_t(1500 + MaxOffset));
+
+    for (const int length : regionLengths()) {
+        for (int offset = 0; offset <= MaxOffset; ++offset) {
+            fill(random, src.data(), qsizetype(src.size()));
+            fill(random, dst.data(), qsizetype(dst.size()));
+
+            expected = dst;
+            for (int i = 0; i < length; ++i) {
+                expected[size_t(offset + i)] ^= src[size_t(offset + i)];
+            }
+            std::vector<uchar> result = dst;
+            Gf256::xorRegion(result.data() + offset, src.data() + offset, length);
+            if (result != expected) {
+                out() << QString("  xorRegion: длина %1, смещение %2 - расхождение").arg(length).arg(offset)
+                      << Qt::endl;
+                return false;
+            }
+
+            for (int coef = 0; coef < 256; ++coef) {
+                expected = dst;
+                for (int i = 0; i < length; ++i) {
+                    expected[size_t(offset + i)] ^= Gf256::mul(uchar(coef), src[size_t(offset + i)]);
+                }
+                result = dst;
+                Gf256::mulAddRegion(result.data() + offset, src.data() + offset, uchar(coef), length);
+                if (result != expected) {
+                    out() << QString("  mulAddRegion: коэффициент %1, длина %2, смещение %3 - расхождение")
+                                 .arg(coef)
+                                 .arg(length)
+                                 .arg(offset)
+                          << Qt::endl;
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+struct Group
+{
+    Fec::Params params;
+    quint32 baseSequence = 0;
+    QList<QByteArray> payloads;
+    QList<QByteArray> parities;
+};
+
+// Группы с разными k, m и длинами пакетов; чётность считает текущая реализация
+QList<Group> encodeGroups(int count)
+{
+    QRandomGenerator random(2);
+    QList<Group> groups;
+    quint32 sequence = 1000;
+    for (int g = 0; g < count; ++g) {
+        Group group;
+        group.params.scheme = g % 4 == 0 ? Fec::Scheme::Xor : Fec::Scheme::ReedSolomon;
+        group.params.sourceCount = 1 + random.bounded(Fec::MaxSourceCount);
+        group.params.parityCount = group.params.scheme == Fec::Scheme::Xor
+                                       ? 1
+                                       : 1 + random.bounded(Fec::MaxParityCount);
+        group.baseSequence = sequence;
+
+        FecEncoder encoder;
+        encoder.setParams(group.params);
+        for (int i = 0; i < group.params.sourceCount; ++i) {
+            QByteArray payload(random.bounded(1, 1400), Qt::Uninitialized);
+            fill(random, reinterpret_cast<uchar *>(payload.data()), payload.size());
+            group.payloads.append(payload);
+            group.parities = encoder.addSource(Protocol::MediaStream::Video, sequence, sequence * 960, payload);
+            ++sequence;
+        }
+        groups.append(group);
+    }
+    return groups;
+}
+
+// Теряется до m пакетов группы, декодер восстанавливает их из чётности
+bool checkRecovery(const QList<Group> &groups)
+{
+    QRandomGenerator random(3);
+    FecDecoder decoder;
+    for (const Group &group : groups) {
+        const int k = group.params.sourceCount;
+        const int losses = qMin(k, 1 + random.bounded(group.params.parityCount));
+        QList<bool> lost(k, false);
+        for (int n = 0; n < losses;) {
+            const int i = random.bounded(k);
+            if (!lost[i]) {
+                lost[i] = true;
+                ++n;
+            }
+        }
+
+        QList<Fec::RecoveredPacket> recovered;
+        for (int i = 0; i < k; ++i) {
+            if (lost[i]) continue;
+            const quint32 sequence = group.baseSequence + quint32(i);
+            recovered.append(decoder.addSource(sequence, sequence * 960, group.payloads.at(i)));
+        }
+        for (const QByteArray &parity : group.parities) {
+            Fec::Header header;
+            if (!Fec::readHeader(parity, &header)) return false;
+            recovered.append(decoder.addParity(header, QByteArrayView(parity).sliced(Fec::HeaderSize)));
+        }
+
+        if (recovered.size() != losses) {
+            out() << QString("  группа %1 (k %2, m %3): восстановлено %4 из %5")
+                         .arg(group.baseSequence)
+                         .arg(k)
+                         .arg(group.params.parityCount)
+                         .arg(recovered.size())
+                         .arg(losses)
+                  << Qt::endl;
+            return false;
+        }
+        for (const Fec::RecoveredPacket &packet : recovered) {
+            const int i = int(packet.sequence - group.baseSequence);
+            if (i < 0 || i >= k || !lost[i] || packet.payload != group.payloads.at(i)
+                || packet.timestamp != packet.sequence * 960) {
+                out() << QString("  группа %1: пакет %2 восстановлен неверно").arg(group.baseSequence).arg(packet.sequence)
+                      << Qt::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool sameParities(const QList<Group> &groups, const QList<Group> &reference)
+{
+    for (qsizetype g = 0; g < groups.size(); ++g) {
+        if (groups.at(g).parities != reference.at(g).parities) {
+            out() << QString("  группа %1: чётность отличается от таблиц").arg(groups.at(g).baseSequence)
+                  << Qt::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    Bench::prepare(parser, "AuthoLASTVLADIOFecCheck",
+                   "Сверка векторных реализаций FEC с таблицами");
+    const QCommandLineOption groupsOption("groups", "Групп FEC на реализацию.", "count", "200");
+    parser.addOption(groupsOption);
+    parser.process(app);
+
+    const int groupCount = qMax(1, parser.value(groupsOption).toInt());
+    const QList<const char *> names = Gf256::backendNames();
+
+    Gf256::setBackend("scalar");
+    const QList<Group> reference = encodeGroups(groupCount);
+    bool ok = checkRecovery(reference);
+    out() << "scalar: восстановление " << (ok ? "верно" : "НЕВЕРНО") << Qt::endl;
+
+    for (const char *name : names) {
+        if (qstrcmp(name, "scalar") == 0) continue;
+        Gf256::setBackend(name);
+
+        const bool regions = checkRegions();
+        const QList<Group> groups = encodeGroups(groupCount);
+        const bool parities = sameParities(groups, reference);
+        const bool recovery = checkRecovery(groups);
+        out() << QString("%1: области %2, чётность %3, восстановление %4")
+                     .arg(name)
+                     .arg(regions ? "совпадают" : "РАСХОДЯТСЯ")
+                     .arg(parities ? "совпадает" : "РАСХОДИТСЯ")
+                     .arg(recovery ? "верно" : "НЕВЕРНО")
+              << Qt::endl;
+        ok = ok && regions && parities && recovery;
+    }
+    if (names.size() == 1) {
+        out() << "Процессор без SSE2/SSSE3/AVX2: сверять нечего" << Qt::endl;
+    }
+    Gf256::setBackend(names.last());
+
+    out() << (ok ? "Итог: в норме" : "Итог: есть расхождения") << Qt::endl;
+    return ok ? 0 : 1;
+}
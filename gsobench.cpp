@@ -0,0 +1,224 @@
+#include "benchutil.h"
+#include <QtGlobal>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// Системные вызовы и процессор на мегабит видео через петлю: кадры из
+// одинаковых фрагментов уходят так же, как их отправляет NetworkEngine -
+// sendmmsg по сообщению на датаграмму или одним сообщением с UDP_SEGMENT
+// на кадр, - и принимаются recvmmsg без UDP_GRO или с ним.
+//
+//   AuthoLASTVLADIOGsoBench --frames 20000 --fragments 30 --fragment-size 1412
+
+namespace {
+
+// Как в NetworkEngine
+constexpr int BatchSize = 32;
+constexpr int MaxGsoSegments = 64;
+constexpr int MaxDatagramSize = 65536;
+
+using Bench::out;
+
+struct Result
+{
+    qint64 sendCalls = 0;
+    qint64 receiveCalls = 0;
+    qint64 receivedPackets = 0;
+    double cpuSeconds = 0.0;
+    double seconds = 0.0;
+};
+
+bool supportsGso()
+{
+    const int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    int segment = 0;
+    socklen_t length = sizeof(segment);
+    const bool supported = fd != -1 && getsockopt(fd, IPPROTO_UDP, UDP_SEGMENT, &segment, &length) == 0;
+    if (fd != -1) ::close(fd);
+    return supported;
+}
+
+void receive(int fd, bool gro, std::atomic<qint64> *calls, std::atomic<qint64> *packets)
+{
+    std::vector<char> buffers(size_t(BatchSize) * MaxDatagramSize);
+    mmsghdr msgs[BatchSize];
+    iovec iovecs[BatchSize];
+    alignas(cmsghdr) char control[BatchSize][CMSG_SPACE(sizeof(int))];
+
+    for (;;) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < BatchSize; ++i) {
+            iovecs[i].iov_base = buffers.data() + size_t(i) * MaxDatagramSize;
+            iovecs[i].iov_len = MaxDatagramSize;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = control[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+        }
+        // Таймаут сокета - признак, что отправитель закончил
+        const int received = recvmmsg(fd, msgs, BatchSize, MSG_WAITFORONE, nullptr);
+        if (received <= 0) break;
+        calls->fetch_add(1, std::memory_order_relaxed);
+
+        for (int i = 0; i < received; ++i) {
+            int segmentSize = int(msgs[i].msg_len);
+            if (gro) {
+                for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+                    if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+                        memcpy(&segmentSize, CMSG_DATA(cmsg), sizeof(segmentSize));
+                    }
+                }
+            }
+            if (segmentSize > 0) {
+                packets->fetch_add((int(msgs[i].msg_len) + segmentSize - 1) / segmentSize, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+bool run(bool segmentation, int frames, int fragments, int fragmentSize, Result *result)
+{
+    const int rx = ::socket(AF_INET, SOCK_DGRAM, 0);
+    const int tx = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (rx == -1 || tx == -1) return false;
+
+    const int bufferSize = 8 * 1024 * 1024;
+    setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    setsockopt(tx, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+    const int one = 1;
+    const bool gro = segmentation && setsockopt(rx, IPPROTO_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+    const timeval timeout = { 0, 200000 };
+    setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addressLength = sizeof(address);
+    if (bind(rx, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1
+        || getsockname(rx, reinterpret_cast<sockaddr *>(&address), &addressLength) == -1) {
+        ::close(rx);
+        ::close(tx);
+        return false;
+    }
+
+    std::atomic<qint64> receiveCalls{0};
+    std::atomic<qint64> receivedPackets{0};
+    std::thread receiver(receive, rx, gro, &receiveCalls, &receivedPackets);
+
+    const std::vector<char> fragment(static_cast<size_t>(fragmentSize), 'v');
+    std::vector<iovec> iovecs(static_cast<size_t>(fragments));
+    for (iovec &iov : iovecs) {
+        iov.iov_base = const_cast<char *>(fragment.data());
+        iov.iov_len = size_t(fragmentSize);
+    }
+    std::vector<mmsghdr> msgs(static_cast<size_t>(fragments));
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(quint16))];
+
+    const double cpuStart = Bench::cpuSeconds();
+    const auto start = std::chrono::steady_clock::now();
+    bool ok = true;
+    for (int frame = 0; frame < frames && ok; ++frame) {
+        // Кадр - сообщениями по MaxGsoSegments сегментов или по датаграмме
+        const int perMessage = segmentation ? MaxGsoSegments : 1;
+        int count = 0;
+        for (int first = 0; first < fragments; first += perMessage) {
+            mmsghdr &msg = msgs[size_t(count++)];
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_hdr.msg_name = &address;
+            msg.msg_hdr.msg_namelen = sizeof(address);
+            msg.msg_hdr.msg_iov = &iovecs[size_t(first)];
+            msg.msg_hdr.msg_iovlen = size_t(qMin(perMessage, fragments - first));
+            if (segmentation && msg.msg_hdr.msg_iovlen > 1) {
+                msg.msg_hdr.msg_control = control;
+                msg.msg_hdr.msg_controllen = sizeof(control);
+                cmsghdr *cmsg = CMSG_FIRSTHDR(&msg.msg_hdr);
+                cmsg->cmsg_level = IPPROTO_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(quint16));
+                const quint16 size = quint16(fragmentSize);
+                memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+            }
+        }
+        // Как в NetworkEngine: не больше BatchSize сообщений за вызов
+        for (int sent = 0; sent < count;) {
+            const int n = sendmmsg(tx, msgs.data() + sent, unsigned(qMin(BatchSize, count - sent)), 0);
+            if (n <= 0) {
+                out() << "Ошибка отправки: " << strerror(errno) << Qt::endl;
+                ok = false;
+                break;
+            }
+            sent += n;
+            ++result->sendCalls;
+        }
+        // Приёмник на той же машине должен успевать, иначе меряются потери
+        if (frame % 50 == 49) std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    const auto sendEnd = std::chrono::steady_clock::now();
+
+    receiver.join();
+    result->cpuSeconds = Bench::cpuSeconds() - cpuStart;
+    result->seconds = std::chrono::duration<double>(sendEnd - start).count();
+    result->receiveCalls = receiveCalls.load();
+    result->receivedPackets = receivedPackets.load();
+    ::close(rx);
+    ::close(tx);
+    return ok;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    Bench::prepare(parser, "AuthoLASTVLADIOGsoBench",
+                   "Отправка видео через петлю: по датаграмме или с UDP GSO/GRO");
+    const QCommandLineOption framesOption("frames", "Кадров.", "count", "20000");
+    const QCommandLineOption fragmentsOption("fragments", "Фрагментов на кадр.", "count", "30");
+    const QCommandLineOption fragmentSizeOption("fragment-size", "Размер фрагмента, байт.", "bytes", "1412");
+    parser.addOptions({ framesOption, fragmentsOption, fragmentSizeOption });
+    parser.process(app);
+
+    const int frames = qMax(1, parser.value(framesOption).toInt());
+    const int fragments = qBound(1, parser.value(fragmentsOption).toInt(), 1024);
+    const int fragmentSize = qBound(64, parser.value(fragmentSizeOption).toInt(), 1472);
+    const double megabits = double(frames) * fragments * fragmentSize * 8 / 1e6;
+
+    const bool gso = supportsGso();
+    if (!gso) {
+        out() << "Ядро не поддерживает UDP_SEGMENT, сравнивать не с чем" << Qt::endl;
+    }
+    for (const bool segmentation : { false, true }) {
+        if (segmentation && !gso) break;
+
+        Result result;
+        if (!run(segmentation, frames, fragments, fragmentSize, &result)) return 1;
+        out() << QString("%1: отправлено %2 пак., вызовов отправки %3, приёма %4, принято %5 пак.;"
+                         " процессор %6 мс/Мбит, %7 Мбит/с")
+                     .arg(segmentation ? "GSO + GRO   " : "по датаграмме")
+                     .arg(qint64(frames) * fragments)
+                     .arg(result.sendCalls)
+                     .arg(result.receiveCalls)
+                     .arg(result.receivedPackets)
+                     .arg(result.cpuSeconds * 1000 / megabits, 0, 'f', 3)
+                     .arg(megabits / qMax(1e-6, result.seconds), 0, 'f', 0)
+              << Qt::endl;
+    }
+    return 0;
+}
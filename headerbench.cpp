@@ -0,0 +1,183 @@
+#include "benchutil.h"
+#include "protocol.h"
+#include <QDataStream>
+#include <QUuid>
+
+// Заголовок датаграммы: прежний формат QDataStream (тип, UUID экземпляра и
+// ник строками QString в каждом пакете, разбор цепочкой сравнений строк)
+// против Protocol::PacketHeader (12 байт, разбор по таблице обработчиков).
+// Байт заголовка на пакет и наносекунды на сборку и на разбор с
+// диспетчеризацией - для аудио- и видеопакетов.
+//
+//   AuthoLASTVLADIOHeaderBench --payload 160 --nickname Алексей
+
+// Результат разбора складывается сюда, чтобы компилятор не выбросил работу
+qint64 sink = 0;
+
+namespace {
+
+using Bench::out;
+
+struct Result
+{
+    qsizetype headerBytes = 0;
+    double encodeNs = 0.0;   // на пакет
+    double decodeNs = 0.0;
+};
+
+// Прежний формат: stream << QString(тип) << instanceId << ник << sequence << данные
+void legacyPayload(QDataStream &stream)
+{
+    QString id;
+    QString name;
+    qint64 sequence = 0;
+    QByteArray data;
+    stream >> id >> name >> sequence >> data;
+    sink += sequence + data.size() + id.size() + name.size();
+}
+
+void legacyDispatch(const QByteArray &datagram)
+{
+    QDataStream stream(datagram);
+    QString msgType;
+    stream >> msgType;
+
+    // Порядок сравнений - как был в readPendingDatagrams
+    if (msgType == "AUDIO") {
+        legacyPayload(stream);
+    } else if (msgType == "DISCOVER") {
+        sink += 1;
+    } else if (msgType == "DISCOVER_REPLY") {
+        sink += 2;
+    } else if (msgType == "KEEPALIVE") {
+        sink += 3;
+    } else if (msgType == "VIDEO") {
+        legacyPayload(stream);
+    } else if (msgType == "MSG") {
+        sink += 4;
+    }
+}
+
+Result measureLegacy(const char *type, const QString &instanceId, const QString &nickname,
+                     const QByteArray &payload, double seconds)
+{
+    const QString typeName(type);
+    auto encode = [&](qint64 sequence) {
+        QByteArray packet;
+        QDataStream stream(&packet, QIODevice::WriteOnly);
+        stream << typeName << instanceId << nickname << sequence << payload;
+        return packet;
+    };
+
+    Result result;
+    result.headerBytes = encode(0).size() - payload.size();
+    result.encodeNs = Bench::nsPerCall(seconds, [&](qint64 sequence) { sink += encode(sequence).size(); });
+    const QByteArray datagram = encode(1);
+    result.decodeNs = Bench::nsPerCall(seconds, [&](qint64) { legacyDispatch(datagram); });
+    return result;
+}
+
+// Новый формат: таблица обработчиков по типу, как в CallSession
+using Handler = void (*)(const Protocol::PacketHeader &, QByteArrayView);
+
+void mediaHandler(const Protocol::PacketHeader &header, QByteArrayView payload)
+{
+    sink += header.sequence + header.timestamp + payload.size();
+}
+
+void otherHandler(const Protocol::PacketHeader &header, QByteArrayView)
+{
+    sink += int(header.type);
+}
+
+constexpr Handler handlers[Protocol::TypeCount] = {
+    mediaHandler,   // Audio
+    mediaHandler,   // Video
+    otherHandler, otherHandler, otherHandler, otherHandler, otherHandler, otherHandler,
+    otherHandler, otherHandler, otherHandler, otherHandler, otherHandler, otherHandler,
+    otherHandler,
+};
+
+Result measureBinary(Protocol::PacketType type, const QByteArray &payload, double seconds)
+{
+    Protocol::PacketHeader header;
+    header.type = type;
+    header.peerId = 0x1234;
+    auto encode = [&](qint64 sequence) {
+        header.sequence = quint32(sequence);
+        header.timestamp = quint32(sequence * 960);
+        return Protocol::makePacket(header, payload);
+    };
+
+    Result result;
+    result.headerBytes = encode(0).size() - payload.size();
+    result.encodeNs = Bench::nsPerCall(seconds, [&](qint64 sequence) { sink += encode(sequence).size(); });
+    const QByteArray datagram = encode(1);
+    result.decodeNs = Bench::nsPerCall(seconds, [&](qint64) {
+        Protocol::PacketHeader received;
+        if (Protocol::readHeader(datagram, &received)) {
+            handlers[int(received.type)](received, Protocol::payloadOf(datagram));
+        }
+    });
+    return result;
+}
+
+void print(const char *name, const Result &result)
+{
+    out() << QString("  %1: заголовок %2 байт, сборка %3 нс/пак, разбор %4 нс/пак")
+                 .arg(name)
+                 .arg(result.headerBytes)
+                 .arg(result.encodeNs, 0, 'f', 0)
+                 .arg(result.decodeNs, 0, 'f', 0)
+          << Qt::endl;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    Bench::prepare(parser, "AuthoLASTVLADIOHeaderBench",
+                   "Заголовок датаграммы: QDataStream со строками против бинарного");
+    const QCommandLineOption payloadOption("payload", "Полезная нагрузка аудиопакета, байт.", "bytes", "160");
+    const QCommandLineOption videoPayloadOption("video-payload", "Полезная нагрузка видеопакета, байт.", "bytes",
+                                                "1200");
+    const QCommandLineOption nicknameOption("nickname", "Ник в прежнем формате.", "name", "Алексей");
+    const QCommandLineOption durationOption("duration", "Замер на формат и направление, с.", "seconds", "0.5");
+    parser.addOptions({ payloadOption, videoPayloadOption, nicknameOption, durationOption });
+    parser.process(app);
+
+    const double seconds = qMax(0.05, parser.value(durationOption).toDouble());
+    const QString instanceId = QUuid::createUuid().toString();
+    const QString nickname = parser.value(nicknameOption);
+
+    const struct
+    {
+        const char *name;
+        const char *legacyType;
+        Protocol::PacketType type;
+        int payloadSize;
+    } kinds[] = {
+        { "Аудио", "AUDIO", Protocol::PacketType::Audio, qBound(0, parser.value(payloadOption).toInt(), 60000) },
+        { "Видео", "VIDEO", Protocol::PacketType::Video,
+          qBound(0, parser.value(videoPayloadOption).toInt(), 60000) },
+    };
+
+    for (const auto &kind : kinds) {
+        const QByteArray payload(kind.payloadSize, 'a');
+        const Result legacy = measureLegacy(kind.legacyType, instanceId, nickname, payload, seconds);
+        const Result binary = measureBinary(kind.type, payload, seconds);
+
+        out() << QString("%1, %2 байт данных:").arg(kind.name).arg(kind.payloadSize) << Qt::endl;
+        print("QDataStream ", legacy);
+        print("бинарный    ", binary);
+        out() << QString("  экономия %1 байт на пакет (%2% датаграммы)")
+                     .arg(legacy.headerBytes - binary.headerBytes)
+                     .arg(100.0 * (legacy.headerBytes - binary.headerBytes)
+                              / double(legacy.headerBytes + kind.payloadSize),
+                          0, 'f', 1)
+              << Qt::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include "impairment.h"
+#include <QMutexLocker>
+#include <cmath>
+#include <random>
+
+namespace {
+
+// Показатель хвоста распределения Парето для джиттера
+constexpr double ParetoShape = 3.0;
+
+}
+
+NetworkImpairment::NetworkImpairment()
+    : m_random(m_config.seed)
+{
+}
+
+void NetworkImpairment::setConfig(const Config &config)
+{
+    m_config = config;
+    m_config.queueLimit = qMax(1, m_config.queueLimit);
+
+    // Новые настройки - новый прогон с тем же seed
+    m_random.seed(m_config.seed);
+    m_burst = false;
+}
+
+bool NetworkImpairment::shouldDrop()
+{
+    // Переход между состояниями, затем потеря с вероятностью текущего
+    if (m_config.burstPercent > 0.0 && m_config.burstLength >= 1.0) {
+        if (m_burst) {
+            if (m_random.generateDouble() * m_config.burstLength < 1.0) m_burst = false;
+        } else if (chance(m_config.burstPercent)) {
+            m_burst = true;
+        }
+    } else {
+        m_burst = false;
+    }
+    return chance(m_burst ? m_config.burstLossPercent : m_config.lossPercent);
+}
+
+qint64 NetworkImpairment::jitterUs()
+{
+    const double jitter = m_config.jitterMs * 1000.0;
+    if (jitter <= 0.0) return 0;
+
+    switch (m_config.distribution) {
+    case Distribution::Uniform:
+        return qint64((m_random.generateDouble() * 2.0 - 1.0) * jitter);
+    case Distribution::Normal:
+        return qint64(std::normal_distribution<double>(0.0, jitter)(m_random));
+    case Distribution::Pareto: {
+        // Ломакс со средним jitter, сдвинутый к нулю: редкие, но длинные задержки
+        const double u = qMax(1e-9, m_random.generateDouble());
+        const double scale = jitter * (ParetoShape - 1.0);
+        return qint64(scale * (std::pow(u, -1.0 / ParetoShape) - 1.0) - jitter);
+    }
+    }
+    return 0;
+}
+
+void NetworkImpairment::submit(OutgoingPacket &&packet, qint64 nowUs)
+{
+    QMutexLocker locker(&m_statsMutex);
+    m_stats.submitted++;
+
+    if (shouldDrop()) {
+        m_stats.lost++;
+        return;
+    }
+
+    // Узкое место: пакет выходит, когда канал передаст всё, что перед ним
+    qint64 departureUs = nowUs;
+    if (m_config.rateLimit > 0) {
+        while (!m_linkDepartures.isEmpty() && m_linkDepartures.head() <= nowUs) {
+            m_linkDepartures.dequeue();
+        }
+        if (m_linkDepartures.size() >= m_config.queueLimit) {
+            m_stats.queueDropped++;
+            return;
+        }
+        const qint64 transmitUs = packet.datagram.size() * 8 * 1000000 / m_config.rateLimit;
+        m_linkFreeUs = qMax(m_linkFreeUs, nowUs) + transmitUs;
+        departureUs = m_linkFreeUs;
+        m_linkDepartures.enqueue(departureUs);
+    }
+
+    qint64 releaseUs = departureUs;
+    if (chance(m_config.reorderPercent)) {
+        m_stats.reordered++;
+    } else {
+        releaseUs = qMax(departureUs, departureUs + qint64(m_config.delayMs) * 1000 + jitterUs());
+        // Джиттер сам по себе порядок не меняет
+        releaseUs = qMax(releaseUs, m_lastReleaseUs);
+        m_lastReleaseUs = releaseUs;
+    }
+
+    if (chance(m_config.duplicatePercent)) {
+        m_stats.duplicated++;
+        schedule(OutgoingPacket(packet), releaseUs);
+    }
+    schedule(std::move(packet), releaseUs);
+}
+
+void NetworkImpairment::schedule(OutgoingPacket &&packet, qint64 releaseUs)
+{
+    m_held.insert(qMakePair(releaseUs, m_order++), std::move(packet));
+    m_stats.held = int(m_held.size());
+}
+
+bool NetworkImpairment::next(qint64 nowUs, OutgoingPacket *packet)
+{
+    if (m_held.isEmpty() || m_held.firstKey().first > nowUs) return false;
+
+    auto it = m_held.begin();
+    *packet = std::move(it.value());
+    m_held.erase(it);
+
+    QMutexLocker locker(&m_statsMutex);
+    m_stats.held = int(m_held.size());
+    return true;
+}
+
+qint64 NetworkImpairment::nextReleaseUs() const
+{
+    return m_held.isEmpty() ? -1 : m_held.firstKey().first;
+}
+
+NetworkImpairment::Stats NetworkImpairment::stats() const
+{
+    QMutexLocker locker(&m_statsMutex);
+    return m_stats;
+}
+
+void NetworkImpairment::clear()
+{
+    QMutexLocker locker(&m_statsMutex);
+    m_held.clear();
+    m_linkDepartures.clear();
+    m_linkFreeUs = 0;
+    m_lastReleaseUs = 0;
+    m_burst = false;
+    m_stats.held = 0;
+}
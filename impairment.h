@@ -0,0 +1,100 @@
+#ifndef IMPAIRMENT_H
+#define IMPAIRMENT_H
+
+#include <QMap>
+#include <QMutex>
+#include <QPair>
+#include <QQueue>
+#include <QRandomGenerator>
+#include <QtGlobal>
+#include "sendscheduler.h"
+
+// Имитация плохой сети для исходящих пакетов, в духе netem.
+//
+// Стоит между планировщиком отправки и сокетом. Каждый пакет по очереди
+// проходит:
+//   - потери: случайные и пачками по модели Гилберта-Эллиота (хорошее и
+//     плохое состояние с вероятностями перехода и потерь в каждом);
+//   - узкое место: ограничение скорости с очередью ограниченной длины,
+//     лишнее отбрасывается с хвоста;
+//   - задержку с джиттером заданного распределения; без переупорядочивания
+//     пакеты выходят в порядке отправки, как в одном маршруте, поэтому при
+//     плотном потоке средняя задержка заметно больше delayMs;
+//   - переупорядочивание: выбранный пакет идёт без задержки и обгоняет очередь;
+//   - дублирование.
+// Генератор случайных чисел инициализируется seed из настроек, поэтому
+// при одинаковых настройках и входе результат повторяется. Класс не
+// зависит от сокетов и годится для тестов без GUI.
+//
+// Работает в сетевом потоке; stats() можно звать из любого.
+class NetworkImpairment
+{
+public:
+    enum class Distribution { Uniform, Normal, Pareto };
+
+    struct Config
+    {
+        bool enabled = false;
+        double lossPercent = 0.0;          // случайные потери (в хорошем состоянии)
+        // Гилберт-Эллиот: вход в плохое состояние и средняя длина пачки
+        // в пакетах; 0 - без пачек
+        double burstPercent = 0.0;
+        double burstLength = 0.0;
+        double burstLossPercent = 100.0;   // потери в плохом состоянии
+        int delayMs = 0;
+        int jitterMs = 0;                  // разброс задержки (ст. отклонение для Normal)
+        Distribution distribution = Distribution::Normal;
+        double reorderPercent = 0.0;
+        double duplicatePercent = 0.0;
+        qint64 rateLimit = 0;              // бит/с, 0 - без ограничения
+        int queueLimit = 1000;             // пакетов в очереди узкого места
+        quint32 seed = 1;
+    };
+
+    struct Stats
+    {
+        qint64 submitted = 0;
+        qint64 lost = 0;           // случайные потери и пачки
+        qint64 queueDropped = 0;   // переполнение очереди узкого места
+        qint64 reordered = 0;
+        qint64 duplicated = 0;
+        int held = 0;              // пакетов ждут выхода сейчас
+    };
+
+    NetworkImpairment();
+
+    void setConfig(const Config &config);
+    const Config &config() const { return m_config; }
+    bool isEnabled() const { return m_config.enabled; }
+
+    void submit(OutgoingPacket &&packet, qint64 nowUs);
+    // Следующий пакет, время выхода которого наступило
+    bool next(qint64 nowUs, OutgoingPacket *packet);
+    // Время выхода ближайшего пакета; -1 - ничего не задержано
+    qint64 nextReleaseUs() const;
+
+    Stats stats() const;
+
+    void clear();
+
+private:
+    bool shouldDrop();
+    bool chance(double percent) { return percent > 0.0 && m_random.generateDouble() * 100.0 < percent; }
+    qint64 jitterUs();
+    void schedule(OutgoingPacket &&packet, qint64 releaseUs);
+
+    Config m_config;
+    QRandomGenerator m_random;
+    bool m_burst = false;                  // плохое состояние Гилберта-Эллиота
+
+    qint64 m_linkFreeUs = 0;               // когда узкое место освободится
+    QQueue<qint64> m_linkDepartures;       // время выхода пакетов из узкого места
+    qint64 m_lastReleaseUs = 0;
+    quint64 m_order = 0;                   // порядок среди пакетов с одним временем
+    QMap<QPair<qint64, quint64>, OutgoingPacket> m_held;
+
+    mutable QMutex m_statsMutex;
+    Stats m_stats;
+};
+
+#endif // IMPAIRMENT_H
@@ -0,0 +1,304 @@
+#include "benchutil.h"
+#include "impairment.h"
+#include <QtEndian>
+#include <cmath>
+#include <limits>
+
+// Проверка NetworkImpairment без GUI и сокетов: пакеты с номерами идут
+// через имитацию с заданным seed по модельному времени, на выходе
+// сверяются с настройками:
+//
+//   - доля случайных потерь;
+//   - пачки Гилберта-Эллиота: доля потерь и средняя длина пачки;
+//   - переупорядочивание и дублирование: счётчики и то, что видно на выходе;
+//   - задержка и джиттер для каждого распределения;
+//   - ограничение скорости и очередь узкого места;
+//   - повторяемость: тот же seed - тот же выход, другой - другой.
+//
+// Допуски - несколько стандартных отклонений выборки, поэтому при любом
+// seed проверка проходит, а при ошибке в модели - нет. Код возврата 1,
+// если что-то не совпало.
+//
+//   AuthoLASTVLADIOImpairmentCheck --seed 7
+
+namespace {
+
+using Bench::out;
+
+struct Delivered
+{
+    quint32 sequence = 0;
+    qint64 sentUs = 0;
+    qint64 releaseUs = 0;
+};
+
+struct Trace
+{
+    QList<Delivered> delivered;
+    NetworkImpairment::Stats stats;
+};
+
+// packets пакетов по size байт каждые intervalUs; номер пакета - в первых
+// четырёх байтах датаграммы
+Trace run(const NetworkImpairment::Config &config, int packets, qint64 intervalUs, int size)
+{
+    NetworkImpairment impairment;
+    impairment.setConfig(config);
+    Trace trace;
+
+    auto drain = [&](qint64 nowUs) {
+        for (qint64 releaseUs = impairment.nextReleaseUs(); releaseUs >= 0 && releaseUs <= nowUs;
+             releaseUs = impairment.nextReleaseUs()) {
+            OutgoingPacket packet;
+            if (!impairment.next(releaseUs, &packet)) break;
+            Delivered delivered;
+            delivered.sequence = qFromBigEndian<quint32>(packet.datagram.constData());
+            delivered.sentUs = packet.enqueuedUs;
+            delivered.releaseUs = releaseUs;
+            trace.delivered.append(delivered);
+        }
+    };
+
+    for (int i = 0; i < packets; ++i) {
+        const qint64 nowUs = qint64(i) * intervalUs;
+        drain(nowUs);
+        OutgoingPacket packet;
+        packet.datagram = QByteArray(qMax(4, size), 'i');
+        qToBigEndian<quint32>(quint32(i), packet.datagram.data());
+        packet.enqueuedUs = nowUs;
+        impairment.submit(std::move(packet), nowUs);
+    }
+    drain(std::numeric_limits<qint64>::max());
+    trace.stats = impairment.stats();
+    return trace;
+}
+
+bool expect(const QString &name, double value, double expected, double tolerance)
+{
+    const bool ok = qAbs(value - expected) <= tolerance;
+    out() << QString("  %1: %2 (ожидается %3 ± %4)%5")
+                 .arg(name)
+                 .arg(value, 0, 'f', 3)
+                 .arg(expected, 0, 'f', 3)
+                 .arg(tolerance, 0, 'f', 3)
+                 .arg(ok ? "" : " - НЕ СОВПАДАЕТ")
+          << Qt::endl;
+    return ok;
+}
+
+bool expectTrue(const QString &name, bool ok)
+{
+    out() << QString("  %1: %2").arg(name).arg(ok ? "да" : "НЕТ") << Qt::endl;
+    return ok;
+}
+
+NetworkImpairment::Config baseConfig(quint32 seed)
+{
+    NetworkImpairment::Config config;
+    config.enabled = true;
+    config.seed = seed;
+    return config;
+}
+
+bool checkRandomLoss(quint32 seed)
+{
+    out() << "Случайные потери 5%:" << Qt::endl;
+    NetworkImpairment::Config config = baseConfig(seed);
+    config.lossPercent = 5.0;
+    const int packets = 200000;
+    const Trace trace = run(config, packets, 20000, 200);
+
+    bool ok = expect("потери, %", 100.0 * (packets - trace.delivered.size()) / packets, 5.0, 0.25);
+    ok = expectTrue("счётчик потерь совпадает с выходом", trace.stats.lost == packets - trace.delivered.size())
+         && ok;
+    return ok;
+}
+
+bool checkBursts(quint32 seed)
+{
+    out() << "Пачки Гилберта-Эллиота 2%, длина 4:" << Qt::endl;
+    NetworkImpairment::Config config = baseConfig(seed);
+    config.burstPercent = 2.0;
+    config.burstLength = 4.0;
+    const int packets = 200000;
+    const Trace trace = run(config, packets, 20000, 200);
+
+    // Пачки - подряд пропавшие номера
+    qint64 bursts = 0;
+    qint64 lost = 0;
+    quint32 expected = 0;
+    for (const Delivered &delivered : trace.delivered) {
+        if (delivered.sequence != expected) {
+            ++bursts;
+            lost += delivered.sequence - expected;
+        }
+        expected = delivered.sequence + 1;
+    }
+    if (expected != quint32(packets)) {
+        ++bursts;
+        lost += packets - expected;
+    }
+
+    // Доля времени в плохом состоянии цепи Маркова: p / (p + 1/L)
+    const double enter = config.burstPercent / 100.0;
+    const double leave = 1.0 / config.burstLength;
+    bool ok = expect("потери, %", 100.0 * lost / packets, 100.0 * enter / (enter + leave), 0.5);
+    ok = expect("средняя длина пачки", bursts > 0 ? double(lost) / bursts : 0.0, config.burstLength, 0.3) && ok;
+    return ok;
+}
+
+bool checkReorderAndDuplicates(quint32 seed)
+{
+    out() << "Переупорядочивание 5% при задержке 50 мс, дублирование 3%:" << Qt::endl;
+    NetworkImpairment::Config config = baseConfig(seed);
+    config.delayMs = 50;
+    config.reorderPercent = 5.0;
+    config.duplicatePercent = 3.0;
+    const int packets = 100000;
+    const Trace trace = run(config, packets, 20000, 200);
+
+    // Переставленный пакет выходит раньше пакетов перед ним: за ним - меньший номер
+    qint64 descents = 0;
+    for (qsizetype i = 1; i < trace.delivered.size(); ++i) {
+        if (trace.delivered.at(i).sequence < trace.delivered.at(i - 1).sequence) ++descents;
+    }
+
+    bool ok = expect("переставлено, %", 100.0 * trace.stats.reordered / packets, 5.0, 0.35);
+    ok = expect("обгонов на выходе, %", 100.0 * descents / packets, 5.0, 0.4) && ok;
+    ok = expect("дублировано, %", 100.0 * trace.stats.duplicated / packets, 3.0, 0.3) && ok;
+    ok = expectTrue("дубликаты видны на выходе", trace.delivered.size() == packets + trace.stats.duplicated)
+         && ok;
+    return ok;
+}
+
+bool checkDelay(quint32 seed, NetworkImpairment::Distribution distribution, const char *name)
+{
+    out() << QString("Задержка 100 мс, джиттер 10 мс, %1:").arg(name) << Qt::endl;
+    NetworkImpairment::Config config = baseConfig(seed);
+    config.delayMs = 100;
+    config.jitterMs = 10;
+    config.distribution = distribution;
+    // Раз в секунду: порядок выхода не влияет на задержку
+    const Trace trace = run(config, 20000, 1000000, 200);
+
+    QList<double> delays;
+    double total = 0.0;
+    for (const Delivered &delivered : trace.delivered) {
+        delays.append((delivered.releaseUs - delivered.sentUs) / 1000.0);
+        total += delays.last();
+    }
+    const double mean = total / double(delays.size());
+    double variance = 0.0;
+    for (const double delay : delays) {
+        variance += (delay - mean) * (delay - mean);
+    }
+    const double deviation = std::sqrt(variance / double(delays.size()));
+    std::sort(delays.begin(), delays.end());
+    const double p99 = delays.at(qsizetype(double(delays.size()) * 0.99));
+
+    const bool pareto = distribution == NetworkImpairment::Distribution::Pareto;
+    bool ok = expect("средняя задержка, мс", mean, 100.0, pareto ? 1.5 : 0.5);
+    switch (distribution) {
+    case NetworkImpairment::Distribution::Uniform:
+        ok = expect("ст. отклонение, мс", deviation, 10.0 / std::sqrt(3.0), 0.3) && ok;
+        ok = expectTrue("в пределах 90-110 мс", delays.first() >= 90.0 && delays.last() <= 110.0) && ok;
+        break;
+    case NetworkImpairment::Distribution::Normal:
+        ok = expect("ст. отклонение, мс", deviation, 10.0, 0.5) && ok;
+        break;
+    case NetworkImpairment::Distribution::Pareto:
+        // Хвост: 99-й перцентиль Ломакса с формой 3 - около 163 мс, у нормального - 123
+        ok = expectTrue(QString("длинный хвост: 99% - %1 мс").arg(p99, 0, 'f', 1), p99 > 140.0) && ok;
+        break;
+    }
+    return ok;
+}
+
+bool checkRateLimit(quint32 seed)
+{
+    out() << "Узкое место 1 Мбит/с, очередь 20 пакетов, поток 5 Мбит/с:" << Qt::endl;
+    NetworkImpairment::Config config = baseConfig(seed);
+    config.rateLimit = 1000000;
+    config.queueLimit = 20;
+    const int packets = 5000;
+    // 1250 байт - 10 мс на канале, отправка каждые 2 мс
+    const Trace trace = run(config, packets, 2000, 1250);
+
+    const qint64 spanUs = trace.delivered.last().releaseUs - trace.delivered.first().releaseUs;
+    const double rate = double(trace.delivered.size() - 1) * 1250 * 8 * 1e6 / double(spanUs);
+    qint64 maxQueueUs = 0;
+    for (const Delivered &delivered : trace.delivered) {
+        maxQueueUs = qMax(maxQueueUs, delivered.releaseUs - delivered.sentUs);
+    }
+
+    bool ok = expect("скорость на выходе, Мбит/с", rate / 1e6, 1.0, 0.01);
+    ok = expectTrue("лишнее сброшено очередью",
+                    trace.stats.queueDropped > 0 && trace.delivered.size() + trace.stats.queueDropped == packets)
+         && ok;
+    ok = expect("наибольшее ожидание в очереди, мс", maxQueueUs / 1000.0, 200.0, 10.0) && ok;
+    return ok;
+}
+
+bool sameTrace(const Trace &a, const Trace &b)
+{
+    if (a.delivered.size() != b.delivered.size()) return false;
+    for (qsizetype i = 0; i < a.delivered.size(); ++i) {
+        if (a.delivered.at(i).sequence != b.delivered.at(i).sequence
+            || a.delivered.at(i).releaseUs != b.delivered.at(i).releaseUs) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool checkReproducible(quint32 seed)
+{
+    out() << "Повторяемость со всеми настройками сразу:" << Qt::endl;
+    NetworkImpairment::Config config = baseConfig(seed);
+    config.lossPercent = 3.0;
+    config.burstPercent = 1.0;
+    config.burstLength = 3.0;
+    config.burstLossPercent = 80.0;
+    config.delayMs = 40;
+    config.jitterMs = 20;
+    config.distribution = NetworkImpairment::Distribution::Pareto;
+    config.reorderPercent = 2.0;
+    config.duplicatePercent = 1.0;
+    config.rateLimit = 2000000;
+    config.queueLimit = 50;
+
+    const Trace first = run(config, 20000, 3000, 1000);
+    const Trace second = run(config, 20000, 3000, 1000);
+    config.seed = seed + 1;
+    const Trace other = run(config, 20000, 3000, 1000);
+
+    bool ok = expectTrue("тот же seed - тот же выход", sameTrace(first, second));
+    ok = expectTrue("другой seed - другой выход", !sameTrace(first, other)) && ok;
+    return ok;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    Bench::prepare(parser, "AuthoLASTVLADIOImpairmentCheck",
+                   "Проверка имитации плохой сети по заданному seed без GUI");
+    const QCommandLineOption seedOption("seed", "Начальное значение генератора.", "seed", "1");
+    parser.addOption(seedOption);
+    parser.process(app);
+
+    const quint32 seed = parser.value(seedOption).toUInt();
+    bool ok = checkRandomLoss(seed);
+    ok = checkBursts(seed) && ok;
+    ok = checkReorderAndDuplicates(seed) && ok;
+    ok = checkDelay(seed, NetworkImpairment::Distribution::Uniform, "равномерный") && ok;
+    ok = checkDelay(seed, NetworkImpairment::Distribution::Normal, "нормальный") && ok;
+    ok = checkDelay(seed, NetworkImpairment::Distribution::Pareto, "Парето") && ok;
+    ok = checkRateLimit(seed) && ok;
+    ok = checkReproducible(seed) && ok;
+
+    out() << (ok ? "Итог: в норме" : "Итог: есть расхождения") << Qt::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,356 @@
+#include "jitterbuffer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+constexpr int MinTargetMs = 20;
+constexpr int MaxTargetMs = 400;
+constexpr int MaxBufferMs = 1000;
+// После стольких подряд замаскированных кадров буфер снова набирается
+constexpr int MaxConcealedFrames = 10;
+// Окно истории задержек для выбора целевой глубины (~8 с при 40 мс пакетах)
+constexpr int DelayHistorySize = 200;
+constexpr double TargetQuantile = 0.95;
+// Кадров в буфере и свободных буферов PCM без перевыделения списков:
+// MaxBufferMs пакетами по 20 мс с запасом
+constexpr int ReservedFrames = 64;
+}
+
+AudioJitterBuffer::AudioJitterBuffer()
+{
+    // Пакет за пакетом память под историю больше не выделяется
+    m_delayHistory.reserve(DelayHistorySize);
+    m_delayScratch.reserve(DelayHistorySize);
+    m_frames.reserve(ReservedFrames);
+    m_spare.reserve(ReservedFrames);
+}
+
+void AudioJitterBuffer::setFormat(int sampleRate, int bytesPerFrame, bool stretchable)
+{
+    m_sampleRate = sampleRate;
+    m_bytesPerFrame = bytesPerFrame;
+    m_stretchable = stretchable;
+    clear();
+}
+
+void AudioJitterBuffer::insert(quint32 sequence, quint32 timestamp, QByteArrayView pcm, qint64 arrivalMs)
+{
+    if (pcm.isEmpty() || pcm.size() % m_bytesPerFrame != 0) return;
+
+    const bool first = !m_hasSequence;
+    const qint64 seq = unwrapSequence(sequence);
+    const qint64 ts = first ? qint64(timestamp) : unwrapTimestamp(timestamp);
+    if (first || ts > m_referenceTimestamp) {
+        m_referenceTimestamp = ts;
+    }
+
+    m_stats.received++;
+
+    // Оценка джиттера по RFC 3550, время прихода переводится в отсчёты
+    const double transit = double(arrivalMs) * m_sampleRate / 1000.0 - double(ts);
+    if (m_hasTransit) {
+        const double d = std::fabs(transit - m_lastTransit);
+        m_jitter += (d - m_jitter) / 16.0;
+    }
+    m_lastTransit = transit;
+    m_hasTransit = true;
+
+    const double delayMs = transit * 1000.0 / m_sampleRate;
+    if (int(m_delayHistory.size()) < DelayHistorySize) {
+        m_delayHistory.push_back(delayMs);
+    } else {
+        m_delayHistory[size_t(m_delayNext)] = delayMs;
+        m_delayNext = (m_delayNext + 1) % DelayHistorySize;
+    }
+    updateTarget();
+
+    if (m_playing && ts + pcm.size() / m_bytesPerFrame <= m_nextTimestamp) {
+        m_stats.late++;
+        return;
+    }
+    const qsizetype index = lowerBound(seq);
+    if (index < m_frames.size() && m_frames.at(index).sequence == seq) {
+        m_stats.duplicates++;
+        return;
+    }
+
+    Frame frame{seq, ts, takeSpare()};
+    frame.pcm.resize(pcm.size());
+    memcpy(frame.pcm.data(), pcm.data(), size_t(pcm.size()));
+    m_frames.insert(index, std::move(frame));
+
+    // Защита от бесконечного роста, если вывод остановлен
+    while (samplesToMs(depthSamples()) > MaxBufferMs && m_frames.size() > 1) {
+        Frame dropped = m_frames.takeFirst();
+        if (m_playing) {
+            m_nextTimestamp = dropped.timestamp + frameSamples(dropped.pcm);
+        }
+        recycle(std::move(dropped.pcm));
+    }
+}
+
+QByteArray AudioJitterBuffer::pop()
+{
+    if (!m_playing) {
+        // Запас в target мс сверх первого кадра, который сразу уйдёт в устройство
+        if (m_frames.isEmpty()) return QByteArray();
+        const qint64 firstSamples = frameSamples(m_frames.first().pcm);
+        if (samplesToMs(depthSamples() - firstSamples) < targetMs()) return QByteArray();
+
+        m_playing = true;
+        m_nextTimestamp = m_frames.first().timestamp;
+        m_consecutiveConcealed = 0;
+    }
+
+    // Кадры, время которых уже прошло, выбрасываются
+    while (!m_frames.isEmpty()) {
+        const Frame &head = m_frames.first();
+        if (head.timestamp + frameSamples(head.pcm) > m_nextTimestamp) break;
+        recycle(std::move(m_frames.takeFirst().pcm));
+        m_stats.late++;
+    }
+
+    const int fallbackSamples = m_lastFrameSamples > 0 ? m_lastFrameSamples : m_sampleRate / 50;
+
+    if (m_frames.isEmpty()) {
+        if (++m_consecutiveConcealed > MaxConcealedFrames) {
+            m_playing = false;
+            m_lastFrame.clear();
+            return QByteArray();
+        }
+        m_nextTimestamp += fallbackSamples;
+        return conceal(fallbackSamples);
+    }
+
+    const Frame &head = m_frames.first();
+    if (head.timestamp > m_nextTimestamp) {
+        // Пакет потерян или ещё в пути, а его время воспроизведения наступило
+        const int gap = int(qMin<qint64>(head.timestamp - m_nextTimestamp, fallbackSamples));
+        m_nextTimestamp += gap;
+        ++m_consecutiveConcealed;
+        return conceal(gap);
+    }
+
+    Frame frame = m_frames.takeFirst();
+    QByteArray pcm = frame.pcm;
+
+    // Начало кадра могло уже быть замаскировано
+    if (frame.timestamp < m_nextTimestamp) {
+        pcm = pcm.mid(qsizetype(m_nextTimestamp - frame.timestamp) * m_bytesPerFrame);
+    }
+
+    m_nextTimestamp = frame.timestamp + frameSamples(frame.pcm);
+    m_lastFrameSamples = frameSamples(frame.pcm);
+    m_consecutiveConcealed = 0;
+    // Прошлый кадр вывод к этому времени обычно уже отпустил
+    recycle(std::move(m_lastFrame));
+    m_lastFrame = pcm;
+
+    // Глубина сглаживается, чтобы не реагировать на одиночные всплески
+    const double depth = double(depthSamples());
+    m_filteredDepth += (depth - m_filteredDepth) * 0.1;
+
+    if (m_stretchable) {
+        const double target = double(targetMs()) * m_sampleRate / 1000.0;
+        const double frameLen = double(m_lastFrameSamples);
+
+        if (m_filteredDepth > target + frameLen / 2) {
+            const QByteArray shorter = accelerate(pcm);
+            if (shorter.size() < pcm.size()) {
+                m_stats.accelerated++;
+                m_filteredDepth -= double(pcm.size() - shorter.size()) / m_bytesPerFrame;
+                return shorter;
+            }
+        } else if (m_frames.isEmpty() && m_filteredDepth < target / 2) {
+            const QByteArray longer = expand(pcm);
+            if (longer.size() > pcm.size()) {
+                m_stats.expanded++;
+                m_filteredDepth += double(longer.size() - pcm.size()) / m_bytesPerFrame;
+                return longer;
+            }
+        }
+    }
+    return pcm;
+}
+
+void AudioJitterBuffer::clear()
+{
+    m_frames.clear();
+    m_hasSequence = false;
+    m_highestSequence = 0;
+    m_playing = false;
+    m_nextTimestamp = 0;
+    m_referenceTimestamp = 0;
+    m_lastFrameSamples = 0;
+    m_consecutiveConcealed = 0;
+    m_lastFrame.clear();
+    m_hasTransit = false;
+    m_lastTransit = 0.0;
+    m_jitter = 0.0;
+    m_filteredDepth = 0.0;
+    m_delayHistory.clear();
+    m_delayNext = 0;
+    m_targetMs = MinTargetMs;
+    m_stats = Stats();
+}
+
+double AudioJitterBuffer::jitterMs() const
+{
+    return m_sampleRate > 0 ? m_jitter * 1000.0 / m_sampleRate : 0.0;
+}
+
+void AudioJitterBuffer::updateTarget()
+{
+    // Цель - 95-й перцентиль задержки относительно самого быстрого пакета окна
+    if (m_delayHistory.size() < 2) {
+        m_targetMs = MinTargetMs;
+        return;
+    }
+
+    // nth_element переставляет элементы, поэтому работает с копией
+    std::vector<double> &delays = m_delayScratch;
+    delays.assign(m_delayHistory.begin(), m_delayHistory.end());
+    const double fastest = *std::min_element(delays.begin(), delays.end());
+    const size_t index = size_t(double(delays.size() - 1) * TargetQuantile);
+    std::nth_element(delays.begin(), delays.begin() + qsizetype(index), delays.end());
+    m_targetMs = qBound(MinTargetMs, int(std::lround(delays[index] - fastest)), MaxTargetMs);
+}
+
+qint64 AudioJitterBuffer::unwrapSequence(quint32 sequence)
+{
+    if (!m_hasSequence) {
+        m_hasSequence = true;
+        m_highestSequence = sequence;
+        return sequence;
+    }
+
+    const qint64 seq = m_highestSequence + qint32(sequence - quint32(m_highestSequence));
+    if (seq > m_highestSequence) {
+        m_highestSequence = seq;
+    }
+    return seq;
+}
+
+qint64 AudioJitterBuffer::unwrapTimestamp(quint32 timestamp) const
+{
+    return m_referenceTimestamp + qint32(timestamp - quint32(m_referenceTimestamp));
+}
+
+qsizetype AudioJitterBuffer::lowerBound(qint64 sequence) const
+{
+    // Новый пакет обычно старше всех в буфере
+    if (m_frames.isEmpty() || m_frames.last().sequence < sequence) return m_frames.size();
+
+    const auto it = std::lower_bound(m_frames.cbegin(), m_frames.cend(), sequence,
+                                     [](const Frame &frame, qint64 value) { return frame.sequence < value; });
+    return qsizetype(it - m_frames.cbegin());
+}
+
+QByteArray AudioJitterBuffer::takeSpare()
+{
+    return m_spare.isEmpty() ? QByteArray() : m_spare.takeLast();
+}
+
+void AudioJitterBuffer::recycle(QByteArray &&pcm)
+{
+    // Буфер, который ещё держит вывод, остаётся ему
+    if (pcm.isDetached() && pcm.capacity() > 0 && m_spare.size() < ReservedFrames) {
+        m_spare.append(std::move(pcm));
+    }
+    pcm = QByteArray();
+}
+
+qint64 AudioJitterBuffer::depthSamples() const
+{
+    if (m_frames.isEmpty()) return 0;
+
+    const Frame &last = m_frames.last();
+    const qint64 end = last.timestamp + frameSamples(last.pcm);
+    const qint64 start = m_playing ? m_nextTimestamp : m_frames.first().timestamp;
+    return qMax<qint64>(0, end - start);
+}
+
+QByteArray AudioJitterBuffer::conceal(int samples)
+{
+    m_stats.concealed++;
+
+    QByteArray out(qsizetype(samples) * m_bytesPerFrame, '\0');
+
+    // Первый пропуск - затухающий повтор последнего кадра, дальше тишина
+    if (m_stretchable && m_consecutiveConcealed <= 1 && !m_lastFrame.isEmpty()) {
+        const qint16 *src = reinterpret_cast<const qint16 *>(m_lastFrame.constData());
+        const int srcCount = int(m_lastFrame.size() / 2);
+        qint16 *dst = reinterpret_cast<qint16 *>(out.data());
+        for (int i = 0; i < samples; ++i) {
+            const double gain = 0.5 * (1.0 - double(i) / samples);
+            dst[i] = qint16(src[i % srcCount] * gain);
+        }
+    }
+    return out;
+}
+
+int AudioJitterBuffer::bestPitchLag(const qint16 *x, int n) const
+{
+    // Поиск периода основного тона 2.5..10 мс (100..400 Гц)
+    const int minLag = m_sampleRate / 400;
+    const int maxLag = qMin(m_sampleRate / 100, n / 2);
+    if (minLag <= 0 || maxLag < minLag) return 0;
+
+    int best = 0;
+    double bestScore = 0.3; // ниже этого сигнал считается непериодическим
+    for (int lag = minLag; lag <= maxLag; lag += 2) {
+        double xy = 0.0, xx = 0.0, yy = 0.0;
+        for (int i = 0; i < lag; i += 4) {
+            const double a = x[i];
+            const double b = x[i + lag];
+            xy += a * b;
+            xx += a * a;
+            yy += b * b;
+        }
+        if (xx <= 0.0 || yy <= 0.0) continue;
+        const double score = xy / std::sqrt(xx * yy);
+        if (score > bestScore) {
+            bestScore = score;
+            best = lag;
+        }
+    }
+    return best;
+}
+
+QByteArray AudioJitterBuffer::accelerate(const QByteArray &pcm) const
+{
+    const qint16 *x = reinterpret_cast<const qint16 *>(pcm.constData());
+    const int n = int(pcm.size() / 2);
+
+    const int lag = bestPitchLag(x, n);
+    if (lag == 0 || 2 * lag > n) return pcm;
+
+    // Два соседних периода сливаются в один с плавным переходом
+    QByteArray out(qsizetype(n - lag) * 2, Qt::Uninitialized);
+    qint16 *y = reinterpret_cast<qint16 *>(out.data());
+    for (int i = 0; i < lag; ++i) {
+        y[i] = qint16((x[i] * (lag - i) + x[i + lag] * i) / lag);
+    }
+    memcpy(y + lag, x + 2 * lag, size_t(n - 2 * lag) * 2);
+    return out;
+}
+
+QByteArray AudioJitterBuffer::expand(const QByteArray &pcm) const
+{
+    const qint16 *x = reinterpret_cast<const qint16 *>(pcm.constData());
+    const int n = int(pcm.size() / 2);
+
+    const int lag = bestPitchLag(x, n);
+    if (lag == 0 || 2 * lag > n) return pcm;
+
+    // Один период вставляется повторно с плавным переходом
+    QByteArray out(qsizetype(n + lag) * 2, Qt::Uninitialized);
+    qint16 *y = reinterpret_cast<qint16 *>(out.data());
+    memcpy(y, x, size_t(lag) * 2);
+    for (int i = 0; i < lag; ++i) {
+        y[lag + i] = qint16((x[lag + i] * (lag - i) + x[i] * i) / lag);
+    }
+    memcpy(y + 2 * lag, x + lag, size_t(n - lag) * 2);
+    return out;
+}
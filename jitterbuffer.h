@@ -0,0 +1,110 @@
+#ifndef JITTERBUFFER_H
+#define JITTERBUFFER_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QList>
+#include <QtGlobal>
+#include <vector>
+
+// Адаптивный джиттер-буфер для входящего аудио.
+//
+// Пакеты упорядочиваются по sequence, воспроизведение идёт по медиа-времени
+// (timestamp в отсчётах): дыры заполняются маскировкой, опоздавшие пакеты
+// отбрасываются. Целевая глубина буфера подстраивается под измеренный
+// разброс задержки, а отклонение глубины от цели выбирается не сбросом
+// пакетов, а растяжением/сжатием речи на один период основного тона.
+// Целевая глубина - 95-й перцентиль задержки пакетов за последние секунды,
+// для статистики дополнительно считается джиттер по RFC 3550.
+//
+// PCM пакета копируется в буфер из собственного запаса: кадры, выброшенные
+// или уже отданные выводу, возвращают туда свои буферы, поэтому в
+// установившемся режиме insert() не выделяет память.
+class AudioJitterBuffer
+{
+public:
+    struct Stats
+    {
+        qint64 received = 0;
+        qint64 late = 0;
+        qint64 duplicates = 0;
+        qint64 concealed = 0;
+        qint64 accelerated = 0;
+        qint64 expanded = 0;
+    };
+
+    AudioJitterBuffer();
+
+    // stretchable - формат Int16 моно, для остальных растяжение отключено
+    void setFormat(int sampleRate, int bytesPerFrame, bool stretchable);
+
+    void insert(quint32 sequence, quint32 timestamp, QByteArrayView pcm, qint64 arrivalMs);
+
+    // Следующая порция для устройства вывода; пустая, пока буфер набирается
+    QByteArray pop();
+
+    void clear();
+
+    bool isPlaying() const { return m_playing; }
+    double jitterMs() const;
+    int targetMs() const { return m_targetMs; }
+    int depthMs() const { return samplesToMs(depthSamples()); }
+    const Stats &stats() const { return m_stats; }
+
+private:
+    struct Frame
+    {
+        qint64 sequence = 0;
+        qint64 timestamp = 0;
+        QByteArray pcm;
+    };
+
+    void updateTarget();
+    qint64 unwrapSequence(quint32 sequence);
+    qint64 unwrapTimestamp(quint32 timestamp) const;
+    qint64 depthSamples() const;
+    // Первый кадр с sequence не меньше заданного
+    qsizetype lowerBound(qint64 sequence) const;
+    QByteArray takeSpare();
+    void recycle(QByteArray &&pcm);
+    int frameSamples(const QByteArray &pcm) const { return m_bytesPerFrame > 0 ? int(pcm.size() / m_bytesPerFrame) : 0; }
+    int samplesToMs(qint64 samples) const { return m_sampleRate > 0 ? int(samples * 1000 / m_sampleRate) : 0; }
+
+    QByteArray conceal(int samples);
+    QByteArray accelerate(const QByteArray &pcm) const;
+    QByteArray expand(const QByteArray &pcm) const;
+    int bestPitchLag(const qint16 *x, int n) const;
+
+    int m_sampleRate = 48000;
+    int m_bytesPerFrame = 2;
+    bool m_stretchable = true;
+
+    // По возрастанию sequence; вставка почти всегда в конец
+    QList<Frame> m_frames;
+    QList<QByteArray> m_spare;
+    bool m_hasSequence = false;
+    qint64 m_highestSequence = 0;
+
+    bool m_playing = false;
+    qint64 m_nextTimestamp = 0;
+    qint64 m_referenceTimestamp = 0;
+    int m_lastFrameSamples = 0;
+    int m_consecutiveConcealed = 0;
+    QByteArray m_lastFrame;
+
+    bool m_hasTransit = false;
+    double m_lastTransit = 0.0;
+    double m_jitter = 0.0;         // в отсчётах
+    double m_filteredDepth = 0.0;  // в отсчётах
+    // Относительная задержка пакетов, мс: кольцо на окно истории. Для
+    // перцентиля порядок не важен, поэтому кольцо не разворачивается.
+    // Копия для nth_element - в заранее выделенном буфере
+    std::vector<double> m_delayHistory;
+    int m_delayNext = 0;
+    std::vector<double> m_delayScratch;
+    int m_targetMs = 20;
+
+    Stats m_stats;
+};
+
+#endif // JITTERBUFFER_H
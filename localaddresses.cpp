@@ -0,0 +1,83 @@
+#include "localaddresses.h"
+#include <QNetworkInterface>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#ifdef Q_OS_LINUX
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace {
+// Без уведомлений от системы - как часто перечитывать адреса
+constexpr int RefreshIntervalMs = 10000;
+}
+
+LocalAddresses::LocalAddresses(QObject *parent)
+    : QObject(parent)
+{
+    refresh();
+    startWatching();
+}
+
+LocalAddresses::~LocalAddresses()
+{
+    delete m_notifier;
+#ifdef Q_OS_LINUX
+    if (m_netlinkFd != -1) {
+        ::close(m_netlinkFd);
+    }
+#endif
+}
+
+bool LocalAddresses::contains(const QHostAddress &address) const
+{
+    return address.isLoopback() || m_addresses.contains(address);
+}
+
+void LocalAddresses::refresh()
+{
+    m_addresses.clear();
+    foreach (const QHostAddress &address, QNetworkInterface::allAddresses()) {
+        m_addresses.insert(address);
+    }
+}
+
+void LocalAddresses::startWatching()
+{
+#ifdef Q_OS_LINUX
+    // Подписка на добавление и удаление адресов интерфейсов
+    const int fd = ::socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd != -1) {
+        sockaddr_nl addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+            m_netlinkFd = fd;
+            m_notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+            connect(m_notifier, &QSocketNotifier::activated, this, &LocalAddresses::readNotifications);
+            return;
+        }
+        ::close(fd);
+    }
+#endif
+
+    m_refreshTimer = new QTimer(this);
+    connect(m_refreshTimer, &QTimer::timeout, this, &LocalAddresses::refresh);
+    m_refreshTimer->start(RefreshIntervalMs);
+}
+
+void LocalAddresses::readNotifications()
+{
+#ifdef Q_OS_LINUX
+    // Содержимое не разбирается: пачка изменений - одно перечитывание
+    char buffer[8192];
+    while (::recv(m_netlinkFd, buffer, sizeof(buffer), 0) > 0) {
+    }
+#endif
+    refresh();
+}
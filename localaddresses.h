@@ -0,0 +1,39 @@
+#ifndef LOCALADDRESSES_H
+#define LOCALADDRESSES_H
+
+#include <QObject>
+#include <QHostAddress>
+#include <QSet>
+
+class QSocketNotifier;
+class QTimer;
+
+// Адреса этой машины для отсечения своих пакетов.
+//
+// QNetworkInterface::allAddresses() перебирает интерфейсы системными
+// вызовами, поэтому набор строится один раз и хранится хешем, а
+// обновляется только при изменениях: на Linux - по уведомлениям netlink
+// о появлении и удалении адресов, на остальных платформах - периодически.
+class LocalAddresses : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LocalAddresses(QObject *parent = nullptr);
+    ~LocalAddresses();
+
+    bool contains(const QHostAddress &address) const;
+    // Перечитать адреса интерфейсов
+    void refresh();
+
+private:
+    void startWatching();
+    void readNotifications();
+
+    QSet<QHostAddress> m_addresses;
+    int m_netlinkFd = -1;
+    QSocketNotifier *m_notifier = nullptr;
+    QTimer *m_refreshTimer = nullptr;
+};
+
+#endif // LOCALADDRESSES_H
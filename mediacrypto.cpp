@@ -0,0 +1,331 @@
+#include "mediacrypto.h"
+#include "fec.h"
+#include <QCryptographicHash>
+#include <QMessageAuthenticationCode>
+#include <QPasswordDigestor>
+#include <QtEndian>
+#include <cstring>
+
+namespace {
+
+// PBKDF2: около десятой доли секунды на вход в звонок, перебор паролей
+// во столько же раз дороже
+constexpr int KeyIterations = 100000;
+const char KeySalt[] = "AuthoLASTVLADIO call key";
+const char SenderKeyLabel[] = "AuthoLASTVLADIO media";
+
+inline quint32 load32(const uchar *p)
+{
+    return qFromLittleEndian<quint32>(p);
+}
+
+inline quint32 rotl(quint32 x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+inline void quarterRound(quint32 &a, quint32 &b, quint32 &c, quint32 &d)
+{
+    a += b; d ^= a; d = rotl(d, 16);
+    c += d; b ^= c; b = rotl(b, 12);
+    a += b; d ^= a; d = rotl(d, 8);
+    c += d; b ^= c; b = rotl(b, 7);
+}
+
+// Состояние ChaCha20 для ключа и nonce, счётчик блоков - слово 12
+struct ChaCha20
+{
+    quint32 state[16];
+
+    ChaCha20(const uchar *key, const uchar *nonce, quint32 counter)
+    {
+        state[0] = 0x61707865;
+        state[1] = 0x3320646e;
+        state[2] = 0x79622d32;
+        state[3] = 0x6b206574;
+        for (int i = 0; i < 8; ++i) {
+            state[4 + i] = load32(key + 4 * i);
+        }
+        state[12] = counter;
+        state[13] = load32(nonce);
+        state[14] = load32(nonce + 4);
+        state[15] = load32(nonce + 8);
+    }
+
+    void block(uchar *out)
+    {
+        quint32 x[16];
+        memcpy(x, state, sizeof(x));
+        for (int i = 0; i < 10; ++i) {
+            quarterRound(x[0], x[4], x[8], x[12]);
+            quarterRound(x[1], x[5], x[9], x[13]);
+            quarterRound(x[2], x[6], x[10], x[14]);
+            quarterRound(x[3], x[7], x[11], x[15]);
+            quarterRound(x[0], x[5], x[10], x[15]);
+            quarterRound(x[1], x[6], x[11], x[12]);
+            quarterRound(x[2], x[7], x[8], x[13]);
+            quarterRound(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; ++i) {
+            qToLittleEndian<quint32>(x[i] + state[i], out + 4 * i);
+        }
+        ++state[12];
+    }
+
+    // data ^= поток ключа
+    void apply(uchar *data, qsizetype length)
+    {
+        uchar stream[64];
+        while (length > 0) {
+            block(stream);
+            const qsizetype n = qMin<qsizetype>(length, 64);
+            for (qsizetype i = 0; i < n; ++i) {
+                data[i] ^= stream[i];
+            }
+            data += n;
+            length -= n;
+        }
+    }
+};
+
+// Poly1305 на 26-битных частях: только 32x32->64 умножения, без 128-битной
+// арифметики, которой нет у MSVC
+class Poly1305
+{
+public:
+    explicit Poly1305(const uchar *key)
+    {
+        m_r[0] = load32(key) & 0x3ffffff;
+        m_r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+        m_r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+        m_r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+        m_r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+        for (int i = 0; i < 4; ++i) {
+            m_pad[i] = load32(key + 16 + 4 * i);
+        }
+    }
+
+    // Данные с дополнением нулями до 16 байт, как в AEAD
+    void updatePadded(const uchar *data, qsizetype length)
+    {
+        while (length >= 16) {
+            blocks(data, 1 << 24);
+            data += 16;
+            length -= 16;
+        }
+        if (length > 0) {
+            uchar last[16] = {};
+            memcpy(last, data, size_t(length));
+            blocks(last, 1 << 24);
+        }
+    }
+
+    void updateLengths(qsizetype aadLength, qsizetype length)
+    {
+        uchar block[16];
+        qToLittleEndian<quint64>(quint64(aadLength), block);
+        qToLittleEndian<quint64>(quint64(length), block + 8);
+        blocks(block, 1 << 24);
+    }
+
+    void finish(uchar *tag)
+    {
+        quint32 h0 = m_h[0], h1 = m_h[1], h2 = m_h[2], h3 = m_h[3], h4 = m_h[4];
+
+        quint32 c = h1 >> 26; h1 &= 0x3ffffff;
+        h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+        h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+        h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+
+        // h - p; берётся, если не отрицательно, без ветвлений
+        quint32 g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+        quint32 g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+        quint32 g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+        quint32 g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+        const quint32 g4 = h4 + c - (1u << 26);
+
+        quint32 mask = (g4 >> 31) - 1;
+        h0 = (h0 & ~mask) | (g0 & mask);
+        h1 = (h1 & ~mask) | (g1 & mask);
+        h2 = (h2 & ~mask) | (g2 & mask);
+        h3 = (h3 & ~mask) | (g3 & mask);
+        h4 = (h4 & ~mask) | (g4 & mask);
+
+        const quint32 w0 = h0 | (h1 << 26);
+        const quint32 w1 = (h1 >> 6) | (h2 << 20);
+        const quint32 w2 = (h2 >> 12) | (h3 << 14);
+        const quint32 w3 = (h3 >> 18) | (h4 << 8);
+
+        quint64 f = quint64(w0) + m_pad[0];
+        qToLittleEndian<quint32>(quint32(f), tag);
+        f = quint64(w1) + m_pad[1] + (f >> 32);
+        qToLittleEndian<quint32>(quint32(f), tag + 4);
+        f = quint64(w2) + m_pad[2] + (f >> 32);
+        qToLittleEndian<quint32>(quint32(f), tag + 8);
+        f = quint64(w3) + m_pad[3] + (f >> 32);
+        qToLittleEndian<quint32>(quint32(f), tag + 12);
+    }
+
+private:
+    void blocks(const uchar *m, quint32 hibit)
+    {
+        const quint32 r0 = m_r[0], r1 = m_r[1], r2 = m_r[2], r3 = m_r[3], r4 = m_r[4];
+        const quint32 s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+
+        quint32 h0 = m_h[0] + (load32(m) & 0x3ffffff);
+        quint32 h1 = m_h[1] + ((load32(m + 3) >> 2) & 0x3ffffff);
+        quint32 h2 = m_h[2] + ((load32(m + 6) >> 4) & 0x3ffffff);
+        quint32 h3 = m_h[3] + ((load32(m + 9) >> 6) & 0x3ffffff);
+        quint32 h4 = m_h[4] + ((load32(m + 12) >> 8) | hibit);
+
+        const quint64 d0 = quint64(h0) * r0 + quint64(h1) * s4 + quint64(h2) * s3 + quint64(h3) * s2 + quint64(h4) * s1;
+        quint64 d1 = quint64(h0) * r1 + quint64(h1) * r0 + quint64(h2) * s4 + quint64(h3) * s3 + quint64(h4) * s2;
+        quint64 d2 = quint64(h0) * r2 + quint64(h1) * r1 + quint64(h2) * r0 + quint64(h3) * s4 + quint64(h4) * s3;
+        quint64 d3 = quint64(h0) * r3 + quint64(h1) * r2 + quint64(h2) * r1 + quint64(h3) * r0 + quint64(h4) * s4;
+        quint64 d4 = quint64(h0) * r4 + quint64(h1) * r3 + quint64(h2) * r2 + quint64(h3) * r1 + quint64(h4) * r0;
+
+        quint32 c = quint32(d0 >> 26); h0 = quint32(d0) & 0x3ffffff;
+        d1 += c; c = quint32(d1 >> 26); h1 = quint32(d1) & 0x3ffffff;
+        d2 += c; c = quint32(d2 >> 26); h2 = quint32(d2) & 0x3ffffff;
+        d3 += c; c = quint32(d3 >> 26); h3 = quint32(d3) & 0x3ffffff;
+        d4 += c; c = quint32(d4 >> 26); h4 = quint32(d4) & 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+
+        m_h[0] = h0;
+        m_h[1] = h1;
+        m_h[2] = h2;
+        m_h[3] = h3;
+        m_h[4] = h4;
+    }
+
+    quint32 m_r[5];
+    quint32 m_h[5] = {};
+    quint32 m_pad[4];
+};
+
+void computeTag(const uchar *key, const uchar *nonce, const uchar *aad, qsizetype aadLength,
+                const uchar *ciphertext, qsizetype length, uchar *tag)
+{
+    // Одноразовый ключ Poly1305 - блок 0 потока, данные шифруются с блока 1
+    uchar polyKey[64];
+    ChaCha20(key, nonce, 0).block(polyKey);
+
+    Poly1305 poly(polyKey);
+    poly.updatePadded(aad, aadLength);
+    poly.updatePadded(ciphertext, length);
+    poly.updateLengths(aadLength, length);
+    poly.finish(tag);
+}
+
+// Nonce пакета: 0 и заголовок без первого байта - тип, peerId, sequence, timestamp
+void packetNonce(const char *packet, uchar *nonce)
+{
+    nonce[0] = 0;
+    memcpy(nonce + 1, packet + 1, Protocol::HeaderSize - 1);
+}
+
+}
+
+namespace ChaCha20Poly1305 {
+
+void seal(const uchar *key, const uchar *nonce, const uchar *aad, qsizetype aadLength,
+          uchar *data, qsizetype length, uchar *tag)
+{
+    ChaCha20(key, nonce, 1).apply(data, length);
+    computeTag(key, nonce, aad, aadLength, data, length, tag);
+}
+
+bool open(const uchar *key, const uchar *nonce, const uchar *aad, qsizetype aadLength,
+          uchar *data, qsizetype length, const uchar *tag)
+{
+    uchar expected[TagSize];
+    computeTag(key, nonce, aad, aadLength, data, length, expected);
+
+    // Сравнение за постоянное время
+    uchar diff = 0;
+    for (int i = 0; i < TagSize; ++i) {
+        diff |= expected[i] ^ tag[i];
+    }
+    if (diff != 0) return false;
+
+    ChaCha20(key, nonce, 1).apply(data, length);
+    return true;
+}
+
+} // namespace ChaCha20Poly1305
+
+QByteArray MediaCrypto::deriveCallKey(const QString &passphrase)
+{
+    if (passphrase.isEmpty()) return QByteArray();
+    return QPasswordDigestor::deriveKeyPbkdf2(QCryptographicHash::Sha256, passphrase.toUtf8(),
+                                              QByteArray(KeySalt), KeyIterations, KeySize);
+}
+
+MediaCrypto::Key MediaCrypto::senderKey(const QByteArray &callKey, const QUuid &instanceId)
+{
+    const QByteArray derived = QMessageAuthenticationCode::hash(QByteArray(SenderKeyLabel) + instanceId.toRfc4122(),
+                                                                callKey, QCryptographicHash::Sha256);
+    Key key;
+    memcpy(key.bytes, derived.constData(), size_t(qMin<qsizetype>(derived.size(), KeySize)));
+    return key;
+}
+
+int MediaCrypto::clearLength(Protocol::PacketType type)
+{
+    return type == Protocol::PacketType::Fec ? Protocol::HeaderSize + Fec::HeaderSize : Protocol::HeaderSize;
+}
+
+void MediaCrypto::seal(const Key &key, char *packet, qsizetype length)
+{
+    const int clear = clearLength(Protocol::PacketType(quint8(packet[1])));
+    uchar *p = reinterpret_cast<uchar *>(packet);
+    uchar nonce[ChaCha20Poly1305::NonceSize];
+    packetNonce(packet, nonce);
+    ChaCha20Poly1305::seal(key.bytes, nonce, p, clear, p + clear, length - clear - TagSize, p + length - TagSize);
+}
+
+bool MediaCrypto::open(const Key &key, char *packet, qsizetype length)
+{
+    if (length < Protocol::HeaderSize + TagSize) return false;
+    const int clear = clearLength(Protocol::PacketType(quint8(packet[1])));
+    if (length < clear + TagSize) return false;
+
+    uchar *p = reinterpret_cast<uchar *>(packet);
+    uchar nonce[ChaCha20Poly1305::NonceSize];
+    packetNonce(packet, nonce);
+    return ChaCha20Poly1305::open(key.bytes, nonce, p, clear, p + clear, length - clear - TagSize,
+                                  p + length - TagSize);
+}
+
+bool ReplayWindow::check(quint32 sequence) const
+{
+    if (!m_started) return true;
+
+    const qint32 ahead = qint32(sequence - m_top);
+    if (ahead > 0) return true;
+    if (-qint64(ahead) >= Size) return false;
+    return !(m_bitmap[(sequence / 64) % Words] & (quint64(1) << (sequence % 64)));
+}
+
+void ReplayWindow::update(quint32 sequence)
+{
+    if (!m_started) {
+        m_started = true;
+        m_top = sequence;
+    } else {
+        const qint32 ahead = qint32(sequence - m_top);
+        if (ahead > 0) {
+            // Слова, через которые окно перешло, освобождаются под новые sequence
+            // Номера слов - по модулю 2^26, чтобы переполнение sequence не сбрасывало окно
+            const quint32 steps = qMin<quint32>((sequence / 64 - m_top / 64) & 0x3ffffff, Words);
+            for (quint32 i = 1; i <= steps; ++i) {
+                m_bitmap[(m_top / 64 + i) % Words] = 0;
+            }
+            m_top = sequence;
+        }
+    }
+    m_bitmap[(sequence / 64) % Words] |= quint64(1) << (sequence % 64);
+}
@@ -0,0 +1,99 @@
+#ifndef MEDIACRYPTO_H
+#define MEDIACRYPTO_H
+
+#include <QByteArray>
+#include <QString>
+#include <QUuid>
+#include "protocol.h"
+
+// AEAD ChaCha20-Poly1305 (RFC 8439). Своя реализация без внешних
+// библиотек: от таблиц не зависит, поэтому время не зависит от данных
+// и на процессорах без AES-NI.
+namespace ChaCha20Poly1305 {
+
+constexpr int KeySize = 32;
+constexpr int NonceSize = 12;
+constexpr int TagSize = 16;
+
+// data шифруется на месте, тег - в tag
+void seal(const uchar *key, const uchar *nonce, const uchar *aad, qsizetype aadLength,
+          uchar *data, qsizetype length, uchar *tag);
+// Тег проверяется до расшифровки; false - data не тронуты
+bool open(const uchar *key, const uchar *nonce, const uchar *aad, qsizetype aadLength,
+          uchar *data, qsizetype length, const uchar *tag);
+
+} // namespace ChaCha20Poly1305
+
+// Шифрование медиапакетов в духе SRTP.
+//
+// Заголовок пакета (а у FEC и её заголовок, по которому пакет направляют
+// планировщик и ретранслятор) остаётся открытым, но входит в проверку
+// подлинности; полезная нагрузка шифруется на месте, в том же буфере,
+// за ней - тег. Nonce - сам заголовок: тип, peerId, sequence и timestamp
+// у пакетов одного отправителя не повторяются. Ключ у каждого
+// отправителя свой, из общего ключа звонка и UUID его экземпляра, поэтому
+// sequence с нуля после перезапуска не повторяют nonce прошлого запуска.
+// Общий ключ - из пароля, который знают все участники.
+class MediaCrypto
+{
+public:
+    static constexpr int TagSize = ChaCha20Poly1305::TagSize;
+    static constexpr int KeySize = ChaCha20Poly1305::KeySize;
+
+    struct Key
+    {
+        uchar bytes[KeySize] = {};
+    };
+
+    // Общий ключ звонка из пароля (PBKDF2-HMAC-SHA256). Намеренно
+    // медленно: вызывать один раз, не на каждую сессию
+    static QByteArray deriveCallKey(const QString &passphrase);
+    // Ключ отправителя - экземпляра instanceId
+    static Key senderKey(const QByteArray &callKey, const QUuid &instanceId);
+
+    // Шифруемые типы и их номера: у каждого своё окно защиты от повторов
+    static constexpr int EncryptedTypeCount = 4;
+    static int encryptedIndex(Protocol::PacketType type)
+    {
+        switch (type) {
+        case Protocol::PacketType::Audio: return 0;
+        case Protocol::PacketType::Video: return 1;
+        case Protocol::PacketType::Fec: return 2;
+        case Protocol::PacketType::Retransmission: return 3;
+        default: return -1;
+        }
+    }
+    static bool isEncrypted(Protocol::PacketType type) { return encryptedIndex(type) >= 0; }
+    // Открытая часть пакета: заголовок, у FEC - и заголовок FEC
+    static int clearLength(Protocol::PacketType type);
+
+    // packet длиной length: заголовок с флагом шифрования, полезная нагрузка
+    // и TagSize байт под тег в конце
+    static void seal(const Key &key, char *packet, qsizetype length);
+    // То же на приёме; false - пакет подделан или повреждён
+    static bool open(const Key &key, char *packet, qsizetype length);
+};
+
+// Окно защиты от повторов (RFC 6479): принятые sequence в кольце бит.
+// Пакет старше окна или уже принятый отбрасывается
+class ReplayWindow
+{
+public:
+    static constexpr int Size = 960;   // насколько пакет может отстать от последнего
+
+    // false - повтор или слишком старый
+    bool check(quint32 sequence) const;
+    // Пакет прошёл проверку тега
+    void update(quint32 sequence);
+    void clear() { *this = ReplayWindow(); }
+
+private:
+    // Степень двойки: номер слова sequence / 64 не ломается на переполнении
+    static constexpr int Words = 16;
+
+    quint64 m_bitmap[Words] = {};
+    quint32 m_top = 0;
+    bool m_started = false;
+};
+
+#endif // MEDIACRYPTO_H
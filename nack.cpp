@@ -0,0 +1,198 @@
+#include "nack.h"
+#include "pathmtu.h"
+#include "protocol.h"
+#include <cstring>
+
+namespace {
+
+// Пропуск длиннее - скорее перезапуск потока, чем потери
+constexpr qint64 MaxGap = 512;
+constexpr int MaxMissing = 1024;
+constexpr int MaxRetries = 3;
+// Столько sequence гарантированно помещается в один NACK
+constexpr int MaxNackSequences = Protocol::MaxNackEntries;
+// Интервал между запросами одного пакета не короче этого даже при малом RTT
+constexpr qint64 MinRetryIntervalUs = 5000;
+
+// Отправитель не отвечает на запросы пакетов старше этого
+constexpr qint64 MaxRetransmitAgeUs = 1000000;
+// Бюджет повторов копится не больше чем за это время
+constexpr qint64 BudgetWindowUs = 100000;
+constexpr double MinBudgetBytes = 16 * 1500;
+
+qint64 retryIntervalUs(double rttMs)
+{
+    return qMax(MinRetryIntervalUs, qint64(rttMs * 1500.0));
+}
+
+} // namespace
+
+NackGenerator::NackGenerator(int deadlineMs)
+    : m_deadlineMs(deadlineMs)
+{
+}
+
+void NackGenerator::onPacket(quint32 sequence, qint64 nowUs)
+{
+    const qint64 previous = m_highestSequence;
+    const bool first = !m_hasSequence;
+    const qint64 seq = unwrapSequence(sequence);
+
+    if (first) return;
+
+    if (seq > previous) {
+        if (seq - previous - 1 > MaxGap) {
+            m_missing.clear();
+            return;
+        }
+        for (qint64 s = previous + 1; s < seq; ++s) {
+            m_missing.insert(s, Missing{ nowUs, 0, 0 });
+        }
+        while (m_missing.size() > MaxMissing) {
+            m_missing.erase(m_missing.begin());
+            m_stats.expired++;
+        }
+    } else {
+        // Переупорядоченный пакет - запрашивать его больше не нужно
+        m_missing.remove(seq);
+    }
+}
+
+bool NackGenerator::onRecovered(quint32 sequence)
+{
+    if (!m_hasSequence) return false;
+
+    const qint64 seq = m_highestSequence + qint32(sequence - quint32(m_highestSequence));
+    if (m_missing.remove(seq) == 0) return false;
+
+    m_stats.recovered++;
+    return true;
+}
+
+QList<quint32> NackGenerator::takeNacks(qint64 nowUs, double rttMs)
+{
+    QList<quint32> sequences;
+    const qint64 deadlineUs = qint64(m_deadlineMs) * 1000;
+    const qint64 rttUs = qint64(rttMs * 1000.0);
+    const qint64 intervalUs = retryIntervalUs(rttMs);
+
+    auto it = m_missing.begin();
+    while (it != m_missing.end()) {
+        Missing &missing = it.value();
+        const bool waited = missing.lastNackUs == 0 || nowUs - missing.lastNackUs >= intervalUs;
+
+        // Ответ не успеет к сроку воспроизведения или попытки исчерпаны
+        if (nowUs - missing.detectedUs + rttUs > deadlineUs || (missing.retries >= MaxRetries && waited)) {
+            it = m_missing.erase(it);
+            m_stats.expired++;
+            continue;
+        }
+
+        if (waited && missing.retries < MaxRetries && sequences.size() < MaxNackSequences) {
+            missing.lastNackUs = nowUs;
+            missing.retries++;
+            sequences.append(quint32(it.key()));
+        }
+        ++it;
+    }
+
+    m_stats.requested += sequences.size();
+    return sequences;
+}
+
+void NackGenerator::clear()
+{
+    m_missing.clear();
+    m_hasSequence = false;
+    m_highestSequence = 0;
+}
+
+qint64 NackGenerator::unwrapSequence(quint32 sequence)
+{
+    if (!m_hasSequence) {
+        m_hasSequence = true;
+        m_highestSequence = sequence;
+        return sequence;
+    }
+
+    const qint64 seq = m_highestSequence + qint32(sequence - quint32(m_highestSequence));
+    if (seq > m_highestSequence) {
+        m_highestSequence = seq;
+    }
+    return seq;
+}
+
+RetransmissionBuffer::RetransmissionBuffer(int capacity)
+    : m_entries(qMax(1, capacity))
+{
+}
+
+void RetransmissionBuffer::store(quint32 sequence, quint32 timestamp, QByteArrayView payload, qint64 nowUs)
+{
+    Entry &entry = m_entries[sequence % quint32(m_entries.size())];
+    entry.valid = true;
+    entry.sequence = sequence;
+    entry.timestamp = timestamp;
+    // Ячейка сразу получает ёмкость под полный фрагмент: после короткого
+    // последнего фрагмента кадра в неё ляжет полный
+    if (entry.payload.capacity() < payload.size()) {
+        entry.payload.reserve(qMax<qsizetype>(payload.size(), PathMtuProber::MaxDatagram));
+    }
+    entry.payload.resize(payload.size());
+    memcpy(entry.payload.data(), payload.data(), size_t(payload.size()));
+    entry.sentUs = nowUs;
+    entry.lastRetransmitUs = 0;
+}
+
+bool RetransmissionBuffer::retransmit(quint32 sequence, qint64 nowUs, double rttMs,
+                                      quint32 *timestamp, QByteArray *payload)
+{
+    m_stats.requested++;
+
+    Entry &entry = m_entries[sequence % quint32(m_entries.size())];
+    if (!entry.valid || entry.sequence != sequence || nowUs - entry.sentUs > MaxRetransmitAgeUs) {
+        m_stats.unavailable++;
+        return false;
+    }
+
+    // Повтор уже в пути: запрос, отправленный до его прихода
+    if (entry.lastRetransmitUs != 0 && nowUs - entry.lastRetransmitUs < retryIntervalUs(rttMs) / 2) {
+        return false;
+    }
+
+    // Бюджет пополняется пропорционально прошедшему времени
+    const double maxBudget = qMax(MinBudgetBytes, m_rateLimit / 8.0 * BudgetWindowUs / 1000000.0);
+    if (m_lastRefillUs != 0) {
+        m_budgetBytes += double(nowUs - m_lastRefillUs) * m_rateLimit / 8.0 / 1000000.0;
+    } else {
+        m_budgetBytes = maxBudget;
+    }
+    m_budgetBytes = qMin(m_budgetBytes, maxBudget);
+    m_lastRefillUs = nowUs;
+
+    if (m_budgetBytes < entry.payload.size()) {
+        m_stats.rateLimited++;
+        return false;
+    }
+    m_budgetBytes -= entry.payload.size();
+
+    entry.lastRetransmitUs = nowUs;
+    *timestamp = entry.timestamp;
+    *payload = entry.payload;
+    m_stats.retransmitted++;
+    return true;
+}
+
+void RetransmissionBuffer::setRateLimit(qint64 bitsPerSecond)
+{
+    m_rateLimit = qMax<qint64>(0, bitsPerSecond);
+}
+
+void RetransmissionBuffer::clear()
+{
+    for (Entry &entry : m_entries) {
+        entry = Entry();
+    }
+    m_budgetBytes = 0.0;
+    m_lastRefillUs = 0;
+}
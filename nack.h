@@ -0,0 +1,107 @@
+#ifndef NACK_H
+#define NACK_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QList>
+#include <QMap>
+#include <QtGlobal>
+
+// Выборочная повторная отправка потерянных видеопакетов (NACK).
+//
+// Получатель (NackGenerator) замечает пропуски в sequence и периодически
+// запрашивает недостающие пакеты, пока их ещё можно успеть показать:
+// повторный запрос не раньше чем через RTT, не больше MaxRetries раз и
+// только если ответ придёт до срока воспроизведения. Отправитель
+// (RetransmissionBuffer) хранит кольцо недавно отправленных пакетов и
+// отвечает на запросы в пределах отдельного бюджета битрейта.
+
+class NackGenerator
+{
+public:
+    struct Stats
+    {
+        qint64 requested = 0;    // sequence, отправленных в NACK (с повторами)
+        qint64 recovered = 0;    // пропуски, закрытые повтором или FEC
+        qint64 expired = 0;      // пропуски, снятые по сроку или числу попыток
+    };
+
+    // deadlineMs - сколько после обнаружения пропуска пакет ещё полезен
+    explicit NackGenerator(int deadlineMs = 250);
+
+    // Пакет пришёл по сети в первый раз
+    void onPacket(quint32 sequence, qint64 nowUs);
+    // Пакет получен повтором или восстановлен FEC; false - его не ждали
+    bool onRecovered(quint32 sequence);
+
+    // Sequence для очередного NACK по возрастанию, пустой список - запрашивать нечего
+    QList<quint32> takeNacks(qint64 nowUs, double rttMs);
+
+    bool hasMissing() const { return !m_missing.isEmpty(); }
+    const Stats &stats() const { return m_stats; }
+
+    void clear();
+
+private:
+    struct Missing
+    {
+        qint64 detectedUs = 0;
+        qint64 lastNackUs = 0;
+        int retries = 0;
+    };
+
+    qint64 unwrapSequence(quint32 sequence);
+
+    int m_deadlineMs;
+    QMap<qint64, Missing> m_missing;   // развёрнутый sequence -> пропуск
+    bool m_hasSequence = false;
+    qint64 m_highestSequence = 0;
+    Stats m_stats;
+};
+
+class RetransmissionBuffer
+{
+public:
+    struct Stats
+    {
+        qint64 requested = 0;
+        qint64 retransmitted = 0;
+        qint64 unavailable = 0;   // пакета уже нет в кольце или он слишком старый
+        qint64 rateLimited = 0;
+    };
+
+    explicit RetransmissionBuffer(int capacity = 2048);
+
+    // Копия payload ложится в буфер ячейки кольца: ячейки переиспользуются,
+    // и в установившемся режиме сохранение не выделяет память
+    void store(quint32 sequence, quint32 timestamp, QByteArrayView payload, qint64 nowUs);
+
+    // Заполняет timestamp и payload, если пакет можно отправить повторно
+    bool retransmit(quint32 sequence, qint64 nowUs, double rttMs, quint32 *timestamp, QByteArray *payload);
+
+    // Бюджет повторов, бит/с
+    void setRateLimit(qint64 bitsPerSecond);
+
+    const Stats &stats() const { return m_stats; }
+
+    void clear();
+
+private:
+    struct Entry
+    {
+        bool valid = false;
+        quint32 sequence = 0;
+        quint32 timestamp = 0;
+        QByteArray payload;
+        qint64 sentUs = 0;
+        qint64 lastRetransmitUs = 0;
+    };
+
+    QList<Entry> m_entries;
+    qint64 m_rateLimit = 1000000;
+    double m_budgetBytes = 0.0;
+    qint64 m_lastRefillUs = 0;
+    Stats m_stats;
+};
+
+#endif // NACK_H
@@ -0,0 +1,208 @@
+#include "benchutil.h"
+#include "networkengine.h"
+#include "protocol.h"
+#include <QElapsedTimer>
+#include <QNetworkDatagram>
+#include <QThread>
+#include <QTimer>
+#include <QUdpSocket>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Пакетов в секунду на приёме через петлю: прежний цикл (QUdpSocket в
+// потоке интерфейса, по одной QNetworkDatagram на readyRead) против
+// NetworkEngine (свой поток, пачки recvmmsg на Linux, очереди к
+// потребителю). Отправитель в отдельном потоке шлёт аудиопакеты с
+// заданным темпом; --gui-load занимает поток интерфейса на столько-то
+// миллисекунд каждые 16 мс, как отрисовка кадра.
+//
+//   AuthoLASTVLADIONetBench --packets 200000 --rate 50000 --gui-load 8
+
+namespace {
+
+constexpr int FramePeriodMs = 16;
+// Столько тишины после отправителя - значит, всё, что могло дойти, дошло
+constexpr int DrainMs = 300;
+
+using Bench::out;
+
+struct Settings
+{
+    quint16 port = 45600;
+    int packets = 200000;
+    int rate = 50000;          // пакетов/с
+    int payloadSize = 160;
+    int guiLoadMs = 0;
+};
+
+struct Result
+{
+    bool ok = false;           // сокет привязан
+    qint64 received = 0;
+    double seconds = 0.0;      // от начала отправки до последнего принятого
+};
+
+// Отправитель: пачка каждую миллисекунду, пока не отправлено всё
+void sendPackets(const Settings &settings, std::atomic<bool> *done)
+{
+    QUdpSocket socket;
+    const QByteArray payload(settings.payloadSize, 'a');
+    Protocol::PacketHeader header;
+    header.type = Protocol::PacketType::Audio;
+    header.peerId = 1;
+
+    const int perMillisecond = qMax(1, settings.rate / 1000);
+    const auto start = std::chrono::steady_clock::now();
+    for (int sent = 0; sent < settings.packets;) {
+        for (int i = 0; i < perMillisecond && sent < settings.packets; ++i) {
+            header.sequence = quint32(++sent);
+            header.timestamp = header.sequence * 960;
+            socket.writeDatagram(Protocol::makePacket(header, payload), QHostAddress::LocalHost, settings.port);
+        }
+        std::this_thread::sleep_until(start + std::chrono::milliseconds(sent / perMillisecond));
+    }
+    done->store(true, std::memory_order_release);
+}
+
+// Общая часть замера: отправитель, имитация отрисовки и ожидание конца
+template <typename Start>
+Result run(QCoreApplication &app, const Settings &settings, qint64 *received, Start &&startReceiver)
+{
+    Result result;
+    if (!startReceiver()) return result;
+
+    QElapsedTimer timer;
+    qint64 lastReceivedNs = 0;
+    qint64 lastCount = 0;
+
+    QTimer guiTimer;
+    QObject::connect(&guiTimer, &QTimer::timeout, [&]() {
+        if (settings.guiLoadMs <= 0) return;
+        const qint64 until = timer.nsecsElapsed() + qint64(settings.guiLoadMs) * 1000000;
+        while (timer.nsecsElapsed() < until) {
+        }
+    });
+
+    std::atomic<bool> done{false};
+    QTimer watchTimer;
+    QObject::connect(&watchTimer, &QTimer::timeout, [&]() {
+        if (*received != lastCount) {
+            lastCount = *received;
+            lastReceivedNs = timer.nsecsElapsed();
+        }
+        const qint64 silentNs = timer.nsecsElapsed() - lastReceivedNs;
+        if (done.load(std::memory_order_acquire) && silentNs > qint64(DrainMs) * 1000000) {
+            app.quit();
+        }
+    });
+
+    timer.start();
+    guiTimer.start(FramePeriodMs);
+    watchTimer.start(1);
+    std::thread sender(sendPackets, settings, &done);
+    app.exec();
+    sender.join();
+
+    result.ok = true;
+    result.received = *received;
+    result.seconds = double(lastReceivedNs) / 1e9;
+    return result;
+}
+
+// Прежний readPendingDatagrams: по одной датаграмме, разбор в потоке интерфейса
+Result runLegacy(QCoreApplication &app, const Settings &settings)
+{
+    QUdpSocket socket;
+    qint64 received = 0;
+    QObject::connect(&socket, &QUdpSocket::readyRead, [&]() {
+        while (socket.hasPendingDatagrams()) {
+            const QNetworkDatagram datagram = socket.receiveDatagram();
+            Protocol::PacketHeader header;
+            if (Protocol::readHeader(datagram.data(), &header)) ++received;
+        }
+    });
+    return run(app, settings, &received, [&]() {
+        return socket.bind(QHostAddress::LocalHost, settings.port);
+    });
+}
+
+// NetworkEngine: приём в своём потоке, потребитель разбирает очереди, как CallSession
+Result runEngine(QCoreApplication &app, const Settings &settings, QString *backend)
+{
+    NetworkEngine engine(settings.port);
+    qint64 received = 0;
+    QObject::connect(&engine, &NetworkEngine::packetsReady, [&]() {
+        engine.acknowledgePackets();
+        ReceivedPacket packet;
+        for (const NetworkEngine::Stream stream :
+             { NetworkEngine::Stream::Control, NetworkEngine::Stream::Audio, NetworkEngine::Stream::Video }) {
+            while (engine.takePacket(stream, &packet)) {
+                ++received;
+                engine.recycle(std::move(packet));
+            }
+        }
+    });
+    Result result = run(app, settings, &received, [&]() { return engine.start(); });
+    *backend = engine.backendName();
+    engine.stop();
+    return result;
+}
+
+void print(const QString &name, const Settings &settings, const Result &result)
+{
+    out() << QString("%1: принято %2 из %3 (потери %4%), %5 пак/с")
+                 .arg(name)
+                 .arg(result.received)
+                 .arg(settings.packets)
+                 .arg(100.0 * (settings.packets - result.received) / settings.packets, 0, 'f', 2)
+                 .arg(result.seconds > 0 ? result.received / result.seconds : 0.0, 0, 'f', 0)
+          << Qt::endl;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    Bench::prepare(parser, "AuthoLASTVLADIONetBench",
+                   "Пакетов в секунду на приёме: прежний цикл readyRead против NetworkEngine");
+    const QCommandLineOption portOption("port", "Порт приёма на петле.", "port", "45600");
+    const QCommandLineOption packetsOption("packets", "Пакетов на замер.", "count", "200000");
+    const QCommandLineOption rateOption("rate", "Темп отправки, пакетов/с.", "pps", "50000");
+    const QCommandLineOption payloadOption("payload", "Полезная нагрузка пакета, байт.", "bytes", "160");
+    const QCommandLineOption guiLoadOption("gui-load", "Занятость потока интерфейса каждые 16 мс, мс.", "ms", "0");
+    parser.addOptions({ portOption, packetsOption, rateOption, payloadOption, guiLoadOption });
+    parser.process(app);
+
+    Settings settings;
+    settings.port = quint16(parser.value(portOption).toUInt());
+    settings.packets = qMax(1, parser.value(packetsOption).toInt());
+    settings.rate = qBound(1000, parser.value(rateOption).toInt(), 10000000);
+    settings.payloadSize = qBound(0, parser.value(payloadOption).toInt(), 1400);
+    settings.guiLoadMs = qBound(0, parser.value(guiLoadOption).toInt(), FramePeriodMs);
+
+    out() << QString("Отправка %1 пак/с по %2 байт, поток интерфейса занят %3 мс из %4")
+                 .arg(settings.rate)
+                 .arg(Protocol::HeaderSize + settings.payloadSize)
+                 .arg(settings.guiLoadMs)
+                 .arg(FramePeriodMs)
+          << Qt::endl;
+
+    const Result legacy = runLegacy(app, settings);
+    if (!legacy.ok) {
+        out() << "Ошибка привязки сокета к порту " << settings.port << Qt::endl;
+        return 1;
+    }
+    print("Прежний цикл (QUdpSocket, поток интерфейса)", settings, legacy);
+
+    QString backend;
+    const Result engine = runEngine(app, settings, &backend);
+    if (!engine.ok) {
+        out() << "Ошибка запуска NetworkEngine на порту " << settings.port << Qt::endl;
+        return 1;
+    }
+    print(QString("NetworkEngine (%1)").arg(backend), settings, engine);
+    return 0;
+}
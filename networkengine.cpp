@@ -0,0 +1,875 @@
+#include "networkengine.h"
+#include <QUdpSocket>
+#include <QSocketNotifier>
+#include <QMutexLocker>
+#include <QTimer>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <unistd.h>
+#include <cerrno>
+
+// Старые заголовки glibc не знают про сегментацию UDP (ядро 4.18+/5.0+)
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+
+namespace {
+constexpr int QueueCapacity = 1024;
+constexpr int BatchSize = 32;
+constexpr int MaxDatagramSize = 65536;
+constexpr int ChannelCount = 3;   // по одному сокету на NetworkEngine::Stream
+
+// Свободных буферов в пулах: на приёме - сколько вмещают очереди к
+// потребителю, на отправке - с запасом на ключевой кадр
+constexpr int ReceivePoolBuffers = QueueCapacity;
+constexpr int SendPoolBuffers = 512;
+
+// Пределы одной отправки с UDP_SEGMENT: число сегментов (UDP_MAX_SEGMENTS)
+// и суммарный размер, который помещается в одну IP-датаграмму
+constexpr int MaxGsoSegments = 64;
+constexpr int MaxGsoBytes = 65000;
+
+// Буферы сокета по потокам: у аудио небольшие (лишнее в них - только
+// задержка), у видео крупные под всплески кадров. Общий сокет несёт
+// видео и получает его размеры
+struct SocketConfig
+{
+    int receiveBuffer;
+    int sendBuffer;
+};
+
+constexpr SocketConfig SocketConfigs[ChannelCount] = {
+    { 256 * 1024, 256 * 1024 },          // Control
+    { 128 * 1024, 128 * 1024 },          // Audio
+    { 4 * 1024 * 1024, 1024 * 1024 },    // Video
+};
+}
+
+// Живёт в сетевом потоке и владеет сокетами
+class NetworkWorker : public QObject
+{
+public:
+    explicit NetworkWorker(NetworkEngine *engine)
+        : m_engine(engine)
+    {
+    }
+
+    ~NetworkWorker() override { close(); }
+
+    // ports - по NetworkEngine::Stream; 0 у аудио или видео - общий сокет с управлением
+    bool open(const quint16 *ports, QString *error);
+    void close();
+    void flush();
+    // Из любого потока: разобрать очередь send() в сетевом потоке
+    void requestFlush() { m_flushWakeup.wake(); }
+    void setImpairment(const NetworkImpairment::Config &config);
+
+    bool isNative() const { return m_channels[0].fd != -1; }
+    bool canProbe() const { return m_probeFd != -1; }
+    void sendProbe(const QByteArray &datagram, const QHostAddress &address, quint16 port);
+    bool hasSegmentationOffload() const { return m_channels[0].gso || m_channels[0].gro; }
+    bool hasChannel(int index) const { return m_channels[index].isOpen(); }
+
+private:
+    // Сокет одного потока со своим читателем
+    struct Channel
+    {
+        quint16 port = 0;
+        QUdpSocket *socket = nullptr;
+        int fd = -1;
+        QSocketNotifier *readNotifier = nullptr;
+        QSocketNotifier *writeNotifier = nullptr;
+        bool gso = false;   // ядро склеивает отправку и режет её на датаграммы
+        bool gro = false;   // ядро может отдать несколько датаграмм одним буфером
+
+        bool isOpen() const { return socket || fd != -1; }
+    };
+
+    bool openChannel(int index, quint16 port, const SocketConfig &config, QString *error);
+    bool setupMulticast(Channel &channel, bool join, QString *error);
+    int channelFor(quint8 sendClass) const;
+    void pump();
+    void sendPending();
+    void receiveFallback(QUdpSocket *socket);
+    void sendFallback(Channel &channel, const OutgoingPacket &packet);
+    void handleDatagram(QByteArray &&data, const QHostAddress &sender);
+    const QHostAddress &senderAddress(quint32 ip4);
+
+#ifdef Q_OS_LINUX
+    bool openNative(Channel &channel, quint16 port, const SocketConfig &config, bool broadcast, QString *error);
+    void receiveNative(int fd);
+    bool sendNative(int index);
+#endif
+
+    NetworkEngine *m_engine;
+    Channel m_channels[ChannelCount];
+    int m_probeFd = -1;                // пробы PMTU: DF без учёта кэша PMTU ядра
+    QTimer *m_paceTimer = nullptr;
+    Wakeup m_flushWakeup;
+    QList<OutgoingPacket> m_outgoing;  // меняется местами с очередью send()
+    QList<OutgoingPacket> m_pending;   // пачка, вынутая из планировщика
+    // Отпущенные разом при выключении имитации: уходят пачками не больше
+    // BatchSize, как и всё остальное
+    QList<OutgoingPacket> m_released;
+    std::vector<char> m_rxBuffers;
+    // Последний отправитель: QHostAddress выделяет память при создании,
+    // а пакеты почти всегда приходят с одного адреса
+    quint32 m_lastSenderIp = 0;
+    QHostAddress m_lastSender;
+};
+
+bool NetworkWorker::open(const quint16 *ports, QString *error)
+{
+    // Будит отправку, когда темп позволит следующий пакет видео
+    m_paceTimer = new QTimer(this);
+    m_paceTimer->setSingleShot(true);
+    m_paceTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_paceTimer, &QTimer::timeout, this, [this]() { pump(); });
+    m_flushWakeup.open(this, [this]() {
+        m_engine->m_flushPending.store(false, std::memory_order_release);
+        flush();
+    });
+
+    m_engine->m_impairment.setConfig(m_engine->m_impairmentConfig);
+
+    const int control = int(NetworkEngine::Stream::Control);
+    const bool separate = ports[int(NetworkEngine::Stream::Audio)] != 0
+                          || ports[int(NetworkEngine::Stream::Video)] != 0;
+
+    for (int i = 0; i < ChannelCount; ++i) {
+        if (i != control && ports[i] == 0) continue;
+
+        const SocketConfig &config = separate ? SocketConfigs[i] : SocketConfigs[int(NetworkEngine::Stream::Video)];
+        if (!openChannel(i, ports[i], config, error)) {
+            close();
+            return false;
+        }
+    }
+
+#ifdef Q_OS_LINUX
+    // IP_PMTUDISC_PROBE: DF стоит всегда, а ядро не режет пробу по своему
+    // кэшу PMTU - иначе поиск никогда не поднялся бы выше однажды
+    // найденного значения. Без сокета проб сессия остаётся на
+    // консервативном размере
+    m_probeFd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    const int discover = IP_PMTUDISC_PROBE;
+    if (m_probeFd != -1 && setsockopt(m_probeFd, IPPROTO_IP, IP_MTU_DISCOVER, &discover, sizeof(discover)) == -1) {
+        ::close(m_probeFd);
+        m_probeFd = -1;
+    }
+#endif
+    return true;
+}
+
+bool NetworkWorker::openChannel(int index, quint16 port, const SocketConfig &config, QString *error)
+{
+    Channel &channel = m_channels[index];
+    channel.port = port;
+
+    // Широковещательный DISCOVER приходит на порт управления, его могут
+    // слушать несколько экземпляров; медиапорты занимаются единолично
+    const bool broadcast = index == int(NetworkEngine::Stream::Control);
+
+#ifdef Q_OS_LINUX
+    if (openNative(channel, port, config, broadcast, error)) {
+        return setupMulticast(channel, broadcast, error);
+    }
+#endif
+
+    channel.socket = new QUdpSocket(this);
+    const QUdpSocket::BindMode mode = broadcast ? QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint
+                                                : QUdpSocket::DefaultForPlatform;
+    if (!channel.socket->bind(QHostAddress::AnyIPv4, port, mode)) {
+        *error = QString("порт %1: %2").arg(port).arg(channel.socket->errorString());
+        delete channel.socket;
+        channel.socket = nullptr;
+        return false;
+    }
+    channel.socket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, config.receiveBuffer);
+    channel.socket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, config.sendBuffer);
+
+    QUdpSocket *socket = channel.socket;
+    connect(socket, &QUdpSocket::readyRead, this, [this, socket]() { receiveFallback(socket); });
+    return setupMulticast(channel, broadcast, error);
+}
+
+bool NetworkWorker::setupMulticast(Channel &channel, bool join, QString *error)
+{
+    // TTL и петля нужны каждому сокету, через который уходит отправка в
+    // группу; в группу входит только сокет управления - на его порт её шлют
+    const NetworkEngine::Multicast &multicast = m_engine->m_multicast;
+    if (multicast.group.isNull()) return true;
+
+#ifdef Q_OS_LINUX
+    if (channel.fd != -1) {
+        const int ttl = multicast.ttl;
+        const int loop = multicast.loopback ? 1 : 0;
+        setsockopt(channel.fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        setsockopt(channel.fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+        if (!join) return true;
+
+        ip_mreqn request;
+        memset(&request, 0, sizeof(request));
+        request.imr_multiaddr.s_addr = htonl(multicast.group.toIPv4Address());
+        request.imr_address.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(channel.fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) == -1) {
+            *error = QString("группа %1: %2").arg(multicast.group.toString(), QString::fromLocal8Bit(strerror(errno)));
+            return false;
+        }
+#ifdef IP_MULTICAST_ALL
+        // Без этого сокет на INADDR_ANY получает и чужие группы на том же порту
+        const int all = 0;
+        setsockopt(channel.fd, IPPROTO_IP, IP_MULTICAST_ALL, &all, sizeof(all));
+#endif
+        return true;
+    }
+#endif
+
+    channel.socket->setSocketOption(QAbstractSocket::MulticastTtlOption, multicast.ttl);
+    channel.socket->setSocketOption(QAbstractSocket::MulticastLoopbackOption, multicast.loopback ? 1 : 0);
+    if (join && !channel.socket->joinMulticastGroup(multicast.group)) {
+        *error = QString("группа %1: %2").arg(multicast.group.toString(), channel.socket->errorString());
+        return false;
+    }
+    return true;
+}
+
+void NetworkWorker::close()
+{
+    delete m_paceTimer;
+    m_paceTimer = nullptr;
+    m_flushWakeup.close();
+
+    for (Channel &channel : m_channels) {
+        delete channel.readNotifier;
+        delete channel.writeNotifier;
+#ifdef Q_OS_LINUX
+        if (channel.fd != -1) {
+            ::close(channel.fd);
+        }
+#endif
+        delete channel.socket;
+        channel = Channel();
+    }
+#ifdef Q_OS_LINUX
+    if (m_probeFd != -1) {
+        ::close(m_probeFd);
+        m_probeFd = -1;
+    }
+#endif
+    m_pending.clear();
+    m_released.clear();
+    m_engine->m_impairment.clear();
+}
+
+int NetworkWorker::channelFor(quint8 sendClass) const
+{
+    int index = int(NetworkEngine::Stream::Control);
+    switch (SendScheduler::Class(sendClass)) {
+    case SendScheduler::Class::Audio:
+        index = int(NetworkEngine::Stream::Audio);
+        break;
+    case SendScheduler::Class::Retransmission:
+    case SendScheduler::Class::Video:
+        index = int(NetworkEngine::Stream::Video);
+        break;
+    default:
+        break;
+    }
+    return m_channels[index].isOpen() ? index : int(NetworkEngine::Stream::Control);
+}
+
+void NetworkWorker::flush()
+{
+    m_engine->takeOutgoing(&m_outgoing);
+    for (OutgoingPacket &packet : m_outgoing) {
+        m_engine->m_scheduler.enqueue(std::move(packet));
+    }
+    // clear() сохраняет ёмкость, новые списки не выделяются
+    m_outgoing.clear();
+    pump();
+}
+
+void NetworkWorker::setImpairment(const NetworkImpairment::Config &config)
+{
+    NetworkImpairment &impairment = m_engine->m_impairment;
+    if (!config.enabled) {
+        // Задержанные пакеты уходят сразу, а не пропадают
+        OutgoingPacket packet;
+        while (impairment.next(std::numeric_limits<qint64>::max(), &packet)) {
+            m_released.append(std::move(packet));
+        }
+        impairment.clear();
+    }
+    impairment.setConfig(config);
+    pump();
+}
+
+void NetworkWorker::pump()
+{
+    SendScheduler &scheduler = m_engine->m_scheduler;
+    NetworkImpairment &impairment = m_engine->m_impairment;
+    scheduler.setPacingRate(m_engine->m_pacingRate.load(std::memory_order_relaxed));
+
+    for (;;) {
+        // Сокет не принял прошлую пачку - продолжим по готовности на запись
+        if (!m_pending.isEmpty()) {
+            sendPending();
+            if (!m_pending.isEmpty()) return;
+        }
+
+        // Отпущенные имитацией при выключении старше всего в планировщике
+        while (m_pending.size() < BatchSize && !m_released.isEmpty()) {
+            m_pending.append(m_released.takeFirst());
+        }
+
+        const qint64 now = NetworkEngine::monotonicUs();
+        OutgoingPacket packet;
+        while (m_pending.size() < BatchSize && scheduler.next(now, &packet)) {
+            if (impairment.isEnabled()) {
+                impairment.submit(std::move(packet), now);
+            } else {
+                m_pending.append(std::move(packet));
+            }
+        }
+        // Пакеты, которые имитация сети уже отпустила
+        while (m_pending.size() < BatchSize && impairment.next(now, &packet)) {
+            m_pending.append(std::move(packet));
+        }
+        if (m_pending.isEmpty()) break;
+    }
+
+    const qint64 now = NetworkEngine::monotonicUs();
+    qint64 wakeUs = scheduler.nextSendTimeUs(now);
+    const qint64 releaseUs = impairment.nextReleaseUs();
+    if (releaseUs >= 0 && (wakeUs < 0 || releaseUs < wakeUs)) {
+        wakeUs = releaseUs;
+    }
+    if (wakeUs >= 0 && m_paceTimer) {
+        m_paceTimer->start(int(qBound<qint64>(1, (wakeUs - now + 999) / 1000, 1000)));
+    }
+}
+
+void NetworkWorker::sendPending()
+{
+    while (!m_pending.isEmpty()) {
+        const int index = channelFor(m_pending.first().sendClass);
+#ifdef Q_OS_LINUX
+        if (m_channels[index].fd != -1) {
+            if (!sendNative(index)) return;
+            continue;
+        }
+#endif
+        sendFallback(m_channels[index], m_pending.first());
+        m_engine->m_sendPool.release(std::move(m_pending.first().datagram));
+        m_pending.removeFirst();
+    }
+}
+
+void NetworkWorker::handleDatagram(QByteArray &&data, const QHostAddress &sender)
+{
+    m_engine->m_bytesReceived.fetch_add(data.size(), std::memory_order_relaxed);
+
+    ReceivedPacket packet;
+    if (!Protocol::readHeader(data, &packet.header)) {
+        m_engine->m_receivePool.release(std::move(data));
+        return;
+    }
+
+    if (packet.header.type == Protocol::PacketType::Bundle) {
+        // Вложенные пакеты расходятся по очередям каждый сам по себе
+        const qint64 arrivalUs = NetworkEngine::monotonicUs();
+        const QByteArrayView payload = Protocol::payloadOf(data);
+        qsizetype offset = 0;
+        QByteArrayView inner;
+        while (Protocol::nextBundledPacket(payload, &offset, &inner)) {
+            ReceivedPacket part;
+            if (!Protocol::readHeader(inner, &part.header) || part.header.type == Protocol::PacketType::Bundle) {
+                continue;
+            }
+            part.datagram = m_engine->m_receivePool.acquire(inner.size());
+            memcpy(part.datagram.data(), inner.data(), size_t(inner.size()));
+            part.sender = sender;
+            part.arrivalUs = arrivalUs;
+            m_engine->deliver(std::move(part));
+        }
+        m_engine->m_receivePool.release(std::move(data));
+        return;
+    }
+
+    packet.datagram = std::move(data);
+    packet.sender = sender;
+    packet.arrivalUs = NetworkEngine::monotonicUs();
+    m_engine->deliver(std::move(packet));
+}
+
+const QHostAddress &NetworkWorker::senderAddress(quint32 ip4)
+{
+    if (ip4 != m_lastSenderIp || m_lastSender.isNull()) {
+        m_lastSenderIp = ip4;
+        m_lastSender = QHostAddress(ip4);
+    }
+    return m_lastSender;
+}
+
+void NetworkWorker::receiveFallback(QUdpSocket *socket)
+{
+    while (socket->hasPendingDatagrams()) {
+        // Сразу в буфер из пула, без промежуточного QNetworkDatagram
+        const qint64 size = socket->pendingDatagramSize();
+        if (size < 0) break;
+        QByteArray data = m_engine->m_receivePool.acquire(size);
+        QHostAddress sender;
+        const qint64 read = socket->readDatagram(data.data(), size, &sender);
+        if (read < 0) {
+            m_engine->m_receivePool.release(std::move(data));
+            continue;
+        }
+        data.resize(read);
+
+        bool isIPv4 = false;
+        const quint32 ip4 = sender.toIPv4Address(&isIPv4);
+        handleDatagram(std::move(data), isIPv4 ? senderAddress(ip4) : sender);
+    }
+}
+
+void NetworkWorker::sendProbe(const QByteArray &datagram, const QHostAddress &address, quint16 port)
+{
+#ifdef Q_OS_LINUX
+    if (m_probeFd == -1) return;
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(address.toIPv4Address());
+    // EMSGSIZE - проба длиннее MTU своего интерфейса: ответа не будет,
+    // и поиск опустит верхнюю границу по таймауту
+    const ssize_t sent = ::sendto(m_probeFd, datagram.constData(), size_t(datagram.size()), MSG_DONTWAIT,
+                                  reinterpret_cast<const sockaddr *>(&addr), sizeof(addr));
+    if (sent > 0) {
+        m_engine->m_bytesSent.fetch_add(sent, std::memory_order_relaxed);
+    }
+#else
+    Q_UNUSED(datagram);
+    Q_UNUSED(address);
+    Q_UNUSED(port);
+#endif
+}
+
+void NetworkWorker::sendFallback(Channel &channel, const OutgoingPacket &packet)
+{
+    qint64 sent = channel.socket->writeDatagram(packet.datagram, packet.address, packet.port);
+    if (sent == -1) {
+        emit m_engine->errorOccurred("Ошибка отправки: " + channel.socket->errorString());
+    } else {
+        m_engine->m_bytesSent.fetch_add(sent, std::memory_order_relaxed);
+    }
+}
+
+#ifdef Q_OS_LINUX
+bool NetworkWorker::openNative(Channel &channel, quint16 port, const SocketConfig &config, bool broadcast, QString *error)
+{
+    int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        *error = QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+
+    int one = 1;
+    if (broadcast) {
+        // SO_REUSEPORT - чтобы широковещательные DISCOVER получали все
+        // экземпляры на машине; на медиапортах он раздал бы поток между ними
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef SO_REUSEPORT
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+#endif
+    }
+    setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &config.receiveBuffer, sizeof(config.receiveBuffer));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &config.sendBuffer, sizeof(config.sendBuffer));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1) {
+        *error = QString("порт %1: %2").arg(port).arg(QString::fromLocal8Bit(strerror(errno)));
+        ::close(fd);
+        return false;
+    }
+
+    // Сегментация UDP: GSO проверяется чтением опции, GRO - включением.
+    // Без поддержки ядра сокет работает по датаграмме на сообщение
+    int segment = 0;
+    socklen_t segmentLength = sizeof(segment);
+    channel.gso = getsockopt(fd, IPPROTO_UDP, UDP_SEGMENT, &segment, &segmentLength) == 0;
+    channel.gro = setsockopt(fd, IPPROTO_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+
+    channel.fd = fd;
+    if (m_rxBuffers.empty()) {
+        m_rxBuffers.resize(size_t(BatchSize) * MaxDatagramSize);
+    }
+
+    channel.readNotifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    connect(channel.readNotifier, &QSocketNotifier::activated, this, [this, fd]() { receiveNative(fd); });
+
+    // Включается только когда буфер отправки переполнен
+    QSocketNotifier *writeNotifier = new QSocketNotifier(fd, QSocketNotifier::Write, this);
+    writeNotifier->setEnabled(false);
+    connect(writeNotifier, &QSocketNotifier::activated, this, [this, writeNotifier]() {
+        writeNotifier->setEnabled(false);
+        pump();
+    });
+    channel.writeNotifier = writeNotifier;
+    return true;
+}
+
+void NetworkWorker::receiveNative(int fd)
+{
+    mmsghdr msgs[BatchSize];
+    iovec iovecs[BatchSize];
+    sockaddr_in addrs[BatchSize];
+    // Для UDP_GRO: размер сегмента склеенного буфера
+    alignas(cmsghdr) char control[BatchSize][CMSG_SPACE(sizeof(int))];
+
+    for (;;) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < BatchSize; ++i) {
+            iovecs[i].iov_base = m_rxBuffers.data() + size_t(i) * MaxDatagramSize;
+            iovecs[i].iov_len = MaxDatagramSize;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            msgs[i].msg_hdr.msg_control = control[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+        }
+
+        const int received = recvmmsg(fd, msgs, BatchSize, MSG_DONTWAIT, nullptr);
+        if (received <= 0) break;
+        m_engine->m_receiveCalls.fetch_add(1, std::memory_order_relaxed);
+
+        for (int i = 0; i < received; ++i) {
+            const char *data = static_cast<const char *>(iovecs[i].iov_base);
+            const int length = int(msgs[i].msg_len);
+            const QHostAddress &sender = senderAddress(ntohl(addrs[i].sin_addr.s_addr));
+
+            int segmentSize = length;
+            for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+                if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+                    int size = 0;
+                    memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+                    if (size > 0) segmentSize = size;
+                }
+            }
+
+            for (int offset = 0; offset < length; offset += segmentSize) {
+                const int size = qMin(segmentSize, length - offset);
+                QByteArray datagram = m_engine->m_receivePool.acquire(size);
+                memcpy(datagram.data(), data + offset, size_t(size));
+                handleDatagram(std::move(datagram), sender);
+            }
+        }
+
+        if (received < BatchSize) break;
+    }
+}
+
+// Отправляет пакеты начала очереди, идущие через сокет index. false - буфер
+// сокета полон, отправка продолжится по готовности на запись.
+//
+// С GSO подряд идущие пакеты одному адресату одинакового размера (последний
+// может быть короче) - фрагменты одного кадра - уходят одним сообщением
+// с UDP_SEGMENT, ядро само режет его на датаграммы.
+bool NetworkWorker::sendNative(int index)
+{
+    Channel &channel = m_channels[index];
+    mmsghdr msgs[BatchSize];
+    iovec iovecs[BatchSize];
+    sockaddr_in addrs[BatchSize];
+    alignas(cmsghdr) char control[BatchSize][CMSG_SPACE(sizeof(quint16))];
+    int runLengths[BatchSize];
+
+    int packetCount = 0;
+    int count = 0;
+    // Массивы рассчитаны на BatchSize пакетов: столько и берётся, даже если
+    // в m_pending больше
+    while (packetCount < BatchSize && packetCount < m_pending.size()) {
+        const OutgoingPacket &packet = m_pending.at(packetCount);
+        if (channelFor(packet.sendClass) != index) break;
+
+        bool isIPv4 = false;
+        const quint32 ip4 = packet.address.toIPv4Address(&isIPv4);
+        if (!isIPv4) break;
+
+        const qsizetype segmentSize = packet.datagram.size();
+        const int maxRun = qMin(MaxGsoSegments, BatchSize - packetCount);
+        int run = 1;
+        qsizetype total = segmentSize;
+        while (channel.gso && run < maxRun && packetCount + run < m_pending.size()) {
+            const OutgoingPacket &next = m_pending.at(packetCount + run);
+            // Короче сегмента может быть только последний
+            if (m_pending.at(packetCount + run - 1).datagram.size() != segmentSize) break;
+            if (next.datagram.size() > segmentSize || total + next.datagram.size() > MaxGsoBytes) break;
+            if (channelFor(next.sendClass) != index || next.port != packet.port || next.address != packet.address) break;
+            total += next.datagram.size();
+            ++run;
+        }
+
+        memset(&addrs[count], 0, sizeof(sockaddr_in));
+        addrs[count].sin_family = AF_INET;
+        addrs[count].sin_port = htons(packet.port);
+        addrs[count].sin_addr.s_addr = htonl(ip4);
+
+        for (int i = 0; i < run; ++i) {
+            const QByteArray &datagram = m_pending.at(packetCount + i).datagram;
+            iovecs[packetCount + i].iov_base = const_cast<char *>(datagram.constData());
+            iovecs[packetCount + i].iov_len = size_t(datagram.size());
+        }
+
+        memset(&msgs[count], 0, sizeof(mmsghdr));
+        msgs[count].msg_hdr.msg_iov = &iovecs[packetCount];
+        msgs[count].msg_hdr.msg_iovlen = size_t(run);
+        msgs[count].msg_hdr.msg_name = &addrs[count];
+        msgs[count].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+
+        if (run > 1) {
+            msgs[count].msg_hdr.msg_control = control[count];
+            msgs[count].msg_hdr.msg_controllen = sizeof(control[count]);
+            cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[count].msg_hdr);
+            cmsg->cmsg_level = IPPROTO_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(quint16));
+            const quint16 size = quint16(segmentSize);
+            memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+        }
+
+        runLengths[count] = run;
+        packetCount += run;
+        ++count;
+    }
+
+    if (count == 0) {
+        // Сокет только IPv4, такие адреса не отправить
+        emit m_engine->errorOccurred("Адрес не IPv4: " + m_pending.first().address.toString());
+        m_pending.removeFirst();
+        return true;
+    }
+
+    const int sent = sendmmsg(channel.fd, msgs, unsigned(count), MSG_DONTWAIT);
+    m_engine->m_sendCalls.fetch_add(1, std::memory_order_relaxed);
+    if (sent == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            channel.writeNotifier->setEnabled(true);
+            return false;
+        }
+        // Ядро знает UDP_SEGMENT, но устройство не умеет контрольные суммы
+        // для него - дальше без склейки, эти же пакеты уйдут по одному
+        if (channel.gso && packetCount > count && (errno == EIO || errno == EINVAL)) {
+            channel.gso = false;
+            emit m_engine->errorOccurred("UDP GSO недоступна: " + QString::fromLocal8Bit(strerror(errno)));
+            return true;
+        }
+        emit m_engine->errorOccurred("Ошибка отправки: " + QString::fromLocal8Bit(strerror(errno)));
+        m_pending.removeFirst();
+        return true;
+    }
+
+    int sentPackets = 0;
+    for (int i = 0; i < sent; ++i) {
+        m_engine->m_bytesSent.fetch_add(msgs[i].msg_len, std::memory_order_relaxed);
+        sentPackets += runLengths[i];
+    }
+    for (int i = 0; i < sentPackets; ++i) {
+        m_engine->m_sendPool.release(std::move(m_pending[i].datagram));
+    }
+    m_pending.remove(0, sentPackets);
+    return true;
+}
+#endif
+
+NetworkEngine::NetworkEngine(quint16 port, QObject *parent)
+    : QObject(parent)
+    , m_controlQueue(QueueCapacity)
+    , m_audioQueue(QueueCapacity)
+    , m_videoQueue(QueueCapacity)
+    , m_receivePool(ReceivePoolBuffers)
+    , m_sendPool(SendPoolBuffers)
+{
+    m_ports[int(Stream::Control)] = port;
+    m_thread.setObjectName("NetworkEngine");
+}
+
+NetworkEngine::~NetworkEngine()
+{
+    stop();
+}
+
+bool NetworkEngine::start()
+{
+    if (m_worker) return true;
+
+    m_readyWakeup.open(this, [this]() { emit packetsReady(); });
+    m_worker = new NetworkWorker(this);
+    m_worker->moveToThread(&m_thread);
+    m_thread.start(QThread::HighPriority);
+
+    bool ok = false;
+    QMetaObject::invokeMethod(m_worker, [this, &ok]() {
+        ok = m_worker->open(m_ports, &m_errorString);
+    }, Qt::BlockingQueuedConnection);
+
+    if (!ok) {
+        stop();
+    }
+    return ok;
+}
+
+void NetworkEngine::stop()
+{
+    if (!m_worker) return;
+
+    // Сокет и нотификаторы закрываются в своём потоке
+    QMetaObject::invokeMethod(m_worker, [this]() {
+        m_worker->close();
+    }, Qt::BlockingQueuedConnection);
+
+    m_thread.quit();
+    m_thread.wait();
+
+    delete m_worker;
+    m_worker = nullptr;
+    m_readyWakeup.close();
+    m_notifyPending.store(false, std::memory_order_release);
+    m_flushPending.store(false, std::memory_order_release);
+}
+
+QString NetworkEngine::backendName() const
+{
+    if (!m_worker) return "нет";
+
+    QString name = m_worker->isNative() ? "recvmmsg/sendmmsg" : "QUdpSocket";
+    if (m_worker->hasSegmentationOffload()) {
+        name += " + GSO/GRO";
+    }
+    if (port(Stream::Audio) != port(Stream::Control) || port(Stream::Video) != port(Stream::Control)) {
+        name += QString(", порты %1/%2/%3")
+                    .arg(port(Stream::Control))
+                    .arg(port(Stream::Audio))
+                    .arg(port(Stream::Video));
+    }
+    if (!m_multicast.group.isNull()) {
+        name += ", группа " + m_multicast.group.toString();
+    }
+    return name;
+}
+
+void NetworkEngine::setImpairment(const NetworkImpairment::Config &config)
+{
+    m_impairmentConfig = config;
+    if (!m_worker) return;
+
+    QMetaObject::invokeMethod(m_worker, [this, config]() {
+        m_worker->setImpairment(config);
+    }, Qt::QueuedConnection);
+}
+
+void NetworkEngine::setMediaPorts(quint16 audioPort, quint16 videoPort)
+{
+    m_ports[int(Stream::Audio)] = audioPort;
+    m_ports[int(Stream::Video)] = videoPort;
+}
+
+quint16 NetworkEngine::port(Stream stream) const
+{
+    if (m_worker && m_worker->hasChannel(int(stream))) {
+        return m_ports[int(stream)];
+    }
+    return m_ports[int(Stream::Control)];
+}
+
+void NetworkEngine::send(QByteArray datagram, const QHostAddress &address, quint16 port)
+{
+    if (!m_worker) return;
+
+    {
+        QMutexLocker locker(&m_sendMutex);
+        m_sendQueue.append(OutgoingPacket{std::move(datagram), address, port, monotonicUs()});
+    }
+
+    // Одно пробуждение сетевого потока на пачку send()
+    if (!m_flushPending.exchange(true, std::memory_order_acq_rel)) {
+        m_worker->requestFlush();
+    }
+}
+
+bool NetworkEngine::sendProbe(const QByteArray &datagram, const QHostAddress &address, quint16 port)
+{
+    if (!m_worker || !m_worker->canProbe()) return false;
+
+    QMetaObject::invokeMethod(m_worker, [this, datagram, address, port]() {
+        m_worker->sendProbe(datagram, address, port);
+    }, Qt::QueuedConnection);
+    return true;
+}
+
+bool NetworkEngine::takePacket(Stream stream, ReceivedPacket *packet)
+{
+    switch (stream) {
+    case Stream::Control:
+        return m_controlQueue.pop(packet);
+    case Stream::Audio:
+        return m_audioQueue.pop(packet);
+    case Stream::Video:
+        return m_videoQueue.pop(packet);
+    }
+    return false;
+}
+
+void NetworkEngine::deliver(ReceivedPacket &&packet)
+{
+    SpscQueue<ReceivedPacket> *queue = &m_controlQueue;
+    if (packet.header.type == Protocol::PacketType::Audio) {
+        queue = &m_audioQueue;
+    } else if (packet.header.type == Protocol::PacketType::Video
+               || packet.header.type == Protocol::PacketType::Retransmission) {
+        queue = &m_videoQueue;
+    } else if (packet.header.type == Protocol::PacketType::Fec) {
+        // Чётность идёт в очередь своего потока: первый байт - MediaStream
+        const QByteArrayView payload = packet.payload();
+        if (!payload.isEmpty() && quint8(payload.at(0)) == quint8(Protocol::MediaStream::Video)) {
+            queue = &m_videoQueue;
+        } else {
+            queue = &m_audioQueue;
+        }
+    }
+
+    // При отказе push() пакет не тронут, буфер возвращается в пул
+    if (!queue->push(std::move(packet))) {
+        m_droppedPackets.fetch_add(1, std::memory_order_relaxed);
+        m_receivePool.release(std::move(packet.datagram));
+        return;
+    }
+
+    if (!m_notifyPending.exchange(true, std::memory_order_acq_rel)) {
+        m_readyWakeup.wake();
+    }
+}
+
+void NetworkEngine::takeOutgoing(QList<OutgoingPacket> *packets)
+{
+    QMutexLocker locker(&m_sendMutex);
+    packets->swap(m_sendQueue);
+}
@@ -0,0 +1,170 @@
+#ifndef NETWORKENGINE_H
+#define NETWORKENGINE_H
+
+#include <QObject>
+#include <QHostAddress>
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <atomic>
+#include <chrono>
+#include "protocol.h"
+#include "spscqueue.h"
+#include "sendscheduler.h"
+#include "packetpool.h"
+#include "impairment.h"
+#include "wakeup.h"
+
+struct ReceivedPacket
+{
+    Protocol::PacketHeader header;
+    QByteArray datagram;
+    QHostAddress sender;
+    qint64 arrivalUs = 0;   // NetworkEngine::monotonicUs() в момент приёма
+
+    QByteArrayView payload() const { return Protocol::payloadOf(datagram); }
+};
+
+class NetworkWorker;
+
+// UDP-транспорт в отдельном потоке.
+//
+// Сокеты принадлежат сетевому потоку. По умолчанию все потоки идут через
+// один порт; setMediaPorts() выделяет аудио и видео собственные сокеты со
+// своими размерами буферов, чтобы всплеск видео в приёмном буфере ядра не
+// вытеснял аудио. У каждого сокета свой читатель. На Linux приём и отправка идут пачками
+// через recvmmsg/sendmmsg, а если ядро умеет - с сегментацией UDP (GSO при
+// отправке фрагментов кадра, GRO при приёме); на остальных платформах -
+// через QUdpSocket.
+// Разобранные пакеты раскладываются по неблокирующим очередям (аудио, видео,
+// управление), BUNDLE - каждый вложенный пакет в свою. О появлении данных
+// потребитель узнаёт по сигналу packetsReady в своём потоке, который не
+// повторяется, пока очереди не начали разбирать. Исходящие пакеты проходят
+// через SendScheduler: приоритет аудио и темп видео. Потоки будят друг друга
+// через Wakeup (eventfd на Linux), а не событиями в очереди Qt, поэтому
+// ни send(), ни пачка принятых пакетов не выделяют память.
+// Буферы датаграмм в обе стороны берутся из пулов: принятый пакет
+// потребитель возвращает через recycle(), отправленный возвращается сам,
+// если отправитель не держит его копию. Для отладки между планировщиком
+// и сокетом можно включить NetworkImpairment - имитацию плохой сети.
+// В групповом режиме сокет управления входит в группу многоадресной
+// рассылки (IGMP), и пакет, отправленный на адрес группы, сеть доставляет
+// всем участникам одной копией.
+class NetworkEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Stream { Control, Audio, Video };
+
+    explicit NetworkEngine(quint16 port, QObject *parent = nullptr);
+    ~NetworkEngine();
+
+    bool start();
+    void stop();
+
+    // Порты аудио и видео, 0 - общий сокет с управлением; действует со следующего start()
+    void setMediaPorts(quint16 audioPort, quint16 videoPort);
+    // Порт, на котором принимается поток; для общего сокета - порт управления
+    quint16 port(Stream stream) const;
+
+    struct Multicast
+    {
+        QHostAddress group;               // IPv4; пусто - без группы
+        int ttl = 1;                      // 1 - не дальше своей подсети
+        bool loopback = false;            // свои пакеты группе - и на эту машину
+    };
+    // Группа для сокета управления; действует со следующего start()
+    void setMulticast(const Multicast &multicast) { m_multicast = multicast; }
+
+    QString errorString() const { return m_errorString; }
+    QString backendName() const;
+
+    // Монотонные часы для времён отправки и приёма пакетов
+    static qint64 monotonicUs()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Потокобезопасно, отправка выполняется в сетевом потоке. Буфер из
+    // packetBuffer(), переданный через std::move, вернётся в пул
+    void send(QByteArray datagram, const QHostAddress &address, quint16 port);
+    // Буфер под исходящую датаграмму длиной size
+    QByteArray packetBuffer(qsizetype size) { return m_sendPool.acquire(size); }
+    // Сам пул отправки - для тех, кто собирает датаграммы из готовых
+    // буферов и возвращает лишние (PacketBundler)
+    PacketPool &sendPool() { return m_sendPool; }
+    // Проба пути: мимо планировщика и имитации, с отдельного сокета с
+    // запретом фрагментации (DF). false - такого сокета нет (не Linux),
+    // размер датаграмм остаётся консервативным
+    bool sendProbe(const QByteArray &datagram, const QHostAddress &address, quint16 port);
+
+    // Скорость темпирования видео, бит/с; 0 - без темпирования
+    void setPacingRate(qint64 bitsPerSecond) { m_pacingRate.store(bitsPerSecond, std::memory_order_relaxed); }
+    // Глубина очереди и задержка в ней; пиковая задержка сбрасывается
+    SendScheduler::ClassStats sendStats(SendScheduler::Class cls) { return m_scheduler.takeStats(cls); }
+
+    // Имитация сети для исходящих пакетов; сохраняется между start()
+    void setImpairment(const NetworkImpairment::Config &config);
+    NetworkImpairment::Stats impairmentStats() const { return m_impairment.stats(); }
+
+    // Вызывается потребителем перед разбором очередей
+    void acknowledgePackets() { m_notifyPending.store(false, std::memory_order_release); }
+    bool takePacket(Stream stream, ReceivedPacket *packet);
+    // Пакет разобран, его буфер можно принимать заново
+    void recycle(ReceivedPacket &&packet) { m_receivePool.release(std::move(packet.datagram)); }
+
+    qint64 bytesSent() const { return m_bytesSent.load(std::memory_order_relaxed); }
+    qint64 bytesReceived() const { return m_bytesReceived.load(std::memory_order_relaxed); }
+    qint64 droppedPackets() const { return m_droppedPackets.load(std::memory_order_relaxed); }
+    // Системные вызовы отправки и приёма (sendmmsg/recvmmsg) на Linux
+    qint64 sendCalls() const { return m_sendCalls.load(std::memory_order_relaxed); }
+    qint64 receiveCalls() const { return m_receiveCalls.load(std::memory_order_relaxed); }
+    PacketPool::Stats receivePoolStats() const { return m_receivePool.stats(); }
+    PacketPool::Stats sendPoolStats() const { return m_sendPool.stats(); }
+
+signals:
+    void packetsReady();
+    void errorOccurred(const QString &message);
+
+private:
+    friend class NetworkWorker;
+
+    // Вызываются из сетевого потока
+    void deliver(ReceivedPacket &&packet);
+    // Меняет накопленную очередь с пустым списком packets, ёмкость обоих сохраняется
+    void takeOutgoing(QList<OutgoingPacket> *packets);
+
+    quint16 m_ports[3] = {};   // по Stream
+    Multicast m_multicast;
+    QString m_errorString;
+    QThread m_thread;
+    NetworkWorker *m_worker = nullptr;
+
+    SpscQueue<ReceivedPacket> m_controlQueue;
+    SpscQueue<ReceivedPacket> m_audioQueue;
+    SpscQueue<ReceivedPacket> m_videoQueue;
+    std::atomic<bool> m_notifyPending{false};
+    Wakeup m_readyWakeup;      // сетевой поток -> поток потребителя
+    PacketPool m_receivePool;
+
+    QMutex m_sendMutex;
+    QList<OutgoingPacket> m_sendQueue;
+    std::atomic<bool> m_flushPending{false};
+    // Очереди разбираются только в сетевом потоке
+    SendScheduler m_scheduler;
+    NetworkImpairment m_impairment;
+    NetworkImpairment::Config m_impairmentConfig;
+    std::atomic<qint64> m_pacingRate{0};
+    PacketPool m_sendPool;
+
+    std::atomic<qint64> m_bytesSent{0};
+    std::atomic<qint64> m_bytesReceived{0};
+    std::atomic<qint64> m_droppedPackets{0};
+    std::atomic<qint64> m_sendCalls{0};
+    std::atomic<qint64> m_receiveCalls{0};
+};
+
+#endif // NETWORKENGINE_H
@@ -0,0 +1,53 @@
+#include "packetpool.h"
+#include <QMutexLocker>
+
+PacketPool::PacketPool(int maxBuffers)
+    : m_maxBuffers(qMax(1, maxBuffers))
+{
+    // Список свободных сам не должен расти в куче при release()
+    m_free.reserve(m_maxBuffers);
+}
+
+QByteArray PacketPool::acquire(qsizetype size)
+{
+    QByteArray buffer;
+    bool pooled = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        pooled = size <= BufferCapacity && !m_free.isEmpty();
+        if (pooled) {
+            buffer = m_free.takeLast();
+            m_stats.hits++;
+        } else {
+            m_stats.misses++;
+        }
+    }
+
+    if (!pooled) {
+        buffer = QByteArray(qMax(size, BufferCapacity), Qt::Uninitialized);
+    }
+    // В пределах ёмкости resize() не перевыделяет память
+    buffer.resize(size);
+    return buffer;
+}
+
+void PacketPool::release(QByteArray &&buffer)
+{
+    // Буфер чужого размера или с живыми копиями в пул не берём
+    if (!buffer.isDetached() || buffer.capacity() < BufferCapacity || buffer.capacity() > 2 * BufferCapacity) {
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if (m_free.size() < m_maxBuffers) {
+        m_free.append(std::move(buffer));
+    }
+}
+
+PacketPool::Stats PacketPool::stats() const
+{
+    QMutexLocker locker(&m_mutex);
+    Stats stats = m_stats;
+    stats.available = int(m_free.size());
+    return stats;
+}
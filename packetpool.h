@@ -0,0 +1,51 @@
+#ifndef PACKETPOOL_H
+#define PACKETPOOL_H
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QtGlobal>
+
+// Пул буферов датаграмм.
+//
+// Буфер - QByteArray с ёмкостью BufferCapacity. acquire() отдаёт свободный
+// буфер нужной длины без выделения памяти, release() возвращает его в пул,
+// если на данные больше никто не ссылается; иначе буфер освободится сам,
+// когда уйдёт последняя копия. Пул растёт по мере надобности до maxBuffers,
+// поэтому в установившемся режиме обмен пакетами не обращается к куче.
+// Датаграммы длиннее BufferCapacity выделяются как обычно.
+//
+// Потокобезопасен: буферы берёт один поток, а возвращает другой
+// (сетевой поток и потребитель пакетов).
+class PacketPool
+{
+public:
+    // С запасом на полноразмерную датаграмму Ethernet
+    static constexpr qsizetype BufferCapacity = 2048;
+
+    struct Stats
+    {
+        qint64 hits = 0;       // буфер взят из пула
+        qint64 misses = 0;     // пришлось выделить память
+        int available = 0;     // свободных буферов сейчас
+    };
+
+    explicit PacketPool(int maxBuffers);
+
+    PacketPool(const PacketPool &) = delete;
+    PacketPool &operator=(const PacketPool &) = delete;
+
+    // Буфер длины size с неопределённым содержимым
+    QByteArray acquire(qsizetype size);
+    void release(QByteArray &&buffer);
+
+    Stats stats() const;
+
+private:
+    mutable QMutex m_mutex;
+    QList<QByteArray> m_free;
+    int m_maxBuffers;
+    Stats m_stats;
+};
+
+#endif // PACKETPOOL_H
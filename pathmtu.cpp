@@ -0,0 +1,74 @@
+#include "pathmtu.h"
+
+namespace {
+// Ожидание ответа на пробу: несколько RTT, но не меньше 250 мс
+constexpr double MinProbeTimeoutMs = 250.0;
+constexpr int ProbeAttempts = 2;
+}
+
+void PathMtuProber::clear()
+{
+    *this = PathMtuProber();
+}
+
+int PathMtuProber::nextProbe(qint64 nowUs, double rttMs, quint32 *probeId)
+{
+    if (m_pendingSize != 0) {
+        const double timeoutMs = qMax(MinProbeTimeoutMs, 3.0 * rttMs);
+        if ((nowUs - m_pendingSentUs) / 1000.0 < timeoutMs) return 0;
+
+        // Повтор той же пробы: одна потеря - ещё не предел пути
+        ++m_stats.probesLost;
+        if (++m_attempts >= ProbeAttempts) {
+            if (m_validating) {
+                // Путь сжался: назад к надёжному размеру и ищем под прежним
+                m_validating = false;
+                m_high = m_low - 1;
+                m_low = MinDatagram;
+            } else {
+                m_high = m_pendingSize - 1;
+            }
+            m_pendingSize = 0;
+            m_attempts = 0;
+            finishProbe(nowUs);
+            if (!isSearching()) return 0;
+        }
+    }
+
+    if (m_pendingSize == 0) {
+        if (!isSearching()) {
+            if (m_researchUs == 0 || nowUs < m_researchUs) return 0;
+            m_validating = m_low > MinDatagram;
+            m_high = MaxDatagram;
+        }
+        m_pendingSize = m_validating ? m_low : (m_low + m_high + 1) / 2;
+    }
+
+    m_pendingId = ++m_nextId;
+    m_pendingSentUs = nowUs;
+    ++m_stats.probesSent;
+    *probeId = m_pendingId;
+    return m_pendingSize;
+}
+
+void PathMtuProber::onReply(quint32 probeId, int size, qint64 nowUs)
+{
+    if (m_pendingSize == 0 || probeId != m_pendingId) return;
+
+    if (m_validating) {
+        m_validating = false;
+    } else {
+        m_low = qMax(m_low, qMin(size, m_pendingSize));
+    }
+    m_pendingSize = 0;
+    m_attempts = 0;
+    finishProbe(nowUs);
+}
+
+void PathMtuProber::finishProbe(qint64 nowUs)
+{
+    if (m_high < m_low) m_high = m_low;
+    if (!isSearching()) {
+        m_researchUs = nowUs + qint64(ResearchIntervalMs) * 1000;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef PATHMTU_H
+#define PATHMTU_H
+
+#include <QtGlobal>
+
+// Поиск наибольшей датаграммы до участника (PMTU) без IP-фрагментации.
+//
+// Пробы - MTU_PROBE заданного размера с флагом DF (отдельный сокет
+// NetworkEngine), участник подтверждает каждую, что дошла. Размер ищется
+// двоичным поиском между проверенным (low) и ещё не опровергнутым (high)
+// значениями; проба без ответа за время ожидания повторяется один раз,
+// потом high опускается ниже неё. Пока ничего не проверено, действует
+// консервативный MinDatagram, который проходит почти любой путь, включая
+// VPN и туннели. После схождения поиск периодически повторяется: путь
+// мог вырасти или сжаться (роуминг Wi-Fi, поднятый VPN), и первой идёт
+// проба текущего размера - если она не доходит, размер падает к
+// MinDatagram, а поиск начинается заново.
+class PathMtuProber
+{
+public:
+    // Размеры датаграммы UDP без заголовков IP и UDP
+    static constexpr int MinDatagram = 1200;
+    static constexpr int MaxDatagram = 1472;     // Ethernet 1500 - IPv4 - UDP
+    static constexpr int Granularity = 8;        // точнее искать незачем
+    static constexpr int ResearchIntervalMs = 60000;
+
+    struct Stats
+    {
+        qint64 probesSent = 0;
+        qint64 probesLost = 0;
+    };
+
+    // Размер следующей пробы и её id; 0 - сейчас ничего не слать
+    int nextProbe(qint64 nowUs, double rttMs, quint32 *probeId);
+    // Участник подтвердил пробу длиной size
+    void onReply(quint32 probeId, int size, qint64 nowUs);
+
+    // Проверенный размер датаграммы
+    int datagramLimit() const { return m_low; }
+    bool isSearching() const { return m_high - m_low >= Granularity || m_validating; }
+    const Stats &stats() const { return m_stats; }
+
+    void clear();
+
+private:
+    void finishProbe(qint64 nowUs);
+
+    int m_low = MinDatagram;
+    int m_high = MaxDatagram;
+    bool m_validating = false;           // проба текущего размера при повторном поиске
+
+    quint32 m_nextId = 0;
+    quint32 m_pendingId = 0;
+    int m_pendingSize = 0;               // 0 - пробы в пути нет
+    qint64 m_pendingSentUs = 0;
+    int m_attempts = 0;
+    qint64 m_researchUs = 0;             // когда повторить поиск после схождения
+    Stats m_stats;
+};
+
+#endif // PATHMTU_H
@@ -0,0 +1,74 @@
+#include "peercache.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+bool PeerCache::load(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll());
+    if (!document.isArray()) return false;
+
+    const qint64 nowMs = QDateTime::currentMSecsSinceEpoch();
+    m_entries.clear();
+    for (const QJsonValue &value : document.array()) {
+        const QJsonObject object = value.toObject();
+        Entry entry;
+        entry.address = QHostAddress(object.value("address").toString());
+        entry.port = quint16(object.value("port").toInt());
+        entry.nickname = object.value("nickname").toString();
+        entry.lastSeenMs = qint64(object.value("lastSeen").toDouble());
+        if (entry.address.isNull() || entry.port == 0 || nowMs - entry.lastSeenMs > MaxAgeMs) continue;
+
+        m_entries.append(entry);
+        if (m_entries.size() == MaxEntries) break;
+    }
+    return true;
+}
+
+bool PeerCache::save(const QString &path) const
+{
+    QJsonArray array;
+    for (const Entry &entry : m_entries) {
+        QJsonObject object;
+        object.insert("address", entry.address.toString());
+        object.insert("port", int(entry.port));
+        object.insert("nickname", entry.nickname);
+        object.insert("lastSeen", double(entry.lastSeenMs));
+        array.append(object);
+    }
+
+    // Через временный файл: оборванная запись не портит прежний список
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    file.write(QJsonDocument(array).toJson());
+    return file.commit();
+}
+
+void PeerCache::touch(const QHostAddress &address, quint16 port, const QString &nickname, qint64 nowMs)
+{
+    for (qsizetype i = 0; i < m_entries.size(); ++i) {
+        if (m_entries[i].address == address && m_entries[i].port == port) {
+            m_entries.removeAt(i);
+            break;
+        }
+    }
+
+    Entry entry;
+    entry.address = address;
+    entry.port = port;
+    entry.nickname = nickname;
+    entry.lastSeenMs = nowMs;
+    m_entries.prepend(entry);
+    while (m_entries.size() > MaxEntries) {
+        m_entries.removeLast();
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef PEERCACHE_H
+#define PEERCACHE_H
+
+#include <QHostAddress>
+#include <QList>
+#include <QString>
+
+// Недавние участники для прямого поиска.
+//
+// Широковещательный DISCOVER доходит не везде (маршрутизируемые сети,
+// Wi-Fi с изоляцией клиентов) и теряется чаще адресного, поэтому при
+// старте и после обрыва сессия дополнительно шлёт DISCOVER прямо по
+// адресам, где недавно был участник. Список переживает перезапуск в
+// JSON-файле; свежие записи первыми, старые вытесняются.
+class PeerCache
+{
+public:
+    struct Entry
+    {
+        QHostAddress address;
+        quint16 port = 0;
+        QString nickname;
+        qint64 lastSeenMs = 0;           // мс с эпохи UTC
+    };
+
+    static constexpr int MaxEntries = 16;
+    static constexpr qint64 MaxAgeMs = 30LL * 24 * 3600 * 1000;
+
+    bool load(const QString &path);
+    bool save(const QString &path) const;
+
+    // Участник на связи: запись поднимается в начало
+    void touch(const QHostAddress &address, quint16 port, const QString &nickname, qint64 nowMs);
+    const QList<Entry> &entries() const { return m_entries; }
+    bool isEmpty() const { return m_entries.isEmpty(); }
+
+private:
+    QList<Entry> m_entries;
+};
+
+#endif // PEERCACHE_H
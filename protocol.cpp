@@ -0,0 +1,300 @@
+#include "protocol.h"
+#include <QtEndian>
+#include <cstring>
+
+namespace Protocol {
+
+void writeHeader(char *dst, const PacketHeader &header)
+{
+    uchar *p = reinterpret_cast<uchar *>(dst);
+    p[0] = header.version | (header.encrypted ? EncryptedFlag : 0);
+    p[1] = quint8(header.type);
+    qToBigEndian<quint16>(header.peerId, p + 2);
+    qToBigEndian<quint32>(header.sequence, p + 4);
+    qToBigEndian<quint32>(header.timestamp, p + 8);
+}
+
+bool readHeader(QByteArrayView data, PacketHeader *header)
+{
+    if (data.size() < HeaderSize) return false;
+
+    const uchar *p = reinterpret_cast<const uchar *>(data.data());
+    if ((p[0] & ~EncryptedFlag) != Version || p[1] >= TypeCount) return false;
+
+    header->version = Version;
+    header->encrypted = (p[0] & EncryptedFlag) != 0;
+    header->type = PacketType(p[1]);
+    header->peerId = qFromBigEndian<quint16>(p + 2);
+    header->sequence = qFromBigEndian<quint32>(p + 4);
+    header->timestamp = qFromBigEndian<quint32>(p + 8);
+    return true;
+}
+
+QByteArray makePacket(const PacketHeader &header, QByteArrayView payload)
+{
+    QByteArray packet(HeaderSize + payload.size(), Qt::Uninitialized);
+    writePacket(packet.data(), header, payload);
+    return packet;
+}
+
+void writePacket(char *dst, const PacketHeader &header, QByteArrayView payload)
+{
+    writeHeader(dst, header);
+    if (!payload.isEmpty()) {
+        memcpy(dst + HeaderSize, payload.data(), payload.size());
+    }
+}
+
+namespace {
+void appendField(QByteArray &out, DiscoverTag tag, QByteArrayView value)
+{
+    out.append(char(tag));
+    out.append(char(value.size()));
+    out.append(value);
+}
+}
+
+QByteArray makeDiscoverPayload(const DiscoverInfo &info)
+{
+    // Длина ника - один байт: обрезается до 255 байт UTF-8 по границе
+    // символа. Байты 10xxxxxx продолжают символ, режется перед его началом
+    QByteArray nickname = info.nickname.toUtf8();
+    if (nickname.size() > 255) {
+        qsizetype length = 255;
+        while (length > 0 && (uchar(nickname.at(length)) & 0xc0) == 0x80) {
+            --length;
+        }
+        nickname.truncate(length);
+    }
+
+    QByteArray out = info.instanceId.toRfc4122();
+    out.append(char(nickname.size()));
+    out.append(nickname);
+
+    const char codecs = char(info.audioCodecs);
+    appendField(out, DiscoverTag::AudioCodecs, QByteArrayView(&codecs, 1));
+
+    if (info.audioPort != 0 || info.videoPort != 0) {
+        uchar ports[4];
+        qToBigEndian<quint16>(info.audioPort, ports);
+        qToBigEndian<quint16>(info.videoPort, ports + 2);
+        appendField(out, DiscoverTag::MediaPorts, QByteArrayView(reinterpret_cast<const char *>(ports), 4));
+    }
+    if (info.features != 0) {
+        const char features = char(info.features);
+        appendField(out, DiscoverTag::Features, QByteArrayView(&features, 1));
+    }
+    return out;
+}
+
+bool readDiscoverPayload(QByteArrayView payload, DiscoverInfo *info)
+{
+    if (payload.size() < InstanceIdSize + 1) return false;
+
+    info->instanceId = QUuid::fromRfc4122(payload.first(InstanceIdSize));
+    const int nickLength = quint8(payload.at(InstanceIdSize));
+    qsizetype offset = InstanceIdSize + 1;
+    if (offset + nickLength > payload.size()) return false;
+    info->nickname = QString::fromUtf8(payload.sliced(offset, nickLength));
+    offset += nickLength;
+
+    while (offset + 2 <= payload.size()) {
+        const DiscoverTag tag = DiscoverTag(quint8(payload.at(offset)));
+        const int length = quint8(payload.at(offset + 1));
+        offset += 2;
+        if (offset + length > payload.size()) return false;
+
+        const QByteArrayView value = payload.sliced(offset, length);
+        switch (tag) {
+        case DiscoverTag::AudioCodecs:
+            if (length >= 1) info->audioCodecs = quint8(value.at(0));
+            break;
+        case DiscoverTag::MediaPorts:
+            if (length >= 4) {
+                const uchar *ports = reinterpret_cast<const uchar *>(value.data());
+                info->audioPort = qFromBigEndian<quint16>(ports);
+                info->videoPort = qFromBigEndian<quint16>(ports + 2);
+            }
+            break;
+        case DiscoverTag::Features:
+            if (length >= 1) info->features = quint8(value.at(0));
+            break;
+        default:
+            break;
+        }
+        offset += length;
+    }
+    return true;
+}
+
+QByteArray makeFeedbackPayload(const TransportFeedback &feedback)
+{
+    const int count = int(qMin<qsizetype>(feedback.deltas.size(), MaxFeedbackPackets));
+
+    QByteArray out(10 + count * 2, Qt::Uninitialized);
+    uchar *p = reinterpret_cast<uchar *>(out.data());
+    qToBigEndian<quint32>(feedback.baseSequence, p);
+    qToBigEndian<quint32>(feedback.referenceTime, p + 4);
+    qToBigEndian<quint16>(quint16(count), p + 8);
+    for (int i = 0; i < count; ++i) {
+        qToBigEndian<qint16>(feedback.deltas.at(i), p + 10 + i * 2);
+    }
+    return out;
+}
+
+bool readFeedbackPayload(QByteArrayView payload, TransportFeedback *feedback)
+{
+    if (payload.size() < 10) return false;
+
+    const uchar *p = reinterpret_cast<const uchar *>(payload.data());
+    const int count = qFromBigEndian<quint16>(p + 8);
+    if (count > MaxFeedbackPackets || payload.size() < 10 + count * 2) return false;
+
+    feedback->baseSequence = qFromBigEndian<quint32>(p);
+    feedback->referenceTime = qFromBigEndian<quint32>(p + 4);
+    feedback->deltas.resize(count);
+    for (int i = 0; i < count; ++i) {
+        feedback->deltas[i] = qFromBigEndian<qint16>(p + 10 + i * 2);
+    }
+    return true;
+}
+
+QByteArray makeSenderReportPayload(const SenderReport &report)
+{
+    QByteArray out(13, Qt::Uninitialized);
+    uchar *p = reinterpret_cast<uchar *>(out.data());
+    p[0] = quint8(report.stream);
+    qToBigEndian<quint32>(report.sendTime, p + 1);
+    qToBigEndian<quint32>(report.packetCount, p + 5);
+    qToBigEndian<quint32>(report.octetCount, p + 9);
+    return out;
+}
+
+bool readSenderReportPayload(QByteArrayView payload, SenderReport *report)
+{
+    if (payload.size() < 13) return false;
+
+    const uchar *p = reinterpret_cast<const uchar *>(payload.data());
+    if (p[0] >= quint8(MediaStream::Count)) return false;
+
+    report->stream = MediaStream(p[0]);
+    report->sendTime = qFromBigEndian<quint32>(p + 1);
+    report->packetCount = qFromBigEndian<quint32>(p + 5);
+    report->octetCount = qFromBigEndian<quint32>(p + 9);
+    return true;
+}
+
+QByteArray makeReceiverReportPayload(const ReceiverReport &report)
+{
+    QByteArray out(22, Qt::Uninitialized);
+    uchar *p = reinterpret_cast<uchar *>(out.data());
+    p[0] = quint8(report.stream);
+    p[1] = report.fractionLost;
+    qToBigEndian<qint32>(report.cumulativeLost, p + 2);
+    qToBigEndian<quint32>(report.highestSequence, p + 6);
+    qToBigEndian<quint32>(report.jitterUs, p + 10);
+    qToBigEndian<quint32>(report.lastSenderReport, p + 14);
+    qToBigEndian<quint32>(report.delaySinceLastSenderReport, p + 18);
+    return out;
+}
+
+bool readReceiverReportPayload(QByteArrayView payload, ReceiverReport *report)
+{
+    if (payload.size() < 22) return false;
+
+    const uchar *p = reinterpret_cast<const uchar *>(payload.data());
+    if (p[0] >= quint8(MediaStream::Count)) return false;
+
+    report->stream = MediaStream(p[0]);
+    report->fractionLost = p[1];
+    report->cumulativeLost = qFromBigEndian<qint32>(p + 2);
+    report->highestSequence = qFromBigEndian<quint32>(p + 6);
+    report->jitterUs = qFromBigEndian<quint32>(p + 10);
+    report->lastSenderReport = qFromBigEndian<quint32>(p + 14);
+    report->delaySinceLastSenderReport = qFromBigEndian<quint32>(p + 18);
+    return true;
+}
+
+QByteArray makeNackPayload(const Nack &nack)
+{
+    QByteArray out(1, char(nack.stream));
+    out.reserve(1 + MaxNackEntries * 6);
+
+    int entries = 0;
+    qsizetype i = 0;
+    while (i < nack.sequences.size() && entries < MaxNackEntries) {
+        const quint32 first = nack.sequences.at(i++);
+        quint16 mask = 0;
+        while (i < nack.sequences.size()) {
+            const quint32 offset = nack.sequences.at(i) - first;
+            if (offset == 0) {
+                ++i;
+                continue;
+            }
+            if (offset > 16) break;
+            mask |= quint16(1u << (offset - 1));
+            ++i;
+        }
+
+        uchar entry[6];
+        qToBigEndian<quint32>(first, entry);
+        qToBigEndian<quint16>(mask, entry + 4);
+        out.append(reinterpret_cast<const char *>(entry), 6);
+        ++entries;
+    }
+    return out;
+}
+
+bool readNackPayload(QByteArrayView payload, Nack *nack)
+{
+    if (payload.size() < 7 || (payload.size() - 1) % 6 != 0) return false;
+
+    const uchar *p = reinterpret_cast<const uchar *>(payload.data());
+    if (p[0] >= quint8(MediaStream::Count)) return false;
+
+    const int entries = int((payload.size() - 1) / 6);
+    if (entries > MaxNackEntries) return false;
+
+    nack->stream = MediaStream(p[0]);
+    nack->sequences.clear();
+    for (int e = 0; e < entries; ++e) {
+        const uchar *entry = p + 1 + e * 6;
+        const quint32 first = qFromBigEndian<quint32>(entry);
+        const quint16 mask = qFromBigEndian<quint16>(entry + 4);
+        nack->sequences.append(first);
+        for (int bit = 0; bit < 16; ++bit) {
+            if (mask & (1u << bit)) nack->sequences.append(first + quint32(bit) + 1);
+        }
+    }
+    return true;
+}
+
+QByteArray makeMtuProbeReplyPayload(quint16 datagramSize)
+{
+    QByteArray out(2, Qt::Uninitialized);
+    qToBigEndian<quint16>(datagramSize, out.data());
+    return out;
+}
+
+bool readMtuProbeReplyPayload(QByteArrayView payload, quint16 *datagramSize)
+{
+    if (payload.size() < 2) return false;
+
+    *datagramSize = qFromBigEndian<quint16>(payload.data());
+    return true;
+}
+
+bool nextBundledPacket(QByteArrayView payload, qsizetype *offset, QByteArrayView *packet)
+{
+    if (*offset + BundleEntryHeaderSize > payload.size()) return false;
+
+    const int length = qFromBigEndian<quint16>(payload.data() + *offset);
+    const qsizetype start = *offset + BundleEntryHeaderSize;
+    if (length == 0 || start + length > payload.size()) return false;
+
+    *packet = payload.sliced(start, length);
+    *offset = start + length;
+    return true;
+}
+
+} // namespace Protocol
@@ -0,0 +1,215 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QString>
+#include <QUuid>
+#include <QList>
+#include <QtGlobal>
+
+// Бинарный формат датаграмм.
+//
+// Каждая датаграмма начинается с заголовка фиксированного размера
+// (все поля в сетевом порядке байт):
+//
+//   0      1      2             4                    8                   12
+//   +------+------+-------------+--------------------+-------------------+
+//   | ver  | type |   peerId    |      sequence      |     timestamp     |
+//   +------+------+-------------+--------------------+-------------------+
+//
+// peerId - короткий идентификатор участника, выбирается случайно при старте
+// и согласуется в DISCOVER/DISCOVER_REPLY (при коллизии один из участников
+// выбирает новый). Ник передаётся только в DISCOVER/DISCOVER_REPLY.
+// timestamp - медиа-время: для аудио в отсчётах частоты дискретизации,
+// для видео в миллисекундах с момента запуска захвата. В пакетах,
+// адресованных одному участнику (DISCOVER_REPLY, TRANSPORT_FEEDBACK,
+// SENDER_REPORT, RECEIVER_REPORT, NACK, MTU_PROBE, MTU_PROBE_REPLY),
+// timestamp - peerId адресата:
+// по нему ретранслятор доставляет их, не разбирая полезную нагрузку.
+// Старший бит ver - медиапакет зашифрован (MediaCrypto): заголовок
+// открыт, за полезной нагрузкой - тег.
+namespace Protocol {
+
+constexpr quint8 Version = 1;
+constexpr quint8 EncryptedFlag = 0x80;
+
+enum class PacketType : quint8 {
+    Audio = 0,
+    Video,
+    Discover,
+    DiscoverReply,
+    KeepAlive,
+    Message,
+    TransportFeedback,
+    SenderReport,
+    ReceiverReport,
+    Fec,
+    Nack,
+    Retransmission,
+    MtuProbe,
+    MtuProbeReply,
+    Bundle,
+    Count
+};
+
+constexpr int TypeCount = int(PacketType::Count);
+
+// Пакет одному участнику, peerId адресата - в timestamp
+constexpr bool isDirected(PacketType type)
+{
+    return type == PacketType::DiscoverReply || type == PacketType::TransportFeedback
+           || type == PacketType::SenderReport || type == PacketType::ReceiverReport
+           || type == PacketType::Nack || type == PacketType::MtuProbe
+           || type == PacketType::MtuProbeReply;
+}
+
+struct PacketHeader
+{
+    quint8 version = Version;
+    PacketType type = PacketType::Audio;
+    quint16 peerId = 0;
+    quint32 sequence = 0;
+    quint32 timestamp = 0;
+    bool encrypted = false;
+};
+
+constexpr int HeaderSize = 12;
+
+// Размер UUID экземпляра в полезной нагрузке DISCOVER (QUuid::toRfc4122)
+constexpr int InstanceIdSize = 16;
+
+// Необязательные поля DISCOVER/DISCOVER_REPLY в формате TLV
+// (тег, длина, значение); неизвестные теги пропускаются
+enum class DiscoverTag : quint8 {
+    AudioCodecs = 1,
+    MediaPorts = 2,    // порт аудио (2), порт видео (2)
+    Features = 3       // маска Feature*
+};
+
+// Возможности участника, о которых нужно знать до отправки
+constexpr quint8 FeatureBundle = 0x01;       // принимает BUNDLE
+constexpr quint8 FeatureEncryption = 0x02;   // медиа зашифровано
+
+struct DiscoverInfo
+{
+    QUuid instanceId;
+    QString nickname;
+    quint8 audioCodecs = 0;   // маска AudioCodecs::maskOf()
+    // Порты для аудио и видео, 0 - тот же порт, что и у управления
+    quint16 audioPort = 0;
+    quint16 videoPort = 0;
+    quint8 features = 0;      // маска Feature*
+};
+
+// TRANSPORT_FEEDBACK: время прихода видеопакетов у получателя для оценки
+// пропускной способности отправителем. Для каждого sequence подряд начиная
+// с baseSequence - смещение времени прихода от предыдущего полученного
+// пакета (у первого - от referenceTime) в единицах FeedbackTimeUnitUs.
+// Часы получателя произвольные, отправитель использует только разности.
+constexpr int FeedbackTimeUnitUs = 250;
+constexpr qint16 FeedbackNotReceived = -32768;
+constexpr int MaxFeedbackPackets = 512;
+
+struct TransportFeedback
+{
+    quint32 baseSequence = 0;
+    quint32 referenceTime = 0;     // в единицах FeedbackTimeUnitUs
+    QList<qint16> deltas;          // FeedbackNotReceived - пакет потерян
+};
+
+// SENDER_REPORT/RECEIVER_REPORT - периодические отчёты по каждому медиапотоку
+// в духе RTCP SR/RR. Время в отчётах - «компактное» (1/65536 с, младшие
+// 32 бита) по часам отправителя отчёта: получатель возвращает время
+// последнего SR (lastSenderReport) и сколько прошло с его приёма
+// (delaySinceLastSenderReport), и отправитель получает RTT без
+// синхронизации часов.
+enum class MediaStream : quint8 {
+    Audio = 0,
+    Video,
+    Count
+};
+
+struct SenderReport
+{
+    MediaStream stream = MediaStream::Audio;
+    quint32 sendTime = 0;
+    quint32 packetCount = 0;
+    quint32 octetCount = 0;
+};
+
+struct ReceiverReport
+{
+    MediaStream stream = MediaStream::Audio;
+    quint8 fractionLost = 0;          // доля потерь с прошлого отчёта, /256
+    qint32 cumulativeLost = 0;
+    quint32 highestSequence = 0;      // наибольший полученный sequence
+    quint32 jitterUs = 0;
+    quint32 lastSenderReport = 0;
+    quint32 delaySinceLastSenderReport = 0;
+};
+
+// NACK - запрос повторной отправки потерянных пакетов потока. Sequence
+// упакованы как в RTCP Generic NACK: первый sequence и 16-битная маска
+// следующих за ним. Ответ отправителя - RETRANSMISSION с исходными
+// sequence, timestamp и полезной нагрузкой.
+constexpr int MaxNackEntries = 64;
+
+struct Nack
+{
+    MediaStream stream = MediaStream::Video;
+    QList<quint32> sequences;   // по возрастанию
+};
+
+void writeHeader(char *dst, const PacketHeader &header);
+bool readHeader(QByteArrayView data, PacketHeader *header);
+
+QByteArray makePacket(const PacketHeader &header, QByteArrayView payload = {});
+// То же в готовый буфер длиной HeaderSize + payload.size(), например из пула
+void writePacket(char *dst, const PacketHeader &header, QByteArrayView payload);
+
+// DISCOVER/DISCOVER_REPLY: UUID экземпляра (16 байт), длина ника (1 байт),
+// ник в UTF-8, затем TLV-поля
+QByteArray makeDiscoverPayload(const DiscoverInfo &info);
+bool readDiscoverPayload(QByteArrayView payload, DiscoverInfo *info);
+
+// TRANSPORT_FEEDBACK: baseSequence (4), referenceTime (4), число пакетов (2),
+// затем по 2 байта на пакет
+QByteArray makeFeedbackPayload(const TransportFeedback &feedback);
+bool readFeedbackPayload(QByteArrayView payload, TransportFeedback *feedback);
+
+QByteArray makeSenderReportPayload(const SenderReport &report);
+bool readSenderReportPayload(QByteArrayView payload, SenderReport *report);
+QByteArray makeReceiverReportPayload(const ReceiverReport &report);
+bool readReceiverReportPayload(QByteArrayView payload, ReceiverReport *report);
+
+// NACK: stream (1), затем записи sequence (4) | маска (2). Sequence, не
+// уместившиеся в MaxNackEntries записей, отбрасываются
+QByteArray makeNackPayload(const Nack &nack);
+bool readNackPayload(QByteArrayView payload, Nack *nack);
+
+// MTU_PROBE - проба пути (см. PathMtuProber): полезная нагрузка - заполнитель
+// до нужной длины датаграммы. MTU_PROBE_REPLY: длина принятой датаграммы (2),
+// sequence - как у пробы
+QByteArray makeMtuProbeReplyPayload(quint16 datagramSize);
+bool readMtuProbeReplyPayload(QByteArrayView payload, quint16 *datagramSize);
+
+// BUNDLE - несколько пакетов одного отправителя одной датаграммой. В
+// заголовке peerId отправителя, в timestamp - число пакетов; дальше для
+// каждого длина (2) и сам пакет со своим заголовком. Очередь отправки
+// выбирается по первому вложенному пакету. Получатель разбирает BUNDLE
+// на входе и обрабатывает вложенные пакеты как отдельные, вложенный
+// BUNDLE не допускается
+constexpr int BundleEntryHeaderSize = 2;
+// Вложенный пакет, начинающийся с *offset, и сдвиг offset за него; false -
+// пакеты кончились или длина выходит за датаграмму
+bool nextBundledPacket(QByteArrayView payload, qsizetype *offset, QByteArrayView *packet);
+
+inline QByteArrayView payloadOf(QByteArrayView datagram)
+{
+    return datagram.size() > HeaderSize ? datagram.sliced(HeaderSize) : QByteArrayView();
+}
+
+} // namespace Protocol
+
+#endif // PROTOCOL_H
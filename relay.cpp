@@ -0,0 +1,119 @@
+#include "relayserver.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QTimer>
+#include <csignal>
+
+// Ретранслятор звонков на много участников. Клиенты указывают его адрес:
+//
+//   AuthoLASTVLADIORelay --port 45500 --threads 4
+//   AuthoLASTVLADIOCli --relay --peer <адрес> --remote-port 45500 --port 50000
+//
+// Порт по умолчанию отличается от порта клиентов: их сокет управления
+// открыт с SO_REUSEPORT, и на одной машине ядро делило бы поток между ними.
+
+namespace {
+
+QTextStream &out()
+{
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void requestStop(int)
+{
+    stopRequested = 1;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("AuthoLASTVLADIORelay");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Ретранслятор: пересылает пакеты участников без декодирования");
+    parser.addHelpOption();
+    const QCommandLineOption portOption("port", "Порт ретранслятора.", "port", "45500");
+    const QCommandLineOption threadsOption("threads", "Потоки пересылки; 0 - по числу ядер.", "count", "0");
+    const QCommandLineOption maxVideoOption("max-video", "Видеопотоков на получателя; 0 - все.", "count", "4");
+    const QCommandLineOption timeoutOption("timeout", "Отключать молчащего клиента через, с.", "seconds", "10");
+    const QCommandLineOption statsOption("stats", "Период вывода статистики, с.", "seconds", "5");
+    parser.addOptions({ portOption, threadsOption, maxVideoOption, timeoutOption, statsOption });
+    parser.process(app);
+
+    RelayServer::Config config;
+    config.port = quint16(parser.value(portOption).toUInt());
+    config.threads = parser.value(threadsOption).toInt();
+    config.maxVideoStreams = parser.value(maxVideoOption).toInt();
+    config.clientTimeoutMs = qMax(1, parser.value(timeoutOption).toInt()) * 1000;
+
+    RelayServer relay(config);
+    QObject::connect(&relay, &RelayServer::logMessage, [](const QString &message) {
+        out() << message << Qt::endl;
+    });
+    if (!relay.start()) {
+        out() << "Не удалось запустить ретранслятор: " << relay.errorString() << Qt::endl;
+        return 1;
+    }
+    out() << QString("Ретранслятор на порту %1, потоков %2, видео на получателя: %3")
+                 .arg(config.port)
+                 .arg(relay.threadCount())
+                 .arg(config.maxVideoStreams > 0 ? QString::number(config.maxVideoStreams) : "все")
+          << Qt::endl;
+
+    // Выбор видео и таймауты - раз в секунду, не в потоках пересылки
+    QTimer maintenanceTimer;
+    QObject::connect(&maintenanceTimer, &QTimer::timeout, [&relay]() {
+        relay.updateVideoSelection();
+        relay.expireClients();
+    });
+    maintenanceTimer.start(1000);
+
+    QElapsedTimer clock;
+    clock.start();
+    RelayServer::Stats previous;
+    qint64 previousMs = 0;
+    QTimer statsTimer;
+    QObject::connect(&statsTimer, &QTimer::timeout, [&]() {
+        const RelayServer::Stats stats = relay.stats();
+        const qint64 nowMs = clock.elapsed();
+        const double seconds = qMax<qint64>(1, nowMs - previousMs) / 1000.0;
+        const qint64 hopPackets = stats.hopPackets - previous.hopPackets;
+
+        out() << QString("Клиентов %1; приём %2 пак/с, пересылка %3 пак/с (%4 Мбит/с), потеряно %5;"
+                         " в ретрансляторе %6 мкс; пакетов на вызов: приём %7, отправка %8")
+                     .arg(stats.clients)
+                     .arg((stats.receivedPackets - previous.receivedPackets) / seconds, 0, 'f', 0)
+                     .arg((stats.forwardedPackets - previous.forwardedPackets) / seconds, 0, 'f', 0)
+                     .arg((stats.forwardedBytes - previous.forwardedBytes) * 8 / seconds / 1e6, 0, 'f', 1)
+                     .arg(stats.droppedPackets - previous.droppedPackets)
+                     .arg(hopPackets > 0 ? (stats.hopNs - previous.hopNs) / 1000.0 / hopPackets : 0.0, 0, 'f', 1)
+                     .arg(double(stats.receivedPackets - previous.receivedPackets)
+                              / qMax<qint64>(1, stats.receiveCalls - previous.receiveCalls), 0, 'f', 1)
+                     .arg(double(stats.forwardedPackets - previous.forwardedPackets)
+                              / qMax<qint64>(1, stats.sendCalls - previous.sendCalls), 0, 'f', 1)
+              << Qt::endl;
+
+        previous = stats;
+        previousMs = nowMs;
+    });
+    statsTimer.start(qMax(1, parser.value(statsOption).toInt()) * 1000);
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+    QTimer stopTimer;
+    QObject::connect(&stopTimer, &QTimer::timeout, [&app]() {
+        if (stopRequested) app.quit();
+    });
+    stopTimer.start(100);
+
+    const int result = app.exec();
+    relay.stop();
+    return result;
+}
@@ -0,0 +1,451 @@
+#include "protocol.h"
+#include "audiocodec.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QHash>
+#include <QTextStream>
+#include <QUuid>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Нагрузочный генератор для ретранслятора: сотни синтетических клиентов в
+// одном процессе шлют аудио и видео с нужным темпом и размером пакетов.
+// В полезной нагрузке - время отправки по CLOCK_MONOTONIC, поэтому на
+// одной машине задержка клиент -> ретранслятор -> клиент меряется прямо
+// по приёму. Медиа не настоящее: ретранслятор его не декодирует.
+//
+//   AuthoLASTVLADIORelay --port 45500
+//   AuthoLASTVLADIORelayLoad --relay 127.0.0.1 --port 45500 --clients 100
+
+namespace {
+
+constexpr int ReceiveBatch = 64;
+constexpr int MaxDatagramSize = 2048;
+// Смещение метки времени в полезной нагрузке: байт 0 - кодек аудио
+constexpr int StampOffset = 1;
+constexpr int MinPayloadSize = StampOffset + int(sizeof(qint64));
+// Гистограмма задержки: шаг 10 мкс, до 200 мс
+constexpr qint64 HistogramStepNs = 10000;
+constexpr int HistogramSize = 20000;
+// Разрыв больше этого - поток заново выбран ретранслятором, а не потери
+constexpr quint32 MaxSequenceGap = 1000;
+
+struct Settings
+{
+    quint32 relayAddress = 0;
+    quint16 relayPort = 45500;
+    int audioIntervalMs = 20;
+    int audioSize = 160;
+    int fps = 15;
+    int fragments = 5;
+    int fragmentSize = 1100;
+};
+
+struct LoadClient
+{
+    int fd = -1;
+    quint16 id = 0;
+    QByteArray discover;
+    quint32 audioSequence = 0;
+    quint32 videoSequence = 0;
+    qint64 nextAudioNs = 0;
+    qint64 nextVideoNs = 0;
+    int discoversLeft = 3;
+    qint64 nextDiscoverNs = 0;
+    // Следующий ожидаемый sequence: ключ - peerId << 8 | тип пакета
+    QHash<quint32, quint32> expected;
+};
+
+struct alignas(64) LoadThread
+{
+    std::thread thread;
+    std::vector<LoadClient> clients;
+
+    std::atomic<qint64> sentPackets{0};
+    std::atomic<qint64> receivedPackets{0};
+    std::atomic<qint64> receivedBytes{0};
+    std::atomic<qint64> lostPackets{0};
+
+    std::mutex histogramMutex;
+    std::vector<quint32> histogram = std::vector<quint32>(HistogramSize + 1, 0);
+};
+
+std::atomic<bool> running{true};
+volatile std::sig_atomic_t stopRequested = 0;
+
+void requestStop(int)
+{
+    stopRequested = 1;
+}
+
+QTextStream &out()
+{
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+qint64 monotonicNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void sendPackets(LoadThread &thread, LoadClient &client, const Settings &settings,
+                 Protocol::PacketType type, int count, int payloadSize, quint32 timestamp)
+{
+    const int length = Protocol::HeaderSize + payloadSize;
+    std::vector<char> buffers(size_t(count) * size_t(length), 0);
+    std::vector<mmsghdr> msgs(static_cast<size_t>(count));
+    std::vector<iovec> iovecs(static_cast<size_t>(count));
+
+    sockaddr_in relay;
+    memset(&relay, 0, sizeof(relay));
+    relay.sin_family = AF_INET;
+    relay.sin_addr.s_addr = htonl(settings.relayAddress);
+    relay.sin_port = htons(settings.relayPort);
+
+    const qint64 stamp = monotonicNs();
+    for (int i = 0; i < count; ++i) {
+        char *packet = buffers.data() + size_t(i) * size_t(length);
+        Protocol::PacketHeader header;
+        header.type = type;
+        header.peerId = client.id;
+        header.sequence = type == Protocol::PacketType::Audio ? ++client.audioSequence : ++client.videoSequence;
+        header.timestamp = timestamp;
+        Protocol::writeHeader(packet, header);
+        packet[Protocol::HeaderSize] = char(AudioCodecId::Pcm);
+        memcpy(packet + Protocol::HeaderSize + StampOffset, &stamp, sizeof(stamp));
+
+        iovecs[size_t(i)].iov_base = packet;
+        iovecs[size_t(i)].iov_len = size_t(length);
+        memset(&msgs[size_t(i)], 0, sizeof(mmsghdr));
+        msgs[size_t(i)].msg_hdr.msg_iov = &iovecs[size_t(i)];
+        msgs[size_t(i)].msg_hdr.msg_iovlen = 1;
+        msgs[size_t(i)].msg_hdr.msg_name = &relay;
+        msgs[size_t(i)].msg_hdr.msg_namelen = sizeof(relay);
+    }
+
+    const int sent = sendmmsg(client.fd, msgs.data(), unsigned(count), MSG_DONTWAIT);
+    if (sent > 0) {
+        thread.sentPackets.fetch_add(sent, std::memory_order_relaxed);
+    }
+}
+
+void receivePackets(LoadThread &thread, LoadClient &client, std::vector<char> &buffers)
+{
+    mmsghdr msgs[ReceiveBatch];
+    iovec iovecs[ReceiveBatch];
+
+    for (;;) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < ReceiveBatch; ++i) {
+            iovecs[i].iov_base = buffers.data() + size_t(i) * MaxDatagramSize;
+            iovecs[i].iov_len = MaxDatagramSize;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        const int received = recvmmsg(client.fd, msgs, ReceiveBatch, MSG_DONTWAIT, nullptr);
+        if (received <= 0) return;
+
+        const qint64 now = monotonicNs();
+        qint64 bytes = 0;
+        qint64 lost = 0;
+        int media = 0;
+        std::lock_guard<std::mutex> locker(thread.histogramMutex);
+        for (int i = 0; i < received; ++i) {
+            const char *data = static_cast<const char *>(iovecs[i].iov_base);
+            const int length = int(msgs[i].msg_len);
+            bytes += length;
+
+            Protocol::PacketHeader header;
+            if (!Protocol::readHeader(QByteArrayView(data, length), &header)) continue;
+            if (header.type != Protocol::PacketType::Audio && header.type != Protocol::PacketType::Video) continue;
+            if (length < Protocol::HeaderSize + MinPayloadSize) continue;
+            ++media;
+
+            qint64 stamp = 0;
+            memcpy(&stamp, data + Protocol::HeaderSize + StampOffset, sizeof(stamp));
+            const qint64 bucket = qBound<qint64>(0, (now - stamp) / HistogramStepNs, HistogramSize);
+            ++thread.histogram[size_t(bucket)];
+
+            const quint32 key = quint32(header.peerId) << 8 | quint32(header.type);
+            auto it = client.expected.find(key);
+            if (it != client.expected.end()) {
+                const quint32 gap = header.sequence - it.value();
+                if (gap != 0 && gap < MaxSequenceGap) lost += gap;
+                if (qint32(gap) >= 0) it.value() = header.sequence + 1;
+            } else {
+                client.expected.insert(key, header.sequence + 1);
+            }
+        }
+        thread.receivedPackets.fetch_add(media, std::memory_order_relaxed);
+        thread.receivedBytes.fetch_add(bytes, std::memory_order_relaxed);
+        thread.lostPackets.fetch_add(lost, std::memory_order_relaxed);
+
+        if (received < ReceiveBatch) return;
+    }
+}
+
+void runThread(LoadThread &thread, const Settings &settings)
+{
+    const int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    for (size_t i = 0; i < thread.clients.size(); ++i) {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u64 = i;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, thread.clients[i].fd, &event);
+    }
+
+    sockaddr_in relay;
+    memset(&relay, 0, sizeof(relay));
+    relay.sin_family = AF_INET;
+    relay.sin_addr.s_addr = htonl(settings.relayAddress);
+    relay.sin_port = htons(settings.relayPort);
+
+    const qint64 audioIntervalNs = qint64(settings.audioIntervalMs) * 1000000;
+    const qint64 videoIntervalNs = settings.fps > 0 ? 1000000000 / settings.fps : 0;
+    const qint64 startNs = monotonicNs();
+    std::vector<char> buffers(size_t(ReceiveBatch) * MaxDatagramSize);
+    std::vector<epoll_event> events(thread.clients.size() + 1);
+
+    while (running.load(std::memory_order_relaxed)) {
+        const qint64 now = monotonicNs();
+        qint64 wakeNs = now + 100000000;
+
+        for (LoadClient &client : thread.clients) {
+            // DISCOVER несколько раз на случай потерь, дальше клиента держит медиа
+            if (client.discoversLeft > 0 && now >= client.nextDiscoverNs) {
+                ::sendto(client.fd, client.discover.constData(), size_t(client.discover.size()), MSG_DONTWAIT,
+                         reinterpret_cast<const sockaddr *>(&relay), sizeof(relay));
+                --client.discoversLeft;
+                client.nextDiscoverNs = now + 500000000;
+                // Медиа - после того, как ретранслятор узнал клиента
+                if (client.nextAudioNs == 0) {
+                    client.nextAudioNs = now + 200000000;
+                    client.nextVideoNs = now + 200000000;
+                }
+            }
+            if (client.discoversLeft > 0) wakeNs = qMin(wakeNs, client.nextDiscoverNs);
+
+            while (client.nextAudioNs != 0 && now >= client.nextAudioNs) {
+                sendPackets(thread, client, settings, Protocol::PacketType::Audio, 1, qMax(MinPayloadSize, settings.audioSize),
+                            quint32((now - startNs) / 1000000));
+                client.nextAudioNs += audioIntervalNs;
+            }
+            while (videoIntervalNs > 0 && client.nextVideoNs != 0 && now >= client.nextVideoNs) {
+                sendPackets(thread, client, settings, Protocol::PacketType::Video, settings.fragments,
+                            qMax(MinPayloadSize, settings.fragmentSize), quint32((now - startNs) / 1000000));
+                client.nextVideoNs += videoIntervalNs;
+            }
+            if (client.nextAudioNs != 0) wakeNs = qMin(wakeNs, client.nextAudioNs);
+            if (videoIntervalNs > 0 && client.nextVideoNs != 0) wakeNs = qMin(wakeNs, client.nextVideoNs);
+        }
+
+        const int timeoutMs = int(qMax<qint64>(0, (wakeNs - monotonicNs()) / 1000000));
+        const int ready = epoll_wait(epollFd, events.data(), int(events.size()), timeoutMs);
+        for (int i = 0; i < ready; ++i) {
+            receivePackets(thread, thread.clients[size_t(events[size_t(i)].data.u64)], buffers);
+        }
+    }
+
+    ::close(epollFd);
+}
+
+// Перцентиль по гистограмме, мкс
+double percentileUs(const std::vector<quint64> &histogram, quint64 total, double fraction)
+{
+    if (total == 0) return 0.0;
+    const quint64 rank = quint64(double(total) * fraction);
+    quint64 seen = 0;
+    for (size_t i = 0; i < histogram.size(); ++i) {
+        seen += histogram[i];
+        if (seen > rank) return double(i) * HistogramStepNs / 1000.0;
+    }
+    return double(histogram.size()) * HistogramStepNs / 1000.0;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("AuthoLASTVLADIORelayLoad");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Нагрузка на ретранслятор: синтетические клиенты, пакетов в секунду и задержка");
+    parser.addHelpOption();
+    const QCommandLineOption relayOption("relay", "Адрес ретранслятора (IPv4).", "address", "127.0.0.1");
+    const QCommandLineOption portOption("port", "Порт ретранслятора.", "port", "45500");
+    const QCommandLineOption clientsOption("clients", "Число клиентов.", "count", "50");
+    const QCommandLineOption threadsOption("threads", "Потоки генератора; 0 - по числу ядер.", "count", "0");
+    const QCommandLineOption durationOption("duration", "Длительность, с; 0 - до Ctrl+C.", "seconds", "30");
+    const QCommandLineOption audioIntervalOption("audio-interval", "Период аудиопакетов, мс.", "ms", "20");
+    const QCommandLineOption audioSizeOption("audio-size", "Полезная нагрузка аудиопакета, байт.", "bytes", "160");
+    const QCommandLineOption fpsOption("fps", "Кадров видео в секунду; 0 - без видео.", "fps", "15");
+    const QCommandLineOption fragmentsOption("fragments", "Пакетов на кадр.", "count", "5");
+    const QCommandLineOption fragmentSizeOption("fragment-size", "Полезная нагрузка видеопакета, байт.", "bytes", "1100");
+    const QCommandLineOption statsOption("stats", "Период вывода статистики, с.", "seconds", "1");
+    parser.addOptions({ relayOption, portOption, clientsOption, threadsOption, durationOption,
+                        audioIntervalOption, audioSizeOption, fpsOption, fragmentsOption,
+                        fragmentSizeOption, statsOption });
+    parser.process(app);
+
+    Settings settings;
+    in_addr relayAddress;
+    if (inet_pton(AF_INET, parser.value(relayOption).toLatin1().constData(), &relayAddress) != 1) {
+        out() << "Нужен IPv4-адрес ретранслятора" << Qt::endl;
+        return 1;
+    }
+    settings.relayAddress = ntohl(relayAddress.s_addr);
+    settings.relayPort = quint16(parser.value(portOption).toUInt());
+    settings.audioIntervalMs = qMax(1, parser.value(audioIntervalOption).toInt());
+    settings.audioSize = parser.value(audioSizeOption).toInt();
+    settings.fps = parser.value(fpsOption).toInt();
+    settings.fragments = qMax(1, parser.value(fragmentsOption).toInt());
+    settings.fragmentSize = qMin(MaxDatagramSize - Protocol::HeaderSize, parser.value(fragmentSizeOption).toInt());
+
+    const int clientCount = qMax(2, parser.value(clientsOption).toInt());
+    const int threadCount = qBound(1, parser.value(threadsOption).toInt() > 0
+                                          ? parser.value(threadsOption).toInt()
+                                          : int(std::thread::hardware_concurrency()),
+                                   clientCount);
+
+    std::vector<std::unique_ptr<LoadThread>> threads;
+    for (int i = 0; i < threadCount; ++i) {
+        threads.push_back(std::make_unique<LoadThread>());
+    }
+    for (int i = 0; i < clientCount; ++i) {
+        LoadClient client;
+        client.fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (client.fd == -1) {
+            out() << "Не удалось создать сокет: " << strerror(errno) << Qt::endl;
+            return 1;
+        }
+        const int bufferSize = 1024 * 1024;
+        setsockopt(client.fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+        // id уникальны в пределах прогона, коллизий не бывает
+        client.id = quint16(i + 1);
+        Protocol::PacketHeader header;
+        header.type = Protocol::PacketType::Discover;
+        header.peerId = client.id;
+        Protocol::DiscoverInfo info;
+        info.instanceId = QUuid::createUuid();
+        info.nickname = QString("load%1").arg(i);
+        info.audioCodecs = AudioCodecs::maskOf(AudioCodecId::Pcm);
+        client.discover = Protocol::makePacket(header, Protocol::makeDiscoverPayload(info));
+        // Старт клиентов размазан, чтобы кадры не шли одной стеной
+        client.nextDiscoverNs = monotonicNs() + qint64(i) * 1000000;
+
+        threads[size_t(i % threadCount)]->clients.push_back(std::move(client));
+    }
+
+    for (const std::unique_ptr<LoadThread> &thread : threads) {
+        LoadThread *t = thread.get();
+        t->thread = std::thread([t, &settings]() { runThread(*t, settings); });
+    }
+    out() << QString("Клиентов %1 в %2 потоках -> %3:%4")
+                 .arg(clientCount)
+                 .arg(threadCount)
+                 .arg(parser.value(relayOption))
+                 .arg(settings.relayPort)
+          << Qt::endl;
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    const int durationSeconds = parser.value(durationOption).toInt();
+    const int statsSeconds = qMax(1, parser.value(statsOption).toInt());
+    std::vector<quint64> total(HistogramSize + 1, 0);
+    quint64 totalCount = 0;
+    qint64 previousSent = 0;
+    qint64 previousReceived = 0;
+    qint64 previousBytes = 0;
+    qint64 previousLost = 0;
+    const auto start = std::chrono::steady_clock::now();
+    auto lastStats = start;
+
+    while (!stopRequested) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        const auto now = std::chrono::steady_clock::now();
+        const bool finished = durationSeconds > 0 && now - start >= std::chrono::seconds(durationSeconds);
+        if (!finished && now - lastStats < std::chrono::seconds(statsSeconds)) continue;
+
+        // Гистограммы потоков забираются и обнуляются: перцентили за период
+        std::vector<quint64> period(HistogramSize + 1, 0);
+        quint64 periodCount = 0;
+        qint64 sent = 0;
+        qint64 received = 0;
+        qint64 bytes = 0;
+        qint64 lost = 0;
+        for (const std::unique_ptr<LoadThread> &thread : threads) {
+            {
+                std::lock_guard<std::mutex> locker(thread->histogramMutex);
+                for (size_t i = 0; i < period.size(); ++i) {
+                    period[i] += thread->histogram[i];
+                    periodCount += thread->histogram[i];
+                    thread->histogram[i] = 0;
+                }
+            }
+            sent += thread->sentPackets.load(std::memory_order_relaxed);
+            received += thread->receivedPackets.load(std::memory_order_relaxed);
+            bytes += thread->receivedBytes.load(std::memory_order_relaxed);
+            lost += thread->lostPackets.load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < total.size(); ++i) {
+            total[i] += period[i];
+        }
+        totalCount += periodCount;
+
+        const double seconds = std::chrono::duration<double>(now - lastStats).count();
+        out() << QString("Отправлено %1 пак/с, принято %2 пак/с (%3 Мбит/с), потери %4%;"
+                         " задержка p50 %5 мкс, p99 %6 мкс, p99.9 %7 мкс")
+                     .arg((sent - previousSent) / seconds, 0, 'f', 0)
+                     .arg((received - previousReceived) / seconds, 0, 'f', 0)
+                     .arg((bytes - previousBytes) * 8 / seconds / 1e6, 0, 'f', 1)
+                     .arg(100.0 * (lost - previousLost) / qMax<qint64>(1, received - previousReceived + lost - previousLost), 0, 'f', 2)
+                     .arg(percentileUs(period, periodCount, 0.5), 0, 'f', 0)
+                     .arg(percentileUs(period, periodCount, 0.99), 0, 'f', 0)
+                     .arg(percentileUs(period, periodCount, 0.999), 0, 'f', 0)
+              << Qt::endl;
+        previousSent = sent;
+        previousReceived = received;
+        previousBytes = bytes;
+        previousLost = lost;
+        lastStats = now;
+
+        if (finished) break;
+    }
+
+    running = false;
+    for (const std::unique_ptr<LoadThread> &thread : threads) {
+        thread->thread.join();
+        for (const LoadClient &client : thread->clients) {
+            ::close(client.fd);
+        }
+    }
+
+    out() << QString("Итого: принято %1 медиапакетов, потери %2; задержка p50 %3 мкс, p99 %4 мкс, p99.9 %5 мкс")
+                 .arg(previousReceived)
+                 .arg(previousLost)
+                 .arg(percentileUs(total, totalCount, 0.5), 0, 'f', 0)
+                 .arg(percentileUs(total, totalCount, 0.99), 0, 'f', 0)
+                 .arg(percentileUs(total, totalCount, 0.999), 0, 'f', 0)
+          << Qt::endl;
+    return 0;
+}
@@ -0,0 +1,528 @@
+#include "relayserver.h"
+#include "fec.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr int ReceiveBatch = 64;
+constexpr int MaxDatagramSize = 2048;
+// Столько запросов повтора помнится на клиента; старые теряют смысл за RTT
+constexpr int MaxNackRequests = 4096;
+constexpr int SocketBufferSize = 4 * 1024 * 1024;
+
+}
+
+struct RelayServer::SendBatch
+{
+    static constexpr int Capacity = 256;
+
+    mmsghdr msgs[Capacity];
+    iovec iovecs[Capacity];
+    sockaddr_in addrs[Capacity];
+    int count = 0;
+    qint64 receivedNs = 0;       // когда принята пачка, из которой пересылаем
+
+    void append(const char *data, int length, quint32 address, quint16 port)
+    {
+        iovecs[count].iov_base = const_cast<char *>(data);
+        iovecs[count].iov_len = size_t(length);
+        memset(&addrs[count], 0, sizeof(sockaddr_in));
+        addrs[count].sin_family = AF_INET;
+        addrs[count].sin_addr.s_addr = htonl(address);
+        addrs[count].sin_port = htons(port);
+        memset(&msgs[count], 0, sizeof(mmsghdr));
+        msgs[count].msg_hdr.msg_iov = &iovecs[count];
+        msgs[count].msg_hdr.msg_iovlen = 1;
+        msgs[count].msg_hdr.msg_name = &addrs[count];
+        msgs[count].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        ++count;
+    }
+};
+
+RelayServer::RelayServer(const Config &config, QObject *parent)
+    : QObject(parent)
+    , m_config(config)
+{
+}
+
+RelayServer::~RelayServer()
+{
+    stop();
+    qDeleteAll(m_clients);
+}
+
+qint64 RelayServer::monotonicNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+qint64 RelayServer::monotonicMs()
+{
+    return monotonicNs() / 1000000;
+}
+
+bool RelayServer::start()
+{
+    if (m_running) return true;
+
+    const int threads = m_config.threads > 0 ? m_config.threads
+                                             : int(qMax(1u, std::thread::hardware_concurrency()));
+    for (int i = 0; i < threads; ++i) {
+        std::unique_ptr<Worker> worker = std::make_unique<Worker>();
+
+        // Один порт на все потоки: SO_REUSEPORT раскладывает клиентов
+        // между сокетами по хешу адреса, пакеты клиента идут в один поток
+        worker->fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (worker->fd == -1) {
+            m_error = QString::fromLocal8Bit(strerror(errno));
+            stop();
+            return false;
+        }
+        int one = 1;
+        setsockopt(worker->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(worker->fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        setsockopt(worker->fd, SOL_SOCKET, SO_RCVBUF, &SocketBufferSize, sizeof(SocketBufferSize));
+        setsockopt(worker->fd, SOL_SOCKET, SO_SNDBUF, &SocketBufferSize, sizeof(SocketBufferSize));
+
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(m_config.port);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (::bind(worker->fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1) {
+            m_error = QString("порт %1: %2").arg(m_config.port).arg(QString::fromLocal8Bit(strerror(errno)));
+            ::close(worker->fd);
+            stop();
+            return false;
+        }
+
+        // eventfd будит поток при остановке
+        worker->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        worker->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = worker->fd;
+        epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, worker->fd, &event);
+        event.data.fd = worker->wakeFd;
+        epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, worker->wakeFd, &event);
+
+        m_workers.push_back(std::move(worker));
+    }
+
+    m_running = true;
+    for (const std::unique_ptr<Worker> &worker : m_workers) {
+        Worker *w = worker.get();
+        w->thread = std::thread([this, w]() { run(*w); });
+    }
+    return true;
+}
+
+void RelayServer::stop()
+{
+    m_running = false;
+    for (const std::unique_ptr<Worker> &worker : m_workers) {
+        if (worker->wakeFd != -1) {
+            const quint64 one = 1;
+            if (::write(worker->wakeFd, &one, sizeof(one)) < 0) {
+                // Поток всё равно проснётся на следующем пакете
+            }
+        }
+    }
+    for (const std::unique_ptr<Worker> &worker : m_workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+        for (int fd : { worker->fd, worker->epollFd, worker->wakeFd }) {
+            if (fd != -1) ::close(fd);
+        }
+    }
+    m_workers.clear();
+}
+
+RelayServer::Stats RelayServer::stats() const
+{
+    Stats stats;
+    {
+        std::shared_lock lock(m_mutex);
+        stats.clients = int(m_clients.size());
+    }
+    for (const std::unique_ptr<Worker> &worker : m_workers) {
+        stats.receivedPackets += worker->receivedPackets.load(std::memory_order_relaxed);
+        stats.forwardedPackets += worker->forwardedPackets.load(std::memory_order_relaxed);
+        stats.forwardedBytes += worker->forwardedBytes.load(std::memory_order_relaxed);
+        stats.droppedPackets += worker->droppedPackets.load(std::memory_order_relaxed);
+        stats.receiveCalls += worker->receiveCalls.load(std::memory_order_relaxed);
+        stats.sendCalls += worker->sendCalls.load(std::memory_order_relaxed);
+        stats.hopNs += worker->hopNs.load(std::memory_order_relaxed);
+        stats.hopPackets += worker->hopPackets.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void RelayServer::run(Worker &worker)
+{
+    std::vector<char> buffers(size_t(ReceiveBatch) * MaxDatagramSize);
+    std::unique_ptr<SendBatch> batch = std::make_unique<SendBatch>();
+
+    epoll_event events[2];
+    while (m_running.load(std::memory_order_relaxed)) {
+        const int ready = epoll_wait(worker.epollFd, events, 2, -1);
+        if (ready < 0 && errno != EINTR) break;
+
+        for (int i = 0; i < ready; ++i) {
+            if (events[i].data.fd == worker.fd) {
+                receive(worker, buffers, *batch);
+            }
+        }
+    }
+}
+
+void RelayServer::receive(Worker &worker, std::vector<char> &buffers, SendBatch &batch)
+{
+    mmsghdr msgs[ReceiveBatch];
+    iovec iovecs[ReceiveBatch];
+    sockaddr_in addrs[ReceiveBatch];
+
+    for (;;) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < ReceiveBatch; ++i) {
+            iovecs[i].iov_base = buffers.data() + size_t(i) * MaxDatagramSize;
+            iovecs[i].iov_len = MaxDatagramSize;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        }
+
+        const int received = recvmmsg(worker.fd, msgs, ReceiveBatch, MSG_DONTWAIT, nullptr);
+        if (received <= 0) break;
+        worker.receiveCalls.fetch_add(1, std::memory_order_relaxed);
+        worker.receivedPackets.fetch_add(received, std::memory_order_relaxed);
+
+        // DISCOVER меняет таблицу и разбирается после пересылки остального
+        int discovers[ReceiveBatch];
+        int discoverCount = 0;
+
+        batch.receivedNs = monotonicNs();
+        {
+            std::shared_lock lock(m_mutex);
+            for (int i = 0; i < received; ++i) {
+                const char *data = static_cast<const char *>(iovecs[i].iov_base);
+                const int length = int(msgs[i].msg_len);
+                if (length >= Protocol::HeaderSize
+                    && quint8(data[1]) == quint8(Protocol::PacketType::Discover)) {
+                    discovers[discoverCount++] = i;
+                    continue;
+                }
+                forward(worker, data, length, ntohl(addrs[i].sin_addr.s_addr), batch);
+            }
+            // Адреса скопированы в пачку, но отправляем до снятия блокировки:
+            // так клиент, удалённый по таймауту, не получит уже ненужный пакет
+            flush(worker, batch, batch.receivedNs);
+        }
+
+        for (int i = 0; i < discoverCount; ++i) {
+            const int index = discovers[i];
+            handleDiscover(worker,
+                           QByteArray(static_cast<const char *>(iovecs[index].iov_base), int(msgs[index].msg_len)),
+                           addrs[index]);
+        }
+
+        if (received < ReceiveBatch) break;
+    }
+}
+
+void RelayServer::forward(Worker &worker, const char *data, int length, quint32 senderAddress, SendBatch &batch)
+{
+    Protocol::PacketHeader header;
+    if (!Protocol::readHeader(QByteArrayView(data, length), &header)) {
+        worker.droppedPackets.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Пересылается только от участников, объявившихся через DISCOVER
+    Client *sender = m_clients.value(header.peerId, nullptr);
+    if (!sender || sender->address != senderAddress) {
+        worker.droppedPackets.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    sender->lastSeenMs.store(batch.receivedNs / 1000000, std::memory_order_relaxed);
+
+    switch (header.type) {
+    case Protocol::PacketType::Audio:
+        sender->audioBytes.fetch_add(length, std::memory_order_relaxed);
+        for (const Client *client : std::as_const(m_clients)) {
+            if (client != sender) sendTo(worker, data, length, *client, Route::Audio, batch);
+        }
+        break;
+
+    case Protocol::PacketType::Video:
+        for (const Client *client : std::as_const(m_clients)) {
+            if (client != sender && wantsVideo(*client, *sender)) {
+                sendTo(worker, data, length, *client, Route::Video, batch);
+            }
+        }
+        break;
+
+    case Protocol::PacketType::Fec: {
+        // Из заголовка FEC нужен только поток: чётность идёт следом за ним
+        Fec::Header fec;
+        if (!Fec::readHeader(Protocol::payloadOf(QByteArrayView(data, length)), &fec)) break;
+        const bool video = fec.stream == Protocol::MediaStream::Video;
+        for (const Client *client : std::as_const(m_clients)) {
+            if (client == sender || (video && !wantsVideo(*client, *sender))) continue;
+            sendTo(worker, data, length, *client, video ? Route::Video : Route::Audio, batch);
+        }
+        break;
+    }
+
+    case Protocol::PacketType::KeepAlive:
+    case Protocol::PacketType::Message:
+        for (const Client *client : std::as_const(m_clients)) {
+            if (client != sender) sendTo(worker, data, length, *client, Route::Control, batch);
+        }
+        break;
+
+    case Protocol::PacketType::DiscoverReply:
+    case Protocol::PacketType::TransportFeedback:
+    case Protocol::PacketType::SenderReport:
+    case Protocol::PacketType::ReceiverReport:
+    case Protocol::PacketType::MtuProbe:
+    case Protocol::PacketType::MtuProbeReply: {
+        const Client *target = m_clients.value(quint16(header.timestamp), nullptr);
+        if (target && target != sender) sendTo(worker, data, length, *target, Route::Control, batch);
+        break;
+    }
+
+    case Protocol::PacketType::Nack: {
+        Client *target = m_clients.value(quint16(header.timestamp), nullptr);
+        if (!target || target == sender) break;
+
+        // Запоминаем, кому вернуть повтор: он придёт от target с тем же sequence
+        Protocol::Nack nack;
+        if (Protocol::readNackPayload(Protocol::payloadOf(QByteArrayView(data, length)), &nack)) {
+            std::lock_guard<std::mutex> locker(target->nackMutex);
+            if (target->nackRequests.size() > MaxNackRequests) {
+                target->nackRequests.clear();
+            }
+            for (quint32 sequence : std::as_const(nack.sequences)) {
+                QList<quint16> &requesters = target->nackRequests[sequence];
+                if (!requesters.contains(sender->id)) requesters.append(sender->id);
+            }
+        }
+        sendTo(worker, data, length, *target, Route::Control, batch);
+        break;
+    }
+
+    case Protocol::PacketType::Retransmission: {
+        QList<quint16> requesters;
+        {
+            std::lock_guard<std::mutex> locker(sender->nackMutex);
+            requesters = sender->nackRequests.take(header.sequence);
+        }
+        for (quint16 id : std::as_const(requesters)) {
+            const Client *client = m_clients.value(id, nullptr);
+            if (client) sendTo(worker, data, length, *client, Route::Video, batch);
+        }
+        break;
+    }
+
+    case Protocol::PacketType::Bundle: {
+        // У вложенных пакетов разные получатели: каждый пересылается по
+        // своим правилам отдельной датаграммой, прямо из буфера приёма
+        const QByteArrayView payload = Protocol::payloadOf(QByteArrayView(data, length));
+        qsizetype offset = 0;
+        QByteArrayView packet;
+        while (Protocol::nextBundledPacket(payload, &offset, &packet)) {
+            if (packet.size() >= Protocol::HeaderSize
+                && quint8(packet.at(1)) == quint8(Protocol::PacketType::Bundle)) {
+                continue;
+            }
+            forward(worker, packet.data(), int(packet.size()), senderAddress, batch);
+        }
+        break;
+    }
+
+    default:
+        worker.droppedPackets.fetch_add(1, std::memory_order_relaxed);
+        break;
+    }
+}
+
+bool RelayServer::wantsVideo(const Client &receiver, const Client &sender) const
+{
+    // Получатель видит maxVideoStreams самых активных участников, не считая
+    // себя: если он сам в их числе, его место занимает следующий
+    const int limit = m_config.maxVideoStreams;
+    if (limit <= 0) return true;
+    const int senderRank = sender.videoRank.load(std::memory_order_relaxed);
+    const int receiverRank = receiver.videoRank.load(std::memory_order_relaxed);
+    return senderRank < limit || (senderRank == limit && receiverRank < limit);
+}
+
+void RelayServer::sendTo(Worker &worker, const char *data, int length, const Client &client, Route route, SendBatch &batch)
+{
+    if (batch.count == SendBatch::Capacity) {
+        flush(worker, batch, batch.receivedNs);
+    }
+    batch.append(data, length, client.address, client.ports[int(route)]);
+}
+
+void RelayServer::flush(Worker &worker, SendBatch &batch, qint64 receivedNs)
+{
+    int offset = 0;
+    while (offset < batch.count) {
+        const int sent = sendmmsg(worker.fd, batch.msgs + offset, unsigned(batch.count - offset), MSG_DONTWAIT);
+        worker.sendCalls.fetch_add(1, std::memory_order_relaxed);
+        if (sent <= 0) {
+            if (sent < 0 && errno == EINTR) continue;
+            // Буфер сокета полон: UDP-ретранслятор не ждёт, остаток теряется
+            worker.droppedPackets.fetch_add(batch.count - offset, std::memory_order_relaxed);
+            break;
+        }
+
+        qint64 bytes = 0;
+        for (int i = offset; i < offset + sent; ++i) {
+            bytes += qint64(batch.iovecs[i].iov_len);
+        }
+        worker.forwardedPackets.fetch_add(sent, std::memory_order_relaxed);
+        worker.forwardedBytes.fetch_add(bytes, std::memory_order_relaxed);
+        if (receivedNs > 0) {
+            worker.hopNs.fetch_add((monotonicNs() - receivedNs) * sent, std::memory_order_relaxed);
+            worker.hopPackets.fetch_add(sent, std::memory_order_relaxed);
+        }
+        offset += sent;
+    }
+    batch.count = 0;
+}
+
+void RelayServer::handleDiscover(Worker &worker, const QByteArray &datagram, const sockaddr_in &sender)
+{
+    Protocol::PacketHeader header;
+    Protocol::DiscoverInfo info;
+    if (!Protocol::readHeader(datagram, &header)
+        || !Protocol::readDiscoverPayload(Protocol::payloadOf(datagram), &info)) {
+        worker.droppedPackets.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    const quint32 address = ntohl(sender.sin_addr.s_addr);
+    const quint16 port = ntohs(sender.sin_port);
+    const qint64 now = monotonicMs();
+
+    SendBatch batch;
+    batch.receivedNs = monotonicNs();
+
+    std::unique_lock lock(m_mutex);
+
+    Client *client = nullptr;
+    for (Client *existing : std::as_const(m_clients)) {
+        if (existing->instanceId == info.instanceId) {
+            client = existing;
+            break;
+        }
+    }
+
+    Client *holder = m_clients.value(header.peerId, nullptr);
+    if (holder && holder != client) {
+        if (now - holder->lastSeenMs.load(std::memory_order_relaxed) < m_config.clientTimeoutMs) {
+            // Коллизия id: каждый видит DISCOVER другого, и участник с
+            // большим UUID выбирает новый id, как и без ретранслятора
+            sendTo(worker, datagram.constData(), int(datagram.size()), *holder, Route::Control, batch);
+            batch.append(holder->discover.constData(), int(holder->discover.size()), address, port);
+            flush(worker, batch, 0);
+            return;
+        }
+        m_clients.remove(holder->id);
+        emit logMessage(QString("Клиент %1 (#%2) вытеснен: id занят новым участником").arg(holder->nickname).arg(holder->id));
+        delete holder;
+    }
+
+    const bool joined = !client;
+    if (client) {
+        m_clients.remove(client->id);
+    } else {
+        client = new Client;
+        client->instanceId = info.instanceId;
+        client->joinOrder = m_nextJoinOrder++;
+        client->videoRank.store(int(m_clients.size()), std::memory_order_relaxed);
+    }
+    client->id = header.peerId;
+    client->nickname = info.nickname;
+    client->address = address;
+    client->ports[int(Route::Control)] = port;
+    client->ports[int(Route::Audio)] = info.audioPort != 0 ? info.audioPort : port;
+    client->ports[int(Route::Video)] = info.videoPort != 0 ? info.videoPort : port;
+    client->discover = datagram;
+    client->lastSeenMs.store(now, std::memory_order_relaxed);
+    m_clients.insert(client->id, client);
+
+    // Остальные ответят новичку DISCOVER_REPLY через ретранслятор
+    for (const Client *other : std::as_const(m_clients)) {
+        if (other != client) sendTo(worker, datagram.constData(), int(datagram.size()), *other, Route::Control, batch);
+    }
+    flush(worker, batch, 0);
+
+    if (joined) {
+        emit logMessage(QString("Подключился %1 (#%2, %3:%4), всего %5")
+                            .arg(info.nickname)
+                            .arg(header.peerId)
+                            .arg(QHostAddress(address).toString())
+                            .arg(port)
+                            .arg(m_clients.size()));
+    }
+}
+
+void RelayServer::updateVideoSelection()
+{
+    std::shared_lock lock(m_mutex);
+
+    // Активность - сглаженный объём аудио за период: с VBR-кодеком речь
+    // заметно крупнее тишины. При равенстве раньше пришедшие впереди
+    std::vector<Client *> ranking;
+    ranking.reserve(size_t(m_clients.size()));
+    for (Client *client : std::as_const(m_clients)) {
+        const qint64 bytes = client->audioBytes.load(std::memory_order_relaxed);
+        client->activity = 0.7 * client->activity + 0.3 * double(bytes - client->reportedAudioBytes);
+        client->reportedAudioBytes = bytes;
+        ranking.push_back(client);
+    }
+    std::sort(ranking.begin(), ranking.end(), [](const Client *a, const Client *b) {
+        if (a->activity != b->activity) return a->activity > b->activity;
+        return a->joinOrder < b->joinOrder;
+    });
+    for (size_t i = 0; i < ranking.size(); ++i) {
+        ranking[i]->videoRank.store(int(i), std::memory_order_relaxed);
+    }
+}
+
+void RelayServer::expireClients()
+{
+    const qint64 now = monotonicMs();
+
+    std::unique_lock lock(m_mutex);
+    const QList<quint16> ids = m_clients.keys();
+    for (quint16 id : ids) {
+        Client *client = m_clients.value(id);
+        if (now - client->lastSeenMs.load(std::memory_order_relaxed) < m_config.clientTimeoutMs) continue;
+
+        m_clients.remove(id);
+        emit logMessage(QString("Клиент %1 (#%2) отключён по таймауту, осталось %3")
+                            .arg(client->nickname)
+                            .arg(id)
+                            .arg(m_clients.size()));
+        delete client;
+    }
+}
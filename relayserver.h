@@ -0,0 +1,144 @@
+#ifndef RELAYSERVER_H
+#define RELAYSERVER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QHostAddress>
+#include <QString>
+#include <QUuid>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include "protocol.h"
+
+struct sockaddr_in;
+
+// Ретранслятор (SFU) для звонков на много участников.
+//
+// Клиенты шлют всё на один адрес ретранслятора (CallSession с useRelay),
+// а он раздаёт пакеты остальным, не разбирая медиа: каждый клиент
+// отправляет один поток вместо N-1. Маршрут выбирается по заголовку:
+// аудио, KEEPALIVE и сообщения - всем, адресные управляющие пакеты - по
+// peerId адресата в timestamp, повторы видео - тем, кто их запросил в NACK.
+// Видео каждому получателю идёт только от maxVideoStreams самых активных
+// (по объёму аудио) участников, кроме него самого.
+//
+// Ядро - потоки с epoll: у каждого свой сокет на общем порту
+// (SO_REUSEPORT), ядро раскладывает клиентов по потокам по адресу.
+// Датаграммы читаются пачкой recvmmsg и уходят пачкой sendmmsg прямо из
+// буфера приёма, без копирования. Таблица клиентов под shared_mutex:
+// пересылка только читает её, меняют DISCOVER и таймаут.
+class RelayServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Config
+    {
+        quint16 port = 45454;
+        int threads = 0;                 // 0 - по числу ядер
+        int maxVideoStreams = 4;         // 0 - пересылать всё видео
+        int clientTimeoutMs = 10000;
+    };
+
+    struct Stats
+    {
+        int clients = 0;
+        qint64 receivedPackets = 0;
+        qint64 forwardedPackets = 0;
+        qint64 forwardedBytes = 0;
+        qint64 droppedPackets = 0;       // неизвестный отправитель, переполнение сокета
+        qint64 receiveCalls = 0;
+        qint64 sendCalls = 0;
+        qint64 hopNs = 0;                // сумма времени от приёма до отправки
+        qint64 hopPackets = 0;
+    };
+
+    explicit RelayServer(const Config &config, QObject *parent = nullptr);
+    ~RelayServer();
+
+    bool start();
+    void stop();
+    QString errorString() const { return m_error; }
+    int threadCount() const { return int(m_workers.size()); }
+
+    Stats stats() const;
+
+    // Вызываются периодически из потока владельца: выбор пересылаемого
+    // видео по активности и удаление молчащих клиентов
+    void updateVideoSelection();
+    void expireClients();
+
+signals:
+    void logMessage(const QString &message);
+
+private:
+    enum class Route { Audio, Control, Video };
+
+    struct Client
+    {
+        quint16 id = 0;
+        QUuid instanceId;
+        QString nickname;
+        quint32 address = 0;             // IPv4, порядок хоста
+        quint16 ports[3] = {};           // по Route
+        QByteArray discover;             // последний DISCOVER целиком
+        qint64 joinOrder = 0;
+        std::atomic<qint64> lastSeenMs{0};
+
+        // Активность - байты аудио; считает поток пересылки, ранжирует владелец
+        std::atomic<qint64> audioBytes{0};
+        qint64 reportedAudioBytes = 0;
+        double activity = 0.0;
+        std::atomic<int> videoRank{0};
+
+        // Кто запрашивал повтор: sequence видео этого клиента -> получатели
+        std::mutex nackMutex;
+        QHash<quint32, QList<quint16>> nackRequests;
+    };
+
+    struct alignas(64) Worker
+    {
+        int fd = -1;
+        int epollFd = -1;
+        int wakeFd = -1;
+        std::thread thread;
+
+        std::atomic<qint64> receivedPackets{0};
+        std::atomic<qint64> forwardedPackets{0};
+        std::atomic<qint64> forwardedBytes{0};
+        std::atomic<qint64> droppedPackets{0};
+        std::atomic<qint64> receiveCalls{0};
+        std::atomic<qint64> sendCalls{0};
+        std::atomic<qint64> hopNs{0};
+        std::atomic<qint64> hopPackets{0};
+    };
+
+    // Пачка на отправку: указатели в буфер приёма и адреса клиентов
+    struct SendBatch;
+
+    void run(Worker &worker);
+    void receive(Worker &worker, std::vector<char> &buffers, SendBatch &batch);
+    void forward(Worker &worker, const char *data, int length, quint32 senderAddress, SendBatch &batch);
+    void handleDiscover(Worker &worker, const QByteArray &datagram, const sockaddr_in &sender);
+    void flush(Worker &worker, SendBatch &batch, qint64 receivedNs);
+    void sendTo(Worker &worker, const char *data, int length, const Client &client, Route route, SendBatch &batch);
+    bool wantsVideo(const Client &receiver, const Client &sender) const;
+    static qint64 monotonicMs();
+    static qint64 monotonicNs();
+
+    Config m_config;
+    QString m_error;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<bool> m_running{false};
+
+    mutable std::shared_mutex m_mutex;
+    QHash<quint16, Client *> m_clients;
+    qint64 m_nextJoinOrder = 0;
+};
+
+#endif // RELAYSERVER_H
@@ -0,0 +1,158 @@
+#include "sendscheduler.h"
+#include "protocol.h"
+#include <QMutexLocker>
+
+namespace {
+
+// Очередь класса не растёт дальше: старые пакеты вытесняются новыми
+constexpr int MaxQueuePackets = 2048;
+// Ведро вмещает столько времени отправки на текущей скорости,
+// но не меньше пары полноразмерных датаграмм
+constexpr qint64 BurstUs = 5000;
+constexpr double MinBurstBytes = 2 * 1500;
+
+}
+
+SendScheduler::Class SendScheduler::classify(QByteArrayView datagram)
+{
+    Protocol::PacketHeader header;
+    if (!Protocol::readHeader(datagram, &header)) return Class::Control;
+
+    switch (header.type) {
+    case Protocol::PacketType::Audio:
+        return Class::Audio;
+    case Protocol::PacketType::Video:
+        return Class::Video;
+    case Protocol::PacketType::Retransmission:
+        return Class::Retransmission;
+    case Protocol::PacketType::Fec: {
+        // Чётность идёт с приоритетом своего потока
+        const QByteArrayView payload = Protocol::payloadOf(datagram);
+        if (!payload.isEmpty() && quint8(payload.at(0)) == quint8(Protocol::MediaStream::Audio)) {
+            return Class::Audio;
+        }
+        return Class::Video;
+    }
+    case Protocol::PacketType::Bundle: {
+        // Очередь - по первому вложенному пакету: управление, попутное
+        // аудио, идёт с приоритетом аудио
+        const QByteArrayView payload = Protocol::payloadOf(datagram);
+        qsizetype offset = 0;
+        QByteArrayView first;
+        if (Protocol::nextBundledPacket(payload, &offset, &first)
+            && quint8(first.at(1)) != quint8(Protocol::PacketType::Bundle)) {
+            return classify(first);
+        }
+        return Class::Control;
+    }
+    default:
+        return Class::Control;
+    }
+}
+
+void SendScheduler::enqueue(OutgoingPacket &&packet)
+{
+    const int cls = int(classify(packet.datagram));
+    packet.sendClass = quint8(cls);
+    QQueue<OutgoingPacket> &queue = m_queues[cls];
+
+    QMutexLocker locker(&m_statsMutex);
+    ClassStats &stats = m_stats[cls];
+    while (queue.size() >= MaxQueuePackets) {
+        stats.queuedPackets--;
+        stats.queuedBytes -= queue.head().datagram.size();
+        stats.droppedPackets++;
+        queue.dequeue();
+    }
+    stats.queuedPackets++;
+    stats.queuedBytes += packet.datagram.size();
+    queue.enqueue(std::move(packet));
+}
+
+bool SendScheduler::next(qint64 nowUs, OutgoingPacket *packet)
+{
+    refill(nowUs);
+
+    for (int cls = 0; cls < int(Class::Count); ++cls) {
+        QQueue<OutgoingPacket> &queue = m_queues[cls];
+        if (queue.isEmpty()) continue;
+
+        // Классы ниже тоже темпируются - ждать будут все
+        if (isPaced(Class(cls)) && m_pacingRate > 0 && m_budgetBytes < 0.0) return false;
+
+        *packet = queue.dequeue();
+        const qsizetype size = packet->datagram.size();
+        if (m_pacingRate > 0) {
+            // Долг от внеочередных пакетов ограничен, чтобы видео не стояло долго
+            m_budgetBytes = qMax(m_budgetBytes - size, -maxBudgetBytes());
+        }
+
+        const double delayMs = (nowUs - packet->enqueuedUs) / 1000.0;
+        QMutexLocker locker(&m_statsMutex);
+        ClassStats &stats = m_stats[cls];
+        stats.queuedPackets--;
+        stats.queuedBytes -= size;
+        stats.sentPackets++;
+        stats.averageDelayMs += (delayMs - stats.averageDelayMs) / 16.0;
+        stats.peakDelayMs = qMax(stats.peakDelayMs, delayMs);
+        return true;
+    }
+    return false;
+}
+
+bool SendScheduler::isEmpty() const
+{
+    for (const QQueue<OutgoingPacket> &queue : m_queues) {
+        if (!queue.isEmpty()) return false;
+    }
+    return true;
+}
+
+qint64 SendScheduler::nextSendTimeUs(qint64 nowUs) const
+{
+    if (isEmpty()) return -1;
+    if (m_pacingRate <= 0 || m_budgetBytes >= 0.0) return nowUs;
+
+    // Баланс вернётся к нулю
+    return m_lastRefillUs + qint64(-m_budgetBytes * 8.0 * 1000000.0 / m_pacingRate) + 1;
+}
+
+void SendScheduler::setPacingRate(qint64 bitsPerSecond)
+{
+    m_pacingRate = qMax<qint64>(0, bitsPerSecond);
+}
+
+SendScheduler::ClassStats SendScheduler::takeStats(Class cls)
+{
+    QMutexLocker locker(&m_statsMutex);
+    ClassStats stats = m_stats[int(cls)];
+    m_stats[int(cls)].peakDelayMs = 0.0;
+    return stats;
+}
+
+void SendScheduler::clear()
+{
+    QMutexLocker locker(&m_statsMutex);
+    for (int cls = 0; cls < int(Class::Count); ++cls) {
+        m_stats[cls].droppedPackets += m_queues[cls].size();
+        m_stats[cls].queuedPackets = 0;
+        m_stats[cls].queuedBytes = 0;
+        m_queues[cls].clear();
+    }
+    m_budgetBytes = 0.0;
+    m_lastRefillUs = 0;
+}
+
+void SendScheduler::refill(qint64 nowUs)
+{
+    if (m_pacingRate > 0 && m_lastRefillUs != 0) {
+        m_budgetBytes += double(nowUs - m_lastRefillUs) * m_pacingRate / 8.0 / 1000000.0;
+        m_budgetBytes = qMin(m_budgetBytes, maxBudgetBytes());
+    }
+    m_lastRefillUs = nowUs;
+}
+
+double SendScheduler::maxBudgetBytes() const
+{
+    return qMax(MinBurstBytes, m_pacingRate / 8.0 * BurstUs / 1000000.0);
+}
@@ -0,0 +1,76 @@
+#ifndef SENDSCHEDULER_H
+#define SENDSCHEDULER_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QHostAddress>
+#include <QMutex>
+#include <QQueue>
+#include <QtGlobal>
+
+struct OutgoingPacket
+{
+    QByteArray datagram;
+    QHostAddress address;
+    quint16 port = 0;
+    qint64 enqueuedUs = 0;   // NetworkEngine::monotonicUs() при постановке в очередь
+    quint8 sendClass = 0;    // SendScheduler::Class, заполняет планировщик
+};
+
+// Очереди отправки со строгим приоритетом и темпированием.
+//
+// Пакеты раскладываются по классам по типу: аудио, управление, повторы
+// видео, видео. Следующим всегда уходит пакет самого приоритетного
+// непустого класса, поэтому аудио не ждёт за фрагментами большого кадра.
+// Темп задаёт ведро токенов: видео и повторы уходят только при
+// неотрицательном балансе, аудио и управление - сразу, но тоже тратят
+// токены, так что общий поток держится около заданной скорости.
+//
+// Планировщик работает в сетевом потоке; stats() можно звать из любого.
+class SendScheduler
+{
+public:
+    enum class Class { Audio, Control, Retransmission, Video, Count };
+
+    struct ClassStats
+    {
+        int queuedPackets = 0;
+        qint64 queuedBytes = 0;
+        qint64 sentPackets = 0;
+        qint64 droppedPackets = 0;
+        double averageDelayMs = 0.0;   // сглаженное время в очереди
+        double peakDelayMs = 0.0;      // максимум с прошлого takeStats()
+    };
+
+    static Class classify(QByteArrayView datagram);
+
+    void enqueue(OutgoingPacket &&packet);
+
+    // Следующий пакет, который можно отправить сейчас
+    bool next(qint64 nowUs, OutgoingPacket *packet);
+    bool isEmpty() const;
+    // Когда темп позволит отправить ожидающий пакет; -1 - ждать нечего
+    qint64 nextSendTimeUs(qint64 nowUs) const;
+
+    void setPacingRate(qint64 bitsPerSecond);
+    qint64 pacingRate() const { return m_pacingRate; }
+
+    ClassStats takeStats(Class cls);
+
+    void clear();
+
+private:
+    static bool isPaced(Class cls) { return cls == Class::Retransmission || cls == Class::Video; }
+    void refill(qint64 nowUs);
+    double maxBudgetBytes() const;
+
+    QQueue<OutgoingPacket> m_queues[int(Class::Count)];
+    qint64 m_pacingRate = 0;   // 0 - без темпирования
+    double m_budgetBytes = 0.0;
+    qint64 m_lastRefillUs = 0;
+
+    mutable QMutex m_statsMutex;
+    ClassStats m_stats[int(Class::Count)];
+};
+
+#endif // SENDSCHEDULER_H
@@ -0,0 +1,141 @@
+#include "streamstats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace StreamStats {
+
+quint32 compactTime(qint64 us)
+{
+    return quint32((us / 1000000) * 65536 + (us % 1000000) * 65536 / 1000000);
+}
+
+}
+
+ReceiverStatistics::ReceiverStatistics(int clockRate)
+    : m_clockRate(qMax(1, clockRate))
+{
+}
+
+void ReceiverStatistics::setClockRate(int clockRate)
+{
+    m_clockRate = qMax(1, clockRate);
+    clear();
+}
+
+void ReceiverStatistics::onPacket(quint32 sequence, quint32 timestamp, qint64 arrivalUs)
+{
+    if (m_received == 0) {
+        m_baseSequence = sequence;
+        m_maxSequence = sequence;
+    } else {
+        const qint64 seq = m_maxSequence + qint32(sequence - quint32(m_maxSequence));
+        if (seq > m_maxSequence) {
+            m_maxSequence = seq;
+        } else if (seq < m_baseSequence) {
+            // Пришёл пакет старше первого - он тоже ожидался
+            m_baseSequence = seq;
+        }
+    }
+    ++m_received;
+
+    // Джиттер по RFC 3550, 6.4.1: сглаженное отклонение времени в пути
+    const double arrival = double(arrivalUs) * m_clockRate / 1000000.0;
+    const double transit = arrival - double(timestamp);
+    if (m_hasTransit) {
+        // timestamp 32-битный: разность берём по модулю
+        double d = transit - m_transit;
+        const double wrap = 4294967296.0;
+        d = std::remainder(d, wrap);
+        m_jitter += (std::fabs(d) - m_jitter) / 16.0;
+    }
+    m_hasTransit = true;
+    m_transit = transit;
+}
+
+void ReceiverStatistics::onSenderReport(const Protocol::SenderReport &report, qint64 arrivalUs)
+{
+    m_hasSenderReport = true;
+    m_lastSenderReport = report.sendTime;
+    m_lastSenderReportArrivalUs = arrivalUs;
+}
+
+Protocol::ReceiverReport ReceiverStatistics::makeReport(Protocol::MediaStream stream, qint64 nowUs)
+{
+    Protocol::ReceiverReport report;
+    report.stream = stream;
+
+    const qint64 expectedNow = expected();
+    const qint64 expectedInterval = expectedNow - m_expectedPrior;
+    const qint64 receivedInterval = m_received - m_receivedPrior;
+    const qint64 lostInterval = expectedInterval - receivedInterval;
+    m_expectedPrior = expectedNow;
+    m_receivedPrior = m_received;
+
+    if (expectedInterval > 0 && lostInterval > 0) {
+        report.fractionLost = quint8(qMin<qint64>(255, (lostInterval << 8) / expectedInterval));
+    }
+    report.cumulativeLost = qint32(std::clamp<qint64>(cumulativeLost(), INT32_MIN, INT32_MAX));
+    report.highestSequence = quint32(m_maxSequence);
+    report.jitterUs = quint32(qMin(jitterMs() * 1000.0, 4294967295.0));
+
+    if (m_hasSenderReport) {
+        report.lastSenderReport = m_lastSenderReport;
+        report.delaySinceLastSenderReport = StreamStats::compactTime(nowUs - m_lastSenderReportArrivalUs);
+    }
+    return report;
+}
+
+double ReceiverStatistics::lossPercent() const
+{
+    const qint64 expectedNow = expected();
+    if (expectedNow <= 0) return 0.0;
+    return qMax<qint64>(0, cumulativeLost()) * 100.0 / expectedNow;
+}
+
+void ReceiverStatistics::clear()
+{
+    const int clockRate = m_clockRate;
+    *this = ReceiverStatistics(clockRate);
+}
+
+void SenderStatistics::onPacketSent(int bytes)
+{
+    ++m_packetCount;
+    m_octetCount += quint32(bytes);
+}
+
+Protocol::SenderReport SenderStatistics::makeReport(Protocol::MediaStream stream, qint64 nowUs) const
+{
+    Protocol::SenderReport report;
+    report.stream = stream;
+    report.sendTime = StreamStats::compactTime(nowUs);
+    report.packetCount = m_packetCount;
+    report.octetCount = m_octetCount;
+    return report;
+}
+
+void SenderStatistics::onReceiverReport(const Protocol::ReceiverReport &report, qint64 nowUs)
+{
+    m_hasReport = true;
+    m_fractionLost = report.fractionLost / 256.0;
+    m_cumulativeLost = report.cumulativeLost;
+    m_highestSequence = report.highestSequence;
+    m_remoteJitterMs = report.jitterUs / 1000.0;
+
+    // RTT = сейчас - время нашего SR - задержка на стороне получателя;
+    // все три в компактном времени, переполнение снимается беззнаковой разностью
+    if (report.lastSenderReport == 0) return;
+    const quint32 rtt = StreamStats::compactTime(nowUs) - report.lastSenderReport
+                        - report.delaySinceLastSenderReport;
+    if (rtt > 65536u * 60) return;   // больше минуты - мусор
+
+    const double rttMs = rtt * 1000.0 / 65536.0;
+    m_rttMs = m_hasRtt ? 0.875 * m_rttMs + 0.125 * rttMs : rttMs;
+    m_hasRtt = true;
+}
+
+void SenderStatistics::clear()
+{
+    *this = SenderStatistics();
+}
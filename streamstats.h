@@ -0,0 +1,94 @@
+#ifndef STREAMSTATS_H
+#define STREAMSTATS_H
+
+#include <QtGlobal>
+#include "protocol.h"
+
+// Статистика медиапотоков для SENDER_REPORT/RECEIVER_REPORT (RFC 3550).
+//
+// ReceiverStatistics ведётся получателем по каждому входящему потоку:
+// ожидаемое и полученное число пакетов, потери (накопленные и доля с
+// прошлого отчёта), межпакетный джиттер. SenderStatistics - у отправителя:
+// счётчики отправленного и последнее, что сообщил о потоке получатель,
+// включая RTT по эху времени SR.
+
+namespace StreamStats {
+// Компактное время: 1/65536 с, младшие 32 бита
+quint32 compactTime(qint64 us);
+}
+
+class ReceiverStatistics
+{
+public:
+    // clockRate - единиц timestamp в секунду
+    explicit ReceiverStatistics(int clockRate = 1000);
+
+    void setClockRate(int clockRate);
+
+    void onPacket(quint32 sequence, quint32 timestamp, qint64 arrivalUs);
+    void onSenderReport(const Protocol::SenderReport &report, qint64 arrivalUs);
+
+    bool hasPackets() const { return m_received > 0; }
+    Protocol::ReceiverReport makeReport(Protocol::MediaStream stream, qint64 nowUs);
+
+    qint64 received() const { return m_received; }
+    qint64 expected() const { return m_received > 0 ? m_maxSequence - m_baseSequence + 1 : 0; }
+    qint64 cumulativeLost() const { return expected() - m_received; }
+    double lossPercent() const;
+    double jitterMs() const { return m_jitter * 1000.0 / m_clockRate; }
+
+    void clear();
+
+private:
+    int m_clockRate;
+
+    qint64 m_baseSequence = 0;
+    qint64 m_maxSequence = 0;    // развёрнутый
+    qint64 m_received = 0;
+    qint64 m_expectedPrior = 0;
+    qint64 m_receivedPrior = 0;
+
+    bool m_hasTransit = false;
+    double m_transit = 0.0;
+    double m_jitter = 0.0;       // в единицах timestamp
+
+    bool m_hasSenderReport = false;
+    quint32 m_lastSenderReport = 0;
+    qint64 m_lastSenderReportArrivalUs = 0;
+};
+
+class SenderStatistics
+{
+public:
+    void onPacketSent(int bytes);
+
+    bool hasSent() const { return m_packetCount > 0; }
+    Protocol::SenderReport makeReport(Protocol::MediaStream stream, qint64 nowUs) const;
+
+    void onReceiverReport(const Protocol::ReceiverReport &report, qint64 nowUs);
+
+    // То, что сообщил получатель
+    bool hasReport() const { return m_hasReport; }
+    bool hasRtt() const { return m_hasRtt; }
+    double rttMs() const { return m_rttMs; }
+    double fractionLost() const { return m_fractionLost; }
+    qint64 cumulativeLost() const { return m_cumulativeLost; }
+    quint32 highestSequence() const { return m_highestSequence; }
+    double remoteJitterMs() const { return m_remoteJitterMs; }
+
+    void clear();
+
+private:
+    quint32 m_packetCount = 0;
+    quint32 m_octetCount = 0;
+
+    bool m_hasReport = false;
+    bool m_hasRtt = false;
+    double m_rttMs = 0.0;
+    double m_fractionLost = 0.0;
+    qint64 m_cumulativeLost = 0;
+    quint32 m_highestSequence = 0;
+    double m_remoteJitterMs = 0.0;
+};
+
+#endif // STREAMSTATS_H
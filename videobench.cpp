@@ -0,0 +1,168 @@
+#include "benchutil.h"
+#include "videodecoder.h"
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QImage>
+
+// Декодирование входящих JPEG-кадров под окно показа: прежний путь
+// (QImage::loadFromData целиком, затем scaled() с SmoothTransformation)
+// против VideoDecoder::decodeScaled (уменьшение 1/2, 1/4, 1/8 при
+// декодировании и досжатие маленького изображения). Кадры - JPEG-файлы
+// из --frames, записанные, например, из звонка; без --frames кадры
+// синтезируются. Задержка кадра (средняя и 95-й перцентиль) и процессор на
+// кадр для каждого размера окна.
+//
+//   AuthoLASTVLADIOVideoBench --frames ~/recorded --targets 640x360,320x180
+
+namespace {
+
+constexpr int SyntheticFrames = 60;
+
+using Bench::out;
+
+QList<QByteArray> loadFrames(const QString &path)
+{
+    QList<QByteArray> frames;
+    const QDir dir(path);
+    const QStringList names = dir.entryList({ "*.jpg", "*.jpeg" }, QDir::Files, QDir::Name);
+    for (const QString &name : names) {
+        QFile file(dir.filePath(name));
+        if (file.open(QIODevice::ReadOnly)) {
+            frames.append(file.readAll());
+        }
+    }
+    return frames;
+}
+
+// Градиенты и движущиеся полосы: JPEG с деталями, как у кадра с камеры
+QList<QByteArray> makeFrames(const QSize &size, int quality)
+{
+    QList<QByteArray> frames;
+    QImage image(size, QImage::Format_RGB32);
+    for (int f = 0; f < SyntheticFrames; ++f) {
+        for (int y = 0; y < size.height(); ++y) {
+            auto *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+            for (int x = 0; x < size.width(); ++x) {
+                const int stripe = ((x + f * 8) / 16 + y / 16) % 2 ? 60 : 0;
+                line[x] = qRgb((x * 255 / size.width() + stripe) % 256, (y * 255 / size.height()) % 256,
+                               (x ^ y ^ f) & 0xff);
+            }
+        }
+        QByteArray jpeg;
+        QBuffer buffer(&jpeg);
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, "JPEG", quality);
+        frames.append(jpeg);
+    }
+    return frames;
+}
+
+QSize parseSize(const QString &text)
+{
+    const QStringList parts = text.split('x');
+    if (parts.size() != 2) return QSize();
+    return QSize(parts.at(0).toInt(), parts.at(1).toInt());
+}
+
+struct Result
+{
+    double meanUs = 0.0;
+    double p95Us = 0.0;
+    double cpuUs = 0.0;   // на кадр
+    QSize outputSize;
+};
+
+// Каждый кадр по очереди, пока не наберётся rounds проходов
+template <typename Decode>
+Result measure(const QList<QByteArray> &frames, int rounds, Decode &&decode)
+{
+    Result result;
+    const Bench::Latency latency = Bench::latency(frames.size() * rounds, [&](qsizetype i) {
+        result.outputSize = decode(frames.at(i % frames.size())).size();
+    });
+    result.meanUs = latency.meanNs / 1e3;
+    result.p95Us = latency.p95Ns / 1e3;
+    result.cpuUs = latency.cpuNs / 1e3;
+    return result;
+}
+
+void print(const char *name, const Result &result)
+{
+    out() << QString("  %1: %2x%3, задержка %4 мс (95% - %5 мс), процессор %6 мс/кадр")
+                 .arg(name)
+                 .arg(result.outputSize.width())
+                 .arg(result.outputSize.height())
+                 .arg(result.meanUs / 1e3, 0, 'f', 2)
+                 .arg(result.p95Us / 1e3, 0, 'f', 2)
+                 .arg(result.cpuUs / 1e3, 0, 'f', 2)
+          << Qt::endl;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    Bench::prepare(parser, "AuthoLASTVLADIOVideoBench",
+                   "Декодирование JPEG-кадров под окно: целиком и scaled()"
+                   " против уменьшения при декодировании");
+    const QCommandLineOption framesOption("frames", "Каталог с записанными JPEG-кадрами.", "dir");
+    const QCommandLineOption sourceOption("source-size", "Размер синтетических кадров.", "WxH", "1280x720");
+    const QCommandLineOption qualityOption("quality", "Качество синтетических кадров.", "0-100", "80");
+    const QCommandLineOption targetsOption("targets", "Размеры окна показа через запятую.", "WxH,...",
+                                           "1280x720,640x360,320x180");
+    const QCommandLineOption roundsOption("rounds", "Проходов по кадрам.", "count", "3");
+    parser.addOptions({ framesOption, sourceOption, qualityOption, targetsOption, roundsOption });
+    parser.process(app);
+
+    QList<QByteArray> frames;
+    if (parser.isSet(framesOption)) {
+        frames = loadFrames(parser.value(framesOption));
+    } else {
+        const QSize source = parseSize(parser.value(sourceOption));
+        if (source.isValid() && !source.isEmpty()) {
+            frames = makeFrames(source, qBound(1, parser.value(qualityOption).toInt(), 100));
+        }
+    }
+    if (frames.isEmpty()) {
+        out() << "Ошибка: нет кадров для декодирования" << Qt::endl;
+        return 1;
+    }
+
+    QImage first;
+    first.loadFromData(frames.first(), "JPEG");
+    qint64 bytes = 0;
+    for (const QByteArray &jpeg : frames) {
+        bytes += jpeg.size();
+    }
+    out() << QString("Кадров %1, %2x%3, в среднем %4 КБ")
+                 .arg(frames.size())
+                 .arg(first.width())
+                 .arg(first.height())
+                 .arg(double(bytes) / frames.size() / 1024, 0, 'f', 1)
+          << Qt::endl;
+
+    const int rounds = qMax(1, parser.value(roundsOption).toInt());
+    const QStringList targets = parser.value(targetsOption).split(',', Qt::SkipEmptyParts);
+    for (const QString &text : targets) {
+        const QSize target = parseSize(text);
+        if (!target.isValid() || target.isEmpty()) continue;
+
+        // Прежний путь из processVideoPacket, без QPixmap::fromImage: ему нужен GUI
+        const Result legacy = measure(frames, rounds, [&](const QByteArray &jpeg) {
+            QImage image;
+            image.loadFromData(jpeg, "JPEG");
+            return image.scaled(target, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        });
+        const Result scaled = measure(frames, rounds, [&](const QByteArray &jpeg) {
+            return VideoDecoder::decodeScaled(jpeg, target);
+        });
+
+        out() << QString("Окно %1x%2:").arg(target.width()).arg(target.height()) << Qt::endl;
+        print("целиком + scaled()    ", legacy);
+        print("уменьшение в декодере ", scaled);
+    }
+    return 0;
+}
@@ -0,0 +1,265 @@
+#include "videodecoder.h"
+#include <QBuffer>
+#include <QImageReader>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+
+#ifdef HAVE_LIBJPEG
+#include <cstdio>
+#include <csetjmp>
+#include <jpeglib.h>
+#endif
+
+namespace {
+
+QSize fitSize(const QSize &source, const QSize &target)
+{
+    if (!target.isValid() || target.isEmpty()) return source;
+    return source.scaled(target, Qt::KeepAspectRatio);
+}
+
+// Наибольший делитель из 8, 4, 2, 1, при котором уменьшенный кадр ещё не
+// меньше итогового размера показа
+int scaleDenominator(const QSize &source, const QSize &fitted)
+{
+    for (int denom = 8; denom > 1; denom /= 2) {
+        if (source.width() / denom >= fitted.width()
+            && source.height() / denom >= fitted.height()) {
+            return denom;
+        }
+    }
+    return 1;
+}
+
+#ifdef HAVE_LIBJPEG
+struct JpegErrorManager
+{
+    jpeg_error_mgr base;
+    std::jmp_buf jump;
+};
+
+void jpegErrorExit(j_common_ptr cinfo)
+{
+    std::longjmp(reinterpret_cast<JpegErrorManager *>(cinfo->err)->jump, 1);
+}
+
+void jpegSilentMessage(j_common_ptr)
+{
+}
+
+QImage decodeWithLibjpeg(const QByteArray &jpeg, const QSize &target)
+{
+    QImage image;
+    jpeg_decompress_struct cinfo;
+    JpegErrorManager error;
+
+    cinfo.err = jpeg_std_error(&error.base);
+    error.base.error_exit = jpegErrorExit;
+    error.base.output_message = jpegSilentMessage;
+
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        return QImage();
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, reinterpret_cast<unsigned char *>(const_cast<char *>(jpeg.constData())),
+                 static_cast<unsigned long>(jpeg.size()));
+    jpeg_read_header(&cinfo, TRUE);
+
+    const QSize source(int(cinfo.image_width), int(cinfo.image_height));
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = unsigned(scaleDenominator(source, fitSize(source, target)));
+    cinfo.dct_method = JDCT_ISLOW;
+#if defined(JCS_EXTENSIONS) && Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    cinfo.out_color_space = JCS_EXT_BGRX;
+    const QImage::Format format = QImage::Format_RGB32;
+#else
+    cinfo.out_color_space = JCS_RGB;
+    const QImage::Format format = QImage::Format_RGB888;
+#endif
+
+    jpeg_start_decompress(&cinfo);
+    image = QImage(int(cinfo.output_width), int(cinfo.output_height), format);
+    if (image.isNull()) {
+        jpeg_destroy_decompress(&cinfo);
+        return QImage();
+    }
+
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = image.scanLine(int(cinfo.output_scanline));
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return image;
+}
+#endif
+
+// Запасной путь: JPEG-плагин Qt тоже умеет уменьшать при декодировании,
+// если задать scaledSize
+QImage decodeWithQt(const QByteArray &jpeg, const QSize &target)
+{
+    QByteArray data(jpeg);
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    QImageReader reader(&buffer, "JPEG");
+    const QSize source = reader.size();
+    if (source.isValid()) {
+        const int denom = scaleDenominator(source, fitSize(source, target));
+        if (denom > 1) {
+            reader.setScaledSize(QSize(source.width() / denom, source.height() / denom));
+        }
+    }
+    return reader.read();
+}
+
+} // namespace
+
+VideoDecoder::VideoDecoder(QObject *parent)
+    : QObject(parent)
+{
+    m_thread.setObjectName("VideoDecoder");
+}
+
+VideoDecoder::~VideoDecoder()
+{
+    stop();
+}
+
+void VideoDecoder::start()
+{
+    if (m_worker) return;
+
+    m_worker = new QObject;
+    m_worker->moveToThread(&m_thread);
+    m_thread.start();
+}
+
+void VideoDecoder::stop()
+{
+    if (!m_worker) return;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_hasPending = false;
+        m_pendingJpeg.clear();
+    }
+
+    m_thread.quit();
+    m_thread.wait();
+    delete m_worker;
+    m_worker = nullptr;
+
+    QMutexLocker locker(&m_mutex);
+    m_busy = false;
+    m_hasReady = false;
+    m_readyFrame = QImage();
+}
+
+void VideoDecoder::submit(const QByteArray &jpeg)
+{
+    bool wake = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_worker) return;
+
+        if (m_hasPending) {
+            m_droppedFrames.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_pendingJpeg = jpeg;
+        m_hasPending = true;
+
+        wake = !m_busy;
+        m_busy = true;
+    }
+
+    if (wake) {
+        QMetaObject::invokeMethod(m_worker, [this]() { processPending(); }, Qt::QueuedConnection);
+    }
+}
+
+void VideoDecoder::setTargetSize(const QSize &size)
+{
+    QMutexLocker locker(&m_mutex);
+    m_targetSize = size;
+}
+
+bool VideoDecoder::takeFrame(QImage *image)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_hasReady) return false;
+
+    *image = std::move(m_readyFrame);
+    m_readyFrame = QImage();
+    m_hasReady = false;
+    return true;
+}
+
+double VideoDecoder::averageDecodeUs() const
+{
+    const qint64 frames = m_decodedFrames.load(std::memory_order_relaxed);
+    if (frames == 0) return 0.0;
+    return double(m_totalDecodeUs.load(std::memory_order_relaxed)) / double(frames);
+}
+
+QImage VideoDecoder::decodeScaled(const QByteArray &jpeg, const QSize &target)
+{
+    QImage image;
+#ifdef HAVE_LIBJPEG
+    image = decodeWithLibjpeg(jpeg, target);
+#endif
+    if (image.isNull()) {
+        image = decodeWithQt(jpeg, target);
+    }
+    if (image.isNull()) return image;
+
+    // Досжатие до точного размера уже на маленьком изображении
+    const QSize fitted = fitSize(image.size(), target);
+    if (fitted != image.size()) {
+        image = image.scaled(fitted, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    return image;
+}
+
+void VideoDecoder::processPending()
+{
+    for (;;) {
+        QByteArray jpeg;
+        QSize target;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (!m_hasPending) {
+                m_busy = false;
+                return;
+            }
+            jpeg = std::move(m_pendingJpeg);
+            m_pendingJpeg = QByteArray();
+            m_hasPending = false;
+            target = m_targetSize;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        QImage image = decodeScaled(jpeg, target);
+        if (image.isNull()) continue;
+
+        m_totalDecodeUs.fetch_add(timer.nsecsElapsed() / 1000, std::memory_order_relaxed);
+        m_decodedFrames.fetch_add(1, std::memory_order_relaxed);
+
+        bool notify = false;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_hasReady) {
+                m_droppedFrames.fetch_add(1, std::memory_order_relaxed);
+            }
+            m_readyFrame = std::move(image);
+            notify = !m_hasReady;
+            m_hasReady = true;
+        }
+
+        if (notify) emit frameReady();
+    }
+}
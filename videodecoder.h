@@ -0,0 +1,68 @@
+#ifndef VIDEODECODER_H
+#define VIDEODECODER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+#include <QMutex>
+#include <QThread>
+#include <atomic>
+
+// Декодирование входящих JPEG-кадров в отдельном потоке.
+//
+// Если окно показа меньше кадра, JPEG декодируется сразу в уменьшенном
+// виде (1/2, 1/4, 1/8 средствами libjpeg-turbo), чтобы не распаковывать
+// пиксели, которые потом всё равно будут выброшены при масштабировании.
+// И на входе, и на выходе по одному слоту: новый кадр вытесняет
+// необработанный старый, GUI забирает последний готовый через takeFrame().
+class VideoDecoder : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit VideoDecoder(QObject *parent = nullptr);
+    ~VideoDecoder();
+
+    void start();
+    void stop();
+
+    void submit(const QByteArray &jpeg);
+    void setTargetSize(const QSize &size);
+
+    // Забрать последний декодированный кадр, false если слот пуст
+    bool takeFrame(QImage *image);
+
+    qint64 decodedFrames() const { return m_decodedFrames.load(std::memory_order_relaxed); }
+    qint64 droppedFrames() const { return m_droppedFrames.load(std::memory_order_relaxed); }
+    // Среднее время декодирования с масштабированием, мкс
+    double averageDecodeUs() const;
+
+    // Декодирование с масштабированием под target (KeepAspectRatio)
+    static QImage decodeScaled(const QByteArray &jpeg, const QSize &target);
+
+signals:
+    // Испускается, когда выходной слот становится непустым
+    void frameReady();
+
+private:
+    void processPending();
+
+    QThread m_thread;
+    QObject *m_worker = nullptr;
+
+    mutable QMutex m_mutex;
+    QByteArray m_pendingJpeg;
+    bool m_hasPending = false;
+    bool m_busy = false;
+    QSize m_targetSize;
+
+    QImage m_readyFrame;
+    bool m_hasReady = false;
+
+    std::atomic<qint64> m_decodedFrames{0};
+    std::atomic<qint64> m_droppedFrames{0};
+    std::atomic<qint64> m_totalDecodeUs{0};
+};
+
+#endif // VIDEODECODER_H
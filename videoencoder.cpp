@@ -0,0 +1,158 @@
+#include "videoencoder.h"
+#include <QBuffer>
+#include <QMutexLocker>
+
+VideoEncoder::VideoEncoder(QObject *parent)
+    : QObject(parent)
+{
+    m_thread.setObjectName("VideoEncoder");
+    m_clock.start();
+}
+
+VideoEncoder::~VideoEncoder()
+{
+    stop();
+}
+
+void VideoEncoder::start()
+{
+    if (m_worker) return;
+
+    m_worker = new QObject;
+    m_worker->moveToThread(&m_thread);
+    m_thread.start();
+}
+
+void VideoEncoder::stop()
+{
+    if (!m_worker) return;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_hasPending = false;
+        m_pendingFrame = QVideoFrame();
+        m_pendingImage = QImage();
+    }
+
+    m_thread.quit();
+    m_thread.wait();
+    delete m_worker;
+    m_worker = nullptr;
+
+    QMutexLocker locker(&m_mutex);
+    m_busy = false;
+}
+
+void VideoEncoder::submit(const QVideoFrame &frame)
+{
+    submitPending(frame, QImage());
+}
+
+void VideoEncoder::submit(const QImage &image)
+{
+    submitPending(QVideoFrame(), image);
+}
+
+void VideoEncoder::submitPending(const QVideoFrame &frame, const QImage &image)
+{
+    bool wake = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_worker) return;
+
+        if (m_hasPending) {
+            m_droppedFrames.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_pendingFrame = frame;
+        m_pendingImage = image;
+        m_pendingMs = m_clock.elapsed();
+        m_hasPending = true;
+
+        wake = !m_busy;
+        m_busy = true;
+    }
+
+    if (wake) {
+        QMetaObject::invokeMethod(m_worker, [this]() { processPending(); }, Qt::QueuedConnection);
+    }
+}
+
+void VideoEncoder::setPreviewSize(const QSize &size)
+{
+    QMutexLocker locker(&m_mutex);
+    m_previewSize = size;
+}
+
+void VideoEncoder::setEncodingEnabled(bool enabled)
+{
+    QMutexLocker locker(&m_mutex);
+    m_encodingEnabled = enabled;
+}
+
+void VideoEncoder::setSettings(const Settings &settings)
+{
+    QMutexLocker locker(&m_mutex);
+    m_settings = settings;
+}
+
+VideoEncoder::Settings VideoEncoder::settings() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_settings;
+}
+
+void VideoEncoder::processPending()
+{
+    for (;;) {
+        QVideoFrame frame;
+        QImage image;
+        qint64 captureMs;
+        QSize previewSize;
+        bool encode;
+        Settings settings;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (!m_hasPending) {
+                m_busy = false;
+                return;
+            }
+            frame = m_pendingFrame;
+            m_pendingFrame = QVideoFrame();
+            image = std::move(m_pendingImage);
+            m_pendingImage = QImage();
+            m_hasPending = false;
+            captureMs = m_pendingMs;
+            previewSize = m_previewSize;
+            encode = m_encodingEnabled;
+            settings = m_settings;
+        }
+
+        if (image.isNull()) {
+            image = frame.toImage();
+        }
+        frame = QVideoFrame();
+        if (image.isNull()) continue;
+
+        if (previewSize.isValid() && !previewSize.isEmpty()) {
+            emit previewReady(image.scaled(previewSize, Qt::KeepAspectRatio, Qt::SmoothTransformation));
+        }
+
+        if (!encode) continue;
+
+        // Ограничение частоты кадров; небольшой допуск на неровный шаг камеры
+        if (settings.maxFps > 0 && m_lastEncodedMs >= 0
+            && captureMs - m_lastEncodedMs < 1000 / settings.maxFps - 5) {
+            continue;
+        }
+        m_lastEncodedMs = captureMs;
+
+        const QImage scaled = image.scaled(settings.resolution, Qt::KeepAspectRatio);
+        QByteArray jpeg;
+        QBuffer buffer(&jpeg);
+        buffer.open(QIODevice::WriteOnly);
+        if (scaled.save(&buffer, "JPEG", settings.quality)) {
+            m_encodedFrames.fetch_add(1, std::memory_order_relaxed);
+            emit frameEncoded(jpeg, quint32(captureMs));
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef VIDEOENCODER_H
+#define VIDEOENCODER_H
+
+#include <QObject>
+#include <QVideoFrame>
+#include <QImage>
+#include <QSize>
+#include <QMutex>
+#include <QThread>
+#include <QElapsedTimer>
+#include <atomic>
+
+// Преобразование, масштабирование и JPEG-кодирование кадров камеры в
+// отдельном потоке.
+//
+// Кадры принимаются по принципу «последний побеждает»: если кодер не успел
+// обработать предыдущий кадр, тот заменяется новым и считается пропущенным.
+// В GUI-поток уходит только готовое к показу превью и закодированный JPEG.
+class VideoEncoder : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Settings
+    {
+        QSize resolution = QSize(640, 480);
+        int quality = 80;
+        int maxFps = 0;     // 0 - с частотой камеры
+    };
+
+    explicit VideoEncoder(QObject *parent = nullptr);
+    ~VideoEncoder();
+
+    void start();
+    void stop();
+
+    // Потокобезопасно, можно подключать напрямую к QVideoSink::videoFrameChanged
+    void submit(const QVideoFrame &frame);
+    // Готовое изображение вместо кадра камеры (синтетические источники)
+    void submit(const QImage &image);
+
+    void setPreviewSize(const QSize &size);
+    void setEncodingEnabled(bool enabled);
+    void setSettings(const Settings &settings);
+    Settings settings() const;
+
+    qint64 encodedFrames() const { return m_encodedFrames.load(std::memory_order_relaxed); }
+    qint64 droppedFrames() const { return m_droppedFrames.load(std::memory_order_relaxed); }
+
+signals:
+    void previewReady(const QImage &preview);
+    // captureMs - время прихода кадра с камеры от запуска кодера
+    void frameEncoded(const QByteArray &jpeg, quint32 captureMs);
+
+private:
+    void submitPending(const QVideoFrame &frame, const QImage &image);
+    void processPending();
+
+    QThread m_thread;
+    QObject *m_worker = nullptr;
+
+    mutable QMutex m_mutex;
+    QVideoFrame m_pendingFrame;
+    QImage m_pendingImage;
+    qint64 m_pendingMs = 0;
+    bool m_hasPending = false;
+    bool m_busy = false;
+    QSize m_previewSize;
+    bool m_encodingEnabled = false;
+    Settings m_settings;
+
+    QElapsedTimer m_clock;
+    qint64 m_lastEncodedMs = -1;   // только в потоке кодера
+    std::atomic<qint64> m_encodedFrames{0};
+    std::atomic<qint64> m_droppedFrames{0};
+};
+
+#endif // VIDEOENCODER_H
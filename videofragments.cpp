@@ -0,0 +1,230 @@
+#include "videofragments.h"
+#include <QtEndian>
+#include <cstring>
+
+namespace VideoFragments {
+
+int fragmentCount(qsizetype frameSize, int maxPayload)
+{
+    const int chunkSize = maxPayload - FragmentHeaderSize;
+    if (chunkSize <= 0 || frameSize <= 0) return 0;
+
+    const qsizetype count = (frameSize + chunkSize - 1) / chunkSize;
+    return count > MaxFragmentsPerFrame ? 0 : int(count);
+}
+
+void writeFragment(QByteArrayView frame, quint32 frameId, int index, int count, int maxPayload,
+                   QByteArray *payload)
+{
+    const int chunkSize = maxPayload - FragmentHeaderSize;
+    const qsizetype offset = qsizetype(index) * chunkSize;
+    const qsizetype length = qMin<qsizetype>(chunkSize, frame.size() - offset);
+
+    payload->resize(FragmentHeaderSize + length);
+    uchar *p = reinterpret_cast<uchar *>(payload->data());
+    qToBigEndian<quint32>(frameId, p);
+    qToBigEndian<quint16>(quint16(index), p + 4);
+    qToBigEndian<quint16>(quint16(count), p + 6);
+    memcpy(p + FragmentHeaderSize, frame.data() + offset, size_t(length));
+}
+
+bool readFragmentHeader(QByteArrayView payload, FragmentHeader *header)
+{
+    if (payload.size() < FragmentHeaderSize) return false;
+
+    const uchar *p = reinterpret_cast<const uchar *>(payload.data());
+    header->frameId = qFromBigEndian<quint32>(p);
+    header->index = qFromBigEndian<quint16>(p + 4);
+    header->count = qFromBigEndian<quint16>(p + 6);
+    return header->count > 0 && header->count <= MaxFragmentsPerFrame
+           && header->index < header->count;
+}
+
+} // namespace VideoFragments
+
+namespace {
+// Одновременно собираемых кадров: сверх этого вытесняется самый старый
+constexpr int MaxPendingFrames = 16;
+}
+
+VideoReassembler::VideoReassembler(int timeoutMs, int memoryBudget)
+    : m_timeoutMs(timeoutMs)
+    , m_memoryBudget(memoryBudget)
+{
+    m_frames.reserve(MaxPendingFrames);
+    m_spare.reserve(MaxPendingFrames);
+}
+
+bool VideoReassembler::addFragment(QByteArrayView payload, qint64 nowMs, QByteArray *frame)
+{
+    VideoFragments::FragmentHeader fh;
+    if (!VideoFragments::readFragmentHeader(payload, &fh)) return false;
+
+    expire(nowMs);
+
+    if (!m_hasFrameId) {
+        m_hasFrameId = true;
+        m_firstFrameId = fh.frameId;
+        m_highestFrameId = fh.frameId;
+    } else if (isNewer(fh.frameId, m_highestFrameId)) {
+        m_highestFrameId = fh.frameId;
+    }
+
+    // Фрагмент кадра, который уже собран или вытеснен более новым
+    if (m_hasCompleted && !isNewer(fh.frameId, m_lastCompletedId)) {
+        m_stats.lateFragments++;
+        return false;
+    }
+
+    const QByteArrayView chunk = payload.sliced(VideoFragments::FragmentHeaderSize);
+    const bool last = fh.index == fh.count - 1;
+    if (!last && chunk.isEmpty()) return false;
+
+    qsizetype index = findFrame(fh.frameId);
+    if (index < 0) {
+        index = startFrame(fh.frameId, fh.count, nowMs);
+    }
+
+    PendingFrame &pending = m_frames[index];
+    if (pending.count != fh.count || pending.has(fh.index)) {
+        return false; // дубликат или несогласованный count
+    }
+
+    if (last) {
+        pending.tail.resize(chunk.size());
+        memcpy(pending.tail.data(), chunk.data(), size_t(chunk.size()));
+    } else {
+        if (pending.chunkSize == 0) {
+            pending.chunkSize = int(chunk.size());
+            // С запасом под последний фрагмент, чтобы сборка не перевыделяла
+            pending.data.reserve(qsizetype(fh.count) * pending.chunkSize);
+            pending.data.resize(qsizetype(fh.count - 1) * pending.chunkSize);
+        } else if (chunk.size() != pending.chunkSize) {
+            return false; // все фрагменты, кроме последнего, одного размера
+        }
+        memcpy(pending.data.data() + qsizetype(fh.index) * pending.chunkSize, chunk.data(),
+               size_t(chunk.size()));
+    }
+    pending.mark(fh.index);
+    pending.receivedCount++;
+    pending.bytes += int(chunk.size());
+    m_pendingBytes += int(chunk.size());
+
+    if (pending.receivedCount == fh.count) {
+        const qsizetype head = qsizetype(fh.count - 1) * pending.chunkSize;
+        pending.data.resize(head + pending.tail.size());
+        memcpy(pending.data.data() + head, pending.tail.constData(), size_t(pending.tail.size()));
+        frame->swap(pending.data);
+
+        releaseFrame(index);
+        m_stats.completedFrames++;
+        m_hasCompleted = true;
+        m_lastCompletedId = fh.frameId;
+
+        // Более старые недособранные кадры уже не будут показаны
+        dropOlderThan(fh.frameId);
+        return true;
+    }
+
+    while (m_pendingBytes > m_memoryBudget && !m_frames.isEmpty()) {
+        dropFrame(oldestFrame());
+    }
+    return false;
+}
+
+void VideoReassembler::expire(qint64 nowMs)
+{
+    for (qsizetype i = m_frames.size() - 1; i >= 0; --i) {
+        if (nowMs - m_frames.at(i).firstArrivalMs > m_timeoutMs) {
+            dropFrame(i);
+        }
+    }
+}
+
+void VideoReassembler::clear()
+{
+    while (!m_frames.isEmpty()) {
+        releaseFrame(m_frames.size() - 1);
+    }
+    m_pendingBytes = 0;
+    m_hasCompleted = false;
+    m_lastCompletedId = 0;
+    m_hasFrameId = false;
+    m_stats = Stats();
+}
+
+double VideoReassembler::frameLossRate() const
+{
+    if (!m_hasFrameId) return 0.0;
+
+    // Как потери пакетов в RFC 3550: ожидалось по диапазону frameId, минус
+    // собранные и ещё собираемые. Отброшенные недособранными и не
+    // начатые вовсе попадают сюда одинаково
+    const qint64 expected = qint64(m_highestFrameId - m_firstFrameId) + 1;
+    const qint64 lost = qMax<qint64>(0, expected - m_stats.completedFrames - m_frames.size());
+    return double(lost) / double(expected) * 100.0;
+}
+
+qsizetype VideoReassembler::findFrame(quint32 frameId) const
+{
+    for (qsizetype i = 0; i < m_frames.size(); ++i) {
+        if (m_frames.at(i).frameId == frameId) return i;
+    }
+    return -1;
+}
+
+qsizetype VideoReassembler::startFrame(quint32 frameId, int count, qint64 nowMs)
+{
+    if (m_frames.size() >= MaxPendingFrames) {
+        dropFrame(oldestFrame());
+    }
+
+    // Буферы берутся из запаса, resize(0) сохраняет их ёмкость
+    PendingFrame pending = m_spare.isEmpty() ? PendingFrame() : m_spare.takeLast();
+    pending.frameId = frameId;
+    pending.count = count;
+    pending.chunkSize = 0;
+    pending.receivedCount = 0;
+    pending.bytes = 0;
+    pending.firstArrivalMs = nowMs;
+    pending.data.resize(0);
+    pending.tail.resize(0);
+    memset(pending.received, 0, sizeof(pending.received));
+    m_frames.append(std::move(pending));
+    return m_frames.size() - 1;
+}
+
+void VideoReassembler::releaseFrame(qsizetype index)
+{
+    m_pendingBytes -= m_frames.at(index).bytes;
+    if (m_spare.size() < MaxPendingFrames) {
+        m_spare.append(std::move(m_frames[index]));
+    }
+    m_frames.removeAt(index);
+}
+
+void VideoReassembler::dropFrame(qsizetype index)
+{
+    releaseFrame(index);
+    m_stats.incompleteFrames++;
+}
+
+void VideoReassembler::dropOlderThan(quint32 frameId)
+{
+    for (qsizetype i = m_frames.size() - 1; i >= 0; --i) {
+        if (isNewer(frameId, m_frames.at(i).frameId)) {
+            dropFrame(i);
+        }
+    }
+}
+
+qsizetype VideoReassembler::oldestFrame() const
+{
+    qsizetype oldest = 0;
+    for (qsizetype i = 1; i < m_frames.size(); ++i) {
+        if (isNewer(m_frames.at(oldest).frameId, m_frames.at(i).frameId)) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
@@ -0,0 +1,127 @@
+#ifndef VIDEOFRAGMENTS_H
+#define VIDEOFRAGMENTS_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QList>
+#include <QtGlobal>
+
+// Фрагментация JPEG-кадров по датаграммам размером не больше MTU.
+//
+// Полезная нагрузка VIDEO-пакета после Protocol::PacketHeader:
+//
+//   0                   4            6            8
+//   +-------------------+------------+------------+--------------
+//   |      frameId      |   index    |   count    |  данные ...
+//   +-------------------+------------+------------+--------------
+//
+// Все фрагменты кадра, кроме последнего, имеют одинаковый размер.
+// Фрагменты пишутся и собираются в буферы, которые вызывающий и сборщик
+// держат от кадра к кадру, поэтому на фрагмент память не выделяется.
+namespace VideoFragments {
+
+constexpr int FragmentHeaderSize = 8;
+
+// 1500 (Ethernet MTU) - 20 (IPv4) - 8 (UDP) - заголовок протокола с запасом
+constexpr int DefaultMaxPayload = 1400;
+
+constexpr int MaxFragmentsPerFrame = 1024;
+
+struct FragmentHeader
+{
+    quint32 frameId = 0;
+    quint16 index = 0;
+    quint16 count = 0;
+};
+
+// Сколько VIDEO-пакетов с полезной нагрузкой не длиннее maxPayload нужно
+// кадру; 0 - кадр пуст или слишком велик
+int fragmentCount(qsizetype frameSize, int maxPayload = DefaultMaxPayload);
+
+// Полезная нагрузка фрагмента index из count в payload; в пределах его
+// ёмкости без выделения памяти
+void writeFragment(QByteArrayView frame, quint32 frameId, int index, int count, int maxPayload,
+                   QByteArray *payload);
+
+bool readFragmentHeader(QByteArrayView payload, FragmentHeader *header);
+
+} // namespace VideoFragments
+
+// Сборка кадров из фрагментов на приёмной стороне. Незавершённые кадры
+// отбрасываются по таймауту, при превышении бюджета памяти (сначала самые
+// старые) и когда собирается более новый кадр.
+//
+// Кадр собирается сразу в один буфер: фрагмент с номером i ложится по
+// смещению i * размер фрагмента, последний (он короче) ждёт отдельно.
+// Буферы отслуживших кадров остаются в запасе для следующих, а собранный
+// кадр меняется местами с буфером, переданным в addFragment(): если
+// вызывающий больше не держит копий, и он вернётся в запас.
+class VideoReassembler
+{
+public:
+    struct Stats
+    {
+        qint64 completedFrames = 0;
+        qint64 incompleteFrames = 0;
+        qint64 lateFragments = 0;
+    };
+
+    explicit VideoReassembler(int timeoutMs = 300, int memoryBudget = 4 * 1024 * 1024);
+
+    // Возвращает true и кладёт в frame кадр, когда он собран целиком;
+    // прежнее содержимое frame сборщик забирает себе под следующие кадры
+    bool addFragment(QByteArrayView payload, qint64 nowMs, QByteArray *frame);
+
+    // Отбрасывает кадры, ожидающие дольше таймаута
+    void expire(qint64 nowMs);
+
+    void clear();
+
+    const Stats &stats() const { return m_stats; }
+    // Доля потерянных кадров, %: кадры, от которых не дошло ни одного
+    // фрагмента, видны по пропускам в frameId
+    double frameLossRate() const;
+    int pendingBytes() const { return m_pendingBytes; }
+
+private:
+    struct PendingFrame
+    {
+        quint32 frameId = 0;
+        int count = 0;
+        int chunkSize = 0;       // 0 - пока пришёл только последний фрагмент
+        int receivedCount = 0;
+        int bytes = 0;
+        qint64 firstArrivalMs = 0;
+        QByteArray data;         // фрагменты 0..count-2 подряд
+        QByteArray tail;         // последний фрагмент
+        quint64 received[VideoFragments::MaxFragmentsPerFrame / 64] = {};
+
+        bool has(int index) const { return received[index / 64] & (quint64(1) << (index % 64)); }
+        void mark(int index) { received[index / 64] |= quint64(1) << (index % 64); }
+    };
+
+    qsizetype findFrame(quint32 frameId) const;
+    qsizetype startFrame(quint32 frameId, int count, qint64 nowMs);
+    // Буферы кадра уходят в запас
+    void releaseFrame(qsizetype index);
+    void dropFrame(qsizetype index);
+    void dropOlderThan(quint32 frameId);
+    qsizetype oldestFrame() const;
+
+    static bool isNewer(quint32 a, quint32 b) { return qint32(a - b) > 0; }
+
+    QList<PendingFrame> m_frames;
+    QList<PendingFrame> m_spare;
+    int m_timeoutMs;
+    int m_memoryBudget;
+    int m_pendingBytes = 0;
+    bool m_hasCompleted = false;
+    quint32 m_lastCompletedId = 0;
+    // Диапазон frameId с первого принятого кадра - столько кадров ожидалось
+    bool m_hasFrameId = false;
+    quint32 m_firstFrameId = 0;
+    quint32 m_highestFrameId = 0;
+    Stats m_stats;
+};
+
+#endif // VIDEOFRAGMENTS_H
@@ -0,0 +1,61 @@
+#include "wakeup.h"
+#include <QSocketNotifier>
+
+#ifdef Q_OS_LINUX
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+void Wakeup::open(QObject *receiver, std::function<void()> handler)
+{
+    close();
+    m_receiver = receiver;
+    m_handler = std::move(handler);
+
+#ifdef Q_OS_LINUX
+    m_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_fd != -1) {
+        m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, receiver);
+        QObject::connect(m_notifier, &QSocketNotifier::activated, receiver, [this]() { activated(); });
+    }
+#endif
+}
+
+void Wakeup::close()
+{
+    delete m_notifier;
+    m_notifier = nullptr;
+#ifdef Q_OS_LINUX
+    if (m_fd != -1) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+#endif
+    m_receiver = nullptr;
+}
+
+void Wakeup::wake()
+{
+#ifdef Q_OS_LINUX
+    if (m_fd != -1) {
+        const quint64 one = 1;
+        // EAGAIN - счётчик переполнен, получатель и так проснётся
+        const ssize_t written = ::write(m_fd, &one, sizeof(one));
+        Q_UNUSED(written);
+        return;
+    }
+#endif
+    if (m_receiver) {
+        QMetaObject::invokeMethod(m_receiver, [this]() { m_handler(); }, Qt::QueuedConnection);
+    }
+}
+
+void Wakeup::activated()
+{
+#ifdef Q_OS_LINUX
+    quint64 count = 0;
+    const ssize_t read = ::read(m_fd, &count, sizeof(count));
+    Q_UNUSED(read);
+#endif
+    m_handler();
+}
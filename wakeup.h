@@ -0,0 +1,43 @@
+#ifndef WAKEUP_H
+#define WAKEUP_H
+
+#include <QObject>
+#include <functional>
+
+class QSocketNotifier;
+
+// Пробуждение потока с циклом событий из другого потока.
+//
+// QMetaObject::invokeMethod и сигнал в чужой поток кладут в очередь
+// событие, выделенное в куче, - на каждый вызов. Здесь на Linux поток
+// получателя слушает eventfd через QSocketNotifier, а wake() - одна
+// запись в него без выделения памяти; пробуждения до обработки ядро
+// склеивает в одно. На остальных платформах - событие через очередь.
+// Лишние вызовы wake() вызывающий отсекает атомарным флагом.
+class Wakeup
+{
+public:
+    Wakeup() = default;
+    ~Wakeup() { close(); }
+
+    Wakeup(const Wakeup &) = delete;
+    Wakeup &operator=(const Wakeup &) = delete;
+
+    // В потоке получателя; handler выполняется в нём же. Получатель
+    // живёт не меньше этого объекта
+    void open(QObject *receiver, std::function<void()> handler);
+    void close();
+
+    // Из любого потока
+    void wake();
+
+private:
+    void activated();
+
+    QObject *m_receiver = nullptr;
+    std::function<void()> m_handler;
+    int m_fd = -1;
+    QSocketNotifier *m_notifier = nullptr;
+};
+
+#endif // WAKEUP_H